@@ -0,0 +1,913 @@
+/* cache.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <util/util.h>
+#include <util/hash.h>
+#include <util/chash.h>
+#include <util/slab.h>
+#include <util/vector.h>
+
+#include <srv/cache.h>
+
+/* what index entries are carved from */
+static slab_t cache_ents = SLAB_INITIALIZER("cache entry", cache_ent_t);
+
+void *_srv_cache_ent_alloc(const void *arg)
+{
+    cache_ent_t *e = slab_alloc(&cache_ents);
+
+    if (NULL != e)
+        memcpy(e, arg, sizeof *e);
+
+    return (void *)e;
+}
+
+void _srv_cache_ent_free(void *a)
+{
+    slab_free(&cache_ents, a);
+}
+
+/**
+ * the file a segment lives in
+ */
+void _srv_cache_path(const cache_t * c, unsigned int id, char *path,
+                     size_t len)
+{
+    snprintf(path, len, "%s/%08u.seg", c->dir, id);
+}
+
+/**
+ * write all of it, or fail
+ */
+int _srv_cache_pwrite(int fd, const char *data, size_t len, off_t off)
+{
+    ssize_t put;
+
+    while (len) {
+        if (-1 == (put = pwrite(fd, data, len, off))) {
+            if (EINTR == errno)
+                continue;
+
+            return 0;
+        }
+
+        data += put;
+        len -= put;
+        off += put;
+    }
+
+    return 1;
+}
+
+/**
+ * is name the header on this line? v is set to its value
+ */
+int _srv_cache_is(const char *line, const char *next, const char *name,
+                  const char **v)
+{
+    size_t len = strlen(name);
+
+    if ((size_t)(next - line) <= len || ':' != line[len]
+        || strncasecmp(line, name, len))
+        return 0;
+
+    for (*v = line + len + 1; ' ' == **v || '\t' == **v; (*v)++) ;
+
+    return 1;
+}
+
+/**
+ * where a directive is in a list of them, like Cache-Control's
+ */
+const char *_srv_cache_token(const char *v, const char *end,
+                             const char *name)
+{
+    size_t len = strlen(name);
+    const char *p;
+
+    for (p = v; p + len <= end; p++) {
+        if (strncasecmp(p, name, len))
+            continue;
+
+        /* all of a word, not the end of some other */
+        if ((p == v || ',' == p[-1] || ' ' == p[-1] || '\t' == p[-1])
+            && (p + len == end || ',' == p[len] || ' ' == p[len]
+                || '=' == p[len] || '\t' == p[len] || '\r' == p[len]))
+            return p;
+    }
+
+    return NULL;
+}
+
+/**
+ * the seconds in name=N, or -1 if it isn't there
+ */
+long _srv_cache_seconds(const char *v, const char *end, const char *name)
+{
+    const char *p = _srv_cache_token(v, end, name);
+
+    if (NULL == p || '=' != p[strlen(name)])
+        return -1;
+
+    p += strlen(name) + 1;
+
+    if ('"' == *p)
+        ++p;
+
+    return (isdigit((unsigned char)*p)) ? strtol(p, NULL, 10) : -1;
+}
+
+/**
+ * an HTTP date, 0 if it isn't one
+ */
+time_t _srv_cache_date(const char *v, const char *end)
+{
+    struct tm tm;
+    char tmp[64];
+    size_t len = end - v;
+
+    if (len >= sizeof tmp)
+        return 0;
+
+    memcpy(tmp, v, len);
+    tmp[len] = '\0';
+    memset(&tm, 0, sizeof tm);
+
+    if (NULL == strptime(tmp, "%a, %d %b %Y %H:%M:%S", &tm))
+        return 0;
+
+    return timegm(&tm);
+}
+
+/**
+ * the key a response is found by: the site's name and the target it
+ * was asked for, as it was asked
+ * @return 0 if it won't fit
+ */
+int srv_cache_key(char *key, size_t size, const char *site,
+                  const char *target, size_t len)
+{
+    int n;
+
+#ifdef DEBUG
+    assert(NULL != key);
+    assert(NULL != site);
+    assert(NULL != target);
+#endif
+
+    if (!len)
+        return 0;
+
+    n = snprintf(key, size, "%s %.*s", site, (int)len, target);
+
+    return (n > 0 && (size_t)n < size);
+}
+
+/**
+ * the key for a request, from the target on its request line
+ */
+int srv_cache_key_line(char *key, size_t size, const char *site,
+                       const char *line)
+{
+    const char *target, *end;
+
+#ifdef DEBUG
+    assert(NULL != line);
+#endif
+
+    if (NULL == (target = strchr(line, ' ')))
+        return 0;
+
+    for (end = ++target; ' ' != *end && '\r' != *end && '\0' != *end; end++) ;
+
+    return srv_cache_key(key, size, site, target, end - target);
+}
+
+/**
+ * what a request lets us do. anything with credentials is nobody
+ * else's business, and a client may ask for a fresh copy, or that
+ * nothing be kept of what it gets.
+ * @param head the request, from its request line
+ * @param end where its header ends, at the blank line
+ * @return SRV_CACHE_STORE and SRV_CACHE_LOOKUP, or 0 for neither
+ */
+unsigned int srv_cache_request(const char *head, const char *end)
+{
+    const char *line, *next, *v;
+    unsigned int what = SRV_CACHE_STORE | SRV_CACHE_LOOKUP;
+
+#ifdef DEBUG
+    assert(NULL != head);
+    assert(NULL != end);
+#endif
+
+    if (NULL == (next = strstr(head, "\r\n")))
+        return 0;
+
+    for (line = next + 2; line < end; line = next + 2) {
+        if (NULL == (next = strstr(line, "\r\n")))
+            break;
+
+        if (_srv_cache_is(line, next, "Authorization", &v)) {
+            return 0;
+        } else if (_srv_cache_is(line, next, "Cache-Control", &v)) {
+            if (NULL != _srv_cache_token(v, next, "no-store"))
+                return 0;
+
+            if (NULL != _srv_cache_token(v, next, "no-cache")
+                || NULL != _srv_cache_token(v, next, "max-age"))
+                what &= ~SRV_CACHE_LOOKUP;
+        } else if (_srv_cache_is(line, next, "Pragma", &v)) {
+            if (NULL != _srv_cache_token(v, next, "no-cache"))
+                what &= ~SRV_CACHE_LOOKUP;
+        }
+    }
+
+    return what;
+}
+
+/**
+ * how long a response may be kept, going by its header: s-maxage, then
+ * max-age, then Expires against its Date. anything private, with a
+ * cookie, or that varies by request header isn't kept at all.
+ * @param head the response, from its status line
+ * @param end where its header ends, at the blank line
+ * @param now the time
+ * @param ttl seconds for one that doesn't say, 0 to not keep those
+ * @return when it's good until, 0 if it isn't to be kept
+ */
+time_t srv_cache_expiry(const char *head, const char *end, time_t now,
+                        unsigned int ttl)
+{
+    const char *line, *next, *v;
+    long smax = -1, max = -1, age = 0;
+    time_t expires = 0, date = 0, until;
+    unsigned int has_expires = 0;
+
+#ifdef DEBUG
+    assert(NULL != head);
+    assert(NULL != end);
+#endif
+
+    if (NULL == (next = strstr(head, "\r\n")))
+        return 0;
+
+    for (line = next + 2; line < end; line = next + 2) {
+        if (NULL == (next = strstr(line, "\r\n")))
+            break;
+
+        if (_srv_cache_is(line, next, "Cache-Control", &v)) {
+            if (NULL != _srv_cache_token(v, next, "no-store")
+                || NULL != _srv_cache_token(v, next, "no-cache")
+                || NULL != _srv_cache_token(v, next, "private"))
+                return 0;
+
+            smax = _srv_cache_seconds(v, next, "s-maxage");
+            max = _srv_cache_seconds(v, next, "max-age");
+        } else if (_srv_cache_is(line, next, "Expires", &v)) {
+            expires = _srv_cache_date(v, next);
+            has_expires = 1;
+        } else if (_srv_cache_is(line, next, "Date", &v)) {
+            date = _srv_cache_date(v, next);
+        } else if (_srv_cache_is(line, next, "Age", &v)) {
+            age = strtol(v, NULL, 10);
+        } else if (_srv_cache_is(line, next, "Pragma", &v)) {
+            if (NULL != _srv_cache_token(v, next, "no-cache"))
+                return 0;
+        } else if (_srv_cache_is(line, next, "Set-Cookie", &v)
+                   || _srv_cache_is(line, next, "Vary", &v)) {
+            return 0;
+        }
+    }
+
+    if (-1 != smax)
+        until = now + smax - age;
+    else if (-1 != max)
+        until = now + max - age;
+    else if (has_expires)
+        until = (expires && date) ? now + (expires - date) : expires;
+    else
+        until = (ttl) ? now + ttl : 0;
+
+    return (until > now) ? until : 0;
+}
+
+/**
+ * the segment being appended to, NULL if there isn't one
+ */
+cache_seg_t *_srv_cache_newest(cache_t * c)
+{
+    if (!c->count)
+        return NULL;
+
+    return &c->segs[(c->first + c->count - 1) % c->seg_max];
+}
+
+/**
+ * let the oldest segment go, unless something is still being written
+ * into it. what the index has in it is dropped by the next sweep, or
+ * when it's looked up. call with the lock held.
+ */
+int _srv_cache_drop(cache_t * c)
+{
+    cache_seg_t *seg = &c->segs[c->first];
+    char path[PATH_MAX];
+
+    if (seg->writers)
+        return 0;
+
+    _srv_cache_path(c, seg->id, path, sizeof path);
+    unlink(path);
+    close(seg->fd);
+
+    c->first = (c->first + 1) % c->seg_max;
+    --c->count;
+    __atomic_store_n(&c->oldest, (c->count) ? c->segs[c->first].id :
+                     c->next_id, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+/**
+ * start a new segment, letting the oldest go if there's no room for
+ * it. call with the lock held.
+ * @param dropped set if one was let go
+ */
+cache_seg_t *_srv_cache_roll(cache_t * c, unsigned int *dropped)
+{
+    cache_seg_t *seg;
+    char path[PATH_MAX];
+    int fd;
+
+    if (c->count == c->seg_max) {
+        if (!_srv_cache_drop(c))
+            return NULL;
+
+        *dropped = 1;
+    }
+
+    _srv_cache_path(c, c->next_id, path, sizeof path);
+
+    if (-1 == (fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                         0600))) {
+        ERRF(__FILE__, __LINE__, "creating cache segment %s: %s\n", path,
+             strerror(errno));
+        return NULL;
+    }
+
+    seg = &c->segs[(c->first + c->count) % c->seg_max];
+    seg->id = c->next_id++;
+    seg->fd = fd;
+    seg->used = 0;
+    seg->writers = 0;
+
+    if (!c->count++)
+        __atomic_store_n(&c->oldest, seg->id, __ATOMIC_RELEASE);
+
+    return seg;
+}
+
+/* what a sweep found, to be deleted once it's done reading */
+struct _cache_sweep {
+    unsigned int oldest;
+    vector_t keys;
+};
+
+int _srv_cache_stale(const void *key, void *val, void *arg)
+{
+    struct _cache_sweep *sw = (struct _cache_sweep *)arg;
+    char *k;
+
+    if (((cache_ent_t *) val)->seg < sw->oldest
+        && NULL != (k = strdup((const char *)key))
+        && !vector_push(&sw->keys, &k))
+        free(k);
+
+    return 1;
+}
+
+/**
+ * take what's in segments that have gone out of the index. anything
+ * missed is dropped when it's looked up.
+ */
+void _srv_cache_sweep(cache_t * c)
+{
+    struct _cache_sweep sw;
+    unsigned int i;
+    char *key;
+
+    if (!vector_init(&sw.keys, 0, sizeof key))
+        return;
+
+    sw.oldest = __atomic_load_n(&c->oldest, __ATOMIC_ACQUIRE);
+
+    chash_enter(&c->index);
+    chash_foreach(&c->index, _srv_cache_stale, &sw);
+    chash_leave(&c->index);
+
+    for (i = 0; i < sw.keys.count; i++) {
+        key = *(char **)vector_get_at(&sw.keys, i);
+        chash_delete(&c->index, key);
+        free(key);
+    }
+
+    vector_destroy(&sw.keys);
+}
+
+/**
+ * read what a segment has back into the index. a record that was never
+ * finished is skipped, and one cut short, or that makes no sense, is
+ * where we stop.
+ * @return how many were still fresh
+ */
+unsigned int _srv_cache_load(cache_t * c, cache_seg_t * seg, time_t now)
+{
+    struct _cache_rec rec;
+    struct stat st;
+    cache_ent_t ent;
+    char path[PATH_MAX], key[SRV_CACHE_KEY_MAX];
+    unsigned long long off = 0, total;
+    unsigned int cnt = 0;
+
+    _srv_cache_path(c, seg->id, path, sizeof path);
+
+    if (-1 == (seg->fd = open(path, O_RDWR | O_CLOEXEC))) {
+        ERRF(__FILE__, __LINE__, "reading cache segment %s: %s\n", path,
+             strerror(errno));
+        return 0;
+    }
+
+    if (-1 == fstat(seg->fd, &st))
+        st.st_size = 0;
+
+    while (off + sizeof rec <= (unsigned long long)st.st_size) {
+        if (sizeof rec != pread(seg->fd, &rec, sizeof rec, off))
+            break;
+
+        if ((SRV_CACHE_MAGIC != rec.magic && 0 != rec.magic)
+            || !rec.keylen || rec.keylen >= sizeof key
+            || rec.headlen > SRV_CACHE_HEAD_MAX || rec.len > c->seg_size)
+            break;
+
+        total = sizeof rec + rec.keylen + rec.headlen + rec.len;
+
+        if (off + total > (unsigned long long)st.st_size)
+            break;
+
+        if (SRV_CACHE_MAGIC == rec.magic && rec.expires > now
+            && (ssize_t)rec.keylen == pread(seg->fd, key, rec.keylen,
+                                            off + sizeof rec)) {
+            key[rec.keylen] = '\0';
+
+            ent.seg = seg->id;
+            ent.off = off + sizeof rec + rec.keylen;
+            ent.headlen = rec.headlen;
+            ent.len = rec.len;
+            ent.stored = rec.stored;
+            ent.expires = rec.expires;
+
+            /* anything later for the same key is newer */
+            chash_insert(&c->index, key, &ent);
+            ++cnt;
+        }
+
+        off += total;
+    }
+
+    /* it's only ever read from now on */
+    seg->used = c->seg_size;
+
+    return cnt;
+}
+
+int _srv_cache_cmp(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * the segments in a directory, oldest first
+ * @return how many, their ids in *ids for the caller to free
+ */
+unsigned int _srv_cache_list(const char *dir, unsigned int **ids)
+{
+    struct dirent *d;
+    unsigned int id, cnt = 0, size = 0, *tmp;
+    DIR *dp;
+    char tail[8];
+
+    *ids = NULL;
+
+    if (NULL == (dp = opendir(dir)))
+        return 0;
+
+    while (NULL != (d = readdir(dp))) {
+        if (2 != sscanf(d->d_name, "%8u%7s", &id, tail)
+            || strcmp(tail, ".seg") || 12 != strlen(d->d_name))
+            continue;
+
+        if (cnt == size) {
+            size = (size) ? size * 2 : 16;
+
+            if (NULL == (tmp = realloc(*ids, size * sizeof *tmp)))
+                break;
+
+            *ids = tmp;
+        }
+
+        (*ids)[cnt++] = id;
+    }
+
+    closedir(dp);
+
+    if (cnt)
+        qsort(*ids, cnt, sizeof **ids, _srv_cache_cmp);
+
+    return cnt;
+}
+
+/**
+ * set the cache up, with whatever the last run left behind
+ * @param c the cache
+ * @param dir where its segments go, which has to stay around
+ * @param size the most they may take up, 0 for our default
+ * @param seg_size how big each may get, 0 for our default
+ */
+int srv_cache_init(cache_t * c, const char *dir, unsigned long long size,
+                   unsigned long long seg_size)
+{
+    struct stat st;
+    cache_seg_t *seg;
+    unsigned int *ids, cnt, i, ents = 0;
+    char path[PATH_MAX];
+    time_t now = time(NULL);
+
+#ifdef DEBUG
+    assert(NULL != c);
+    assert(NULL != dir);
+#endif
+
+    memset(c, 0, sizeof *c);
+
+    c->size = (size) ? size : SRV_CACHE_SIZE;
+    c->seg_size = (seg_size) ? seg_size : SRV_CACHE_SEGMENT;
+
+    /* there's always one being written and one before it */
+    if (c->seg_size > c->size / 2)
+        c->seg_size = c->size / 2;
+
+    c->seg_max = c->size / c->seg_size;
+
+    if (-1 == mkdir(dir, 0700) && EEXIST != errno) {
+        ERRF(__FILE__, __LINE__, "creating cache dir %s: %s\n", dir,
+             strerror(errno));
+        return 0;
+    }
+
+    if (-1 == stat(dir, &st) || !S_ISDIR(st.st_mode)) {
+        ERRF(__FILE__, __LINE__, "%s isn't a directory!\n", dir);
+        return 0;
+    }
+
+    c->dev = st.st_dev;
+    pthread_mutex_init(&c->mt, NULL);
+
+    if (!chash_init(&c->index, 0, SRV_CACHE_SLOTS)) {
+        ERRF(__FILE__, __LINE__, "error setting up the cache index!\n");
+        return 0;
+    }
+
+    /* key functions... basic string type */
+    chash_set_keycmp(&c->index, hash_default_keycmp);
+    chash_set_keycpy(&c->index, hash_default_keycpy);
+    chash_set_free_key(&c->index, hash_default_free_key);
+
+    /* val functions... a copy of a cache_ent_t */
+    chash_set_free_val(&c->index, _srv_cache_ent_free);
+    chash_set_valcpy(&c->index, _srv_cache_ent_alloc);
+
+    if (NULL == (c->segs = calloc(c->seg_max, sizeof *c->segs))) {
+        ERRF(__FILE__, __LINE__, "allocating memory for the cache!\n");
+        return 0;
+    }
+
+    c->dir = dir;
+    cnt = _srv_cache_list(dir, &ids);
+
+    for (i = 0; i < cnt; i++) {
+        if (cnt - i >= c->seg_max) {
+            /* more than we'd keep now, leaving room for a new one */
+            _srv_cache_path(c, ids[i], path, sizeof path);
+            unlink(path);
+            continue;
+        }
+
+        seg = &c->segs[c->count];
+        seg->id = ids[i];
+        ents += _srv_cache_load(c, seg, now);
+
+        if (-1 == seg->fd)
+            continue;
+
+        ++c->count;
+    }
+
+    c->next_id = (cnt) ? ids[cnt - 1] + 1 : 1;
+    c->oldest = (c->count) ? c->segs[c->first].id : c->next_id;
+
+    DEBUGF(__FILE__, __LINE__, "cache in %s: %u segments, %u responses\n",
+           dir, c->count, ents);
+
+    free(ids);
+
+    return 1;
+}
+
+/**
+ * look a response up
+ * @param c the cache
+ * @param key what it's found by
+ * @param ent where what the index has goes
+ * @param path where its segment's path goes
+ * @param len how much room there is for it
+ * @return 1 if there's a fresh one, else 0
+ */
+int srv_cache_get(cache_t * c, const char *key, cache_ent_t * ent,
+                  char *path, size_t len)
+{
+    cache_ent_t *e;
+    int found = 0;
+
+#ifdef DEBUG
+    assert(NULL != c);
+    assert(NULL != key);
+    assert(NULL != ent);
+#endif
+
+    chash_enter(&c->index);
+
+    if (NULL != (e = chash_get(&c->index, key))) {
+        *ent = *e;
+        found = 1;
+    }
+
+    chash_leave(&c->index);
+
+    if (found && (ent->expires <= time(NULL)
+                  || ent->seg < __atomic_load_n(&c->oldest,
+                                                __ATOMIC_ACQUIRE))) {
+        /* gone off, or its segment went */
+        chash_delete(&c->index, key);
+        found = 0;
+    }
+
+    if (!found) {
+        __atomic_add_fetch(&c->misses, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    _srv_cache_path(c, ent->seg, path, len);
+    __atomic_add_fetch(&c->hits, 1, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+/**
+ * make room for a response in the newest segment, starting a new one
+ * if it won't fit, and write everything but its body
+ * @param c the cache
+ * @param put what's needed to go on with it
+ * @param key what it's found by
+ * @param head its header, past the status line and date
+ * @param headlen how long that is
+ * @param len how long its body is
+ * @param stored when it was made
+ * @param expires when it's good until
+ * @return 0 if it can't be kept
+ */
+int srv_cache_begin(cache_t * c, cache_put_t * put, const char *key,
+                    const char *head, size_t headlen,
+                    unsigned long long len, time_t stored, time_t expires)
+{
+    struct _cache_rec rec;
+    struct iovec iov[3];
+    cache_seg_t *seg;
+    unsigned long long need;
+    unsigned int dropped = 0;
+    size_t keylen = strlen(key);
+    ssize_t put_len;
+
+#ifdef DEBUG
+    assert(NULL != c);
+    assert(NULL != put);
+    assert(NULL != key);
+#endif
+
+    need = sizeof rec + keylen + headlen + len;
+
+    if (NULL == c->dir || !keylen || keylen >= SRV_CACHE_KEY_MAX
+        || headlen > SRV_CACHE_HEAD_MAX || need > c->seg_size)
+        return 0;
+
+    pthread_mutex_lock(&c->mt);
+
+    seg = _srv_cache_newest(c);
+
+    if (NULL == seg || seg->used + need > c->seg_size)
+        seg = _srv_cache_roll(c, &dropped);
+
+    if (NULL != seg) {
+        put->start = seg->used;
+        seg->used += need;
+        ++seg->writers;
+    }
+
+    pthread_mutex_unlock(&c->mt);
+
+    if (dropped)
+        _srv_cache_sweep(c);
+
+    if (NULL == seg)
+        return 0;
+
+    put->c = c;
+    put->seg = seg;
+    put->pos = put->start + sizeof rec + keylen + headlen;
+    put->end = put->pos + len;
+    memcpy(put->key, key, keylen + 1);
+
+    put->ent.seg = seg->id;
+    put->ent.off = put->start + sizeof rec + keylen;
+    put->ent.headlen = headlen;
+    put->ent.len = len;
+    put->ent.stored = stored;
+    put->ent.expires = expires;
+
+    memset(&rec, 0, sizeof rec);
+    rec.keylen = keylen;
+    rec.headlen = headlen;
+    rec.len = len;
+    rec.stored = stored;
+    rec.expires = expires;
+
+    iov[0].iov_base = &rec;
+    iov[0].iov_len = sizeof rec;
+    iov[1].iov_base = (void *)key;
+    iov[1].iov_len = keylen;
+    iov[2].iov_base = (void *)head;
+    iov[2].iov_len = headlen;
+
+    while (-1 == (put_len = pwritev(seg->fd, iov, 3, put->start))
+           && EINTR == errno) ;
+
+    if ((size_t)put_len != sizeof rec + keylen + headlen) {
+        srv_cache_end(put, 0);
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * the next of a response's body
+ * @return 0 if it couldn't be written, or there's more than it said
+ */
+int srv_cache_write(cache_put_t * put, const char *data, size_t len)
+{
+#ifdef DEBUG
+    assert(NULL != put);
+#endif
+
+    if (put->pos + len > put->end
+        || !_srv_cache_pwrite(put->seg->fd, data, len, put->pos))
+        return 0;
+
+    put->pos += len;
+
+    return 1;
+}
+
+/**
+ * finish a response. only one that's all there is marked as done, and
+ * only then does the index have it
+ * @param ok whether it went all the way through
+ * @return ok, if it's in
+ */
+int srv_cache_end(cache_put_t * put, int ok)
+{
+    cache_t *c = put->c;
+    unsigned int magic = SRV_CACHE_MAGIC;
+
+#ifdef DEBUG
+    assert(NULL != put);
+#endif
+
+    ok = ok && put->pos == put->end
+        && _srv_cache_pwrite(put->seg->fd, (const char *)&magic,
+                             sizeof magic, put->start);
+
+    if (ok) {
+        chash_insert(&c->index, put->key, &put->ent);
+        __atomic_add_fetch(&c->stores, 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_lock(&c->mt);
+    --put->seg->writers;
+    pthread_mutex_unlock(&c->mt);
+
+    return ok;
+}
+
+/**
+ * keep a response that's all in memory
+ */
+int srv_cache_store(cache_t * c, const char *key, const char *head,
+                    size_t headlen, const char *body,
+                    unsigned long long len, time_t stored, time_t expires)
+{
+    cache_put_t put;
+
+    if (!srv_cache_begin(c, &put, key, head, headlen, len, stored, expires))
+        return 0;
+
+    return srv_cache_end(&put, srv_cache_write(&put, body, len));
+}
+
+/**
+ * keep the index to what memory we can spare for it, by letting the
+ * oldest segments go, and what the index has from them with them. the
+ * newest, and any still being written into, are kept.
+ * @param c the cache
+ * @param max how much the index may cost, in bytes
+ * @return how many segments went
+ */
+unsigned int srv_cache_trim(cache_t * c, size_t max)
+{
+    unsigned int n = 0;
+    int ok;
+
+#ifdef DEBUG
+    assert(NULL != c);
+#endif
+
+    if (NULL == c->dir)
+        return 0;
+
+    while ((unsigned long long)chash_count(&c->index) * SRV_CACHE_ENT_COST
+           > max) {
+        pthread_mutex_lock(&c->mt);
+        ok = c->count > 1 && _srv_cache_drop(c);
+        pthread_mutex_unlock(&c->mt);
+
+        if (!ok)
+            break;
+
+        _srv_cache_sweep(c);
+        ++n;
+    }
+
+    return n;
+}
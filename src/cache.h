@@ -0,0 +1,158 @@
+/* cache.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef SRV_CACHE_H
+#define SRV_CACHE_H
+
+#include <time.h>
+#include <pthread.h>
+
+#include <util/chash.h>
+
+/* responses from modules and proxies, kept on disk for as long as they
+ * say they're good for. each is appended to the newest of a run of
+ * segment files, and found through an index in memory, by site and
+ * request target, of where it starts in which segment. a hit is sent
+ * from its segment like any other file. segments go oldest first to
+ * stay under the size we're given, and the index is read back out of
+ * them when we start.
+ */
+#define SRV_CACHE_SLOTS      4096
+#define SRV_CACHE_SIZE       (1024ULL * 1024 * 1024)
+#define SRV_CACHE_SEGMENT    (64ULL * 1024 * 1024)
+#define SRV_CACHE_KEY_MAX    1024
+#define SRV_CACHE_HEAD_MAX   (8 * 1024)
+
+/* what each response in the index costs in memory, key and all, near
+ * enough. the index is held to the memory governor's budget by letting
+ * the oldest segments go */
+#define SRV_CACHE_ENT_COST   256
+
+/* what a request lets us do */
+#define SRV_CACHE_STORE      1
+#define SRV_CACHE_LOOKUP     2
+
+/* in front of each response in a segment, then its key, the header
+ * past the status line and date, and the body */
+#define SRV_CACHE_MAGIC      0x63767273
+
+struct _cache_rec {
+    /* SRV_CACHE_MAGIC once all of it is written, 0 until then */
+    unsigned int magic;
+    unsigned int keylen;
+    unsigned int headlen;
+    unsigned int pad;
+    unsigned long long len;
+    long long stored;
+    long long expires;
+};
+
+typedef struct _cache_ent_t {
+    /* the segment, and where the header starts in it */
+    unsigned int seg;
+    unsigned long long off;
+    unsigned int headlen;
+    unsigned long long len;
+
+    time_t stored;
+    time_t expires;
+} cache_ent_t;
+
+typedef struct _cache_seg_t {
+    unsigned int id;
+    int fd;
+    /* how much of it is spoken for */
+    unsigned long long used;
+    /* responses still being written into it */
+    unsigned int writers;
+} cache_seg_t;
+
+typedef struct _cache_t {
+    /* NULL if we aren't caching */
+    const char *dir;
+    unsigned long long size;
+    unsigned long long seg_size;
+    /* the device it's on, for the disk threads */
+    unsigned long long dev;
+
+    /* key to cache_ent_t */
+    chash_t index;
+
+    /* the segments, oldest first, in a ring. anything in one before
+     * oldest is gone */
+    pthread_mutex_t mt;
+    cache_seg_t *segs;
+    unsigned int seg_max;
+    unsigned int first;
+    unsigned int count;
+    unsigned int next_id;
+    unsigned int oldest;
+
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long stores;
+} cache_t;
+
+/* a response on its way in */
+typedef struct _cache_put_t {
+    cache_t *c;
+    cache_seg_t *seg;
+    unsigned long long start;
+    unsigned long long pos;
+    unsigned long long end;
+
+    cache_ent_t ent;
+    char key[SRV_CACHE_KEY_MAX];
+} cache_put_t;
+
+/* set the cache up in a directory, reading back what's already there:
+ * the most it may take up, and how big each segment is, 0 for ours */
+int srv_cache_init(cache_t *, const char *, unsigned long long,
+                   unsigned long long);
+/* the key for a target on a site, 0 if it's too long to have one */
+int srv_cache_key(char *, size_t, const char *, const char *, size_t);
+/* the same, for the target on a request line */
+int srv_cache_key_line(char *, size_t, const char *, const char *);
+/* what a request's header lets us do: SRV_CACHE_STORE, _LOOKUP */
+unsigned int srv_cache_request(const char *, const char *);
+/* when a response is good until, from its header, or ttl seconds from
+ * now if it doesn't say. 0 if it isn't to be kept */
+time_t srv_cache_expiry(const char *, const char *, time_t, unsigned int);
+/* a fresh entry for a key, and the path of its segment */
+int srv_cache_get(cache_t *, const char *, cache_ent_t *, char *, size_t);
+/* start a response: key, header, body length, when, and until when */
+int srv_cache_begin(cache_t *, cache_put_t *, const char *, const char *,
+                    size_t, unsigned long long, time_t, time_t);
+/* the next of its body */
+int srv_cache_write(cache_put_t *, const char *, size_t);
+/* done with it, and whether it all went in: only then is it found */
+int srv_cache_end(cache_put_t *, int);
+/* all of a response at once */
+int srv_cache_store(cache_t *, const char *, const char *, size_t,
+                    const char *, unsigned long long, time_t, time_t);
+/* let the oldest segments go until the index costs no more than this,
+ * returns how many went */
+unsigned int srv_cache_trim(cache_t *, size_t);
+
+#endif
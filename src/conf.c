@@ -104,6 +104,7 @@ void srv_conf_strip_line(char *buf)
 int srv_conf_handler_module(void *pnt, const char *key, const char *val)
 {
     struct _srvmod_conf_t *mods = (struct _srvmod_conf_t *)pnt;
+    struct _srvhndlr_conf_t hnd;
 
     DEBUGF(__FILE__, __LINE__, "got module config settings: %s, %s\n", key,
            val);
@@ -115,16 +116,174 @@ int srv_conf_handler_module(void *pnt, const char *key, const char *val)
         mods->name = strdup(val);
     } else if (!strncmp(key, "func", 4)) {
         mods->func = strdup(val);
+    } else if (!strncmp(key, "prio", 4)) {
+        if (!strcmp(val, "high"))
+            mods->prio = SRV_PRIO_HIGH;
+        else if (!strcmp(val, "low"))
+            mods->prio = SRV_PRIO_LOW;
+        else
+            mods->prio = SRV_PRIO_NORMAL;
+    } else if (!strncmp(key, "cache", 5)) {
+        mods->cache = strtol(val, NULL, 0);
     } else if (!strncmp(key, "hnd.", 4)) {
         if (!strncmp(key + 4, "dir", 3))
-            mods->hnd[mods->hnd_cnt].type = SRV_HANDLER_DIR;
+            hnd.type = SRV_HANDLER_DIR;
         else if (!strncmp(key + 4, "ext", 3))
-            mods->hnd[mods->hnd_cnt].type = SRV_HANDLER_EXT;
+            hnd.type = SRV_HANDLER_EXT;
         else if (!strncmp(key + 4, "file", 4))
-            mods->hnd[mods->hnd_cnt].type = SRV_HANDLER_FILE;
+            hnd.type = SRV_HANDLER_FILE;
+        else
+            return 0;
 
         /* and we're done */
-        mods->hnd[mods->hnd_cnt++].data = strdup(val);
+        hnd.data = strdup(val);
+        vector_push(&mods->hnd, &hnd);
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+int srv_conf_handler_vhost(void *pnt, const char *key, const char *val)
+{
+    struct _srvvhost_conf_t *vh = (struct _srvvhost_conf_t *)pnt;
+    struct _srvhndlr_conf_t hnd;
+    char *str;
+
+    DEBUGF(__FILE__, __LINE__, "got vhost config settings: %s, %s\n", key,
+           val);
+
+    /* determine setting */
+    if (!strncmp(key, "name", 4)) {
+        str = strdup(val);
+        vector_push(&vh->names, &str);
+    } else if (!strncmp(key, "docroot", 7)) {
+        if (NULL != vh->docroot)
+            free(vh->docroot);
+
+        vh->docroot = strdup(val);
+    } else if (!strncmp(key, "index", 5)) {
+        if (NULL != vh->index)
+            free(vh->index);
+
+        vh->index = strdup(val);
+    } else if (!strncmp(key, "hide", 4)) {
+        hnd.type = (!strncmp(key, "hide.ext", 8)) ?
+            SRV_HANDLER_EXT : SRV_HANDLER_DIR;
+        hnd.data = strdup(val);
+        vector_push(&vh->hide, &hnd);
+    } else if (!strncmp(key, "module", 6)) {
+        str = strdup(val);
+        vector_push(&vh->mods, &str);
+    } else if (!strncmp(key, "path_cache", 10)) {
+        vh->path_cache = strtol(val, NULL, 0);
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+int srv_conf_handler_proxy(void *pnt, const char *key, const char *val)
+{
+    struct _srvproxy_conf_t *px = (struct _srvproxy_conf_t *)pnt;
+    char *str;
+
+    DEBUGF(__FILE__, __LINE__, "got proxy config settings: %s, %s\n", key,
+           val);
+
+    /* determine setting */
+    if (!strncmp(key, "prefix", 6)) {
+        if (NULL != px->prefix)
+            free(px->prefix);
+
+        px->prefix = strdup(val);
+    } else if (!strncmp(key, "upstream", 8)) {
+        str = strdup(val);
+        vector_push(&px->upstreams, &str);
+    } else if (!strncmp(key, "vhost", 5)) {
+        if (NULL != px->vhost)
+            free(px->vhost);
+
+        px->vhost = strdup(val);
+    } else if (!strncmp(key, "health_interval", 15)) {
+        px->health_ms = strtol(val, NULL, 0);
+    } else if (!strncmp(key, "health", 6)) {
+        if (NULL != px->health)
+            free(px->health);
+
+        px->health = strdup(val);
+    } else if (!strncmp(key, "idle", 4)) {
+        px->idle = strtol(val, NULL, 0);
+    } else if (!strncmp(key, "timeout", 7)) {
+        px->timeout = strtol(val, NULL, 0);
+    } else if (!strncmp(key, "cache", 5)) {
+        /* "yes" goes by what the upstream says, seconds for when it
+         * doesn't say */
+        px->cache_ttl = strtol(val, NULL, 0);
+        px->cache = (px->cache_ttl || tolower(*val) == 'y'
+                     || tolower(*val) == 't');
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
+
+int srv_conf_handler_fcgi(void *pnt, const char *key, const char *val)
+{
+    struct _srvfcgi_conf_t *fc = (struct _srvfcgi_conf_t *)pnt;
+    struct _srvhndlr_conf_t hnd;
+    char *str;
+
+    DEBUGF(__FILE__, __LINE__, "got fastcgi config settings: %s, %s\n", key,
+           val);
+
+    /* determine setting */
+    if (!strncmp(key, "hnd.", 4)) {
+        if (!strncmp(key + 4, "dir", 3))
+            hnd.type = SRV_HANDLER_DIR;
+        else if (!strncmp(key + 4, "ext", 3))
+            hnd.type = SRV_HANDLER_EXT;
+        else if (!strncmp(key + 4, "file", 4))
+            hnd.type = SRV_HANDLER_FILE;
+        else
+            return 0;
+
+        hnd.data = strdup(val);
+        vector_push(&fc->hnd, &hnd);
+    } else if (!strncmp(key, "backend", 7)) {
+        str = strdup(val);
+        vector_push(&fc->backends, &str);
+    } else if (!strncmp(key, "param", 5)) {
+        str = strdup(val);
+        vector_push(&fc->params, &str);
+    } else if (!strncmp(key, "vhost", 5)) {
+        if (NULL != fc->vhost)
+            free(fc->vhost);
+
+        fc->vhost = strdup(val);
+    } else if (!strncmp(key, "spawn", 5)) {
+        if (NULL != fc->spawn)
+            free(fc->spawn);
+
+        fc->spawn = strdup(val);
+    } else if (!strncmp(key, "script", 6)) {
+        if (NULL != fc->script)
+            free(fc->script);
+
+        fc->script = strdup(val);
+    } else if (!strncmp(key, "procs", 5)) {
+        fc->procs = strtol(val, NULL, 0);
+    } else if (!strncmp(key, "conns", 5)) {
+        fc->conns = strtol(val, NULL, 0);
+    } else if (!strncmp(key, "mux", 3)) {
+        fc->mux = strtol(val, NULL, 0);
+    } else if (!strncmp(key, "queue", 5)) {
+        fc->queue = strtol(val, NULL, 0);
+    } else if (!strncmp(key, "timeout", 7)) {
+        fc->timeout = strtol(val, NULL, 0);
     } else {
         return 0;
     }
@@ -148,14 +307,67 @@ int srv_conf_process_block(conf_t * conf, const char *blkname,
     switch (*blkname) {
     case 'v':
         /* new vhost */
-        /* srv_conf_block_handler = srv_conf_handler_vhost; */
-        /* pnt = conf->vhosts; */
+        if (conf->vhost_cnt >= SRV_VHOST_MAX) {
+            ERRF(__FILE__, __LINE__,
+                 "vhosts limited to %u!\n", SRV_VHOST_MAX);
+            return 0;
+        }
+
+        srv_conf_block_handler = srv_conf_handler_vhost;
+        pnt = &conf->vhosts[conf->vhost_cnt++];
+        vector_init(&((struct _srvvhost_conf_t *)pnt)->names, 0,
+                    sizeof(char *));
+        vector_init(&((struct _srvvhost_conf_t *)pnt)->hide, 0,
+                    sizeof(struct _srvhndlr_conf_t));
+        vector_init(&((struct _srvvhost_conf_t *)pnt)->mods, 0,
+                    sizeof(char *));
         break;
 
     case 'm':
         /* new module */
+        if (conf->mod_cnt >= SRV_MODULE_MAX) {
+            ERRF(__FILE__, __LINE__,
+                 "modules limited to %u!\n", SRV_MODULE_MAX);
+            return 0;
+        }
+
         srv_conf_block_handler = srv_conf_handler_module;
         pnt = &conf->mods[conf->mod_cnt++];
+        vector_init(&((struct _srvmod_conf_t *)pnt)->hnd, 0,
+                    sizeof(struct _srvhndlr_conf_t));
+        ((struct _srvmod_conf_t *)pnt)->prio = SRV_PRIO_NORMAL;
+        break;
+
+    case 'p':
+        /* new proxy */
+        if (conf->proxy_cnt >= SRV_PROXY_MAX) {
+            ERRF(__FILE__, __LINE__,
+                 "proxies limited to %u!\n", SRV_PROXY_MAX);
+            return 0;
+        }
+
+        srv_conf_block_handler = srv_conf_handler_proxy;
+        pnt = &conf->proxies[conf->proxy_cnt++];
+        vector_init(&((struct _srvproxy_conf_t *)pnt)->upstreams, 0,
+                    sizeof(char *));
+        break;
+
+    case 'f':
+        /* new fastcgi pool */
+        if (conf->fcgi_cnt >= SRV_FCGI_MAX) {
+            ERRF(__FILE__, __LINE__,
+                 "fastcgi pools limited to %u!\n", SRV_FCGI_MAX);
+            return 0;
+        }
+
+        srv_conf_block_handler = srv_conf_handler_fcgi;
+        pnt = &conf->fcgis[conf->fcgi_cnt++];
+        vector_init(&((struct _srvfcgi_conf_t *)pnt)->hnd, 0,
+                    sizeof(struct _srvhndlr_conf_t));
+        vector_init(&((struct _srvfcgi_conf_t *)pnt)->backends, 0,
+                    sizeof(char *));
+        vector_init(&((struct _srvfcgi_conf_t *)pnt)->params, 0,
+                    sizeof(char *));
         break;
 
     case 'a':
@@ -187,6 +399,14 @@ int srv_conf_process_block(conf_t * conf, const char *blkname,
         if (!srv_conf_parse_line(r, buf, key, val, sizeof key))
             continue;
 
+        /* only the default site is warmed up, so say so */
+        if ('v' == *blkname && !strncmp(key, "warm", 4)) {
+            ERRF(__FILE__, __LINE__,
+                 "%s goes outside any vhost block, only the default site "
+                 "is warmed up!\n", key);
+            return 0;
+        }
+
         /* handle the values accordingly */
         srv_conf_block_handler(pnt, key, val);
 
@@ -196,13 +416,41 @@ int srv_conf_process_block(conf_t * conf, const char *blkname,
     return 1;
 }
 
+/**
+ * a size, in bytes unless it ends in k, m or g
+ */
+unsigned long long srv_conf_size(const char *val)
+{
+    unsigned long long size;
+    char *end;
+
+    size = strtoull(val, &end, 0);
+
+    switch (tolower(*end)) {
+    case 'g':
+        size <<= 10;
+        /* fall through */
+    case 'm':
+        size <<= 10;
+        /* fall through */
+    case 'k':
+        size <<= 10;
+        break;
+    default:
+        break;
+    }
+
+    return size;
+}
+
 /**
  * parse the config
  */
 int srv_conf_parse(conf_t * conf, const char *file)
 {
+    struct _srvhndlr_conf_t hnd;
     FILE *fp;
-    char *buf, line[256];
+    char *buf, *path, line[256];
     char key[128], val[128];
     regex_t blk_r, lin_r;
     int i, open = 0;
@@ -219,6 +467,11 @@ int srv_conf_parse(conf_t * conf, const char *file)
     memset(&blk_r, 0, sizeof blk_r);
     memset(&lin_r, 0, sizeof lin_r);
 
+    vector_init(&conf->hide, 0, sizeof(struct _srvhndlr_conf_t));
+    vector_init(&conf->warm, 0, sizeof(char *));
+    vector_init(&conf->disk_devs, 0, sizeof(char *));
+    conf->disk_depth = -1;
+
     regcomp(&blk_r, "([a-z]+)[[:space:]]*([{])", REG_EXTENDED);
     regcomp(&lin_r, "([a-z._]+)[[:space:]]*=[[:space:]]*\"(.+)\"",
             REG_EXTENDED);
@@ -253,6 +506,17 @@ int srv_conf_parse(conf_t * conf, const char *file)
 
         switch (key[0]) {
         case 'i':
+            if (!strncmp(key, "io", 2)) {
+                /* io, libevent, io_uring or epoll */
+                if (!strcmp(val, "uring"))
+                    conf->io = SRV_IO_URING;
+                else if (!strcmp(val, "epoll"))
+                    conf->io = SRV_IO_EPOLL;
+                else
+                    conf->io = SRV_IO_EVENT;
+                break;
+            }
+
             /* index */
             if (NULL != conf->index)
                 free(conf->index);
@@ -262,6 +526,17 @@ int srv_conf_parse(conf_t * conf, const char *file)
             break;
 
         case 'd':
+            if (!strncmp(key, "disk_depth.dev", 14)) {
+                /* a device with a depth of its own */
+                path = strdup(val);
+                vector_push(&conf->disk_devs, &path);
+                break;
+            } else if (!strncmp(key, "disk_depth", 10)) {
+                /* reads going at once on each device's disk threads */
+                conf->disk_depth = strtol(val, NULL, 0);
+                break;
+            }
+
             /* docroot */
             if (NULL != conf->docroot)
                 free(conf->docroot);
@@ -271,6 +546,20 @@ int srv_conf_parse(conf_t * conf, const char *file)
             break;
 
         case 'p':
+            if (!strncmp(key, "path_cache", 10)) {
+                /* the default site's share of the path cache */
+                conf->path_cache = strtol(val, NULL, 0);
+                break;
+            } else if (!strncmp(key, "pack", 4)) {
+                /* serve a packed docroot */
+                if (NULL != conf->pack)
+                    free(conf->pack);
+
+                conf->pack = strdup(val);
+                DEBUGF(__FILE__, __LINE__, "got a pack: %s\n", conf->pack);
+                break;
+            }
+
             /* port */
             if (conf->port_cnt >= SRV_PORT_MAX) {
                 /* we're full, so don't add another port */
@@ -294,9 +583,11 @@ int srv_conf_parse(conf_t * conf, const char *file)
                 DEBUGF(__FILE__, __LINE__, "got a hostname: %s\n",
                        conf->hostname);
             } else if (key[1] == 'i') {
-                /* hide this file! */
-                if (conf->hide_cnt < SRV_CACHE_MAX)
-                    conf->hide[conf->hide_cnt++] = strdup(val);
+                /* hide this path, or every file with this extension */
+                hnd.type = (!strncmp(key, "hide.ext", 8)) ?
+                    SRV_HANDLER_EXT : SRV_HANDLER_DIR;
+                hnd.data = strdup(val);
+                vector_push(&conf->hide, &hnd);
             }
             break;
 
@@ -306,17 +597,124 @@ int srv_conf_parse(conf_t * conf, const char *file)
                             || tolower(*val) == 't') ? 1 : 0;
             break;
 
-#if 0                            /* not implemented */
         case 'm':
+            if (!strncmp(key, "mem_limit", 9)) {
+                /* what the memory governor keeps us under */
+                conf->mem_limit = srv_conf_size(val);
+                break;
+            }
+
             /* max_conn */
             conf->max_conn = strtol(val, NULL, 0);
             break;
 
+        case 'a':
+            /* accept_batch */
+            conf->accept_batch = strtol(val, NULL, 0);
+            break;
+
         case 'c':
+            if (!strncmp(key, "cache_dir", 9)) {
+                /* where responses are kept */
+                if (NULL != conf->cache_dir)
+                    free(conf->cache_dir);
+
+                conf->cache_dir = strdup(val);
+                DEBUGF(__FILE__, __LINE__, "got a cache dir: %s\n",
+                       conf->cache_dir);
+                break;
+            } else if (!strncmp(key, "cache_size", 10)) {
+                /* the most they take up on disk */
+                conf->cache_size = srv_conf_size(val);
+                break;
+            } else if (!strncmp(key, "cache_segment", 13)) {
+                /* how big each segment gets */
+                conf->cache_segment = srv_conf_size(val);
+                break;
+            }
+
             /* conn_time */
             conf->conn_time = strtol(val, NULL, 0);
             break;
-#endif
+
+        case 't':
+            if (!strncmp(key, "timeout_header", 14)) {
+                /* slow request headers */
+                conf->timeout_header = strtol(val, NULL, 0);
+            } else if (!strncmp(key, "timeout_send", 12)) {
+                /* clients that stop reading */
+                conf->timeout_send = strtol(val, NULL, 0);
+            }
+            break;
+
+        case 'e':
+            if (!strncmp(key, "error_pages", 11)) {
+                /* the site's own error pages */
+                if (NULL != conf->errors)
+                    free(conf->errors);
+
+                conf->errors = strdup(val);
+                DEBUGF(__FILE__, __LINE__, "got error pages: %s\n",
+                       conf->errors);
+                break;
+            }
+
+            /* exec, threads or coroutines */
+            conf->exec = (!strcmp(val, "coro")) ?
+                SRV_EXEC_CORO : SRV_EXEC_THREADS;
+            break;
+
+        case 'q':
+            if (!strncmp(key, "queue_order", 11)) {
+                /* oldest request first, or newest */
+                conf->queue_order = (!strcmp(val, "lifo")) ?
+                    SRV_QUEUE_LIFO : SRV_QUEUE_FIFO;
+            } else if (!strncmp(key, "queue_mode", 10)) {
+                /* one queue for everyone, or per worker with stealing */
+                conf->queue_mode = (!strcmp(val, "steal")) ?
+                    SRV_POOL_STEAL : SRV_POOL_SHARED;
+            } else if (!strncmp(key, "queue_max", 9)) {
+                /* how deep the queue gets before we turn people away */
+                conf->queue_max = strtol(val, NULL, 0);
+            } else if (!strncmp(key, "queue_budget", 12)) {
+                /* longest a request may wait for a worker */
+                conf->queue_budget = strtol(val, NULL, 0);
+            } else if (!strncmp(key, "queue_overflow", 14)) {
+                /* turn it away with a 503, or just hang up */
+                conf->queue_shed = (!strcmp(val, "drop")) ?
+                    SRV_SHED_DROP : SRV_SHED_503;
+            }
+            break;
+
+        case 'w':
+            if (!strncmp(key, "warm_manifest", 13)) {
+                /* the busiest paths, kept across restarts */
+                if (NULL != conf->warm_manifest)
+                    free(conf->warm_manifest);
+
+                conf->warm_manifest = strdup(val);
+                DEBUGF(__FILE__, __LINE__, "got a warm manifest: %s\n",
+                       conf->warm_manifest);
+            } else if (!strncmp(key, "warm", 4)) {
+                /* a path to read in at startup */
+                path = strdup(val);
+                vector_push(&conf->warm, &path);
+            } else if (!strncmp(key, "workers_max", 11)) {
+                /* the most workers we'll grow to */
+                conf->workers_max = strtol(val, NULL, 0);
+            } else if (!strncmp(key, "workers_pin", 11)) {
+                /* pin each worker to a cpu, or to a numa node */
+                if (!strcmp(val, "cpu"))
+                    conf->workers_pin = SRV_PIN_CPU;
+                else if (!strcmp(val, "numa"))
+                    conf->workers_pin = SRV_PIN_NUMA;
+                else
+                    conf->workers_pin = SRV_PIN_NONE;
+            } else if (!strncmp(key, "workers", 7)) {
+                /* workers we always keep, "auto" to fit the cpus */
+                conf->workers = strtol(val, NULL, 0);
+            }
+            break;
 
         case 'u':
             /* user */
@@ -363,23 +761,13 @@ int srv_conf_parse(conf_t * conf, const char *file)
         ERRF(__FILE__, __LINE__, "no docroot set in %s, exiting!\n", file);
         conf->docroot = strdup("/var/www");
     }
-#if 0                            /* not implemented */
-    if (!conf->conn_time) {
-        /* no connection timeout time */
-        ERRF(__FILE__, __LINE__,
-             "config %s didn't set max conn time, "
-             "defaulting to 150ms\n", file);
-        conf->conn_time = 150;
-    }
-
     if (!conf->max_conn) {
         /* no maximum connection count */
         ERRF(__FILE__, __LINE__,
              "config %s didn't set maximum connections, "
-             "defaulting to 100\n", file);
+             "defaulting to 2048\n", file);
         conf->max_conn = 2048;
     }
-#endif
 
     DEBUGF(__FILE__, __LINE__, "config file parsed!\n");
 
@@ -387,5 +775,39 @@ int srv_conf_parse(conf_t * conf, const char *file)
     regfree(&lin_r);
     fclose(fp);
 
+    for (i = 0; i < (int)conf->vhost_cnt; i++) {
+        if (!conf->vhosts[i].names.count || NULL == conf->vhosts[i].docroot) {
+            /* a site nobody can reach, or with nothing to serve */
+            ERRF(__FILE__, __LINE__,
+                 "vhost %d in %s needs a name and a docroot!\n", i + 1, file);
+            return 0;
+        }
+
+        /* the default site's index, unless it has its own */
+        if (NULL == conf->vhosts[i].index)
+            conf->vhosts[i].index = strdup(conf->index);
+    }
+
+    for (i = 0; i < (int)conf->proxy_cnt; i++) {
+        if (NULL == conf->proxies[i].prefix
+            || !conf->proxies[i].upstreams.count) {
+            /* nothing to route, or nowhere to send it */
+            ERRF(__FILE__, __LINE__,
+                 "proxy %d in %s needs a prefix and an upstream!\n", i + 1,
+                 file);
+            return 0;
+        }
+    }
+
+    for (i = 0; i < (int)conf->fcgi_cnt; i++) {
+        if (!conf->fcgis[i].hnd.count || !conf->fcgis[i].backends.count) {
+            /* nothing to answer, or nobody to answer it */
+            ERRF(__FILE__, __LINE__,
+                 "fastcgi %d in %s needs a handler and a backend!\n", i + 1,
+                 file);
+            return 0;
+        }
+    }
+
     return 1;
 }
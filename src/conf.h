@@ -26,16 +26,49 @@
 #define SRV_CONF_H
 
 #include <util/hash.h>
+#include <util/vector.h>
 
 #define SRV_PORT_MAX     64
 #define SRV_MODULE_MAX   16
-#define SRV_HANDLER_MAX  128
-#define SRV_CACHE_MAX     512
+#define SRV_VHOST_MAX   128
+#define SRV_PROXY_MAX    16
+#define SRV_FCGI_MAX     16
 
 #define SRV_HANDLER_FILE  0
 #define SRV_HANDLER_DIR   1
 #define SRV_HANDLER_EXT   2
 
+/* scheduling classes for requests a module handles */
+#define SRV_PRIO_HIGH     0
+#define SRV_PRIO_NORMAL   1
+#define SRV_PRIO_LOW      2
+
+/* order of the worker queue */
+#define SRV_QUEUE_FIFO    0
+#define SRV_QUEUE_LIFO    1
+
+/* one shared worker queue, or one per worker with stealing */
+#define SRV_POOL_SHARED   0
+#define SRV_POOL_STEAL    1
+
+/* how workers are pinned to cpus */
+#define SRV_PIN_NONE      0
+#define SRV_PIN_CPU       1
+#define SRV_PIN_NUMA      2
+
+/* what happens to a request that waited past queue_budget */
+#define SRV_SHED_503      0
+#define SRV_SHED_DROP     1
+
+/* how connections are run */
+#define SRV_EXEC_THREADS  0
+#define SRV_EXEC_CORO     1
+
+/* what drives the sockets */
+#define SRV_IO_EVENT      0
+#define SRV_IO_URING      1
+#define SRV_IO_EPOLL      2
+
 struct _srvhndlr_conf_t {
     short type;
     char *data;
@@ -46,8 +79,76 @@ struct _srvmod_conf_t {
     char *path;
     char *func;
 
-    struct _srvhndlr_conf_t hnd[SRV_HANDLER_MAX];
-    unsigned int hnd_cnt;
+    /* scheduling class of the requests we handle */
+    unsigned int prio;
+    /* seconds to keep what it makes in the cache, 0 not to */
+    unsigned int cache;
+
+    /* vector of struct _srvhndlr_conf_t */
+    vector_t hnd;
+};
+
+struct _srvvhost_conf_t {
+    /* the hosts it answers for, vector of char *: exact names, or
+     * "*.example.com" for anything under example.com */
+    vector_t names;
+
+    char *docroot;
+    char *index;
+    /* hidden paths and extensions, on top of everyone's */
+    vector_t hide;
+    /* the modules it may use, vector of char *, all of them if empty */
+    vector_t mods;
+    /* its share of each thread's path cache, 0 for the default */
+    unsigned int path_cache;
+};
+
+struct _srvproxy_conf_t {
+    /* the path it takes, and everything below it */
+    char *prefix;
+    /* the one site it's for, by any of its names, NULL for all */
+    char *vhost;
+    /* where requests go, vector of char * ("host:port") */
+    vector_t upstreams;
+
+    /* what to GET to see if an upstream is well, NULL to just connect,
+     * and how often, in ms */
+    char *health;
+    unsigned int health_ms;
+    /* idle connections kept open to each upstream */
+    unsigned int idle;
+    /* ms to connect, and to wait on the upstream for anything */
+    unsigned int timeout;
+    /* whether what comes back may be cached, and for how many seconds
+     * when it doesn't say */
+    unsigned int cache;
+    unsigned int cache_ttl;
+};
+
+struct _srvfcgi_conf_t {
+    /* the paths it answers, vector of struct _srvhndlr_conf_t */
+    vector_t hnd;
+    /* the one site it's for, by any of its names, NULL for all */
+    char *vhost;
+    /* where the responders listen, vector of char * ("host:port" or
+     * "unix:/path") */
+    vector_t backends;
+
+    /* what to run on each backend's socket, NULL if something else
+     * runs them, and how many of it */
+    char *spawn;
+    unsigned int procs;
+    /* connections to each backend, and requests on each at once */
+    unsigned int conns;
+    unsigned int mux;
+    /* requests that may wait for a connection, and ms to connect, or
+     * wait for one, or on the backend for anything */
+    unsigned int queue;
+    unsigned int timeout;
+    /* the script every request goes to, NULL for the file asked for */
+    char *script;
+    /* more params to pass, vector of char * ("NAME value") */
+    vector_t params;
 };
 
 /* config def */
@@ -59,27 +160,91 @@ typedef struct {
     /* chroot boolean */
     unsigned int chroot;
 
-    unsigned int hide_cnt;
-    char *hide[SRV_CACHE_MAX];
+    /* hidden paths and extensions, vector of struct _srvhndlr_conf_t */
+    vector_t hide;
     char *hostname;
     char *docroot;
     char *index;
+    /* the default site's share of each thread's path cache */
+    unsigned int path_cache;
+    /* where the site's own error pages are, 404.html and so on */
+    char *errors;
+    /* the docroot compiled by srvpack, served instead of the docroot */
+    char *pack;
+    /* paths to read in before we take anyone, vector of char *, and
+     * where the busiest ones served are kept for next time */
+    vector_t warm;
+    char *warm_manifest;
 
     /* when running as root */
     char *group;
     char *user;
 
+    /* worker threads: how many to keep, how many we may grow to
+     * (0 for both means work it out from the cpus we have), and how
+     * to pin them */
+    unsigned int workers;
+    unsigned int workers_max;
+    unsigned int workers_pin;
+
+    /* worker queue order and layout, how long a request may wait for a worker
+     * in ms (0 is forever), and what to do with one that waited longer */
+    unsigned int queue_order;
+    unsigned int queue_mode;
+    unsigned int queue_budget;
+    unsigned int queue_shed;
+    /* queued requests past which new connections get a 503, 0 for none */
+    unsigned int queue_max;
+
+    /* run connections on the worker threads, or as coroutines on the
+     * event loop */
+    unsigned int exec;
+
+    /* libevent, io_uring where the kernel has it, or epoll */
+    unsigned int io;
+
+    /* reads each device may have going on the disk threads, -1 for
+     * our default and 0 to read in place, and the devices that get
+     * their own, vector of char * ("path depth") */
+    int disk_depth;
+    vector_t disk_devs;
+
     /* set up modules */
     struct _srvmod_conf_t mods[SRV_MODULE_MAX];
     unsigned int mod_cnt;
 
-#if 0                            /* not implemented */
-    /* number of connections */
+    /* sites picked by the Host they're asked for, anything else gets
+     * the default one set up outside any vhost block */
+    struct _srvvhost_conf_t vhosts[SRV_VHOST_MAX];
+    unsigned int vhost_cnt;
+
+    /* paths handed to other servers */
+    struct _srvproxy_conf_t proxies[SRV_PROXY_MAX];
+    unsigned int proxy_cnt;
+
+    /* paths answered by FastCGI backends */
+    struct _srvfcgi_conf_t fcgis[SRV_FCGI_MAX];
+    unsigned int fcgi_cnt;
+
+    /* where module and proxied responses are kept, NULL for nowhere,
+     * the most they may take up, and the size of each segment */
+    char *cache_dir;
+    unsigned long long cache_size;
+    unsigned long long cache_segment;
+
+    /* most connections open at once, past it they get a 503 */
     unsigned int max_conn;
+    /* bytes we should stay well under, 0 to go by our cgroup */
+    unsigned long long mem_limit;
+    /* most connections taken per wakeup of the listener */
+    unsigned int accept_batch;
 
-    /* kill after... */
+    /* kill after... this many seconds, 0 for never */
     unsigned int conn_time;
-#endif
+    /* ms for the whole request header to come in, and the longest a
+     * response may go without any of it being taken */
+    unsigned int timeout_header;
+    unsigned int timeout_send;
 } conf_t;
 
 /* the only public function */
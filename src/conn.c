@@ -39,6 +39,9 @@
 
 #include <srv/conn.h>
 
+/* client connections open right now */
+static unsigned int conn_open;
+
 /**
  * initialize a connection
  */
@@ -129,6 +132,8 @@ int srv_conn_init(conn_t * conn, unsigned short port)
  */
 void srv_conn_cleanup(conn_t * conn)
 {
+    int sock;
+
 #ifdef DEBUG
     assert(NULL != conn);
 #endif
@@ -142,32 +147,91 @@ void srv_conn_cleanup(conn_t * conn)
         DEBUGF(__FILE__, __LINE__,
                "(sock:%d) preemptive close of connection\n", conn->sock);
 
-    /* nicer way to close instead of straight disconnect */
-    if (shutdown(conn->sock, SHUT_WR)) {
-        if (errno != ENOTCONN) {
-            ERRF(__FILE__, __LINE__,
-                 "shutting down socket(%d)! %s\n", conn->sock, strerror(errno));
-            return;
-        }
-    }
-
-    /* if the shutdown wasn't respected... */
-    if (-1 != conn->sock) {
-        if (close(conn->sock)) {
-            ERRF(__FILE__, __LINE__, "closing socket! %s\n", strerror(errno));
-            return;
-        }
-    }
+    /* once the socket is closed its number goes to the next client, so
+     * the timer comes off first, and the slot is put back before */
+    srv_conn_untime(conn);
+    srv_conn_release(conn);
 
     if (conn->fd) {
         /* our filehandle still open */
         close(conn->fd);
     }
 
+    sock = conn->sock;
+
     conn->fd = 0;
     conn->sock = -1;
     conn->state = CONN_STATE_NEW;
     conn->locked = 0;
 
+    srv_conn_closed(conn);
+
     memset(&conn->addr, 0, sizeof conn->addr);
+
+    /* nicer way to close instead of straight disconnect */
+    if (shutdown(sock, SHUT_WR) && ENOTCONN != errno)
+        ERRF(__FILE__, __LINE__,
+             "shutting down socket(%d)! %s\n", sock, strerror(errno));
+
+    if (close(sock))
+        ERRF(__FILE__, __LINE__, "closing socket! %s\n", strerror(errno));
+}
+
+/**
+ * hand back whatever buffers a connection still has on loan, and any
+ * file its response was holding
+ */
+void srv_conn_release(conn_t * conn)
+{
+#ifdef DEBUG
+    assert(NULL != conn);
+#endif
+
+    buf_put(conn->req.buf);
+    conn->req.buf = NULL;
+
+    buf_put(conn->iobuf);
+    conn->iobuf = NULL;
+
+    /* and a cache segment its response never got to */
+    if (conn->resp.fd) {
+        close(conn->resp.fd);
+        conn->resp.fd = 0;
+    }
+}
+
+/**
+ * count a freshly accepted client connection
+ */
+void srv_conn_opened(conn_t * conn)
+{
+#ifdef DEBUG
+    assert(NULL != conn);
+#endif
+
+    conn->client = 1;
+    __atomic_add_fetch(&conn_open, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * stop counting a client connection, safe to call more than once
+ */
+void srv_conn_closed(conn_t * conn)
+{
+#ifdef DEBUG
+    assert(NULL != conn);
+#endif
+
+    if (conn->client) {
+        conn->client = 0;
+        __atomic_sub_fetch(&conn_open, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * how many client connections are open
+ */
+unsigned int srv_conn_count(void)
+{
+    return __atomic_load_n(&conn_open, __ATOMIC_RELAXED);
 }
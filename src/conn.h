@@ -31,6 +31,11 @@
 #include <arpa/inet.h>
 #include <event.h>
 
+#include <util/coro.h>
+#include <util/buf.h>
+#include <util/wheel.h>
+
+#include <srv/disk.h>
 #include <srv/resp.h>
 #include <srv/req.h>
 
@@ -38,6 +43,7 @@
 #define CONN_STATE_REQ      2
 #define CONN_STATE_RESP     3
 #define CONN_STATE_SEND     4
+#define CONN_STATE_PARSED   5
 #define CONN_STATE_DESTROY  0
 
 typedef struct _conn_t {
@@ -46,18 +52,60 @@ typedef struct _conn_t {
     unsigned int locked;
     unsigned int state;
 
-    /* our file */
+    /* a client we counted as open, not a listener */
+    unsigned int client;
+
+    /* when we were last queued for a worker (ms), and in what class */
+    unsigned long long queued;
+    unsigned int prio;
+
+    /* the worker that last handled us, -1 for none yet */
+    int worker;
+
+    /* when we were accepted, and last got anywhere (ms), and the timer
+     * that hangs up on us if we stop getting anywhere */
+    unsigned long long born;
+    unsigned long long active;
+    wtimer_t timer;
+
+    /* our coroutine, in the coroutine exec mode, and the next one
+     * waiting for the event loop to resume it */
+    coro_t *co;
+    struct _conn_t *woken;
+
+    /* our file, and the read of it the disk pool is doing for us */
     int fd;
+    disk_job_t disk;
+
+    /* io_uring: ops in flight, and whether we're winding down */
+    unsigned int inflight;
+    unsigned int closing;
+
+    /* the chunk of the body being sent, borrowed until we close */
+    buf_t *iobuf;
+    size_t iopos;
+    size_t iolen;
 
     /* client only */
     struct event ev;
     req_t req;
     resp_t resp;
+    /* the site the request asked for */
+    vhost_t *site;
 } conn_t;
 
 /* intialize a connection */
 int srv_conn_init(conn_t *, unsigned short);
 /* disconnect */
 void srv_conn_cleanup(conn_t *);
+/* give back the buffers a connection borrowed */
+void srv_conn_release(conn_t *);
+/* count a client connection in, and out again */
+void srv_conn_opened(conn_t *);
+void srv_conn_closed(conn_t *);
+/* take a closing connection's timer off the wheel */
+void srv_conn_untime(conn_t *);
+/* how many client connections are open */
+unsigned int srv_conn_count(void);
 
 #endif
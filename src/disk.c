@@ -0,0 +1,331 @@
+/* disk.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <util/util.h>
+
+#include <srv/disk.h>
+
+/* a device, its queue, and the threads working it */
+struct _disk_dev {
+    unsigned long long dev;
+    unsigned int depth;
+
+    pthread_mutex_t mt;
+    pthread_cond_t cond;
+    disk_job_t *head;
+    disk_job_t *tail;
+    unsigned int queued;
+    unsigned long long reads;
+};
+
+/* devices are only ever added, and can be looked through without the
+ * lock once they're counted */
+static pthread_mutex_t disk_mt = PTHREAD_MUTEX_INITIALIZER;
+static struct _disk_dev disk_devs[SRV_DISK_DEVS];
+static unsigned int disk_dev_cnt;
+
+/* threads per device, unless the device was given its own */
+static unsigned int disk_depth;
+
+/**
+ * how many reads each device may have going at once. 0 has every read
+ * done in place, by whoever wants it.
+ */
+void srv_disk_init(unsigned int depth)
+{
+    disk_depth = depth;
+}
+
+/**
+ * a device's slot, set up if it's new. called with disk_mt held.
+ */
+struct _disk_dev *_srv_disk_add(unsigned long long dev, unsigned int depth)
+{
+    struct _disk_dev *d;
+    unsigned int i;
+
+    for (i = 0; i < disk_dev_cnt; i++)
+        if (dev == disk_devs[i].dev)
+            return &disk_devs[i];
+
+    if (SRV_DISK_DEVS == disk_dev_cnt)
+        return NULL;
+
+    d = &disk_devs[disk_dev_cnt];
+    d->dev = dev;
+    d->depth = depth;
+    pthread_mutex_init(&d->mt, NULL);
+    pthread_cond_init(&d->cond, NULL);
+
+    __atomic_store_n(&disk_dev_cnt, disk_dev_cnt + 1, __ATOMIC_RELEASE);
+
+    return d;
+}
+
+/**
+ * give the device a path is on a depth of its own. only before the
+ * first read from it.
+ * @param path anything on the device
+ * @param depth how many reads it may have going, 0 to read in place
+ */
+int srv_disk_depth(const char *path, unsigned int depth)
+{
+    struct _disk_dev *d;
+    struct stat st;
+
+#ifdef DEBUG
+    assert(NULL != path);
+#endif
+
+    if (stat(path, &st)) {
+        ERRF(__FILE__, __LINE__, "stat %s: %s!\n", path, strerror(errno));
+        return 0;
+    }
+
+    pthread_mutex_lock(&disk_mt);
+
+    if (NULL != (d = _srv_disk_add(st.st_dev, depth)))
+        d->depth = depth;
+
+    pthread_mutex_unlock(&disk_mt);
+
+    return (NULL != d);
+}
+
+/**
+ * read, but only what's already in memory
+ * @return what was read, or -1 with errno EAGAIN if it would wait
+ */
+ssize_t srv_disk_try(int fd, char *buf, size_t len, off_t off)
+{
+#ifdef RWF_NOWAIT
+    struct iovec iov;
+    ssize_t got;
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+
+    got = preadv2(fd, &iov, 1, off, RWF_NOWAIT);
+
+    /* a kernel or filesystem that can't say counts as would wait */
+    if (-1 == got && (EOPNOTSUPP == errno || ENOSYS == errno))
+        errno = EAGAIN;
+
+    return got;
+#else
+    errno = EAGAIN;
+
+    return -1;
+#endif
+}
+
+/**
+ * one read, and a hint to the kernel about what comes after it
+ */
+void _srv_disk_read(disk_job_t * job)
+{
+    job->err = 0;
+
+    if (!job->off)
+        posix_fadvise(job->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    while (-1 == (job->got = pread(job->fd, job->buf, job->len, job->off))
+           && EINTR == errno) ;
+
+    if (-1 == job->got) {
+        job->err = errno;
+        return;
+    }
+
+    if ((size_t)job->got == job->len)
+        posix_fadvise(job->fd, job->off + job->got, SRV_DISK_AHEAD,
+                      POSIX_FADV_WILLNEED);
+}
+
+/**
+ * one of a device's threads
+ */
+void *_srv_disk_worker(void *arg)
+{
+    struct _disk_dev *d = (struct _disk_dev *)arg;
+    disk_job_t *job;
+
+    for (;;) {
+        pthread_mutex_lock(&d->mt);
+
+        while (NULL == d->head)
+            pthread_cond_wait(&d->cond, &d->mt);
+
+        job = d->head;
+
+        if (NULL == (d->head = job->next))
+            d->tail = NULL;
+
+        --d->queued;
+        pthread_mutex_unlock(&d->mt);
+
+        _srv_disk_read(job);
+
+        __atomic_add_fetch(&d->reads, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&job->busy, 0, __ATOMIC_RELEASE);
+        job->done(job);
+    }
+
+    return NULL;
+}
+
+/**
+ * the device a job is for, its threads started if this is the first
+ * read from it
+ */
+struct _disk_dev *_srv_disk_dev(unsigned long long dev)
+{
+    struct _disk_dev *d;
+    unsigned int i, cnt;
+    pthread_t th;
+
+    cnt = __atomic_load_n(&disk_dev_cnt, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < cnt; i++) {
+        d = &disk_devs[i];
+
+        if (dev != d->dev)
+            continue;
+
+        if (__atomic_load_n(&d->reads, __ATOMIC_ACQUIRE))
+            return d;
+
+        /* read in place, nothing to start */
+        if (!d->depth)
+            return NULL;
+
+        break;
+    }
+
+    /* new, or nobody's read from it yet */
+    pthread_mutex_lock(&disk_mt);
+
+    if (NULL != (d = _srv_disk_add(dev, disk_depth)) && !d->reads) {
+        for (i = 0; i < d->depth; i++) {
+            if (pthread_create(&th, NULL, _srv_disk_worker, d)) {
+                ERRF(__FILE__, __LINE__, "starting a disk thread!\n");
+                break;
+            }
+
+            pthread_detach(th);
+        }
+
+        /* only ever started once */
+        if (!(d->depth = i))
+            d = NULL;
+        else
+            __atomic_store_n(&d->reads, 1, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&disk_mt);
+
+    return d;
+}
+
+/**
+ * hand a read over to the device's threads. done is called once it's
+ * been read, from one of them.
+ * @param job the read, busy until done is called
+ * @return 0 if the read should just be done in place
+ */
+int srv_disk_submit(disk_job_t * job)
+{
+    struct _disk_dev *d;
+
+#ifdef DEBUG
+    assert(NULL != job);
+    assert(NULL != job->done);
+#endif
+
+    /* with no pool by default, only the devices given one have it */
+    if ((!disk_depth && !__atomic_load_n(&disk_dev_cnt, __ATOMIC_RELAXED))
+        || NULL == (d = _srv_disk_dev(job->dev)))
+        return 0;
+
+    job->next = NULL;
+    job->busy = 1;
+
+    pthread_mutex_lock(&d->mt);
+
+    if (NULL == d->tail)
+        d->head = job;
+    else
+        d->tail->next = job;
+
+    d->tail = job;
+    ++d->queued;
+
+    pthread_cond_signal(&d->cond);
+    pthread_mutex_unlock(&d->mt);
+
+    return 1;
+}
+
+/**
+ * call func with how each device that has been read from is doing
+ */
+void srv_disk_walk(void (*func) (const disk_stats_t *, void *), void *arg)
+{
+    struct _disk_dev *d;
+    disk_stats_t st;
+    unsigned int i, cnt;
+
+    cnt = __atomic_load_n(&disk_dev_cnt, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < cnt; i++) {
+        d = &disk_devs[i];
+
+        if (!__atomic_load_n(&d->reads, __ATOMIC_RELAXED))
+            continue;
+
+        pthread_mutex_lock(&d->mt);
+        st.dev = d->dev;
+        st.depth = d->depth;
+        st.queued = d->queued;
+        st.reads = d->reads - 1;
+        pthread_mutex_unlock(&d->mt);
+
+        func(&st, arg);
+    }
+}
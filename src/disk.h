@@ -0,0 +1,79 @@
+/* disk.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef SRV_DISK_H
+#define SRV_DISK_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* reads that would have to wait on the disk are done here, off the
+ * threads that look after sockets. each device gets its own queue and
+ * its own few threads, so one that stops answering (an nfs mount, say)
+ * only holds up the reads from it.
+ */
+#define SRV_DISK_DEVS     16
+#define SRV_DISK_DEPTH     4
+#define SRV_DISK_AHEAD    (512 * 1024)
+
+typedef struct _disk_job_t {
+    /* what to read, where to, and from which device */
+    int fd;
+    char *buf;
+    size_t len;
+    off_t off;
+    unsigned long long dev;
+
+    /* how it went, got is -1 with err set on failure */
+    ssize_t got;
+    int err;
+
+    /* set while it's with us, and called once it's done, from one of
+     * our threads */
+    unsigned int busy;
+    void (*done) (struct _disk_job_t *);
+    void *arg;
+
+    struct _disk_job_t *next;
+} disk_job_t;
+
+typedef struct _disk_stats_t {
+    unsigned long long dev;
+    unsigned int depth;
+    unsigned int queued;
+    unsigned long long reads;
+} disk_stats_t;
+
+/* how many reads each device may have going, 0 to do them in place */
+void srv_disk_init(unsigned int);
+/* a different depth for the device a path is on */
+int srv_disk_depth(const char *, unsigned int);
+/* read if it's already in memory, else -1 with errno EAGAIN */
+ssize_t srv_disk_try(int, char *, size_t, off_t);
+/* hand a read over, 0 if it has to be done in place */
+int srv_disk_submit(disk_job_t *);
+/* how each device is doing */
+void srv_disk_walk(void (*)(const disk_stats_t *, void *), void *);
+
+#endif
@@ -0,0 +1,1661 @@
+/* fcgi.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <util/util.h>
+#include <util/buf.h>
+#include <util/vector.h>
+
+#include <srv/path.h>
+#include <srv/resp.h>
+#include <srv/vhost.h>
+#include <srv/fcgi.h>
+
+/* record types */
+#define FCGI_BEGIN_REQUEST      1
+#define FCGI_ABORT_REQUEST      2
+#define FCGI_END_REQUEST        3
+#define FCGI_PARAMS             4
+#define FCGI_STDIN              5
+#define FCGI_STDOUT             6
+#define FCGI_STDERR             7
+
+#define FCGI_VERSION_1          1
+#define FCGI_RESPONDER          1
+#define FCGI_KEEP_CONN          1
+
+/* what END_REQUEST says about a request */
+#define FCGI_REQUEST_COMPLETE   0
+#define FCGI_CANT_MPX_CONN      1
+#define FCGI_OVERLOADED         2
+#define FCGI_UNKNOWN_ROLE       3
+
+struct _fcgi_header {
+    unsigned char version;
+    unsigned char type;
+    unsigned char id[2];
+    unsigned char len[2];
+    unsigned char pad;
+    unsigned char reserved;
+};
+
+/* one request, client and backend */
+struct _fcgi_io {
+    conn_t *clnt;
+    void (*progress) (conn_t *);
+
+    /* where it went, and as which request on the connection */
+    fcgi_t *f;
+    fcgi_backend_t *back;
+    fcgi_conn_t *c;
+    fcgi_slot_t *s;
+    unsigned int id;
+    /* the connection was open before we got it */
+    unsigned int reused;
+
+    /* the client's body is partly read, the backend said something,
+     * the client heard something: past any of these it can't be tried
+     * again on another connection */
+    unsigned int streamed;
+    unsigned int heard;
+    unsigned int answered;
+
+    /* the backend ran out of time, or said why it wouldn't */
+    unsigned int late;
+    unsigned int proto;
+
+    /* only the header goes back for a HEAD */
+    unsigned int head;
+};
+
+static const unsigned char fcgi_pad[8];
+
+/**
+ * a clock for when backends failed, in ms
+ */
+unsigned long long _srv_fcgi_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * the client got somewhere, or the backend did on its behalf
+ */
+void _srv_fcgi_moved(struct _fcgi_io *io)
+{
+    if (NULL != io->progress)
+        io->progress(io->clnt);
+}
+
+/**
+ * wait for the client. the timing wheel hangs up on one that takes too
+ * long, which wakes us up too.
+ */
+int _srv_fcgi_wait(struct _fcgi_io *io, short events)
+{
+    struct pollfd pfd;
+
+    pfd.fd = io->clnt->sock;
+    pfd.events = events;
+    pfd.revents = 0;
+
+    return (poll(&pfd, 1, -1) > 0);
+}
+
+/**
+ * recv from the client
+ * @return what was read, 0 if it hung up, -1 on failure
+ */
+ssize_t _srv_fcgi_recv(struct _fcgi_io *io, char *data, size_t len)
+{
+    ssize_t got;
+
+    for (;;) {
+        if ((got = recv(io->clnt->sock, data, len, 0)) >= 0) {
+            if (got)
+                _srv_fcgi_moved(io);
+
+            return got;
+        }
+
+        if (EINTR != errno && ((EAGAIN != errno && EWOULDBLOCK != errno)
+                               || !_srv_fcgi_wait(io, POLLIN)))
+            return -1;
+    }
+}
+
+/**
+ * send all of it to the client
+ */
+int _srv_fcgi_send(struct _fcgi_io *io, const char *data, size_t len)
+{
+    ssize_t sent;
+    size_t pos = 0;
+
+    while (pos < len) {
+        if ((sent = send(io->clnt->sock, data + pos, len - pos,
+                         MSG_NOSIGNAL)) > 0) {
+            pos += sent;
+            _srv_fcgi_moved(io);
+        } else if (-1 == sent && EINTR == errno) {
+            continue;
+        } else if (-1 == sent && (EAGAIN == errno || EWOULDBLOCK == errno)
+                   && _srv_fcgi_wait(io, POLLOUT)) {
+            continue;
+        } else {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * a record's header, for len bytes of content
+ */
+void _srv_fcgi_header(struct _fcgi_header *h, unsigned int type,
+                      unsigned int id, size_t len)
+{
+    h->version = FCGI_VERSION_1;
+    h->type = type;
+    h->id[0] = id >> 8;
+    h->id[1] = id & 0xff;
+    h->len[0] = len >> 8;
+    h->len[1] = len & 0xff;
+    h->pad = (8 - (len & 7)) & 7;
+    h->reserved = 0;
+}
+
+/**
+ * add a name and its value to the params being built, each with its
+ * length in front, 0 if they won't fit
+ */
+int _srv_fcgi_pair(buf_t * b, const char *name, size_t nlen,
+                   const char *val, size_t vlen)
+{
+    unsigned char *p;
+    size_t need;
+
+    need = nlen + vlen + ((nlen > 127) ? 4 : 1) + ((vlen > 127) ? 4 : 1);
+
+    if (b->len + need > b->size)
+        return 0;
+
+    p = (unsigned char *)b->data + b->len;
+
+    if (nlen > 127) {
+        *p++ = 0x80 | (nlen >> 24);
+        *p++ = nlen >> 16;
+        *p++ = nlen >> 8;
+    }
+
+    *p++ = nlen;
+
+    if (vlen > 127) {
+        *p++ = 0x80 | (vlen >> 24);
+        *p++ = vlen >> 16;
+        *p++ = vlen >> 8;
+    }
+
+    *p++ = vlen;
+
+    memcpy(p, name, nlen);
+    memcpy(p + nlen, val, vlen);
+    b->len += need;
+
+    return 1;
+}
+
+int _srv_fcgi_param(buf_t * b, const char *name, const char *val)
+{
+    return _srv_fcgi_pair(b, name, strlen(name), val, strlen(val));
+}
+
+/**
+ * a request header as a param: HTTP_ and its name, upper case, with
+ * dashes as underscores. names that already have an underscore would
+ * pass for one of ours or another's, and are dropped.
+ */
+int _srv_fcgi_http(buf_t * b, const char *name, size_t nlen,
+                   const char *val, size_t vlen)
+{
+    char tmp[256];
+    size_t i;
+
+    if (nlen + 5 >= sizeof tmp || NULL != memchr(name, '_', nlen))
+        return 1;
+
+    memcpy(tmp, "HTTP_", 5);
+
+    for (i = 0; i < nlen; i++)
+        tmp[5 + i] = ('-' == name[i]) ? '_' : toupper((unsigned char)name[i]);
+
+    return _srv_fcgi_pair(b, tmp, nlen + 5, val, vlen);
+}
+
+/**
+ * is this header line the one named?
+ */
+int _srv_fcgi_is(const char *line, size_t len, const char *name)
+{
+    return (strlen(name) == len && !strncasecmp(line, name, len));
+}
+
+/**
+ * the params a request goes with: where the script is and what's after
+ * it, the request line and headers as CGI has them, where it came from
+ * and to, and whatever else the pool is set up to say
+ * @param io the request
+ * @param b where they go, without any records around them yet
+ * @param end where the client's header ends, at its blank line
+ * @param clen set to the length of the body
+ * @param expect set if the client waits for a 100 before the body
+ * @return 0, or the error to answer the client with
+ */
+unsigned int _srv_fcgi_params(struct _fcgi_io *io, buf_t * b,
+                              const char *end, unsigned long long *clen,
+                              unsigned int *expect)
+{
+    const char *line, *next, *colon, *v, *sp, *target, *query, *proto;
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof addr;
+    conn_t *clnt = io->clnt;
+    vhost_t *site = clnt->site;
+    const vector_t *params = io->f->params;
+    char ip[INET_ADDRSTRLEN], tmp[128], *e;
+    unsigned long long len;
+    size_t tlen, n;
+    unsigned int i, has_len = 0;
+    path_t path;
+    int ok = 1;
+
+    b->len = 0;
+    *clen = 0;
+    *expect = 0;
+
+    /* METHOD target HTTP/1.x, as it came */
+    line = clnt->req.buf->data;
+    next = strstr(line, "\r\n");
+
+    if (NULL == (sp = memchr(line, ' ', next - line))
+        || NULL == (proto = memchr(sp + 1, ' ', next - sp - 1)))
+        return RESP_HTTP_400;
+
+    target = sp + 1;
+    tlen = proto - target;
+    ++proto;
+    query = memchr(target, '?', tlen);
+
+    /* the script, cleaned up the way the route was matched */
+    if (!srv_path_lookup(&path, &site->root, clnt->req.path, time(NULL)))
+        return RESP_HTTP_404;
+
+    ok = ok && _srv_fcgi_pair(b, "REQUEST_METHOD", 14, line, sp - line);
+    ok = ok && _srv_fcgi_pair(b, "REQUEST_URI", 11, target, tlen);
+    ok = ok && _srv_fcgi_pair(b, "QUERY_STRING", 12,
+                              (NULL != query) ? query + 1 : "",
+                              (NULL != query) ? tlen - (query + 1 - target)
+                              : 0);
+    ok = ok && _srv_fcgi_pair(b, "SERVER_PROTOCOL", 15, proto, next - proto);
+    ok = ok && _srv_fcgi_param(b, "GATEWAY_INTERFACE", "CGI/1.1");
+    ok = ok && _srv_fcgi_param(b, "SERVER_SOFTWARE", "srv/" _SRV_VERSION);
+    ok = ok && _srv_fcgi_param(b, "DOCUMENT_ROOT", site->root.dir);
+    /* php won't run without it, thinking it was asked for directly */
+    ok = ok && _srv_fcgi_param(b, "REDIRECT_STATUS", "200");
+
+    if (NULL != io->f->script) {
+        /* one script for everything, which goes by the path */
+        ok = ok && _srv_fcgi_param(b, "SCRIPT_FILENAME", io->f->script);
+        ok = ok && _srv_fcgi_param(b, "SCRIPT_NAME", "");
+        ok = ok && _srv_fcgi_param(b, "PATH_INFO", path.full + path.rel);
+    } else {
+        ok = ok && _srv_fcgi_param(b, "SCRIPT_FILENAME", path.full);
+        ok = ok && _srv_fcgi_param(b, "SCRIPT_NAME", path.full + path.rel);
+    }
+
+    /* the ring doesn't keep the address it accepted from */
+    addr = clnt->addr;
+
+    if (AF_INET != addr.sin_family
+        && getpeername(clnt->sock, (struct sockaddr *)&addr, &alen))
+        memset(&addr, 0, sizeof addr);
+
+    inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof ip);
+    snprintf(tmp, sizeof tmp, "%u", ntohs(addr.sin_port));
+    ok = ok && _srv_fcgi_param(b, "REMOTE_ADDR", ip);
+    ok = ok && _srv_fcgi_param(b, "REMOTE_PORT", tmp);
+
+    alen = sizeof addr;
+
+    if (getsockname(clnt->sock, (struct sockaddr *)&addr, &alen))
+        memset(&addr, 0, sizeof addr);
+
+    inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof ip);
+    snprintf(tmp, sizeof tmp, "%u", ntohs(addr.sin_port));
+    ok = ok && _srv_fcgi_param(b, "SERVER_ADDR", ip);
+    ok = ok && _srv_fcgi_param(b, "SERVER_PORT", tmp);
+    ok = ok && _srv_fcgi_param(b, "SERVER_NAME", ('\0' != clnt->req.host[0])
+                               ? clnt->req.host : site->name);
+
+    for (line = next + 2; ok && line < end; line = next + 2) {
+        next = strstr(line, "\r\n");
+
+        if (NULL == (colon = memchr(line, ':', next - line)))
+            return RESP_HTTP_400;
+
+        for (v = colon + 1; ' ' == *v || '\t' == *v; v++) ;
+
+        for (n = next - v; n && (' ' == v[n - 1] || '\t' == v[n - 1]); n--) ;
+
+        if (_srv_fcgi_is(line, colon - line, "Transfer-Encoding")) {
+            /* CGI has nowhere to put a body without a length */
+            return RESP_HTTP_411;
+        } else if (_srv_fcgi_is(line, colon - line, "Content-Length")) {
+            len = strtoull(v, &e, 10);
+
+            if (e == v || (e < next && ' ' != *e && '\t' != *e))
+                return RESP_HTTP_400;
+
+            /* lengths that disagree leave the body's end in doubt; the
+             * same one again says nothing new */
+            if (has_len) {
+                if (len != *clen)
+                    return RESP_HTTP_400;
+
+                continue;
+            }
+
+            *clen = len;
+            has_len = 1;
+            ok = _srv_fcgi_pair(b, "CONTENT_LENGTH", 14, v, e - v);
+        } else if (_srv_fcgi_is(line, colon - line, "Content-Type")) {
+            ok = _srv_fcgi_pair(b, "CONTENT_TYPE", 12, v, n);
+        } else if (_srv_fcgi_is(line, colon - line, "Expect")) {
+            *expect = !strncasecmp(v, "100-continue", 12);
+        } else if (!_srv_fcgi_is(line, colon - line, "Proxy")) {
+            /* HTTP_PROXY would be taken for where to send the
+             * script's own requests */
+            ok = _srv_fcgi_http(b, line, colon - line, v, n);
+        }
+    }
+
+    /* and what the pool adds, "NAME value" */
+    for (i = 0; ok && NULL != params && i < params->count; i++) {
+        line = *(char **)vector_get_at((vector_t *) params, i);
+        sp = strchr(line, ' ');
+        ok = _srv_fcgi_pair(b, line, (NULL != sp) ? (size_t)(sp - line)
+                            : strlen(line), (NULL != sp) ? sp + 1 : "",
+                            (NULL != sp) ? strlen(sp + 1) : 0);
+    }
+
+    return (ok) ? 0 : RESP_HTTP_413;
+}
+
+/**
+ * send whole records down a connection, while nobody else does
+ * @param late set if the backend stopped taking them in time
+ */
+int _srv_fcgi_write(fcgi_conn_t * c, struct iovec *iov, int cnt,
+                    unsigned int *late)
+{
+    struct msghdr msg;
+    ssize_t sent;
+    int ok = 1;
+
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = cnt;
+
+    pthread_mutex_lock(&c->wmt);
+
+    while (msg.msg_iovlen) {
+        if (-1 == (sent = sendmsg(c->fd, &msg, MSG_NOSIGNAL))) {
+            if (EINTR == errno)
+                continue;
+
+            *late = (EAGAIN == errno || EWOULDBLOCK == errno);
+            ok = 0;
+            break;
+        }
+
+        while (msg.msg_iovlen && (size_t)sent >= msg.msg_iov->iov_len) {
+            sent -= msg.msg_iov->iov_len;
+            ++msg.msg_iov;
+            --msg.msg_iovlen;
+        }
+
+        if (msg.msg_iovlen) {
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + sent;
+            msg.msg_iov->iov_len -= sent;
+        }
+    }
+
+    pthread_mutex_unlock(&c->wmt);
+
+    return ok;
+}
+
+/**
+ * read len bytes from a backend, all of them
+ */
+int _srv_fcgi_read_all(fcgi_conn_t * c, void *data, size_t len,
+                       unsigned int *late)
+{
+    size_t pos = 0;
+    ssize_t got;
+
+    while (pos < len) {
+        if ((got = recv(c->fd, (char *)data + pos, len - pos, 0)) > 0) {
+            pos += got;
+        } else if (-1 == got && EINTR == errno) {
+            continue;
+        } else {
+            *late = (-1 == got && (EAGAIN == errno || EWOULDBLOCK == errno));
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * the next record on a connection, its content in a buffer of its own
+ * if it has any
+ */
+int _srv_fcgi_read(fcgi_conn_t * c, struct _fcgi_header *h, buf_t ** b,
+                   size_t *len, unsigned int *late)
+{
+    unsigned char pad[8];
+
+    *b = NULL;
+    *late = 0;
+
+    if (!_srv_fcgi_read_all(c, h, sizeof *h, late)
+        || FCGI_VERSION_1 != h->version)
+        return 0;
+
+    *len = (h->len[0] << 8) | h->len[1];
+
+    if (*len && (NULL == (*b = buf_get(*len))
+                 || !_srv_fcgi_read_all(c, (*b)->data, *len, late)))
+        goto fail;
+
+    if (h->pad && !_srv_fcgi_read_all(c, pad, h->pad, late))
+        goto fail;
+
+    if (NULL != *b)
+        (*b)->len = *len;
+
+    return 1;
+
+  fail:
+    if (NULL != *b)
+        buf_put(*b);
+
+    *b = NULL;
+
+    return 0;
+}
+
+/**
+ * close a connection nobody's on any more, for it to be opened again
+ * when it's next wanted. the pool's lock is held.
+ */
+void _srv_fcgi_close(fcgi_conn_t * c)
+{
+    close(c->fd);
+    c->fd = -1;
+    c->broken = 0;
+    c->late = 0;
+}
+
+/**
+ * give a slot back, with anything left in it. the pool's lock is held.
+ */
+void _srv_fcgi_drop(fcgi_t * f, fcgi_conn_t * c, fcgi_slot_t * s)
+{
+    buf_t *b;
+
+    while (NULL != (b = s->out)) {
+        s->out = b->next;
+        buf_put(b);
+    }
+
+    memset(s, 0, sizeof *s);
+    --c->active;
+
+    if (c->broken && !c->active)
+        _srv_fcgi_close(c);
+
+    pthread_cond_signal(&f->free);
+}
+
+/**
+ * a connection is no good any more. everyone on it hears about it, and
+ * it's closed once they've all let go. the pool's lock is held.
+ */
+void _srv_fcgi_break(fcgi_t * f, fcgi_conn_t * c, unsigned int late)
+{
+    unsigned int i;
+
+    if (!c->broken) {
+        c->broken = 1;
+        c->late = late;
+
+        /* whoever's stuck on it wakes up */
+        shutdown(c->fd, SHUT_RDWR);
+    }
+
+    /* nobody's waiting on the ones given up on */
+    for (i = 0; i < f->mux; i++) {
+        if (c->slots[i].busy && c->slots[i].gone)
+            _srv_fcgi_drop(f, c, &c->slots[i]);
+    }
+
+    pthread_cond_broadcast(&c->cv);
+}
+
+/**
+ * hand a record to the request it's for. output waits for there to be
+ * room for it, which holds up everyone on the connection, the backend
+ * included, until the request takes what it has. the pool's lock is
+ * held, and we're the one reading.
+ */
+void _srv_fcgi_dispatch(fcgi_t * f, fcgi_conn_t * c, struct _fcgi_header *h,
+                        buf_t * b, size_t len)
+{
+    unsigned int id = (h->id[0] << 8) | h->id[1];
+    fcgi_slot_t *s;
+
+    /* anything for the connection as a whole, or no request of ours */
+    if (!id || id > f->mux || !(s = &c->slots[id - 1])->busy) {
+        if (NULL != b)
+            buf_put(b);
+
+        return;
+    }
+
+    switch (h->type) {
+    case FCGI_STDOUT:
+        while (len && !s->gone && !c->broken && s->held
+               && s->held + len > SRV_FCGI_HELD)
+            pthread_cond_wait(&c->cv, &f->mt);
+
+        if (!len || s->gone || c->broken)
+            break;
+
+        b->next = NULL;
+
+        if (NULL != s->last)
+            s->last->next = b;
+        else
+            s->out = b;
+
+        s->last = b;
+        s->held += len;
+        b = NULL;
+        break;
+
+    case FCGI_STDERR:
+        /* the script's own complaints, for our log */
+        while (len && ('\n' == b->data[len - 1] || '\r' == b->data[len - 1]))
+            --len;
+
+        if (len)
+            ERRF(__FILE__, __LINE__, "fastcgi %s: %.*s\n", f->name,
+                 (int)len, b->data);
+        break;
+
+    case FCGI_END_REQUEST:
+        s->done = 1;
+        s->proto = (len >= 5) ? (unsigned char)b->data[4]
+            : FCGI_REQUEST_COMPLETE;
+
+        if (s->gone)
+            _srv_fcgi_drop(f, c, s);
+        break;
+    }
+
+    if (NULL != b)
+        buf_put(b);
+}
+
+/**
+ * what the backend has for us: whatever's come in already, or the next
+ * records off the connection, read by whoever gets there first for
+ * everyone on it
+ * @param out set to what came, in a chain, NULL if nothing did
+ * @param done set once there's nothing more to come
+ * @return 0 if the connection broke before the end
+ */
+int _srv_fcgi_next(struct _fcgi_io *io, buf_t ** out, unsigned int *done)
+{
+    fcgi_t *f = io->f;
+    fcgi_conn_t *c = io->c;
+    fcgi_slot_t *s = io->s;
+    struct _fcgi_header h;
+    unsigned int late;
+    size_t len = 0;
+    buf_t *b;
+    int ok;
+
+    pthread_mutex_lock(&f->mt);
+
+    while (NULL == s->out && !s->done && !c->broken) {
+        if (c->reading) {
+            pthread_cond_wait(&c->cv, &f->mt);
+            continue;
+        }
+
+        c->reading = 1;
+        pthread_mutex_unlock(&f->mt);
+
+        ok = _srv_fcgi_read(c, &h, &b, &len, &late);
+
+        pthread_mutex_lock(&f->mt);
+
+        if (ok)
+            _srv_fcgi_dispatch(f, c, &h, b, len);
+        else
+            _srv_fcgi_break(f, c, late);
+
+        /* someone else's turn, if it was for them */
+        c->reading = 0;
+        pthread_cond_broadcast(&c->cv);
+    }
+
+    *out = s->out;
+    *done = s->done;
+    s->out = s->last = NULL;
+    s->held = 0;
+
+    io->proto = s->proto;
+    io->late = c->late;
+    ok = (NULL != *out || s->done);
+
+    /* there's room again */
+    pthread_cond_broadcast(&c->cv);
+    pthread_mutex_unlock(&f->mt);
+
+    return ok;
+}
+
+/**
+ * connect to a backend, giving up after timeout ms. the socket blocks
+ * from then on, for up to timeout ms at a time
+ * @return the socket, or -1
+ */
+int _srv_fcgi_connect(fcgi_backend_t * back, unsigned int timeout)
+{
+    struct pollfd pfd;
+    struct timeval tv;
+    socklen_t len;
+    int fd, err = 0, y = 1;
+
+    if (-1 == (fd = socket(back->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK
+                           | SOCK_CLOEXEC, 0)))
+        return -1;
+
+    if (connect(fd, (struct sockaddr *)&back->addr, back->alen)) {
+        if (EINPROGRESS != errno)
+            goto fail;
+
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        len = sizeof err;
+
+        if (poll(&pfd, 1, timeout) <= 0
+            || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) || err)
+            goto fail;
+    }
+
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+
+    if (-1 == fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK)
+        || setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv)
+        || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv))
+        goto fail;
+
+    if (AF_INET == back->addr.ss_family)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &y, sizeof y);
+
+    return fd;
+
+  fail:
+    close(fd);
+    return -1;
+}
+
+/**
+ * a slot to send a request on: on an open connection nobody else is
+ * using, or a new connection if the backend can have one, or on a
+ * connection with room for another request, fewest in flight first.
+ * failing all that, wait for one to come free, if not too many others
+ * are already, and not for too long. the pool's lock is held.
+ * @return the connection, NULL if there's none to be had right now
+ */
+fcgi_conn_t *_srv_fcgi_pick(fcgi_t * f, fcgi_backend_t ** back,
+                            unsigned int *up)
+{
+    fcgi_conn_t *c, *idle = NULL, *fresh = NULL, *shared = NULL;
+    fcgi_backend_t *b, *ib = NULL, *fb = NULL, *sb = NULL;
+    unsigned long long now = _srv_fcgi_now();
+    unsigned int i, j;
+
+    *up = 0;
+
+    for (i = 0; i < f->count; i++) {
+        b = &f->backs[(f->next + i) % f->count];
+
+        /* one that wouldn't connect a moment ago won't now either */
+        if (b->down && now - b->down < SRV_FCGI_RETRY)
+            continue;
+
+        ++*up;
+
+        for (j = 0; j < f->conns; j++) {
+            c = &b->conns[j];
+
+            if (c->broken || c->opening || c->active >= f->mux)
+                continue;
+
+            if (-1 == c->fd) {
+                if (NULL == fresh) {
+                    fresh = c;
+                    fb = b;
+                }
+            } else if (!c->active) {
+                if (NULL == idle) {
+                    idle = c;
+                    ib = b;
+                }
+            } else if (NULL == shared || c->active < shared->active) {
+                shared = c;
+                sb = b;
+            }
+        }
+    }
+
+    ++f->next;
+
+    if (NULL != idle) {
+        *back = ib;
+        return idle;
+    } else if (NULL != fresh) {
+        *back = fb;
+        return fresh;
+    }
+
+    *back = sb;
+
+    return shared;
+}
+
+/**
+ * take a slot for a request, opening its connection if it has to be
+ * @return 0, or the error to answer the client with
+ */
+unsigned int _srv_fcgi_take(struct _fcgi_io *io)
+{
+    fcgi_t *f = io->f;
+    fcgi_backend_t *back;
+    fcgi_conn_t *c;
+    struct timespec ts;
+    unsigned int i, up;
+    int fd, waited = 0;
+
+    pthread_mutex_lock(&f->mt);
+
+    for (;;) {
+        if (NULL == (c = _srv_fcgi_pick(f, &back, &up))) {
+            if (!up) {
+                /* nowhere to send it */
+                pthread_mutex_unlock(&f->mt);
+                return RESP_HTTP_502;
+            }
+
+            if (f->waiting >= f->queue || waited) {
+                ++f->rejected;
+                pthread_mutex_unlock(&f->mt);
+                return RESP_HTTP_503;
+            }
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += f->timeout / 1000;
+            ts.tv_nsec += (f->timeout % 1000) * 1000000L;
+
+            if (ts.tv_nsec >= 1000000000L) {
+                ++ts.tv_sec;
+                ts.tv_nsec -= 1000000000L;
+            }
+
+            ++f->waiting;
+
+            while (NULL == (c = _srv_fcgi_pick(f, &back, &up)) && up
+                   && ETIMEDOUT != pthread_cond_timedwait(&f->free, &f->mt,
+                                                          &ts)) ;
+
+            --f->waiting;
+            waited = 1;
+
+            if (NULL == c)
+                continue;
+        }
+
+        for (i = 0; c->slots[i].busy; i++) ;
+
+        io->back = back;
+        io->c = c;
+        io->s = &c->slots[i];
+        io->id = i + 1;
+        io->s->busy = 1;
+        ++c->active;
+
+        if (-1 != c->fd) {
+            io->reused = 1;
+            break;
+        }
+
+        /* a new connection, opened without holding everyone up */
+        c->opening = 1;
+        pthread_mutex_unlock(&f->mt);
+
+        fd = _srv_fcgi_connect(back, f->timeout);
+
+        pthread_mutex_lock(&f->mt);
+        c->opening = 0;
+
+        if (-1 != fd) {
+            c->fd = fd;
+            back->down = 0;
+            io->reused = 0;
+            break;
+        }
+
+        if (!back->down)
+            ERRF(__FILE__, __LINE__, "fastcgi backend %s is down!\n",
+                 back->name);
+
+        back->down = _srv_fcgi_now();
+        ++back->failed;
+        memset(io->s, 0, sizeof *io->s);
+        --c->active;
+        waited = 0;
+
+        /* someone else may have been waiting on it */
+        pthread_cond_broadcast(&f->free);
+    }
+
+    pthread_mutex_unlock(&f->mt);
+
+    return 0;
+}
+
+/**
+ * let go of a request's slot. a request the backend isn't done with
+ * is given up on, and what comes for it thrown away until it is. if
+ * nobody's left on the connection that wants anything from it, it's
+ * no use keeping it, and it's broken off.
+ */
+void _srv_fcgi_give(struct _fcgi_io *io)
+{
+    fcgi_t *f = io->f;
+    fcgi_conn_t *c = io->c;
+    fcgi_slot_t *s = io->s;
+    unsigned int i, owned = 0;
+
+    pthread_mutex_lock(&f->mt);
+
+    if (s->done || c->broken) {
+        _srv_fcgi_drop(f, c, s);
+    } else {
+        s->gone = 1;
+
+        for (i = 0; i < f->mux; i++)
+            owned += (c->slots[i].busy && !c->slots[i].gone);
+
+        if (!owned)
+            _srv_fcgi_break(f, c, 0);
+        else
+            pthread_cond_broadcast(&c->cv);
+    }
+
+    pthread_mutex_unlock(&f->mt);
+}
+
+/**
+ * the client's body, as STDIN records, then the empty one that ends it
+ * @param body what of it came in with the request
+ * @param have how much that is
+ * @param clen how much there is in all
+ */
+int _srv_fcgi_stdin(struct _fcgi_io *io, const char *body, size_t have,
+                    unsigned long long clen, unsigned int expect)
+{
+    static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    struct _fcgi_header h, end;
+    struct iovec iov[4];
+    unsigned long long left = clen - have;
+    unsigned int late = 0;
+    buf_t *b = NULL;
+    ssize_t got;
+    int ok = 1, cnt;
+
+    _srv_fcgi_header(&end, FCGI_STDIN, io->id, 0);
+
+    if (have) {
+        _srv_fcgi_header(&h, FCGI_STDIN, io->id, have);
+        iov[0].iov_base = &h;
+        iov[0].iov_len = sizeof h;
+        iov[1].iov_base = (void *)body;
+        iov[1].iov_len = have;
+        iov[2].iov_base = (void *)fcgi_pad;
+        iov[2].iov_len = h.pad;
+        cnt = 3;
+    } else {
+        cnt = 0;
+    }
+
+    /* the rest comes from the client as we go, in records as big as we
+     * read it in */
+    if (left) {
+        if (expect && !_srv_fcgi_send(io, cont, sizeof cont - 1)) {
+            ok = 0;
+            goto out;
+        }
+
+        if (cnt && !(ok = _srv_fcgi_write(io->c, iov, cnt, &late)))
+            goto out;
+
+        if (NULL == (b = buf_get(SRV_FCGI_CHUNK))) {
+            ok = 0;
+            goto out;
+        }
+
+        io->streamed = 1;
+        cnt = 0;
+
+        while (left) {
+            /* the pool may hand us more room than a record can say */
+            got = _srv_fcgi_recv(io, b->data, (left < SRV_FCGI_CHUNK) ? left
+                                 : SRV_FCGI_CHUNK);
+
+            if (got <= 0) {
+                /* the client went away mid-body, so the backend's
+                 * answer would be to a request nobody made */
+                ok = 0;
+                goto out;
+            }
+
+            left -= got;
+            _srv_fcgi_header(&h, FCGI_STDIN, io->id, got);
+            iov[0].iov_base = &h;
+            iov[0].iov_len = sizeof h;
+            iov[1].iov_base = b->data;
+            iov[1].iov_len = got;
+            iov[2].iov_base = (void *)fcgi_pad;
+            iov[2].iov_len = h.pad;
+
+            /* the last one goes out with the end of it */
+            cnt = 3;
+
+            if (!left)
+                break;
+
+            if (!(ok = _srv_fcgi_write(io->c, iov, cnt, &late)))
+                goto out;
+        }
+    }
+
+    iov[cnt].iov_base = &end;
+    iov[cnt].iov_len = sizeof end;
+    ok = _srv_fcgi_write(io->c, iov, cnt + 1, &late);
+
+  out:
+    if (!ok && late)
+        io->late = 1;
+
+    if (NULL != b)
+        buf_put(b);
+
+    return ok;
+}
+
+/**
+ * turn what the script said in its header into what the client hears:
+ * a status line from its Status, or a 302 if it only gave a Location,
+ * then the rest of what it said, less anything hop-by-hop, which is
+ * ours. we hang up after, and that's where the body ends.
+ * @param data the header, with \n or \r\n after each line
+ * @param end where it ends, at its blank line
+ * @return 0 if it made no sense
+ */
+int _srv_fcgi_response(buf_t * out, const char *data, const char *end)
+{
+    const char *line, *next, *colon, *v, *status = NULL;
+    unsigned int loc = 0;
+    size_t n, slen = 0;
+    char date[40];
+    struct tm tm;
+    time_t now;
+    int pass, w;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (line = data; line < end; line = next + 1) {
+            next = memchr(line, '\n', end - line);
+            n = next - line - ('\r' == next[-1]);
+
+            if (NULL == (colon = memchr(line, ':', n)))
+                return 0;
+
+            for (v = colon + 1; ' ' == *v || '\t' == *v; v++) ;
+
+            if (_srv_fcgi_is(line, colon - line, "Status")) {
+                status = v;
+                slen = line + n - v;
+                continue;
+            }
+
+            loc |= _srv_fcgi_is(line, colon - line, "Location");
+
+            if (!pass
+                || _srv_fcgi_is(line, colon - line, "Connection")
+                || _srv_fcgi_is(line, colon - line, "Keep-Alive")
+                || _srv_fcgi_is(line, colon - line, "Transfer-Encoding")
+                || _srv_fcgi_is(line, colon - line, "Trailer")
+                || _srv_fcgi_is(line, colon - line, "Upgrade"))
+                continue;
+
+            if (out->len + n + 3 > out->size)
+                return 0;
+
+            memcpy(out->data + out->len, line, n);
+            memcpy(out->data + out->len + n, "\r\n", 2);
+            out->len += n + 2;
+        }
+
+        if (pass)
+            break;
+
+        /* "NNN reason", or just "NNN" */
+        if (NULL != status && (slen < 3 || !isdigit((unsigned char)status[0])
+                               || !isdigit((unsigned char)status[1])
+                               || !isdigit((unsigned char)status[2])))
+            return 0;
+
+        time(&now);
+        gmtime_r(&now, &tm);
+        strftime(date, sizeof date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+        if (NULL != status)
+            w = snprintf(out->data, out->size, "HTTP/1.1 %.*s%s\r\n",
+                         (int)slen, status, (3 == slen) ? " " : "");
+        else
+            w = snprintf(out->data, out->size, "HTTP/1.1 %s\r\n",
+                         (loc) ? "302 Found" : "200 OK");
+
+        w += snprintf(out->data + w, out->size - w, "Date: %s\r\n"
+                      "Server: srv/" _SRV_VERSION "\r\n", date);
+        out->len = w;
+    }
+
+    if (out->len + 22 > out->size)
+        return 0;
+
+    memcpy(out->data + out->len, "Connection: close\r\n\r\n", 22);
+    out->len += 21;
+
+    return 1;
+}
+
+/**
+ * some of the script's output: its header, until it's all here and the
+ * client has been sent what we make of it, then the body as it comes
+ */
+int _srv_fcgi_out(struct _fcgi_io *io, buf_t * rh, buf_t * hb,
+                  const char *data, size_t len)
+{
+    char *end, *crlf;
+    size_t n, skip, from;
+
+    io->heard = 1;
+
+    if (io->answered)
+        return (io->head || _srv_fcgi_send(io, data, len));
+
+    /* the blank line could be split across records, so look from just
+     * before what's new */
+    from = (rh->len > 2) ? rh->len - 2 : 0;
+    n = (len < rh->size - rh->len) ? len : rh->size - rh->len;
+
+    memcpy(rh->data + rh->len, data, n);
+    rh->len += n;
+
+    end = memmem(rh->data + from, rh->len - from, "\n\n", 2);
+    crlf = memmem(rh->data + from, rh->len - from, "\n\r\n", 3);
+
+    if (NULL != crlf && (NULL == end || crlf < end)) {
+        end = crlf + 1;
+        skip = 2;
+    } else if (NULL != end) {
+        end = end + 1;
+        skip = 1;
+    } else {
+        /* not yet, and it doesn't get to be any longer than this */
+        return (n == len);
+    }
+
+    if (!_srv_fcgi_response(hb, rh->data, end))
+        return 0;
+
+    io->answered = 1;
+
+    if (!_srv_fcgi_send(io, hb->data, hb->len))
+        return 0;
+
+    if (io->head)
+        return 1;
+
+    /* whatever came after it is the start of the body */
+    end += skip;
+
+    return (_srv_fcgi_send(io, end, rh->len - (end - rh->data))
+            && _srv_fcgi_send(io, data + n, len - n));
+}
+
+/**
+ * one request and its response, over a connection we have a slot on
+ * @param params what the request goes with
+ * @param body what of the client's body came in with it, and how much
+ * @param clen the length of all of it
+ */
+int _srv_fcgi_exchange(struct _fcgi_io *io, buf_t * params, const char *body,
+                       size_t have, unsigned long long clen,
+                       unsigned int expect)
+{
+    unsigned char begin[8] = { 0, FCGI_RESPONDER, FCGI_KEEP_CONN };
+    struct _fcgi_header h[3];
+    struct iovec iov[6];
+    unsigned int done = 0, late = 0;
+    buf_t *rh = NULL, *hb = NULL, *chain, *b;
+    int ok;
+
+    /* who it is, and what it's after, in one go */
+    _srv_fcgi_header(&h[0], FCGI_BEGIN_REQUEST, io->id, sizeof begin);
+    _srv_fcgi_header(&h[1], FCGI_PARAMS, io->id, params->len);
+    _srv_fcgi_header(&h[2], FCGI_PARAMS, io->id, 0);
+    iov[0].iov_base = &h[0];
+    iov[0].iov_len = sizeof h[0];
+    iov[1].iov_base = begin;
+    iov[1].iov_len = sizeof begin;
+    iov[2].iov_base = &h[1];
+    iov[2].iov_len = sizeof h[1];
+    iov[3].iov_base = params->data;
+    iov[3].iov_len = params->len;
+    iov[4].iov_base = (void *)fcgi_pad;
+    iov[4].iov_len = h[1].pad;
+    iov[5].iov_base = &h[2];
+    iov[5].iov_len = sizeof h[2];
+
+    if (!_srv_fcgi_write(io->c, iov, 6, &late)) {
+        io->late = late;
+        goto fail;
+    }
+
+    if (!_srv_fcgi_stdin(io, body, have, clen, expect))
+        goto fail;
+
+    if (NULL == (rh = buf_get(SRV_FCGI_HEAD_MAX))
+        || NULL == (hb = buf_get(SRV_FCGI_HEAD_MAX + 256)))
+        goto fail;
+
+    rh->len = hb->len = 0;
+    ok = 1;
+
+    while (!done) {
+        if (!_srv_fcgi_next(io, &chain, &done)) {
+            ok = 0;
+            break;
+        }
+
+        for (; NULL != chain; chain = b) {
+            b = chain->next;
+            ok = ok && _srv_fcgi_out(io, rh, hb, chain->data, chain->len);
+            buf_put(chain);
+        }
+
+        if (!ok)
+            break;
+    }
+
+    buf_put(rh);
+    buf_put(hb);
+
+    /* a script that says nothing, or never finishes its header, or a
+     * backend that won't take it after all */
+    return (ok && io->answered && FCGI_REQUEST_COMPLETE == io->proto);
+
+  fail:
+    if (NULL != rh)
+        buf_put(rh);
+
+    /* the connection's half way through a record, or the client is
+     * gone mid-body: either way it's no good to anyone */
+    pthread_mutex_lock(&io->f->mt);
+    _srv_fcgi_break(io->f, io->c, io->late);
+    pthread_mutex_unlock(&io->f->mt);
+
+    return 0;
+}
+
+/**
+ * where a backend is, from its "host:port" or "unix:/path"
+ */
+int _srv_fcgi_resolve(fcgi_backend_t * back)
+{
+    struct sockaddr_un *un = (struct sockaddr_un *)&back->addr;
+    struct addrinfo hints, *res;
+    char host[256], *port;
+    int err;
+
+    memset(&back->addr, 0, sizeof back->addr);
+
+    if (!strncmp(back->name, "unix:", 5)) {
+        if (strlen(back->name + 5) >= sizeof un->sun_path) {
+            ERRF(__FILE__, __LINE__, "backend %s: path too long!\n",
+                 back->name);
+            return 0;
+        }
+
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, back->name + 5);
+        back->alen = sizeof *un;
+
+        return 1;
+    }
+
+    snprintf(host, sizeof host, "%s", back->name);
+
+    if (NULL != (port = strrchr(host, ':')))
+        *port++ = '\0';
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if ((err = getaddrinfo(host, (NULL != port) ? port : "9000", &hints,
+                           &res))) {
+        ERRF(__FILE__, __LINE__, "backend %s: %s!\n", back->name,
+             gai_strerror(err));
+        return 0;
+    }
+
+    memcpy(&back->addr, res->ai_addr, res->ai_addrlen);
+    back->alen = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    return 1;
+}
+
+/**
+ * set a pool up
+ * @param f where it goes
+ * @param fc its config block, which has to stay around
+ */
+int srv_fcgi_init(fcgi_t * f, const struct _srvfcgi_conf_t *fc)
+{
+    struct _srvhndlr_conf_t *hnd;
+    fcgi_backend_t *back;
+    unsigned int i, j;
+
+#ifdef DEBUG
+    assert(NULL != f);
+    assert(NULL != fc);
+#endif
+
+    memset(f, 0, sizeof *f);
+
+    hnd = (struct _srvhndlr_conf_t *)vector_get_at((vector_t *) & fc->hnd, 0);
+    f->name = hnd->data;
+    f->count = fc->backends.count;
+    f->conns = (fc->conns) ? fc->conns : SRV_FCGI_CONNS;
+    f->mux = (fc->mux) ? fc->mux : SRV_FCGI_MUX;
+    f->queue = (fc->queue) ? fc->queue : SRV_FCGI_QUEUE;
+    f->timeout = (fc->timeout) ? fc->timeout : SRV_FCGI_TIMEOUT;
+    f->script = fc->script;
+    f->params = &fc->params;
+    f->spawn = fc->spawn;
+    f->procs = (fc->procs) ? fc->procs : SRV_FCGI_PROCS;
+
+    /* request ids are 16 bits, and 0 is the connection's own */
+    if (f->mux > 0xffff)
+        f->mux = 0xffff;
+
+    pthread_mutex_init(&f->mt, NULL);
+    pthread_cond_init(&f->free, NULL);
+
+    if (NULL == (f->backs = calloc(f->count, sizeof *f->backs))) {
+        ERRF(__FILE__, __LINE__, "allocating memory for backends!\n");
+        return 0;
+    }
+
+    for (i = 0; i < f->count; i++) {
+        back = &f->backs[i];
+        back->name = *(char **)vector_get_at((vector_t *) & fc->backends, i);
+        back->lfd = -1;
+
+        if (!_srv_fcgi_resolve(back))
+            return 0;
+
+        if (NULL == (back->conns = calloc(f->conns, sizeof *back->conns))) {
+            ERRF(__FILE__, __LINE__, "allocating memory for backends!\n");
+            return 0;
+        }
+
+        for (j = 0; j < f->conns; j++) {
+            back->conns[j].fd = -1;
+            pthread_mutex_init(&back->conns[j].wmt, NULL);
+            pthread_cond_init(&back->conns[j].cv, NULL);
+
+            if (NULL == (back->conns[j].slots = calloc(f->mux,
+                                                       sizeof(fcgi_slot_t))))
+            {
+                ERRF(__FILE__, __LINE__, "allocating memory for backends!\n");
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * listen where a backend is to be, for the processes we start for it
+ * to take connections from
+ */
+int _srv_fcgi_listen(fcgi_backend_t * back)
+{
+    struct sockaddr_un *un = (struct sockaddr_un *)&back->addr;
+    int fd, y = 1;
+
+    if (-1 == (fd = socket(back->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC,
+                           0)))
+        return -1;
+
+    /* one left over from last time would be in the way */
+    if (AF_UNIX == back->addr.ss_family)
+        unlink(un->sun_path);
+    else
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &y, sizeof y);
+
+    if (bind(fd, (struct sockaddr *)&back->addr, back->alen)
+        || listen(fd, 128)) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * start one of a backend's processes, with its socket where a FastCGI
+ * responder looks for it, on its stdin. it goes when we do.
+ */
+pid_t _srv_fcgi_start(fcgi_t * f, fcgi_backend_t * back)
+{
+    sigset_t all;
+    pid_t pid;
+
+    if (0 != (pid = fork()))
+        return pid;
+
+    sigemptyset(&all);
+    sigprocmask(SIG_SETMASK, &all, NULL);
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+    if (-1 == dup2(back->lfd, 0))
+        _exit(127);
+
+    close_range(3, ~0U, 0);
+    execl("/bin/sh", "sh", "-c", f->spawn, (char *)NULL);
+    _exit(127);
+}
+
+/**
+ * start a pool's processes, and start them again when they go
+ */
+void *_srv_fcgi_keeper(void *arg)
+{
+    fcgi_t *f = (fcgi_t *) arg;
+    fcgi_backend_t *back;
+    struct timespec ts;
+    unsigned int i, j;
+    int st;
+
+    ts.tv_sec = SRV_FCGI_RETRY / 1000;
+    ts.tv_nsec = (SRV_FCGI_RETRY % 1000) * 1000000L;
+
+    for (;;) {
+        for (i = 0; i < f->count; i++) {
+            back = &f->backs[i];
+
+            for (j = 0; j < f->procs; j++) {
+                if (back->pids[j] > 0) {
+                    if (waitpid(back->pids[j], &st, WNOHANG) != back->pids[j])
+                        continue;
+
+                    ERRF(__FILE__, __LINE__, "fastcgi backend %s: process "
+                         "%d went (status %d), starting another\n",
+                         back->name, back->pids[j], st);
+                }
+
+                if (-1 == (back->pids[j] = _srv_fcgi_start(f, back)))
+                    ERRF(__FILE__, __LINE__, "starting %s: %s!\n", f->spawn,
+                         strerror(errno));
+            }
+        }
+
+        nanosleep(&ts, NULL);
+    }
+
+    return NULL;
+}
+
+/**
+ * start the processes a pool is to run, listening for them where its
+ * backends are
+ */
+int srv_fcgi_spawn(fcgi_t * f)
+{
+    fcgi_backend_t *back;
+    pthread_t th;
+    unsigned int i;
+
+#ifdef DEBUG
+    assert(NULL != f);
+#endif
+
+    if (NULL == f->spawn)
+        return 1;
+
+    for (i = 0; i < f->count; i++) {
+        back = &f->backs[i];
+
+        if (-1 == (back->lfd = _srv_fcgi_listen(back))) {
+            ERRF(__FILE__, __LINE__, "listening on %s: %s!\n", back->name,
+                 strerror(errno));
+            return 0;
+        }
+
+        if (NULL == (back->pids = calloc(f->procs, sizeof *back->pids))) {
+            ERRF(__FILE__, __LINE__, "allocating memory for backends!\n");
+            return 0;
+        }
+    }
+
+    /* started from a thread that's there for as long as we are, which
+     * is who they go with */
+    if (pthread_create(&th, NULL, _srv_fcgi_keeper, f)) {
+        ERRF(__FILE__, __LINE__, "starting a backend keeper thread!\n");
+        return 0;
+    }
+
+    pthread_detach(th);
+
+    return 1;
+}
+
+/**
+ * answer a request through one of a pool's backends. a connection kept
+ * from before that turns out to have been closed under us is tried
+ * again on another, so long as the client hasn't sent or heard anything
+ * it'd miss.
+ * @param f the pool its route led to
+ * @param clnt the client, with its request parsed and still in its
+ * buffer
+ * @param progress told whenever the client gets somewhere, or NULL
+ * @return 1 if it went through, 0 if not, in which case the client has
+ * been told why if it can be
+ */
+int srv_fcgi_serve(fcgi_t * f, conn_t * clnt, void (*progress) (conn_t *))
+{
+    struct _fcgi_io io;
+    buf_t *params;
+    const char *wire;
+    char *data, *end;
+    unsigned long long clen;
+    unsigned int code, expect, tries;
+    size_t have, len;
+    int ok = 0;
+
+#ifdef DEBUG
+    assert(NULL != f);
+    assert(NULL != clnt);
+    assert(NULL != clnt->req.buf);
+    assert(NULL != clnt->site);
+#endif
+
+    memset(&io, 0, sizeof io);
+    io.clnt = clnt;
+    io.f = f;
+    io.progress = progress;
+    io.head = (HTTP_MTHD_HEAD == clnt->req.meth);
+
+    if (NULL == (params = buf_get(SRV_FCGI_PARAMS_MAX)))
+        return 0;
+
+    data = clnt->req.buf->data;
+
+    /* the whole header came in with the request, or it'd not have
+     * parsed. some of the body may have too. */
+    if (NULL == (end = strstr(data, "\r\n\r\n"))) {
+        code = RESP_HTTP_400;
+        goto out;
+    }
+
+    if (0 != (code = _srv_fcgi_params(&io, params, end + 2, &clen, &expect)))
+        goto out;
+
+    have = clnt->req.buf->len - (end + 4 - data);
+
+    if (have > clen)
+        have = clen;
+
+    for (tries = 0; tries <= f->count; tries++) {
+        if (0 != (code = _srv_fcgi_take(&io)))
+            goto out;
+
+        ok = _srv_fcgi_exchange(&io, params, end + 4, have, clen, expect);
+        _srv_fcgi_give(&io);
+
+        pthread_mutex_lock(&f->mt);
+
+        if (ok)
+            ++io.back->served;
+        else
+            ++io.back->failed;
+
+        pthread_mutex_unlock(&f->mt);
+
+        if (ok)
+            break;
+
+        code = (io.late) ? RESP_HTTP_504
+            : (FCGI_OVERLOADED == io.proto
+               || FCGI_CANT_MPX_CONN == io.proto) ? RESP_HTTP_503
+            : RESP_HTTP_502;
+
+        /* too late to try anywhere else */
+        if (!io.reused || io.streamed || io.heard || io.answered)
+            break;
+
+        io.late = 0;
+        io.proto = FCGI_REQUEST_COMPLETE;
+    }
+
+  out:
+    if (!ok && !io.answered) {
+        DEBUGF(__FILE__, __LINE__, "(sock:%d) fastcgi failed, %u\n",
+               clnt->sock, code);
+        wire = srv_resp_error_wire(code, &len);
+        _srv_fcgi_send(&io, wire, len);
+    }
+
+    buf_put(params);
+
+    return ok;
+}
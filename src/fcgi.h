@@ -0,0 +1,159 @@
+/* fcgi.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef SRV_FCGI_H
+#define SRV_FCGI_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <util/buf.h>
+#include <util/vector.h>
+
+#include <srv/conf.h>
+#include <srv/conn.h>
+
+/* paths answered by FastCGI responders, php-fpm, flup and the like,
+ * that stay up between requests. each backend gets a few connections,
+ * opened as they're needed and kept open after, and each connection
+ * takes as many requests at once as the pool's mux, one for anything
+ * that doesn't say it multiplexes. whoever's waiting on a connection
+ * reads its records for everyone on it, and hands each request's
+ * output over to it in buffers, only so much at a time, so a slow
+ * client holds up its backend rather than filling our memory. past
+ * that, requests wait for a free slot, only so many of them and only
+ * for so long, and get a 503 after. backends can also be started and
+ * kept running by us, on a socket we listen on for them.
+ */
+#define SRV_FCGI_CONNS         4
+#define SRV_FCGI_MUX           1
+#define SRV_FCGI_QUEUE        64
+#define SRV_FCGI_TIMEOUT   30000
+#define SRV_FCGI_RETRY      1000
+#define SRV_FCGI_PROCS         4
+#define SRV_FCGI_HEAD_MAX   (8 * 1024)
+#define SRV_FCGI_PARAMS_MAX (16 * 1024)
+#define SRV_FCGI_CHUNK      (32 * 1024)
+#define SRV_FCGI_HELD       (256 * 1024)
+
+/* one request on a connection, by its id less one */
+typedef struct _fcgi_slot_t {
+    /* someone has it, the backend's done with it, or its owner gave
+     * up on it and what comes for it is thrown away */
+    unsigned int busy;
+    unsigned int done;
+    unsigned int gone;
+    /* what END_REQUEST said */
+    unsigned int proto;
+
+    /* its output, not yet taken, and how much */
+    buf_t *out;
+    buf_t *last;
+    size_t held;
+} fcgi_slot_t;
+
+typedef struct _fcgi_conn_t {
+    /* -1 until someone needs it, and while it's being opened */
+    int fd;
+    unsigned int opening;
+
+    /* failed, or ran out of time, and closed once nobody's on it */
+    unsigned int broken;
+    unsigned int late;
+
+    /* someone's reading for everyone */
+    unsigned int reading;
+    /* slots in use */
+    unsigned int active;
+
+    /* records go out whole, one at a time */
+    pthread_mutex_t wmt;
+    /* a record came in, or there's room for one */
+    pthread_cond_t cv;
+
+    fcgi_slot_t *slots;
+} fcgi_conn_t;
+
+typedef struct _fcgi_backend_t {
+    /* "host:port" or "unix:/path", as configured, and where that is */
+    char *name;
+    struct sockaddr_storage addr;
+    socklen_t alen;
+
+    fcgi_conn_t *conns;
+
+    /* when it last wouldn't take a connection, in ms, 0 if it's up */
+    unsigned long long down;
+
+    /* the processes we started for it, and the socket they share */
+    pid_t *pids;
+    int lfd;
+
+    unsigned long long served;
+    unsigned long long failed;
+} fcgi_backend_t;
+
+typedef struct _fcgi_t {
+    /* where it's routed from, for the log */
+    const char *name;
+
+    fcgi_backend_t *backs;
+    unsigned int count;
+    /* where the next pick starts, so ties go round */
+    unsigned int next;
+
+    /* per backend, and per connection */
+    unsigned int conns;
+    unsigned int mux;
+    /* requests that may wait for a slot, and ms for anything */
+    unsigned int queue;
+    unsigned int timeout;
+
+    /* the script everything goes to, NULL for the file asked for,
+     * and what else each request is told, "NAME value" */
+    const char *script;
+    const vector_t *params;
+
+    /* what to start for each backend, and how many of it */
+    const char *spawn;
+    unsigned int procs;
+
+    /* everything above that changes, and requests waiting for a slot */
+    pthread_mutex_t mt;
+    pthread_cond_t free;
+    unsigned int waiting;
+
+    unsigned long long rejected;
+} fcgi_t;
+
+/* set a pool up from its config block, resolving its backends */
+int srv_fcgi_init(fcgi_t *, const struct _srvfcgi_conf_t *);
+/* start the backends it's to run, and keep them running */
+int srv_fcgi_spawn(fcgi_t *);
+/* answer a parsed request through a backend, start to finish. told
+ * each time the client gets somewhere, if not NULL */
+int srv_fcgi_serve(fcgi_t *, conn_t *, void (*)(conn_t *));
+
+#endif
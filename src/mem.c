@@ -0,0 +1,244 @@
+/* mem.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <util/util.h>
+#include <util/buf.h>
+#include <util/coro.h>
+
+#include <srv/path.h>
+#include <srv/mem.h>
+
+/* what we read from, opened at startup because a chroot would put them
+ * out of reach. -1 for anything we don't have.
+ */
+static int mem_cur_fd = -1;
+static int mem_max_fd = -1;
+static int mem_psi_fd = -1;
+static int mem_statm_fd = -1;
+
+/* a limit from the config, and whether stacks count */
+static unsigned long long mem_conf_limit;
+static int mem_stacks;
+static int mem_polled;
+
+static mem_t mem;
+
+/**
+ * read a small file from the start, 0 if there was nothing
+ */
+ssize_t _srv_mem_read(int fd, char *buf, size_t size)
+{
+    ssize_t got;
+
+    if (-1 == fd || 0 >= (got = pread(fd, buf, size - 1, 0)))
+        return 0;
+
+    buf[got] = '\0';
+
+    return got;
+}
+
+/**
+ * open one of our cgroup's files
+ */
+int _srv_mem_cgroup(const char *dir, const char *name)
+{
+    char file[SRV_PATH_MAX + 32];
+
+    snprintf(file, sizeof file, "/sys/fs/cgroup%s/%s", dir, name);
+
+    return open(file, O_RDONLY | O_CLOEXEC);
+}
+
+/**
+ * find out where to look. with cgroup v2 that's our cgroup's usage,
+ * limit and pressure. without it, it's what we have resident, and how
+ * the whole box is doing.
+ * @param limit a limit of our own, 0 to go by the cgroup
+ * @param stacks whether coroutine stacks are pooled
+ * @return 1 if there's anything to go on
+ */
+int srv_mem_init(unsigned long long limit, int stacks)
+{
+    char line[SRV_PATH_MAX], *dir = NULL;
+    FILE *fp;
+
+    mem_conf_limit = limit;
+    mem_stacks = stacks;
+    mem.ceiling = buf_pool_max() + ((stacks) ? coro_pool_max() : 0);
+    mem.budget = mem.ceiling;
+
+    /* the unified hierarchy is the one numbered 0 */
+    if (NULL != (fp = fopen("/proc/self/cgroup", "r"))) {
+        while (fgets(line, sizeof line, fp)) {
+            if (!strncmp(line, "0::", 3)) {
+                line[strcspn(line, "\n")] = '\0';
+                dir = line + 3;
+                break;
+            }
+        }
+
+        fclose(fp);
+    }
+
+    if (NULL != dir) {
+        mem_cur_fd = _srv_mem_cgroup(dir, "memory.current");
+        mem_max_fd = _srv_mem_cgroup(dir, "memory.max");
+        mem_psi_fd = _srv_mem_cgroup(dir, "memory.pressure");
+    }
+
+    if (-1 == mem_cur_fd)
+        mem_statm_fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+
+    if (-1 == mem_psi_fd)
+        mem_psi_fd = open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+
+    return (mem_conf_limit || -1 != mem_max_fd || -1 != mem_psi_fd);
+}
+
+/**
+ * look at other files than the ones srv_mem_init found, which is how
+ * the checks drive the governor
+ * @param current what's in use, as in memory.current
+ * @param max the limit, as in memory.max
+ * @param pressure the stall info, as in memory.pressure
+ * @return 1 if everything given could be opened
+ */
+int srv_mem_files(const char *current, const char *max, const char *pressure)
+{
+    int *fds[] = { &mem_cur_fd, &mem_max_fd, &mem_psi_fd, &mem_statm_fd };
+    const char *files[] = { current, max, pressure, NULL };
+    unsigned int i;
+    int ok = 1;
+
+    for (i = 0; i < sizeof fds / sizeof *fds; i++) {
+        if (-1 != *fds[i])
+            close(*fds[i]);
+
+        *fds[i] = -1;
+
+        if (NULL != files[i]
+            && -1 == (*fds[i] = open(files[i], O_RDONLY | O_CLOEXEC)))
+            ok = 0;
+    }
+
+    return ok;
+}
+
+/**
+ * hand the budget out to the pools, stacks and buffers in the same
+ * proportion as the most they'd hold
+ */
+void _srv_mem_apply(void)
+{
+    size_t stacks = 0;
+
+    if (mem_stacks) {
+        stacks = (size_t)((unsigned long long)mem.budget
+                          * coro_pool_max() / mem.ceiling);
+        coro_pool_limit(stacks);
+    }
+
+    buf_pool_limit(mem.budget - stacks);
+
+    mem.held = buf_pool_held() + ((mem_stacks) ? coro_pool_held() : 0);
+}
+
+/**
+ * look again, and move the budget
+ */
+size_t srv_mem_poll(void)
+{
+    unsigned long long whole, frac, spare;
+    size_t target;
+    char buf[256], *s;
+
+    mem.limit = mem_conf_limit;
+
+    /* "max" reads as no limit */
+    if (!mem.limit && _srv_mem_read(mem_max_fd, buf, sizeof buf))
+        mem.limit = strtoull(buf, NULL, 10);
+
+    mem.used = 0;
+
+    if (_srv_mem_read(mem_cur_fd, buf, sizeof buf))
+        mem.used = strtoull(buf, NULL, 10);
+    else if (_srv_mem_read(mem_statm_fd, buf, sizeof buf)
+             && NULL != (s = strchr(buf, ' ')))
+        mem.used = strtoull(s, NULL, 10) * sysconf(_SC_PAGESIZE);
+
+    mem.stall = 0;
+
+    if (_srv_mem_read(mem_psi_fd, buf, sizeof buf)
+        && 2 == sscanf(buf, "some avg10=%llu.%llu", &whole, &frac))
+        mem.stall = whole * 100 + frac;
+
+    mem.held = buf_pool_held() + ((mem_stacks) ? coro_pool_held() : 0);
+
+    /* what the pools are holding could be given back, so it counts as
+     * free when working out their share */
+    target = mem.ceiling;
+
+    if (mem.limit) {
+        spare = ((mem.used < mem.limit) ? mem.limit - mem.used : 0)
+            + mem.held;
+
+        if (spare / SRV_MEM_SHARE < target)
+            target = spare / SRV_MEM_SHARE;
+    }
+
+    if (mem.stall >= SRV_MEM_STALL
+        || (mem.limit && mem.used > mem.limit
+            - mem.limit / 100 * SRV_MEM_FREE_PCT)) {
+        /* tight, let go of half at once */
+        mem.budget /= 2;
+    } else if (!mem_polled) {
+        mem.budget = target;
+    } else if (mem.budget < target) {
+        mem.budget = (target - mem.budget > SRV_MEM_GROW) ?
+            mem.budget + SRV_MEM_GROW : target;
+    }
+
+    if (mem.budget > target)
+        mem.budget = target;
+
+    mem_polled = 1;
+    _srv_mem_apply();
+
+    return mem.budget;
+}
+
+/**
+ * what the governor knows, as of the last look
+ */
+const mem_t *srv_mem_state(void)
+{
+    return &mem;
+}
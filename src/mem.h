@@ -0,0 +1,72 @@
+/* mem.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef SRV_MEM_H
+#define SRV_MEM_H
+
+#include <stddef.h>
+
+/* the memory governor. every so often it looks at how close we are to
+ * our limit, and how long things have been stalled waiting on memory,
+ * and moves the budget for what our pools may keep idle: cut in half
+ * when memory is tight, grown back a little at a time when it isn't.
+ */
+#define SRV_MEM_POLL_MS   1000
+#define SRV_MEM_GROW      (16 * 1024 * 1024)
+
+/* tight means stalled this long of the last ten seconds, in
+ * hundredths of a percent, or less than this share of the limit free */
+#define SRV_MEM_STALL     1000
+#define SRV_MEM_FREE_PCT    10
+
+/* at most this share of whatever else is free goes to the pools */
+#define SRV_MEM_SHARE        4
+
+typedef struct _mem_t {
+    /* the limit, 0 if there isn't one, and what's in use */
+    unsigned long long limit;
+    unsigned long long used;
+    /* of the last ten seconds, how long was spent stalled on memory,
+     * in hundredths of a percent */
+    unsigned int stall;
+
+    /* what the pools may keep, the most they ever would, and what
+     * they're holding */
+    size_t budget;
+    size_t ceiling;
+    size_t held;
+} mem_t;
+
+/* find out where to look, while we still can. takes a limit of our own,
+ * 0 to go by the cgroup, and whether coroutine stacks are pooled */
+int srv_mem_init(unsigned long long, int);
+/* look at these instead of our cgroup's usage, limit and pressure,
+ * NULL for any we shouldn't have */
+int srv_mem_files(const char *, const char *, const char *);
+/* look again and move the budget, returns it */
+size_t srv_mem_poll(void);
+/* what the governor knows */
+const mem_t *srv_mem_state(void);
+
+#endif
@@ -0,0 +1,231 @@
+/* pack.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <util/hash.h>
+#include <util/util.h>
+
+#include <srv/pack.h>
+
+/* spreads a displaced hash over the slots */
+#define PACK_MIX0  0x9e3779b97f4a7c15ULL
+#define PACK_MIX1  0xbf58476d1ce4e5b9ULL
+
+/**
+ * where a hash lands in the slots, once its bucket's displacement is
+ * folded in. the builder tries displacements until every key in a
+ * bucket lands somewhere free, so lookups never probe.
+ * @param hash the key's hash, seeded with the pack's seed
+ * @param disp the displacement stored for its bucket
+ * @param slots how many slots there are
+ */
+unsigned int srv_pack_slot(unsigned long long hash, unsigned int disp,
+                           unsigned int slots)
+{
+    unsigned long long x = hash ^ ((unsigned long long)disp * PACK_MIX0);
+
+    x ^= x >> 31;
+    x *= PACK_MIX1;
+    x ^= x >> 29;
+
+    return (unsigned int)(x % slots);
+}
+
+/**
+ * is a range of the pack inside the file?
+ */
+int _srv_pack_within(const pack_t * pk, unsigned long long off,
+                     unsigned long long len)
+{
+    return (off <= pk->size && len <= pk->size - off);
+}
+
+/**
+ * does every entry point inside the pack? checked once, so requests
+ * don't have to.
+ */
+int _srv_pack_check(const pack_t * pk)
+{
+    const struct _pack_var *v;
+    const pack_ent_t *e;
+    unsigned int i, j;
+
+    for (i = 0; i < pk->hdr->slots; ++i) {
+        e = &pk->ents[i];
+
+        if (!e->pathlen)
+            continue;
+
+        if (!_srv_pack_within(pk, e->path, e->pathlen))
+            return 0;
+
+        for (j = 0; j < PACK_VAR_CNT; ++j) {
+            v = &e->var[j];
+
+            if (v->headlen > PACK_HEAD_MAX
+                || !_srv_pack_within(pk, v->head, v->headlen)
+                || !_srv_pack_within(pk, v->body, v->len))
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * map a pack and make sure it's one of ours, and whole. the checks are
+ * the only time anything of it is read before a request needs it.
+ * @param pk the pack to fill in
+ * @param file where it is
+ */
+int srv_pack_open(pack_t * pk, const char *file)
+{
+    const pack_hdr_t *h;
+    struct stat st;
+
+#ifdef DEBUG
+    assert(NULL != pk);
+    assert(NULL != file);
+#endif
+
+    memset(pk, 0, sizeof *pk);
+
+    if (-1 == (pk->fd = open(file, O_RDONLY | O_CLOEXEC))) {
+        ERRF(__FILE__, __LINE__, "opening pack %s: %s!\n", file,
+             strerror(errno));
+        return 0;
+    }
+
+    if (fstat(pk->fd, &st) || (size_t) st.st_size < sizeof *h) {
+        ERRF(__FILE__, __LINE__, "%s is too short to be a pack!\n", file);
+        goto fail;
+    }
+
+    pk->size = st.st_size;
+    pk->map = mmap(NULL, pk->size, PROT_READ, MAP_SHARED, pk->fd, 0);
+
+    if (MAP_FAILED == pk->map) {
+        ERRF(__FILE__, __LINE__, "mapping pack %s: %s!\n", file,
+             strerror(errno));
+        pk->map = NULL;
+        goto fail;
+    }
+
+    h = pk->hdr = (const pack_hdr_t *)pk->map;
+
+    if (memcmp(h->magic, PACK_MAGIC, sizeof h->magic) || 1 != h->order) {
+        ERRF(__FILE__, __LINE__, "%s isn't a pack we can read!\n", file);
+        goto fail;
+    }
+
+    if (h->size != pk->size || !h->slots || !h->buckets
+        || h->disp % sizeof *pk->disp || h->ents % 8
+        || !_srv_pack_within(pk, h->disp,
+                             (unsigned long long)h->buckets * sizeof *pk->disp)
+        || !_srv_pack_within(pk, h->ents,
+                             (unsigned long long)h->slots * sizeof *pk->ents)) {
+        ERRF(__FILE__, __LINE__, "pack %s is damaged!\n", file);
+        goto fail;
+    }
+
+    pk->disp = (const unsigned int *)(pk->map + h->disp);
+    pk->ents = (const pack_ent_t *)(pk->map + h->ents);
+
+    if (!_srv_pack_check(pk)) {
+        ERRF(__FILE__, __LINE__, "pack %s is damaged!\n", file);
+        goto fail;
+    }
+
+    /* the index gets hit on every request, the bodies as they're asked
+     * for */
+    madvise(pk->map + h->disp, pk->size - h->disp, MADV_WILLNEED);
+
+    DEBUGF(__FILE__, __LINE__, "mapped pack %s, %u paths in %lu bytes\n",
+           file, h->count, (unsigned long)pk->size);
+
+    return 1;
+
+  fail:
+    srv_pack_close(pk);
+    return 0;
+}
+
+/**
+ * unmap a pack
+ */
+void srv_pack_close(pack_t * pk)
+{
+#ifdef DEBUG
+    assert(NULL != pk);
+#endif
+
+    if (NULL != pk->map)
+        munmap(pk->map, pk->size);
+
+    if (-1 != pk->fd)
+        close(pk->fd);
+
+    memset(pk, 0, sizeof *pk);
+    pk->fd = -1;
+}
+
+/**
+ * find a path in a pack. one hash, one slot, one compare.
+ * @param pk the pack
+ * @param path the path, from the slash after the docroot
+ * @param len its length
+ */
+const pack_ent_t *srv_pack_find(const pack_t * pk, const char *path,
+                                size_t len)
+{
+    const pack_hdr_t *h = pk->hdr;
+    const pack_ent_t *e;
+    unsigned long long hash;
+
+#ifdef DEBUG
+    assert(NULL != pk);
+    assert(NULL != path);
+#endif
+
+    hash = hash_bytes_seed(path, len, h->seed);
+    e = &pk->ents[srv_pack_slot(hash, pk->disp[(hash >> 32) % h->buckets],
+                                h->slots)];
+
+    if (e->hash != hash || e->pathlen != len
+        || memcmp(pk->map + e->path, path, len))
+        return NULL;
+
+    return e;
+}
@@ -0,0 +1,112 @@
+/* pack.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef SRV_PACK_H
+#define SRV_PACK_H
+
+#include <stddef.h>
+
+/* a whole docroot compiled into one file, built by srvpack and mapped
+ * by the server at startup. every path is found through a perfect hash,
+ * and its response header was written out when the pack was built, so
+ * serving from it never touches the filesystem.
+ *
+ * the layout, all offsets from the start of the file:
+ *
+ *   pack_hdr_t
+ *   bodies, each starting on a page
+ *   paths and headers
+ *   the displacement for each bucket of the hash
+ *   pack_ent_t for each slot of the hash, unused ones zeroed
+ */
+
+#define PACK_MAGIC      "srvpack1"
+#define PACK_ALIGN      4096
+
+/* which body to send */
+#define PACK_VAR_PLAIN  0
+#define PACK_VAR_GZIP   1
+#define PACK_VAR_CNT    2
+
+/* the most a prewritten header may be: what's left of a resp_t's
+ * header after the status line and date */
+#define PACK_HEAD_MAX   176
+
+typedef struct _pack_hdr_t {
+    char magic[8];
+    /* 1, as written on the machine that built it */
+    unsigned int order;
+    unsigned int count;
+
+    /* the perfect hash: where a key's bucket sends it, and how many
+     * slots there are for it to land in */
+    unsigned long long seed;
+    unsigned int buckets;
+    unsigned int slots;
+    unsigned long long disp;
+    unsigned long long ents;
+
+    /* the whole file, so a short one is caught */
+    unsigned long long size;
+} pack_hdr_t;
+
+/* one way of sending a path */
+struct _pack_var {
+    unsigned long long head;
+    unsigned long long body;
+    unsigned long long len;
+    unsigned int headlen;
+    unsigned int pad;
+};
+
+typedef struct _pack_ent_t {
+    unsigned long long hash;
+    unsigned long long path;
+    unsigned int pathlen;
+    unsigned int type;
+
+    /* the plain body, and a gzipped one if the docroot had it */
+    struct _pack_var var[PACK_VAR_CNT];
+} pack_ent_t;
+
+typedef struct _pack_t {
+    int fd;
+    char *map;
+    size_t size;
+
+    const pack_hdr_t *hdr;
+    const unsigned int *disp;
+    const pack_ent_t *ents;
+} pack_t;
+
+/* map a pack and check it over */
+int srv_pack_open(pack_t *, const char *);
+/* unmap it again */
+void srv_pack_close(pack_t *);
+/* the entry for a path, NULL if the pack doesn't have it */
+const pack_ent_t *srv_pack_find(const pack_t *, const char *, size_t);
+/* where a hash lands, given its bucket's displacement */
+unsigned int srv_pack_slot(unsigned long long, unsigned int, unsigned int);
+
+#endif
@@ -0,0 +1,658 @@
+/* path.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#define HAVE_INOTIFY 1
+#endif
+
+#include <util/util.h>
+#include <util/hash.h>
+
+#include <srv/path.h>
+
+/* what a target resolved to, the last time this thread saw it */
+struct _path_ent {
+    unsigned int hash;
+    time_t when;
+    unsigned int gen;
+    const path_root_t *root;
+
+    char target[SRV_PATH_CACHE_KEY];
+    char rel[SRV_PATH_CACHE_KEY];
+
+    int err;
+    struct stat st;
+    int has_index;
+    struct stat ind;
+};
+
+static pthread_once_t path_once = PTHREAD_ONCE_INIT;
+static pthread_key_t path_key;
+
+/* every docroot's share of a thread's cache, added up */
+static unsigned int path_slots;
+
+/* paths we know aren't there, shared by every thread. a slot holds a
+ * path's hash, and the generation and time it was found missing in
+ * the one word beside it.
+ */
+struct _path_neg {
+    unsigned long long key;
+    unsigned long long meta;
+};
+
+static struct _path_neg path_neg[SRV_PATH_NEG];
+
+/* bumped whenever something appears under the docroot, which makes
+ * every negative answer, shared or per thread, stale at once */
+static unsigned int path_gen;
+
+/* inotify, how many directories it's watching, and which is which */
+static int path_ifd = -1;
+static unsigned int path_watches;
+static char **path_dirs;
+static unsigned int path_dir_slots;
+
+/* the docroots being watched, so one whose tree can't all be watched
+ * goes back to believing its misses for SRV_PATH_NEG_TTL */
+static path_root_t **path_roots;
+static unsigned int path_nroots;
+
+void _srv_path_init(void)
+{
+    pthread_key_create(&path_key, free);
+}
+
+/**
+ * how far into s, at most len, until a slash or a percent. sixteen
+ * bytes at a time while there are that many left.
+ */
+size_t _srv_path_span(const char *s, size_t len)
+{
+    size_t n = 0;
+
+#ifdef __SSE2__
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i pct = _mm_set1_epi8('%');
+    __m128i v;
+    int m;
+
+    for (; n + 16 <= len; n += 16) {
+        v = _mm_loadu_si128((const __m128i *)(s + n));
+        m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, slash),
+                                           _mm_cmpeq_epi8(v, pct)));
+        if (m)
+            return n + __builtin_ctz(m);
+    }
+#endif
+
+    while (n < len && '/' != s[n] && '%' != s[n])
+        ++n;
+
+    return n;
+}
+
+/**
+ * the value of a hex digit, -1 if it isn't one
+ */
+int _srv_path_hex(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return -1;
+}
+
+/**
+ * clean up a request target, in one pass: escapes are decoded, empty
+ * segments dropped, and dot segments collapsed once decoded, so %2e%2e
+ * is .. too. nothing climbs above the docroot.
+ * @param p where the result goes
+ * @param root the docroot
+ * @param target the path the client asked for, query already gone
+ */
+int srv_path_canon(path_t * p, const char *root, const char *target)
+{
+    const char *c, *end;
+    char *out = p->full;
+    size_t o, seg, base, n;
+    int hi, lo;
+
+#ifdef DEBUG
+    assert(NULL != p);
+    assert(NULL != root);
+    assert(NULL != target);
+#endif
+
+    if ('/' != *target)
+        return 0;
+
+    /* the docroot, without its trailing slashes */
+    for (base = strlen(root); base && '/' == root[base - 1]; --base) ;
+
+    if (base + 2 > sizeof p->full)
+        return 0;
+
+    memcpy(out, root, base);
+    p->rel = base;
+    out[base++] = '/';
+
+    o = seg = base;
+    c = target + 1;
+    end = c + strlen(c);
+
+    for (;;) {
+        n = _srv_path_span(c, end - c);
+
+        if (o + n >= sizeof p->full)
+            return 0;
+
+        memcpy(out + o, c, n);
+        o += n;
+        c += n;
+
+        if ('%' == *c) {
+            if (end - c < 3 || -1 == (hi = _srv_path_hex(c[1]))
+                || -1 == (lo = _srv_path_hex(c[2])))
+                return 0;
+
+            /* an escaped NUL or slash is never a real path */
+            if (!(hi | lo) || '/' == (hi << 4 | lo))
+                return 0;
+
+            if (o + 1 >= sizeof p->full)
+                return 0;
+
+            out[o++] = hi << 4 | lo;
+            c += 3;
+            continue;
+        }
+
+        /* the end of a segment, see if it was a dot one */
+        if (1 == o - seg && '.' == out[seg]) {
+            o = seg;
+        } else if (2 == o - seg && '.' == out[seg] && '.' == out[seg + 1]) {
+            o = seg;
+
+            if (o > base)
+                for (--o; o > base && '/' != out[o - 1]; --o) ;
+        }
+
+        if ('\0' == *c)
+            break;
+
+        /* the slash, unless that would make an empty segment */
+        ++c;
+
+        if ('/' != out[o - 1]) {
+            if (o + 1 >= sizeof p->full)
+                return 0;
+
+            out[o++] = '/';
+        }
+
+        seg = o;
+    }
+
+    out[o] = '\0';
+    p->len = o;
+
+    return 1;
+}
+
+/**
+ * the path to a directory's index, joined with just the one slash
+ */
+int _srv_path_index(path_t * p, const char *index)
+{
+    size_t n = p->len;
+
+    if ('/' == p->full[n - 1] && '/' == *index)
+        --n;
+
+    if (n + strlen(index) >= sizeof p->index)
+        return 0;
+
+    memcpy(p->index, p->full, n);
+    strcpy(p->index + n, index);
+
+    return 1;
+}
+
+/**
+ * is a path one we know isn't there, and has been for less than ttl?
+ */
+int _srv_path_neg_get(unsigned long long key, time_t ttl, time_t now)
+{
+    struct _path_neg *n = &path_neg[key & (SRV_PATH_NEG - 1)];
+    unsigned long long meta;
+
+    if (key != __atomic_load_n(&n->key, __ATOMIC_RELAXED))
+        return 0;
+
+    meta = __atomic_load_n(&n->meta, __ATOMIC_RELAXED);
+
+    return ((meta >> 32) == __atomic_load_n(&path_gen, __ATOMIC_RELAXED)
+            && now - (time_t)(meta & 0xffffffffULL) < ttl);
+}
+
+/**
+ * remember that a path isn't there, as of gen, which was read before we
+ * looked. a reader that catches a slot half written can only pair one
+ * missing path with another's time.
+ */
+void _srv_path_neg_put(unsigned long long key, unsigned int gen, time_t now)
+{
+    struct _path_neg *n = &path_neg[key & (SRV_PATH_NEG - 1)];
+
+    __atomic_store_n(&n->key, key, __ATOMIC_RELAXED);
+    __atomic_store_n(&n->meta,
+                     (unsigned long long)gen << 32 | (now & 0xffffffffULL),
+                     __ATOMIC_RELAXED);
+}
+
+/**
+ * stat what a path points at, and its index if it's a directory
+ */
+void _srv_path_stat(path_t * p, const char *index)
+{
+    p->has_index = 0;
+    p->err = (stat(p->full, &p->st)) ? errno : 0;
+
+    if (p->err || !S_ISDIR(p->st.st_mode))
+        return;
+
+    p->has_index = _srv_path_index(p, index) && !stat(p->index, &p->ind);
+}
+
+/**
+ * set up a docroot, and carve its share out of each thread's cache
+ * @param r the root to set up
+ * @param dir the docroot
+ * @param index what to look for in a directory
+ * @param slots its share, 0 for the default
+ */
+int srv_path_root(path_root_t * r, const char *dir, const char *index,
+                  unsigned int slots)
+{
+    unsigned int n;
+
+#ifdef DEBUG
+    assert(NULL != r);
+    assert(NULL != dir);
+    assert(NULL != index);
+#endif
+
+    if (!slots)
+        slots = SRV_PATH_CACHE;
+
+    if (slots > SRV_PATH_CACHE_MAX)
+        slots = SRV_PATH_CACHE_MAX;
+
+    for (n = 1; n < slots; n <<= 1) ;
+
+    r->dir = dir;
+    r->index = index;
+    r->off = path_slots;
+    r->slots = n;
+    r->neg_ttl = SRV_PATH_NEG_TTL;
+    path_slots += n;
+
+    return 1;
+}
+
+/**
+ * the cache slot for a target under a root, NULL if it can't be cached
+ */
+struct _path_ent *_srv_path_ent(unsigned int *hash, const path_root_t * root,
+                                const char *target)
+{
+    struct _path_ent *cache;
+    size_t tlen;
+
+    pthread_once(&path_once, _srv_path_init);
+
+    if (!root->slots || root->off + root->slots > path_slots)
+        return NULL;
+
+    if (NULL == (cache = pthread_getspecific(path_key))) {
+        if (NULL == (cache = calloc(path_slots, sizeof *cache)))
+            return NULL;
+
+        if (pthread_setspecific(path_key, cache)) {
+            free(cache);
+            return NULL;
+        }
+    }
+
+    if ((tlen = strlen(target)) >= SRV_PATH_CACHE_KEY)
+        return NULL;
+
+    *hash = (unsigned int)hash_bytes(target, tlen);
+
+    return &cache[root->off + (*hash & (root->slots - 1))];
+}
+
+/**
+ * find the clean path for a request target. if this thread has seen
+ * it lately, what's there comes back too, and known is set.
+ * @param p where the result goes
+ * @param root the docroot and its index
+ * @param target the path the client asked for
+ * @param now the time, for the cache
+ */
+int srv_path_lookup(path_t * p, const path_root_t * root, const char *target,
+                    time_t now)
+{
+    struct _path_ent *e;
+    const char *dir;
+
+#ifdef DEBUG
+    assert(NULL != p);
+    assert(NULL != root);
+    assert(NULL != target);
+#endif
+
+    p->known = 0;
+    p->target = target;
+    dir = root->dir;
+
+    e = _srv_path_ent(&p->hash, root, target);
+
+    if (NULL != e && e->hash == p->hash && e->root == root
+        && now - e->when < SRV_PATH_CACHE_TTL
+        && e->gen == __atomic_load_n(&path_gen, __ATOMIC_RELAXED)
+        && !strcmp(e->target, target)) {
+        /* seen it, put it back together */
+        p->rel = strlen(dir);
+        while (p->rel && '/' == dir[p->rel - 1])
+            --p->rel;
+
+        memcpy(p->full, dir, p->rel);
+        strcpy(p->full + p->rel, e->rel);
+        p->len = p->rel + strlen(e->rel);
+
+        p->err = e->err;
+        p->st = e->st;
+        p->has_index = e->has_index;
+        p->ind = e->ind;
+
+        if (p->has_index)
+            _srv_path_index(p, root->index);
+
+        p->known = 1;
+        return 1;
+    }
+
+    return srv_path_canon(p, dir, target);
+}
+
+/**
+ * find out what's at a path, unless we already know: from the shared
+ * list of misses if it's on there, else from the filesystem.
+ * @param p a path from srv_path_lookup
+ * @param root the docroot it was looked up under
+ * @param now the time, for the caches
+ */
+void srv_path_stat(path_t * p, const path_root_t * root, time_t now)
+{
+    struct _path_ent *e;
+    unsigned long long key;
+    unsigned int hash, gen;
+
+#ifdef DEBUG
+    assert(NULL != p);
+#endif
+
+    if (p->known)
+        return;
+
+    /* before we look, so a file that turns up while we do makes what
+     * we find stale, rather than being missed until the next change */
+    gen = __atomic_load_n(&path_gen, __ATOMIC_RELAXED);
+
+    /* never zero, so an empty slot matches nothing */
+    key = hash_bytes(p->full, p->len) | 1;
+
+    if (_srv_path_neg_get(key, __atomic_load_n(&root->neg_ttl,
+                                               __ATOMIC_RELAXED), now)) {
+        p->err = ENOENT;
+        p->has_index = 0;
+    } else {
+        _srv_path_stat(p, root->index);
+
+        if (ENOENT == p->err || ENOTDIR == p->err)
+            _srv_path_neg_put(key, gen, now);
+    }
+
+    p->known = 1;
+
+    if (NULL == (e = _srv_path_ent(&hash, root, p->target)))
+        return;
+
+    /* the clean path is never longer than what it came from */
+    e->hash = hash;
+    e->when = now;
+    e->gen = gen;
+    e->root = root;
+    strcpy(e->target, p->target);
+    strcpy(e->rel, p->full + p->rel);
+    e->err = p->err;
+    e->st = p->st;
+    e->has_index = p->has_index;
+    e->ind = p->ind;
+}
+
+#ifdef HAVE_INOTIFY
+/**
+ * a directory couldn't be watched, so nothing may appear in it without
+ * us knowing: every docroot it's under believes its misses for the
+ * short ttl only
+ */
+void _srv_path_unwatched(const char *dir)
+{
+    unsigned int i;
+    size_t len;
+
+    for (i = 0; i < path_nroots; i++) {
+        len = strlen(path_roots[i]->dir);
+        while (len && '/' == path_roots[i]->dir[len - 1])
+            --len;
+
+        if (!strncmp(dir, path_roots[i]->dir, len)
+            && ('/' == dir[len] || '\0' == dir[len]))
+            __atomic_store_n(&path_roots[i]->neg_ttl, SRV_PATH_NEG_TTL,
+                             __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * watch one directory for things appearing in it
+ */
+int _srv_path_watch_dir(const char *dir, const struct stat *st, int flag,
+                        struct FTW *ftw)
+{
+    unsigned int slots;
+    char **tmp;
+    int wd;
+
+    if (FTW_D != flag)
+        return 0;
+
+    if (path_watches >= SRV_PATH_WATCH_MAX) {
+        /* too many to keep track of, fall back on the ttl alone */
+        _srv_path_unwatched(dir);
+        return 1;
+    }
+
+    wd = inotify_add_watch(path_ifd, dir, IN_CREATE | IN_MOVED_TO
+                           | IN_ATTRIB | IN_ONLYDIR);
+
+    if (-1 == wd) {
+        ERRF(__FILE__, __LINE__, "watching %s: %s!\n", dir, strerror(errno));
+        _srv_path_unwatched(dir);
+        return 1;
+    }
+
+    if ((unsigned int)wd >= path_dir_slots) {
+        /* remember where each watch is, for when things appear in it */
+        slots = (path_dir_slots) ? path_dir_slots : 64;
+        while (slots <= (unsigned int)wd)
+            slots *= 2;
+
+        if (NULL == (tmp = realloc(path_dirs, slots * sizeof *tmp))) {
+            _srv_path_unwatched(dir);
+            return 1;
+        }
+
+        memset(tmp + path_dir_slots, 0,
+               (slots - path_dir_slots) * sizeof *tmp);
+        path_dirs = tmp;
+        path_dir_slots = slots;
+    }
+
+    if (NULL == path_dirs[wd]) {
+        path_dirs[wd] = strdup(dir);
+        ++path_watches;
+    }
+
+    return 0;
+}
+
+/**
+ * a directory appeared in one we watch, watch it and everything in it
+ */
+void _srv_path_watch_new(int wd, const char *name)
+{
+    char dir[SRV_PATH_MAX];
+
+    if (wd < 0 || (unsigned int)wd >= path_dir_slots || NULL == path_dirs[wd])
+        return;
+
+    if ((size_t)snprintf(dir, sizeof dir, "%s/%s", path_dirs[wd], name)
+        >= sizeof dir) {
+        _srv_path_unwatched(path_dirs[wd]);
+        return;
+    }
+
+    nftw(dir, _srv_path_watch_dir, 16, FTW_PHYS);
+}
+#endif
+
+/**
+ * watch a docroot, so misses under it can be believed for longer.
+ * without inotify, or if its tree is too big to watch, they only last
+ * SRV_PATH_NEG_TTL.
+ * @param root the docroot
+ */
+int srv_path_watch(path_root_t * root)
+{
+#ifdef HAVE_INOTIFY
+    path_root_t **tmp;
+
+#ifdef DEBUG
+    assert(NULL != root);
+#endif
+
+    if (-1 == path_ifd
+        && -1 == (path_ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC))) {
+        ERRF(__FILE__, __LINE__, "inotify: %s!\n", strerror(errno));
+        return 0;
+    }
+
+    if (NULL == (tmp = realloc(path_roots, (path_nroots + 1) * sizeof *tmp)))
+        return 0;
+
+    path_roots = tmp;
+    path_roots[path_nroots++] = root;
+
+    /* until some part of it can't be watched */
+    root->neg_ttl = SRV_PATH_NEG_WATCHED_TTL;
+
+    if (nftw(root->dir, _srv_path_watch_dir, 16, FTW_PHYS)) {
+        root->neg_ttl = SRV_PATH_NEG_TTL;
+        return 0;
+    }
+
+    DEBUGF(__FILE__, __LINE__, "watching %u directories under %s\n",
+           path_watches, root->dir);
+
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * see if anything has appeared under the docroot, and forget every
+ * miss if it has. new directories are watched too.
+ */
+void srv_path_poll(void)
+{
+#ifdef HAVE_INOTIFY
+    char buf[4096], *c;
+    struct inotify_event *ev;
+    unsigned int changed = 0;
+    ssize_t got;
+
+    if (-1 == path_ifd)
+        return;
+
+    while ((got = read(path_ifd, buf, sizeof buf)) > 0) {
+        for (c = buf; c < buf + got; c += sizeof *ev + ev->len) {
+            ev = (struct inotify_event *)c;
+            changed = 1;
+
+            /* a new directory, and whatever it already holds */
+            if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO))
+                && ev->len)
+                _srv_path_watch_new(ev->wd, ev->name);
+        }
+    }
+
+    if (changed)
+        __atomic_add_fetch(&path_gen, 1, __ATOMIC_RELAXED);
+#endif
+}
@@ -0,0 +1,104 @@
+/* path.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef SRV_PATH_H
+#define SRV_PATH_H
+
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* the longest path we'll build, docroot and all */
+#define SRV_PATH_MAX        1024
+
+/* each thread remembers what its recent request targets resolved to,
+ * and what was there, for a second or so. this is each docroot's share
+ * unless it asks for another, and the most any may have
+ */
+#define SRV_PATH_CACHE       128
+#define SRV_PATH_CACHE_MAX   65536
+#define SRV_PATH_CACHE_KEY   128
+#define SRV_PATH_CACHE_TTL     1
+
+/* paths known not to exist are shared by every thread, and believed
+ * for a few seconds, or a minute under a docroot that inotify tells us
+ * about anything new in
+ */
+#define SRV_PATH_NEG          4096
+#define SRV_PATH_NEG_TTL         5
+#define SRV_PATH_NEG_WATCHED_TTL 60
+#define SRV_PATH_WATCH_MAX    4096
+
+/* a docroot, what a directory's index is called, and its own share of
+ * each thread's cache, so a busy site can't push out another's paths */
+typedef struct _path_root_t {
+    const char *dir;
+    const char *index;
+
+    /* where its share starts, and how many slots, a power of two */
+    unsigned int off;
+    unsigned int slots;
+
+    /* how long a miss under it is believed, longer while it's watched */
+    time_t neg_ttl;
+} path_root_t;
+
+typedef struct _path_t {
+    /* the docroot and the cleaned up request path after it, which
+     * starts at rel */
+    char full[SRV_PATH_MAX];
+    size_t len;
+    size_t rel;
+
+    /* whether we know what's there yet, and if so what stat said, or
+     * why it failed */
+    int known;
+    int err;
+    struct stat st;
+
+    /* a directory's index, if it has one */
+    int has_index;
+    char index[SRV_PATH_MAX];
+    struct stat ind;
+
+    /* what it was looked up by, for the thread's cache */
+    const char *target;
+    unsigned int hash;
+} path_t;
+
+/* clean up a request target and put it under a docroot, 0 if it's no
+ * good: malformed escapes, an escaped NUL or slash, or too long */
+int srv_path_canon(path_t *, const char *, const char *);
+/* set up a docroot with this many slots of each thread's cache, 0 for
+ * SRV_PATH_CACHE. every root is set up before any thread looks up */
+int srv_path_root(path_root_t *, const char *, const char *, unsigned int);
+/* the clean path for a request target, and what's there if we know */
+int srv_path_lookup(path_t *, const path_root_t *, const char *, time_t);
+/* find out what's there, if we don't know already */
+void srv_path_stat(path_t *, const path_root_t *, time_t);
+/* watch a docroot for new files, and catch up on what it saw */
+int srv_path_watch(path_root_t *);
+void srv_path_poll(void);
+
+#endif
@@ -0,0 +1,1275 @@
+/* proxy.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <util/util.h>
+#include <util/buf.h>
+#include <util/vector.h>
+
+#include <srv/resp.h>
+#include <srv/proxy.h>
+
+/* how a response body ends */
+#define PROXY_BODY_NONE     0
+#define PROXY_BODY_LENGTH   1
+#define PROXY_BODY_CHUNKED  2
+#define PROXY_BODY_CLOSE    3
+
+/* where we are in a chunked body */
+#define PROXY_CK_SIZE       0
+#define PROXY_CK_DATA       1
+#define PROXY_CK_END        2
+#define PROXY_CK_TRAIL      3
+#define PROXY_CK_DONE       4
+#define PROXY_CK_BAD        5
+
+struct _proxy_chunk {
+    unsigned int st;
+    /* past the size, into an extension */
+    unsigned int ext;
+    /* length of the trailer line so far */
+    unsigned int line;
+    unsigned long long left;
+};
+
+/* what the upstream said, as far as we care */
+struct _proxy_resp {
+    unsigned int status;
+    unsigned int body;
+    unsigned long long len;
+    /* whether the connection can take another request */
+    unsigned int reuse;
+};
+
+/* one exchange, client and upstream */
+struct _proxy_io {
+    conn_t *clnt;
+    void (*progress) (conn_t *);
+    int up;
+
+    /* the client's body is partly read, the upstream said something,
+     * the client heard something: past any of these it can't be tried
+     * again somewhere else */
+    unsigned int streamed;
+    unsigned int heard;
+    unsigned int answered;
+
+    /* the upstream ran out of time */
+    unsigned int late;
+
+    /* what the response is kept by, if it may be, and where it's
+     * going while it comes in */
+    proxy_t *px;
+    const char *key;
+    cache_put_t *put;
+};
+
+/* each thread's pipe, for splicing one socket into another */
+struct _proxy_pipe {
+    int fd[2];
+};
+
+static pthread_once_t proxy_once = PTHREAD_ONCE_INIT;
+static pthread_key_t proxy_key;
+
+void _srv_proxy_pipe_free(void *p)
+{
+    struct _proxy_pipe *pp = (struct _proxy_pipe *)p;
+
+    close(pp->fd[0]);
+    close(pp->fd[1]);
+    free(pp);
+}
+
+void _srv_proxy_init(void)
+{
+    pthread_key_create(&proxy_key, _srv_proxy_pipe_free);
+}
+
+/**
+ * this thread's pipe, NULL if it can't have one
+ */
+struct _proxy_pipe *_srv_proxy_pipe(void)
+{
+    struct _proxy_pipe *pp;
+
+    pthread_once(&proxy_once, _srv_proxy_init);
+
+    if (NULL != (pp = pthread_getspecific(proxy_key)))
+        return pp;
+
+    if (NULL == (pp = malloc(sizeof *pp)))
+        return NULL;
+
+    if (pipe2(pp->fd, O_CLOEXEC)) {
+        free(pp);
+        return NULL;
+    }
+
+    pthread_setspecific(proxy_key, pp);
+
+    return pp;
+}
+
+/**
+ * throw this thread's pipe away, with whatever is stuck in it
+ */
+void _srv_proxy_pipe_drop(void)
+{
+    struct _proxy_pipe *pp;
+
+    if (NULL != (pp = pthread_getspecific(proxy_key))) {
+        pthread_setspecific(proxy_key, NULL);
+        _srv_proxy_pipe_free(pp);
+    }
+}
+
+/**
+ * the client got somewhere, or the upstream did on its behalf
+ */
+void _srv_proxy_moved(struct _proxy_io *io)
+{
+    if (NULL != io->progress)
+        io->progress(io->clnt);
+}
+
+/**
+ * wait for the client. the timing wheel hangs up on one that takes too
+ * long, which wakes us up too.
+ */
+int _srv_proxy_wait(struct _proxy_io *io, short events)
+{
+    struct pollfd pfd;
+
+    pfd.fd = io->clnt->sock;
+    pfd.events = events;
+    pfd.revents = 0;
+
+    return (poll(&pfd, 1, -1) > 0);
+}
+
+/**
+ * a socket's recv or send would block: wait if it's the client, give up
+ * if it's the upstream, whose own timeout just ran out
+ */
+int _srv_proxy_blocked(struct _proxy_io *io, int fd, short events)
+{
+    if (EAGAIN != errno && EWOULDBLOCK != errno)
+        return 0;
+
+    if (fd == io->clnt->sock)
+        return _srv_proxy_wait(io, events);
+
+    io->late = 1;
+
+    return 0;
+}
+
+/**
+ * recv from either side
+ * @return what was read, 0 if they hung up, -1 on failure
+ */
+ssize_t _srv_proxy_recv(struct _proxy_io *io, int fd, char *data, size_t len)
+{
+    ssize_t got;
+
+    for (;;) {
+        if ((got = recv(fd, data, len, 0)) >= 0) {
+            if (got)
+                _srv_proxy_moved(io);
+
+            return got;
+        }
+
+        if (EINTR != errno && !_srv_proxy_blocked(io, fd, POLLIN))
+            return -1;
+    }
+}
+
+/**
+ * send all of it to either side
+ */
+int _srv_proxy_send(struct _proxy_io *io, int fd, const char *data,
+                    size_t len)
+{
+    ssize_t sent;
+    size_t pos = 0;
+
+    while (pos < len) {
+        if ((sent = send(fd, data + pos, len - pos, MSG_NOSIGNAL)) > 0) {
+            pos += sent;
+            _srv_proxy_moved(io);
+        } else if (-1 == sent && EINTR == errno) {
+            continue;
+        } else if (-1 == sent && _srv_proxy_blocked(io, fd, POLLOUT)) {
+            continue;
+        } else {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * move len bytes from one socket to the other through this thread's
+ * pipe, without them ever coming up to us
+ * @return 1 once they're across, 0 on failure, or -1 if splice can't
+ * be used here and nothing has been moved
+ */
+int _srv_proxy_splice(struct _proxy_io *io, int from, int to,
+                      unsigned long long len)
+{
+    struct _proxy_pipe *pp;
+    unsigned long long done = 0;
+    ssize_t in, out;
+    size_t want;
+
+    if (NULL == (pp = _srv_proxy_pipe()))
+        return -1;
+
+    while (done < len) {
+        want = (len - done < SRV_PROXY_CHUNK) ? len - done : SRV_PROXY_CHUNK;
+        in = splice(from, NULL, pp->fd[1], NULL, want, SPLICE_F_MOVE);
+
+        if (-1 == in) {
+            if (EINTR == errno || _srv_proxy_blocked(io, from, POLLIN))
+                continue;
+
+            if (!done && (EINVAL == errno || ENOSYS == errno))
+                return -1;
+
+            return 0;
+        } else if (!in) {
+            /* hung up short */
+            return 0;
+        }
+
+        done += in;
+
+        while (in) {
+            out = splice(pp->fd[0], NULL, to, NULL, in, SPLICE_F_MOVE
+                         | ((done < len) ? SPLICE_F_MORE : 0));
+
+            if (out > 0) {
+                in -= out;
+                _srv_proxy_moved(io);
+            } else if (-1 == out && (EINTR == errno
+                                     || _srv_proxy_blocked(io, to,
+                                                           POLLOUT))) {
+                continue;
+            } else {
+                /* what's left in the pipe is no use to anyone now */
+                _srv_proxy_pipe_drop();
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * the next of a response being kept. if it can't be, it isn't, and
+ * the client gets it all the same
+ */
+void _srv_proxy_keep(struct _proxy_io *io, const char *data, size_t len)
+{
+    if (NULL != io->put && !srv_cache_write(io->put, data, len)) {
+        srv_cache_end(io->put, 0);
+        io->put = NULL;
+    }
+}
+
+/**
+ * move len bytes from one socket to the other, through splice if we
+ * can, or through a buffer if not, or if what's moved is being kept
+ */
+int _srv_proxy_move(struct _proxy_io *io, int from, int to,
+                    unsigned long long len)
+{
+    buf_t *b;
+    ssize_t got;
+    int ok;
+
+    if (NULL == io->put && -1 != (ok = _srv_proxy_splice(io, from, to, len)))
+        return ok;
+
+    if (NULL == (b = buf_get(SRV_PROXY_CHUNK)))
+        return 0;
+
+    for (ok = 1; ok && len; len -= got) {
+        got = _srv_proxy_recv(io, from, b->data,
+                              (len < b->size) ? len : b->size);
+        ok = (got > 0 && _srv_proxy_send(io, to, b->data, got));
+
+        if (!ok)
+            break;
+
+        _srv_proxy_keep(io, b->data, got);
+    }
+
+    buf_put(b);
+
+    return ok;
+}
+
+/**
+ * follow a chunked body along, so we know where it ends
+ * @return how much of it is body, all of it unless it ended
+ */
+size_t _srv_proxy_chunked(struct _proxy_chunk *ck, const char *data,
+                          size_t len)
+{
+    size_t i = 0, n;
+    int c;
+
+    while (i < len && PROXY_CK_DONE != ck->st && PROXY_CK_BAD != ck->st) {
+        if (PROXY_CK_DATA == ck->st) {
+            n = (len - i < ck->left) ? len - i : ck->left;
+            i += n;
+
+            if (!(ck->left -= n))
+                ck->st = PROXY_CK_END;
+
+            continue;
+        }
+
+        c = (unsigned char)data[i++];
+
+        switch (ck->st) {
+        case PROXY_CK_SIZE:
+            if ('\n' == c) {
+                ck->st = (ck->left) ? PROXY_CK_DATA : PROXY_CK_TRAIL;
+                ck->ext = ck->line = 0;
+            } else if (!ck->ext && isxdigit(c)) {
+                /* no chunk is that big */
+                if (ck->left >> 56)
+                    ck->st = PROXY_CK_BAD;
+
+                ck->left = (ck->left << 4)
+                    | (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+            } else if ('\r' != c) {
+                ck->ext = 1;
+            }
+            break;
+
+        case PROXY_CK_END:
+            if ('\n' == c) {
+                ck->st = PROXY_CK_SIZE;
+                ck->left = 0;
+            }
+            break;
+
+        case PROXY_CK_TRAIL:
+            if ('\n' == c) {
+                if (!ck->line)
+                    ck->st = PROXY_CK_DONE;
+
+                ck->line = 0;
+            } else if ('\r' != c) {
+                ++ck->line;
+            }
+            break;
+        }
+    }
+
+    return i;
+}
+
+/**
+ * is this header line the one named?
+ */
+int _srv_proxy_is(const char *line, size_t len, const char *name)
+{
+    return (strlen(name) == len && !strncasecmp(line, name, len));
+}
+
+/**
+ * one that only means something between us and the client, or us and
+ * the upstream, and isn't passed on
+ */
+int _srv_proxy_hop(const char *line, size_t len)
+{
+    return (_srv_proxy_is(line, len, "Connection")
+            || _srv_proxy_is(line, len, "Keep-Alive")
+            || _srv_proxy_is(line, len, "Proxy-Connection")
+            || _srv_proxy_is(line, len, "TE")
+            || _srv_proxy_is(line, len, "Trailer")
+            || _srv_proxy_is(line, len, "Upgrade"));
+}
+
+/**
+ * add to a header being built, 0 if it won't fit
+ */
+int _srv_proxy_put(buf_t * b, const char *data, size_t len)
+{
+    if (b->len + len + 1 > b->size)
+        return 0;
+
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+
+    return 1;
+}
+
+/**
+ * the request as the upstream gets it: the same request line, without
+ * anything hop-by-hop, with who it's really from, and asking for the
+ * connection to be kept open
+ * @param io the exchange
+ * @param out where it goes
+ * @param end where the client's header ends, at its blank line
+ * @param host what to call the upstream, if the client didn't say
+ * @param clen set to the length of the body
+ * @param expect set if the client waits for a 100 before the body
+ * @return 0, or the error to answer the client with
+ */
+unsigned int _srv_proxy_request(struct _proxy_io *io, buf_t * out,
+                                const char *end, const char *host,
+                                unsigned long long *clen,
+                                unsigned int *expect)
+{
+    const char *line, *next, *colon, *v;
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof addr;
+    char ip[INET_ADDRSTRLEN], tmp[128];
+    unsigned int has_host = 0, has_len = 0;
+    unsigned long long n;
+    char *e;
+
+    out->len = 0;
+    *clen = 0;
+    *expect = 0;
+
+    /* the request line as it came */
+    line = io->clnt->req.buf->data;
+    next = strstr(line, "\r\n");
+
+    if (!_srv_proxy_put(out, line, next + 2 - line))
+        return RESP_HTTP_413;
+
+    for (line = next + 2; line < end; line = next + 2) {
+        next = strstr(line, "\r\n");
+
+        if (NULL == (colon = memchr(line, ':', next - line)))
+            return RESP_HTTP_400;
+
+        for (v = colon + 1; ' ' == *v || '\t' == *v; v++) ;
+
+        if (_srv_proxy_is(line, colon - line, "Transfer-Encoding")) {
+            /* a chunked body would have to be picked apart as it comes
+             * in, so we ask for one with a length instead */
+            return RESP_HTTP_411;
+        } else if (_srv_proxy_is(line, colon - line, "Content-Length")) {
+            n = strtoull(v, &e, 10);
+
+            if (e == v || (e < next && ' ' != *e && '\t' != *e))
+                return RESP_HTTP_400;
+
+            /* lengths that disagree would have us and the upstream
+             * split the body in different places; the same one again
+             * is passed on once */
+            if (has_len) {
+                if (n != *clen)
+                    return RESP_HTTP_400;
+
+                continue;
+            }
+
+            *clen = n;
+            has_len = 1;
+        } else if (_srv_proxy_is(line, colon - line, "Expect")) {
+            *expect = !strncasecmp(v, "100-continue", 12);
+            continue;
+        } else if (_srv_proxy_is(line, colon - line, "Host")) {
+            has_host = 1;
+        } else if (_srv_proxy_hop(line, colon - line)) {
+            continue;
+        }
+
+        if (!_srv_proxy_put(out, line, next + 2 - line))
+            return RESP_HTTP_413;
+    }
+
+    /* the ring doesn't keep the address it accepted from */
+    addr = io->clnt->addr;
+
+    if (AF_INET != addr.sin_family
+        && getpeername(io->clnt->sock, (struct sockaddr *)&addr, &alen))
+        memset(&addr, 0, sizeof addr);
+
+    inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof ip);
+    snprintf(tmp, sizeof tmp, "X-Forwarded-For: %s\r\n", ip);
+
+    if (!_srv_proxy_put(out, tmp, strlen(tmp)))
+        return RESP_HTTP_413;
+
+    if (!has_host) {
+        snprintf(tmp, sizeof tmp, "Host: %s\r\n", host);
+
+        if (!_srv_proxy_put(out, tmp, strlen(tmp)))
+            return RESP_HTTP_413;
+    }
+
+    if (!_srv_proxy_put(out, "Connection: keep-alive\r\n\r\n", 26))
+        return RESP_HTTP_413;
+
+    return 0;
+}
+
+/**
+ * read what the upstream said, and build what the client hears: the
+ * same, but hop-by-hop headers are ours, and we hang up after
+ * @param end where the upstream's header ends, at its blank line
+ * @param head whether the request was a HEAD
+ * @return 0 if it made no sense
+ */
+int _srv_proxy_response(struct _proxy_resp *pr, buf_t * out,
+                        const char *data, const char *end,
+                        unsigned int head)
+{
+    const char *line, *next, *colon, *v;
+    unsigned int len_known = 0;
+
+    memset(pr, 0, sizeof *pr);
+    out->len = 0;
+
+    /* HTTP/1.x NNN */
+    if (strncmp(data, "HTTP/1.", 7) || !isdigit((unsigned char)data[9])
+        || !isdigit((unsigned char)data[10])
+        || !isdigit((unsigned char)data[11]))
+        return 0;
+
+    pr->status = strtoul(data + 9, NULL, 10);
+    pr->reuse = ('1' == data[7]);
+    pr->body = PROXY_BODY_CLOSE;
+
+    next = strstr(data, "\r\n");
+
+    if (!_srv_proxy_put(out, data, next + 2 - data))
+        return 0;
+
+    for (line = next + 2; line < end; line = next + 2) {
+        next = strstr(line, "\r\n");
+
+        if (NULL == (colon = memchr(line, ':', next - line)))
+            return 0;
+
+        for (v = colon + 1; ' ' == *v || '\t' == *v; v++) ;
+
+        if (_srv_proxy_is(line, colon - line, "Content-Length")) {
+            pr->len = strtoull(v, NULL, 10);
+            len_known = 1;
+        } else if (_srv_proxy_is(line, colon - line, "Transfer-Encoding")) {
+            if (NULL != strcasestr(v, "chunked"))
+                pr->body = PROXY_BODY_CHUNKED;
+        } else if (_srv_proxy_is(line, colon - line, "Connection")) {
+            if (!strncasecmp(v, "close", 5))
+                pr->reuse = 0;
+
+            continue;
+        } else if (_srv_proxy_hop(line, colon - line)) {
+            continue;
+        }
+
+        if (!_srv_proxy_put(out, line, next + 2 - line))
+            return 0;
+    }
+
+    if (PROXY_BODY_CHUNKED != pr->body && len_known)
+        pr->body = PROXY_BODY_LENGTH;
+
+    if (head || 204 == pr->status || 304 == pr->status)
+        pr->body = PROXY_BODY_NONE;
+
+    /* it's the only way the client would know where it ends */
+    if (PROXY_BODY_CLOSE == pr->body)
+        pr->reuse = 0;
+
+    return _srv_proxy_put(out, "Connection: close\r\n\r\n", 21);
+}
+
+/**
+ * start keeping a response as it goes to the client: a 200 with a
+ * length, that the upstream lets us keep. what's kept of its header is
+ * what the client got, less the status line, date and age, which are
+ * made again for each hit.
+ * @param io the exchange, with a key if the request may be kept
+ * @param pr what the upstream said
+ * @param head the upstream's header, and where it ends
+ * @param out what the client gets
+ * @param put where to keep track of it
+ */
+void _srv_proxy_begin_keep(struct _proxy_io *io, struct _proxy_resp *pr,
+                           const char *head, const char *end,
+                           const buf_t * out, cache_put_t * put)
+{
+    const char *line, *next, *v;
+    proxy_t *px = io->px;
+    buf_t *kept;
+    time_t now, until;
+    long age = 0;
+
+    if (NULL == io->key || 200 != pr->status
+        || PROXY_BODY_LENGTH != pr->body)
+        return;
+
+    now = time(NULL);
+
+    if (!(until = srv_cache_expiry(head, end, now, px->cache_ttl))
+        || NULL == (kept = buf_get(SRV_PROXY_HEAD_MAX)))
+        return;
+
+    kept->len = 0;
+    line = strstr(out->data, "\r\n") + 2;
+
+    for (; line < out->data + out->len; line = next + 2) {
+        next = strstr(line, "\r\n");
+
+        if (NULL != (v = memchr(line, ':', next - line))
+            && _srv_proxy_is(line, v - line, "Date"))
+            continue;
+
+        /* how old it already was is counted in when it was stored, so
+         * the Age it goes out with is the whole of it */
+        if (NULL != v && _srv_proxy_is(line, v - line, "Age")) {
+            age = strtol(v + 1, NULL, 10);
+            continue;
+        }
+
+        _srv_proxy_put(kept, line, next + 2 - line);
+    }
+
+    if (age < 0 || age > now)
+        age = 0;
+
+    if (srv_cache_begin(px->store, put, io->key, kept->data, kept->len,
+                        pr->len, now - age, until))
+        io->put = put;
+
+    buf_put(kept);
+}
+
+/**
+ * send the request on, and the response back
+ * @param io the exchange, with the upstream connected
+ * @param req the request as the upstream gets it, and the buffer its
+ * response header is built in once that's been sent
+ * @param body what of the client's body came in with its request
+ * @param have how much of it that is
+ * @param clen how long all of it is
+ * @param expect whether the client is waiting for a 100
+ * @param reuse set if the upstream connection can be used again
+ */
+int _srv_proxy_exchange(struct _proxy_io *io, buf_t * req, const char *body,
+                        size_t have, unsigned long long clen,
+                        unsigned int expect, unsigned int *reuse)
+{
+    static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    struct _proxy_chunk ck;
+    struct _proxy_resp pr;
+    cache_put_t put;
+    buf_t *rh;
+    char *end;
+    ssize_t got = 0;
+    size_t rest = 0, extra, n;
+    int ok = 0;
+
+    *reuse = 0;
+
+    if (!_srv_proxy_send(io, io->up, req->data, req->len)
+        || !_srv_proxy_send(io, io->up, body, have))
+        return 0;
+
+    if (clen > have) {
+        /* the rest of the body goes straight through. we took the
+         * Expect off, so the 100 has to come from us */
+        if (expect && !io->streamed
+            && !_srv_proxy_send(io, io->clnt->sock, cont, sizeof cont - 1))
+            return 0;
+
+        io->streamed = 1;
+
+        if (!_srv_proxy_move(io, io->clnt->sock, io->up, clen - have))
+            return 0;
+    }
+
+    if (NULL == (rh = buf_get(SRV_PROXY_HEAD_MAX)))
+        return 0;
+
+    rh->len = 0;
+
+    /* its header, after any 1xx it sends first */
+    for (;;) {
+        rh->data[rh->len] = '\0';
+
+        if (NULL != (end = strstr(rh->data, "\r\n\r\n"))) {
+            if (!_srv_proxy_response(&pr, req, rh->data, end + 2,
+                                     HTTP_MTHD_HEAD == io->clnt->req.meth))
+                goto out;
+
+            rest = rh->len - (end + 4 - rh->data);
+
+            if (100 > pr.status || 199 < pr.status)
+                break;
+
+            /* we took Upgrade off, so it's no use to anyone */
+            if (101 == pr.status)
+                goto out;
+
+            memmove(rh->data, end + 4, rest);
+            rh->len = rest;
+            continue;
+        }
+
+        if (rh->len + 1 >= rh->size)
+            goto out;
+
+        if ((got = _srv_proxy_recv(io, io->up, rh->data + rh->len,
+                                   rh->size - 1 - rh->len)) <= 0)
+            goto out;
+
+        io->heard = 1;
+        rh->len += got;
+    }
+
+    io->answered = 1;
+    _srv_proxy_begin_keep(io, &pr, rh->data, end + 2, req, &put);
+
+    if (!_srv_proxy_send(io, io->clnt->sock, req->data, req->len))
+        goto out;
+
+    end += 4;
+    extra = 0;
+
+    switch (pr.body) {
+    case PROXY_BODY_NONE:
+        extra = rest;
+        ok = 1;
+        break;
+
+    case PROXY_BODY_LENGTH:
+        n = (rest < pr.len) ? rest : pr.len;
+        extra = rest - n;
+        ok = _srv_proxy_send(io, io->clnt->sock, end, n);
+
+        if (ok)
+            _srv_proxy_keep(io, end, n);
+
+        ok = ok && (n == pr.len || _srv_proxy_move(io, io->up, io->clnt->sock,
+                                                   pr.len - n));
+        break;
+
+    case PROXY_BODY_CHUNKED:
+        memset(&ck, 0, sizeof ck);
+        n = _srv_proxy_chunked(&ck, end, rest);
+        extra = rest - n;
+        ok = _srv_proxy_send(io, io->clnt->sock, end, n);
+
+        while (ok && PROXY_CK_DONE != ck.st && PROXY_CK_BAD != ck.st) {
+            if ((got = _srv_proxy_recv(io, io->up, rh->data, rh->size)) <= 0)
+                break;
+
+            n = _srv_proxy_chunked(&ck, rh->data, got);
+            extra = got - n;
+            ok = _srv_proxy_send(io, io->clnt->sock, rh->data, n);
+        }
+
+        ok = ok && PROXY_CK_DONE == ck.st;
+        break;
+
+    case PROXY_BODY_CLOSE:
+        ok = _srv_proxy_send(io, io->clnt->sock, end, rest);
+
+        while (ok && (got = _srv_proxy_recv(io, io->up, rh->data,
+                                            rh->size)) > 0)
+            ok = _srv_proxy_send(io, io->clnt->sock, rh->data, got);
+
+        ok = ok && !got;
+        break;
+    }
+
+    /* anything past the end of the response, and we've lost track */
+    *reuse = (ok && pr.reuse && !extra);
+
+  out:
+    if (NULL != io->put) {
+        srv_cache_end(io->put, ok);
+        io->put = NULL;
+    }
+
+    buf_put(rh);
+
+    return ok;
+}
+
+/**
+ * connect to an upstream, giving up after timeout ms. the socket
+ * blocks from then on, for up to timeout ms at a time
+ * @return the socket, or -1
+ */
+int _srv_proxy_connect(upstream_t * up, unsigned int timeout)
+{
+    struct pollfd pfd;
+    struct timeval tv;
+    socklen_t len;
+    int fd, err = 0, y = 1;
+
+    if (-1 == (fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK
+                           | SOCK_CLOEXEC, 0)))
+        return -1;
+
+    if (connect(fd, (struct sockaddr *)&up->addr, sizeof up->addr)) {
+        if (EINPROGRESS != errno)
+            goto fail;
+
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        len = sizeof err;
+
+        if (poll(&pfd, 1, timeout) <= 0
+            || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) || err)
+            goto fail;
+    }
+
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+
+    if (-1 == fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK)
+        || setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv)
+        || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv)
+        || setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &y, sizeof y))
+        goto fail;
+
+    return fd;
+
+  fail:
+    close(fd);
+    return -1;
+}
+
+/**
+ * a connection to an upstream, one kept from before if it's still
+ * good, or a new one
+ * @param reused set if it was kept from before
+ */
+int _srv_proxy_take(proxy_t * px, upstream_t * up, unsigned int *reused)
+{
+    char c;
+    int fd;
+
+    for (;;) {
+        pthread_mutex_lock(&up->mt);
+        fd = (up->idle_cnt) ? up->idle[--up->idle_cnt] : -1;
+        pthread_mutex_unlock(&up->mt);
+
+        if (-1 == fd)
+            break;
+
+        /* nothing to read means it's still open and has nothing to
+         * say, which is what we want */
+        if (-1 == recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT)
+            && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+            *reused = 1;
+            return fd;
+        }
+
+        close(fd);
+    }
+
+    *reused = 0;
+
+    return _srv_proxy_connect(up, px->timeout);
+}
+
+/**
+ * keep a connection for the next request, if there's room
+ */
+void _srv_proxy_give(proxy_t * px, upstream_t * up, int fd)
+{
+    pthread_mutex_lock(&up->mt);
+
+    if (up->idle_cnt < px->idle_max) {
+        up->idle[up->idle_cnt++] = fd;
+        fd = -1;
+    }
+
+    pthread_mutex_unlock(&up->mt);
+
+    if (-1 != fd)
+        close(fd);
+}
+
+/**
+ * the upstream with the fewest requests in flight, of those that are
+ * up. where we start looking goes round, so ties are shared out.
+ */
+upstream_t *_srv_proxy_pick(proxy_t * px)
+{
+    upstream_t *up, *best = NULL;
+    unsigned int i, start;
+
+    start = __atomic_fetch_add(&px->next, 1, __ATOMIC_RELAXED);
+
+    for (i = 0; i < px->count; i++) {
+        up = &px->ups[(start + i) % px->count];
+
+        if (__atomic_load_n(&up->down, __ATOMIC_RELAXED))
+            continue;
+
+        if (NULL == best
+            || __atomic_load_n(&up->active, __ATOMIC_RELAXED)
+            < __atomic_load_n(&best->active, __ATOMIC_RELAXED))
+            best = up;
+    }
+
+    if (NULL != best)
+        __atomic_add_fetch(&best->active, 1, __ATOMIC_RELAXED);
+
+    return best;
+}
+
+/**
+ * is an upstream well? it has to take a connection, and answer its
+ * health check with a 2xx or 3xx if it has one
+ */
+int _srv_proxy_check(proxy_t * px, upstream_t * up)
+{
+    char req[512], res[512];
+    size_t got = 0;
+    ssize_t n;
+    int fd, ok;
+
+    if (-1 == (fd = _srv_proxy_connect(up, px->timeout)))
+        return 0;
+
+    if (NULL == px->health) {
+        close(fd);
+        return 1;
+    }
+
+    snprintf(req, sizeof req, "GET %s HTTP/1.1\r\nHost: %s\r\n"
+             "Connection: close\r\n\r\n", px->health, up->name);
+
+    ok = (send(fd, req, strlen(req), MSG_NOSIGNAL) == (ssize_t) strlen(req));
+
+    /* "HTTP/1.1 200" is all we need, the rest is read so it isn't
+     * cut off mid-answer */
+    while (ok && got < 12) {
+        if ((n = recv(fd, res + got, sizeof res - got, 0)) <= 0)
+            ok = 0;
+        else
+            got += n;
+    }
+
+    while (ok && recv(fd, req, sizeof req, 0) > 0) ;
+
+    close(fd);
+
+    return (ok && !strncmp(res, "HTTP/1.", 7)
+            && ('2' == res[9] || '3' == res[9]));
+}
+
+/**
+ * check a proxy's upstreams, forever
+ */
+void *_srv_proxy_health(void *arg)
+{
+    proxy_t *px = (proxy_t *) arg;
+    struct timespec ts;
+    unsigned int i, ok;
+
+    ts.tv_sec = px->health_ms / 1000;
+    ts.tv_nsec = (px->health_ms % 1000) * 1000000L;
+
+    for (;;) {
+        nanosleep(&ts, NULL);
+
+        for (i = 0; i < px->count; i++) {
+            ok = _srv_proxy_check(px, &px->ups[i]);
+
+            if (ok == !__atomic_load_n(&px->ups[i].down, __ATOMIC_RELAXED))
+                continue;
+
+            if (ok)
+                DEBUGF(__FILE__, __LINE__, "upstream %s is back\n",
+                       px->ups[i].name);
+            else
+                ERRF(__FILE__, __LINE__, "upstream %s is down!\n",
+                     px->ups[i].name);
+
+            __atomic_store_n(&px->ups[i].down, !ok, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * where an upstream is, from its "host:port"
+ */
+int _srv_proxy_resolve(upstream_t * up)
+{
+    struct addrinfo hints, *res;
+    char host[256], *port;
+    int err;
+
+    snprintf(host, sizeof host, "%s", up->name);
+
+    if (NULL != (port = strrchr(host, ':')))
+        *port++ = '\0';
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if ((err = getaddrinfo(host, (NULL != port) ? port : "80", &hints,
+                           &res))) {
+        ERRF(__FILE__, __LINE__, "upstream %s: %s!\n", up->name,
+             gai_strerror(err));
+        return 0;
+    }
+
+    memcpy(&up->addr, res->ai_addr, sizeof up->addr);
+    freeaddrinfo(res);
+
+    return 1;
+}
+
+/**
+ * set a proxy up
+ * @param px where it goes
+ * @param pc its config block, which has to stay around
+ */
+int srv_proxy_init(proxy_t * px, const struct _srvproxy_conf_t *pc)
+{
+    upstream_t *up;
+    unsigned int i;
+
+#ifdef DEBUG
+    assert(NULL != px);
+    assert(NULL != pc);
+#endif
+
+    memset(px, 0, sizeof *px);
+
+    px->prefix = pc->prefix;
+    px->count = pc->upstreams.count;
+    px->idle_max = (pc->idle) ? pc->idle : SRV_PROXY_IDLE;
+    px->timeout = (pc->timeout) ? pc->timeout : SRV_PROXY_TIMEOUT;
+    px->health = pc->health;
+    px->health_ms = (pc->health_ms) ? pc->health_ms : SRV_PROXY_HEALTH;
+    px->cache_ttl = pc->cache_ttl;
+
+    if (NULL == (px->ups = calloc(px->count, sizeof *px->ups))) {
+        ERRF(__FILE__, __LINE__, "allocating memory for upstreams!\n");
+        return 0;
+    }
+
+    for (i = 0; i < px->count; i++) {
+        up = &px->ups[i];
+        up->name = *(char **)vector_get_at((vector_t *) & pc->upstreams, i);
+
+        if (!_srv_proxy_resolve(up))
+            return 0;
+
+        if (NULL == (up->idle = calloc(px->idle_max, sizeof *up->idle))) {
+            ERRF(__FILE__, __LINE__, "allocating memory for upstreams!\n");
+            return 0;
+        }
+
+        pthread_mutex_init(&up->mt, NULL);
+    }
+
+    return 1;
+}
+
+/**
+ * start checking on a proxy's upstreams
+ */
+int srv_proxy_watch(proxy_t * px)
+{
+    pthread_t th;
+
+#ifdef DEBUG
+    assert(NULL != px);
+#endif
+
+    if (pthread_create(&th, NULL, _srv_proxy_health, px)) {
+        ERRF(__FILE__, __LINE__, "starting a health check thread!\n");
+        return 0;
+    }
+
+    pthread_detach(th);
+
+    return 1;
+}
+
+/**
+ * pass a request on to one of a proxy's upstreams, and its response
+ * back. a GET or HEAD on a connection kept from before that turns out
+ * to have been closed under us is tried again on a new one, and an
+ * upstream that won't take a connection at all is passed over for the
+ * next, so long as the client hasn't sent or heard anything it'd miss.
+ * anything else may have been acted on before the connection went, so
+ * it isn't sent twice.
+ * @param px the proxy its route led to
+ * @param clnt the client, with its request parsed and still in its
+ * buffer
+ * @param progress told whenever the client gets somewhere, or NULL
+ * @return 1 if it went through, 0 if not, in which case the client has
+ * been told why if it can be
+ */
+int srv_proxy_serve(proxy_t * px, conn_t * clnt, void (*progress) (conn_t *))
+{
+    struct _proxy_io io;
+    upstream_t *up;
+    buf_t *head;
+    const char *wire;
+    char *data, *end;
+    unsigned long long clen;
+    unsigned int code, expect, reused, reuse, tries;
+    size_t have, len;
+    char key[SRV_CACHE_KEY_MAX];
+    int ok = 0;
+
+#ifdef DEBUG
+    assert(NULL != px);
+    assert(NULL != clnt);
+    assert(NULL != clnt->req.buf);
+#endif
+
+    memset(&io, 0, sizeof io);
+    io.clnt = clnt;
+    io.px = px;
+    io.progress = progress;
+    io.up = -1;
+
+    if (NULL == (head = buf_get(SRV_PROXY_HEAD_MAX)))
+        return 0;
+
+    data = clnt->req.buf->data;
+
+    /* the whole header came in with the request, or it'd not have
+     * parsed. some of the body may have too. */
+    if (NULL == (end = strstr(data, "\r\n\r\n"))) {
+        code = RESP_HTTP_400;
+        goto out;
+    }
+
+    /* what comes back is kept, if the request lets it be */
+    if (NULL != px->store && HTTP_MTHD_GET == clnt->req.meth
+        && (SRV_CACHE_STORE & srv_cache_request(data, end + 2))
+        && srv_cache_key_line(key, sizeof key, clnt->site->name, data))
+        io.key = key;
+
+    for (tries = 0, code = RESP_HTTP_502; tries <= px->count; tries++) {
+        if (NULL == (up = _srv_proxy_pick(px)))
+            break;
+
+        if (0 != (code = _srv_proxy_request(&io, head, end + 2, up->name,
+                                            &clen, &expect))) {
+            __atomic_sub_fetch(&up->active, 1, __ATOMIC_RELAXED);
+            goto out;
+        }
+
+        have = clnt->req.buf->len - (end + 4 - data);
+
+        if (have > clen)
+            have = clen;
+
+        if (-1 == (io.up = _srv_proxy_take(px, up, &reused))) {
+            /* won't even take a connection, so nothing was sent */
+            __atomic_store_n(&up->down, 1, __ATOMIC_RELAXED);
+        } else if (_srv_proxy_exchange(&io, head, end + 4, have, clen,
+                                       expect, &reuse)) {
+            if (reuse)
+                _srv_proxy_give(px, up, io.up);
+            else
+                close(io.up);
+
+            __atomic_add_fetch(&up->served, 1, __ATOMIC_RELAXED);
+            __atomic_sub_fetch(&up->active, 1, __ATOMIC_RELAXED);
+            ok = 1;
+            break;
+        } else {
+            close(io.up);
+
+            /* a kept connection the upstream had given up on isn't
+             * the upstream's fault */
+            if (!reused || io.heard)
+                __atomic_store_n(&up->down, 1, __ATOMIC_RELAXED);
+        }
+
+        __atomic_add_fetch(&up->failed, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&up->active, 1, __ATOMIC_RELAXED);
+        code = (io.late) ? RESP_HTTP_504 : RESP_HTTP_502;
+
+        /* too late to try anywhere else, or not safe to */
+        if (-1 != io.up && (!reused || io.streamed || io.heard
+                            || (HTTP_MTHD_GET != clnt->req.meth
+                                && HTTP_MTHD_HEAD != clnt->req.meth)))
+            break;
+
+        io.up = -1;
+        io.late = 0;
+    }
+
+  out:
+    if (!ok && !io.answered) {
+        DEBUGF(__FILE__, __LINE__, "(sock:%d) proxy failed, %u\n",
+               clnt->sock, code);
+        wire = srv_resp_error_wire(code, &len);
+        _srv_proxy_send(&io, clnt->sock, wire, len);
+    }
+
+    buf_put(head);
+
+    return ok;
+}
@@ -0,0 +1,99 @@
+/* proxy.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef SRV_PROXY_H
+#define SRV_PROXY_H
+
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include <srv/conf.h>
+#include <srv/conn.h>
+#include <srv/cache.h>
+
+/* paths handed on to other servers. a request under a proxy's prefix
+ * goes, whatever its method, to the upstream with the fewest requests
+ * in flight, over a connection kept open from last time if there is
+ * one. the exchange runs wherever responses are built, a worker or an
+ * offload thread, never on the event loop, and bodies go through a
+ * pipe with splice where the kernel lets us. an upstream that fails is
+ * left alone until its health check passes again. a response that's
+ * being kept in the cache is copied through instead, into its segment
+ * on the way.
+ */
+#define SRV_PROXY_IDLE        16
+#define SRV_PROXY_TIMEOUT  30000
+#define SRV_PROXY_HEALTH    2000
+#define SRV_PROXY_HEAD_MAX  (8 * 1024)
+#define SRV_PROXY_CHUNK     (64 * 1024)
+
+typedef struct _upstream_t {
+    /* "host:port", as configured, and where that is */
+    char *name;
+    struct sockaddr_in addr;
+
+    /* connections kept open for the next request */
+    pthread_mutex_t mt;
+    int *idle;
+    unsigned int idle_cnt;
+
+    /* requests in flight, and whether it's failed since last checked */
+    unsigned int active;
+    unsigned int down;
+
+    unsigned long long served;
+    unsigned long long failed;
+} upstream_t;
+
+typedef struct _proxy_t {
+    const char *prefix;
+
+    upstream_t *ups;
+    unsigned int count;
+    /* where the next pick starts, so ties go round */
+    unsigned int next;
+
+    /* per upstream, and in ms */
+    unsigned int idle_max;
+    unsigned int timeout;
+
+    /* what to GET, NULL to only connect, and how often */
+    const char *health;
+    unsigned int health_ms;
+
+    /* where what comes back is kept, NULL if it isn't, and for how
+     * long when it doesn't say */
+    cache_t *store;
+    unsigned int cache_ttl;
+} proxy_t;
+
+/* set a proxy up from its config block, resolving its upstreams */
+int srv_proxy_init(proxy_t *, const struct _srvproxy_conf_t *);
+/* start checking a proxy's upstreams in the background */
+int srv_proxy_watch(proxy_t *);
+/* pass a parsed request on, and its response back, start to finish.
+ * told each time the client gets somewhere, if not NULL */
+int srv_proxy_serve(proxy_t *, conn_t *, void (*)(conn_t *));
+
+#endif
@@ -33,43 +33,15 @@
 #include <util/utstring.h>
 
 #define REQ_LINES        15
-#define HTTP_ESC_CNT     22
-#define MAX_REPLACE_ITER 128
-
-/* HTTP escape codes */
-static const char *http_esc_codes[][2] = {
-    {"%20", " "},
-    {"%3C", "<"},
-    {"%3E", ">"},
-    {"%23", "#"},
-    {"%25", "%"},
-    {"%7B", "{"},
-    {"%7D", "}"},
-    {"%7C", "|"},
-    {"%5C", "\\"},
-    {"%5E", "^"},
-    {"%7E", "~"},
-    {"%5B", "["},
-    {"%5D", "]"},
-    {"%60", "`"},
-    {"%3B", ";"},
-    {"%2F", "/"},
-    {"%3F", "?"},
-    {"%3A", ":"},
-    {"%40", "@"},
-    {"%3D", "="},
-    {"%26", "&"},
-    {"%24", "$"}
-};
 
 /**
  * parse a request
  */
 unsigned int srv_req_parse(req_t * req)
 {
-    char *str, *copy, *tmp, *pm, *pmcopy;
-    char *pa, *pb;
+    char *str, *copy, *line, *tmp, *pm, *pmcopy;
     unsigned int i;
+    size_t n;
 
 #ifdef DEBUG
     assert(NULL != req);
@@ -78,6 +50,9 @@ unsigned int srv_req_parse(req_t * req)
     if (NULL != req->path)
         free(req->path);
 
+    /* a request that doesn't parse mustn't leave the old one behind */
+    req->path = NULL;
+
     /* clear up old params */
     for (i = 0; i < req->param_cnt; ++i) {
         if (NULL != req->params[i].key)
@@ -87,21 +62,22 @@ unsigned int srv_req_parse(req_t * req)
     }
 
     req->param_cnt = 0;
+    req->gzip = 0;
     req->port = 0;
     req->pos = 0;
+    req->host[0] = '\0';
 
-    copy = strdup((char *)req->buf);
+    /* strsep walks line along, copy is what gets freed */
+    if (NULL == (line = copy = strdup(req->buf->data)))
+        return 0;
 
     /* lets take care of the first line */
-    str = strsep(&copy, "\r\n");
+    str = strsep(&line, "\r\n");
 
     if (NULL == str) {
         /* wtf? */
         ERRF(__FILE__, __LINE__, "empty request!\n");
-
-        if (NULL != copy)
-            free(copy);
-
+        free(copy);
         return 0;
     }
 
@@ -118,14 +94,19 @@ unsigned int srv_req_parse(req_t * req)
     } else if (!strncmp(str, "HEAD", 4)) {
         req->meth = HTTP_MTHD_HEAD;
         str += 5;
+    } else if ((n = strspn(str, "ABCDEFGHIJKLMNOPQRSTUVWXYZ"))
+               && ' ' == str[n]) {
+        /* one we don't serve, but a proxy might pass on */
+        req->meth = HTTP_MTHD_OTHER;
+        str += n + 1;
     } else {
         /* unsupported */
         free(copy);
         return 0;
     }
 
-    /* which http/x.x is this? */
-    if (NULL == (tmp = strchr(str, '.'))) {
+    /* which http/x.x is this? there has to be room for a path too */
+    if (strlen(str) < 10 || NULL == (tmp = strchr(str, '.'))) {
         free(copy);
         return 0;
     }
@@ -135,26 +116,9 @@ unsigned int srv_req_parse(req_t * req)
     /* lose the HTTP/x.x directive */
     str[strlen(str) - 9] = '\0';
 
-    /* check to see if there are any escapes */
-    if (NULL != strchr(str, '%')) {
-        /* make a copy */
-        tmp = str;
-        pa = strdup(str);
-
-        for (i = 0; i < HTTP_ESC_CNT; i++) {
-            /* fix up the path */
-            pb = strreplace(pa, http_esc_codes[i][0],
-                            http_esc_codes[i][1], MAX_REPLACE_ITER);
-
-            /* clean it up */
-            free(pa);
-            pa = pb;
-        }
-
-        /* copy back */
-        str = tmp;
-    }
-
+    /* escapes in the path are decoded when it's resolved to a file,
+     * so an escaped ? or / can't change its meaning here
+     */
     if (NULL != (pmcopy = strchr(str, '?'))) {
         /* remove the shit from the path */
         str[strlen(str) - (strlen(pmcopy))] = '\0';
@@ -188,7 +152,7 @@ unsigned int srv_req_parse(req_t * req)
         req->path = strdup(str);
     }
 
-    while (NULL != (str = strsep(&copy, "\r\n"))) {
+    while (NULL != (str = strsep(&line, "\r\n"))) {
         if (!strlen(str))
             continue;
 
@@ -204,6 +168,9 @@ unsigned int srv_req_parse(req_t * req)
             /* who sent that shit son */
             tmp = strchr(str, ' ');
             strncpy(req->from, ++tmp, sizeof req->from);
+        } else if (!strncmp(str, "Accept-Encoding", 15)) {
+            /* will they take a gzipped body? */
+            req->gzip = (NULL != strstr(str + 15, "gzip"));
         } else if (!strncmp(str, "Connection", 10)) {
             /* close when we're done? */
             tmp = strchr(str, ' ');
@@ -226,12 +193,15 @@ unsigned int srv_req_parse(req_t * req)
 
                 /* the host: (-port len + -1 for the ':') */
                 str[strlen(str) - (strlen(tmp) + 1)] = '\0';
-                strncpy(req->host, str, sizeof req->host);
             } else {
                 /* there was no port specified */
                 req->port = 80;
-                strncpy(req->host, str, sizeof req->host);
             }
+
+            /* one too long to keep is no host at all, rather than
+             * part of one that could name some other site */
+            if (strlen(str) < sizeof req->host)
+                strcpy(req->host, str);
         } else {
             /* we don't support it yet */
             continue;
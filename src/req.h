@@ -25,12 +25,16 @@
 #ifndef SRV_REQ_H
 #define SRV_REQ_H
 
+#include <util/buf.h>
+
 #define HTTP_MTHD_GET       0
 
 /* unsupported */
 #define HTTP_MTHD_PUT       1
 #define HTTP_MTHD_HEAD      2
 #define HTTP_MTHD_POST      3
+/* anything else, only ever proxied */
+#define HTTP_MTHD_OTHER     4
 /* unsupported */
 
 #define SRV_REQ_PARAM_MAX   64
@@ -42,8 +46,8 @@ struct req_param {
 };
 
 typedef struct _req_t {
-    /* where were we? */
-    char buf[1024];
+    /* where were we? the buffer is only borrowed while reading */
+    buf_t *buf;
     size_t pos;
 
     /* requested file/dir */
@@ -58,6 +62,7 @@ typedef struct _req_t {
 
     /* header directives */
     unsigned int close;
+    unsigned int gzip;
     char from[64];
     char ref[128];
     char ua[128];
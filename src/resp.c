@@ -24,12 +24,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
 #include <errno.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <limits.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -38,10 +40,15 @@
 #include <time.h>
 
 #include <util/hash.h>
+#include <util/chash.h>
 #include <util/util.h>
 
 #include <srv/mod.h>
+#include <srv/path.h>
 #include <srv/resp.h>
+#include <srv/route.h>
+#include <srv/warm.h>
+#include <srv/proxy.h>
 
 #define MIME_TYPE_CNT 31
 
@@ -133,55 +140,269 @@ typedef struct _file_t {
 } file_t;
 
 /* list a dir homie */
-char *srv_build_dir_index(const char *, file_t *, unsigned int);
+buf_t *srv_build_dir_index(const char *, file_t *, unsigned int);
 
-/* srv responses */
-void srv_resp_403(resp_t * resp)
+/* every error we send, rendered once at startup and never touched
+ * again, so any thread can send one straight out of here. the header
+ * and body sit back to back, ready to go out in one send.
+ */
+typedef struct _resp_err_t {
+    const char *html;
+    const char *extra;
+
+    char *wire;
+    size_t headlen;
+    size_t len;
+} resp_err_t;
+
+/* the pack we serve from, if we were given one */
+
+static resp_err_t resp_errors[RESP_HTTP_CNT] = {
+    [RESP_HTTP_400] = {RESP_ERR_HTML("400", "bad request",
+                                     "we couldn't make sense of that!"),
+                       NULL},
+    [RESP_HTTP_403] = {RESP_ERR_HTML("403", "forbidden",
+                                     "access is forbidden to the "
+                                     "requested file!"), NULL},
+    [RESP_HTTP_404] = {RESP_ERR_HTML("404", "not found",
+                                     "the requested file was not found!"),
+                       NULL},
+    [RESP_HTTP_405] = {RESP_ERR_HTML("405", "method not allowed",
+                                     "we only serve things up here!"),
+                       "Allow: GET, HEAD\r\n"},
+    [RESP_HTTP_408] = {RESP_ERR_HTML("408", "request timeout",
+                                     "the request took too long to "
+                                     "come in!"), NULL},
+    [RESP_HTTP_411] = {RESP_ERR_HTML("411", "length required",
+                                     "a request body needs a length!"),
+                       NULL},
+    [RESP_HTTP_413] = {RESP_ERR_HTML("413", "request too large",
+                                     "the request was too big!"), NULL},
+    [RESP_HTTP_414] = {RESP_ERR_HTML("414", "uri too long",
+                                     "the requested path was too long!"),
+                       NULL},
+    [RESP_HTTP_500] = {RESP_ERR_HTML("500", "internal server error",
+                                     "something went wrong on our end!"),
+                       NULL},
+    [RESP_HTTP_502] = {RESP_ERR_HTML("502", "bad gateway",
+                                     "the server behind us didn't answer "
+                                     "properly!"), NULL},
+    [RESP_HTTP_503] = {RESP_ERR_HTML("503", "service unavailable",
+                                     "the server is too busy, please try "
+                                     "again!"), "Retry-After: 1\r\n"},
+    [RESP_HTTP_504] = {RESP_ERR_HTML("504", "gateway timeout",
+                                     "the server behind us took too long!"),
+                       NULL}
+};
+
+/**
+ * read a site's own error page, NULL if it doesn't have one
+ */
+char *srv_resp_error_page(const char *dir, const char *code, size_t * len)
 {
+    char file[1024];
+    struct stat st;
+    char *page;
+    ssize_t got;
+    size_t pos;
+    int fd;
+
+    snprintf(file, sizeof file, "%s/%s.html", dir, code);
+
+    if (-1 == (fd = open(file, O_RDONLY)))
+        return NULL;
+
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode)
+        || st.st_size > RESP_ERR_PAGE_MAX
+        || NULL == (page = malloc(st.st_size + 1))) {
+        ERRF(__FILE__, __LINE__, "can't use error page %s!\n", file);
+        close(fd);
+        return NULL;
+    }
+
+    for (pos = 0; pos < (size_t) st.st_size; pos += got) {
+        if ((got = read(fd, page + pos, st.st_size - pos)) <= 0) {
+            if (-1 == got && EINTR == errno) {
+                got = 0;
+                continue;
+            }
+
+            break;
+        }
+    }
+
+    close(fd);
+    page[pos] = '\0';
+    *len = pos;
+
+    DEBUGF(__FILE__, __LINE__, "using error page %s\n", file);
+
+    return page;
+}
+
+/**
+ * render every error response we know, with the site's pages where it
+ * has them. called once, before anyone can ask for one.
+ */
+int srv_resp_errors_init(const char *dir)
+{
+    char header[256];
+    resp_err_t *e;
+    size_t len;
+    char *page;
+    int i;
+
+    for (i = 0; i < RESP_HTTP_CNT; ++i) {
+        e = &resp_errors[i];
+
+        if (NULL == e->html)
+            continue;
+
+        page = NULL;
+
+        if (NULL == dir
+            || NULL == (page = srv_resp_error_page(dir, resp_status[i][0],
+                                                   &len)))
+            len = strlen(e->html);
+
+        e->headlen = snprintf(header, sizeof header,
+                              "HTTP/1.1 %s %s\r\n"
+                              "Connection: close\r\n"
+                              "Server: srv/" _SRV_VERSION "\r\n"
+                              "%s"
+                              "Content-Length: %lu\r\n"
+                              "Content-Type: %s\r\n"
+                              "\r\n",
+                              resp_status[i][0], resp_status[i][1],
+                              (NULL != e->extra) ? e->extra : "",
+                              (long unsigned)len, mime_types[9][1]);
+        e->len = len;
+
+        if (NULL == (e->wire = malloc(e->headlen + e->len))) {
+            ERRF(__FILE__, __LINE__, "allocating error responses!\n");
+            free(page);
+            return 0;
+        }
+
+        memcpy(e->wire, header, e->headlen);
+        memcpy(e->wire + e->headlen, (NULL != page) ? page : e->html,
+               e->len);
+        free(page);
+    }
+
+    return 1;
+}
+
+/**
+ * answer with one of the shared error responses. the body is sent from
+ * the registry as is, nothing is copied but the header.
+ */
+void srv_resp_error(resp_t * resp, unsigned int code)
+{
+    const resp_err_t *e = &resp_errors[code];
+
 #ifdef DEBUG
     assert(NULL != resp);
+    assert(code < RESP_HTTP_CNT);
+    assert(NULL != e->wire);
 #endif
 
-    resp->code = RESP_HTTP_403;
+    srv_resp_release(resp);
+
+    resp->code = code;
     resp->type = 9;
-    resp->len = strlen(RESP_403_HTML);
     resp->pregen = 1;
-    resp->data = strdup(RESP_403_HTML);
-    snprintf(resp->header, sizeof resp->header,
-             "HTTP/1.1 %s %s\r\n"
-             "Connection: close\r\n"
-             "Server: srv/0.1.1\r\n"
-             "Content-Length: %lu\r\n"
-             "Content-Type: %s\r\n"
-             "\r\n"
-             "\r\n",
-             resp_status[RESP_HTTP_403][0],
-             resp_status[RESP_HTTP_403][1],
-             (long unsigned)resp->len, mime_types[resp->type][1]);
+    resp->shared = 1;
+    resp->len = e->len;
+    resp->data = e->wire + e->headlen;
+
+    memcpy(resp->header, e->wire, e->headlen);
+    resp->header[e->headlen] = '\0';
+}
+
+/**
+ * the whole of a shared error response, for when there's no resp_t
+ * to send it through
+ */
+const char *srv_resp_error_wire(unsigned int code, size_t * len)
+{
+    const resp_err_t *e = &resp_errors[code];
+
+#ifdef DEBUG
+    assert(code < RESP_HTTP_CNT);
+    assert(NULL != e->wire);
+    assert(NULL != len);
+#endif
+
+    *len = e->headlen + e->len;
+
+    return e->wire;
 }
 
-void srv_resp_404(resp_t * resp)
+/**
+ * let go of a response's file name and body, however it came by them
+ */
+void srv_resp_release(resp_t * resp)
 {
 #ifdef DEBUG
     assert(NULL != resp);
 #endif
 
-    resp->code = RESP_HTTP_404;
-    resp->type = 9;
-    resp->len = strlen(RESP_404_HTML);
+    if (NULL != resp->file)
+        free(resp->file);
+
+    /* a segment nobody took */
+    if (resp->fd)
+        close(resp->fd);
+
+    if (NULL != resp->body)
+        buf_put(resp->body);
+    else if (resp->pregen && !resp->shared && NULL != resp->data)
+        free(resp->data);
+
+    memset(resp, 0, sizeof *resp);
+}
+
+/**
+ * answer from the pack. the header was written when the pack was built,
+ * all but the date, and the body goes out straight from the mapping.
+ */
+int srv_resp_packed(resp_t * resp, const pack_t * pack, const path_t * path,
+                    const req_t * req, const char *date)
+{
+    const struct _pack_var *v;
+    const pack_ent_t *e;
+
+    e = srv_pack_find(pack, path->full + path->rel,
+                      path->len - path->rel);
+
+    if (NULL == e) {
+        srv_resp_error(resp, RESP_HTTP_404);
+        return 1;
+    }
+
+    v = &e->var[(req->gzip && e->var[PACK_VAR_GZIP].headlen) ?
+                PACK_VAR_GZIP : PACK_VAR_PLAIN];
+
+    srv_warm_hit(path->full + path->rel, path->len - path->rel);
+
+    resp->code = RESP_HTTP_200;
+    resp->type = e->type;
     resp->pregen = 1;
-    resp->data = strdup(RESP_404_HTML);
+    resp->shared = 1;
+    resp->len = v->len;
+    resp->data = pack->map + v->body;
+
     snprintf(resp->header, sizeof resp->header,
              "HTTP/1.1 %s %s\r\n"
              "Connection: close\r\n"
-             "Server: srv/0.1.1\r\n"
-             "Content-Length: %lu\r\n"
-             "Content-Type: %s\r\n"
-             "\r\n"
-             "\r\n",
-             resp_status[RESP_HTTP_404][0],
-             resp_status[RESP_HTTP_404][1],
-             (long unsigned)resp->len, mime_types[resp->type][1]);
+             "Date: %s\r\n"
+             "%.*s",
+             resp_status[RESP_HTTP_200][0],
+             resp_status[RESP_HTTP_200][1],
+             date, (int)v->headlen, pack->map + v->head);
+
+    return 1;
 }
 
 /**
@@ -204,69 +425,47 @@ char *srv_get_extension(const char *filename)
 }
 
 /**
- * private function
+ * which of our mime types a file is, going by its extension
  */
-int _srv_list_filter(const struct dirent *ent)
+unsigned int srv_resp_type(const char *file)
 {
-#ifdef DEBUG
-    assert(NULL != ent);
-#endif
+    unsigned int i;
+    char *ext;
 
-    if (*ent->d_name == '.')
+    if (NULL == (ext = srv_get_extension(file)))
         return 0;
 
-    return 1;
+    for (i = 1; i < MIME_TYPE_CNT; i++) {
+        if (!strcmp(ext, mime_types[i][0])) {
+            /* found it! */
+            return i;
+        }
+    }
+
+    return 0;
 }
 
 /**
- * fix a path handed to us by the client
+ * the name of a mime type
  */
-char *srv_fix_req_path(const char *root, char *path)
+const char *srv_resp_mime(unsigned int type)
 {
-    char tmp[1024], *c, *i;
+    return mime_types[(type < MIME_TYPE_CNT) ? type : 0][1];
+}
 
+/**
+ * private function
+ */
+int _srv_list_filter(const struct dirent *ent)
+{
 #ifdef DEBUG
-    assert(NULL != root);
-    assert(NULL != path);
+    assert(NULL != ent);
 #endif
 
-    memset(tmp, 0, sizeof tmp);
-    strncpy(tmp, root, strlen(root) + 1);
-
-    for (c = path, i = tmp + strlen(root); '\0' != *c; c++) {
-        if (*c == '.') {
-            if (!strncmp(c, "./", 2)) {
-                /* dir/dir/./file <-- pointless */
-                c++;
-                continue;
-            } else if (!strncmp(c, "../", 3)) {
-                /* dir/dir/../file <-- naughty */
-                c += 2;
-                continue;
-            }
-        } else if (*c == '%') {
-            if (!strncmp(c, "%20", 3)) {
-                /* i'll add more later */
-                *i = ' ';
-                c += 2;
-                i++;
-                continue;
-            }
-        } else if (*c == '/') {
-            if (!strncmp(c, "//", 2)) {
-                /* no need for a double slash */
-                *i = '/';
-                c++;
-                i++;
-                continue;
-            }
-        }
-
-        *i = *c;
-        i++;
-    }
+    if (*ent->d_name == '.')
+        return 0;
 
-    return strdup(tmp);
+    return 1;
 }
 
 /**
@@ -311,7 +510,10 @@ file_t *srv_list_dir(const char *dir, unsigned int *cnt)
         f = &list[i];
 
         strcpy(c, ent[i]->d_name);
-        stat(tmp, &st);
+
+        /* listed but not ours to look at, show it as empty */
+        if (stat(tmp, &st))
+            memset(&st, 0, sizeof st);
 
         tm = localtime(&st.st_mtime);
 
@@ -372,61 +574,218 @@ int srv_resp_cache(resp_t * resp, const char *path)
     return 1;
 }
 
+/**
+ * answer from the cache. the status line and date are ours, the rest
+ * of the header and the body are sent straight out of the segment,
+ * which is held open from here. if it's gone already, it's a miss.
+ * @param resp the response
+ * @param c the cache
+ * @param key what it's found by
+ * @param req the request, a HEAD only gets the header
+ * @param date the date it goes out with
+ * @return 1 if there was a fresh one
+ */
+int srv_resp_cached(resp_t * resp, cache_t * c, const char *key,
+                    const req_t * req, const char *date)
+{
+    cache_ent_t ent;
+    char path[PATH_MAX];
+
+#ifdef DEBUG
+    assert(NULL != resp);
+    assert(NULL != c);
+    assert(NULL != key);
+#endif
+
+    if (!srv_cache_get(c, key, &ent, path, sizeof path))
+        return 0;
+
+    if (-1 == (resp->fd = open(path, O_RDONLY))) {
+        resp->fd = 0;
+        return 0;
+    }
+
+    if (NULL == (resp->file = strdup(path))) {
+        close(resp->fd);
+        resp->fd = 0;
+        return 0;
+    }
+
+    resp->off = ent.off;
+    resp->len = ent.headlen + ((HTTP_MTHD_HEAD == req->meth) ? 0 : ent.len);
+    resp->dev = c->dev;
+    resp->cache = 1;
+    resp->mtime = ent.stored;
+    resp->code = RESP_HTTP_200;
+
+    snprintf(resp->header, sizeof resp->header,
+             "HTTP/1.1 %s %s\r\n" "Date: %s\r\n" "Age: %ld\r\n",
+             resp_status[RESP_HTTP_200][0], resp_status[RESP_HTTP_200][1],
+             date, (long)(time(NULL) - ent.stored));
+
+    return 1;
+}
+
+/**
+ * the key for what a module makes: all it's given is the path and the
+ * parameters, so that's all that's in it
+ */
+int _srv_resp_mod_key(char *key, size_t size, const vhost_t * site,
+                      const path_t * path, const req_t * req)
+{
+    char target[SRV_CACHE_KEY_MAX];
+    unsigned int i;
+    int n;
+
+    n = snprintf(target, sizeof target, "%s", path->full + path->rel);
+
+    for (i = 0; i < req->param_cnt && n > 0 && (size_t)n < sizeof target;
+         i++)
+        n += snprintf(target + n, sizeof target - n, "%c%s=%s",
+                      (i) ? '&' : '?', req->params[i].key,
+                      req->params[i].val);
+
+    if (n <= 0 || (size_t)n >= sizeof target)
+        return 0;
+
+    return srv_cache_key(key, size, site->name, target, n);
+}
+
+/**
+ * find the scheduling class for a request, from the route that will
+ * handle it. anything that isn't a module gets the normal class.
+ */
+unsigned int srv_resp_prio(vhost_t * site, const char *req)
+{
+    const route_t *rt;
+    unsigned int prio = SRV_PRIO_NORMAL;
+    path_t path;
+
+#ifdef DEBUG
+    assert(NULL != site);
+    assert(NULL != req);
+#endif
+
+    if (!srv_path_canon(&path, site->root.dir, req))
+        return prio;
+
+    rt = srv_router_lookup(&site->routes, path.full + path.rel);
+
+    if (NULL != rt && ROUTE_MODULE == rt->type)
+        prio = rt->prio;
+
+    return prio;
+}
+
 /**
  * generate a response from a request
  */
-int srv_resp_generate(resp_t * resp, const char *root,
-                      const char *req, const char *index,
-                      struct req_param *params, unsigned int param_cnt,
-                      hash_t * hide, hash_t * mps)
+int srv_resp_generate(resp_t * resp, vhost_t * site, req_t * req,
+                      cache_t * cache)
 {
-    struct stat st, ind;
+    path_t path;
     file_t *list;
 
-    resp_t *cache;
+    const route_t *rt;
     struct _modfunc *mf;
+    proxy_t *px;
     unsigned int res, cnt;
-    unsigned int i, size;
+    unsigned int size;
     struct tm *tm;
     time_t blah;
-    char *path, *ext;
-    char *ind_path;
     char date[30];
+    char key[SRV_CACHE_KEY_MAX], head[256];
+    int keep;
 
-    struct _respptr *pt;
     struct srv_mod_trans mt;
 
 #ifdef DEBUG
     assert(NULL != resp);
     assert(NULL != req);
-    assert(NULL != root);
-    assert(NULL != index);
+    assert(NULL != site);
 #endif
 
     time(&blah);
     tm = gmtime(&blah);
     mf = NULL;
 
-    /* clear the filename */
-    if (resp->file)
-        free(resp->file);
-
-    /* clear the pre-existing data */
-    if (resp->pregen && resp->data)
-        free(resp->data);
-
+    /* clear out whatever was sent last time */
+    srv_resp_release(resp);
     memset(&mt, 0, sizeof mt);
-    memset(resp, 0, sizeof *resp);
 
     strftime(date, sizeof date, "%a, %d %b %Y %H:%M:%S GMT", tm);
 
-    path = srv_fix_req_path(root, (char *)req);
+    if (!srv_path_lookup(&path, &site->root, req->path, blah)) {
+        /* nothing that could be a file of ours */
+        DEBUGF(__FILE__, __LINE__, "bad request path %s\n", req->path);
+        srv_resp_error(resp, RESP_HTTP_404);
+        return 1;
+    }
+
+    /* routes are matched against the cleaned up request path, before
+     * we go anywhere near the filesystem
+     */
+    rt = srv_router_lookup(&site->routes, path.full + path.rel);
+
+    if (NULL != rt && ROUTE_PROXY == rt->type) {
+        px = (proxy_t *) rt->data;
+
+        /* unless we kept what it said last time */
+        if (NULL != px->store && NULL != req->buf
+            && (HTTP_MTHD_GET == req->meth || HTTP_MTHD_HEAD == req->meth)
+            && (SRV_CACHE_LOOKUP
+                & srv_cache_request(req->buf->data,
+                                    strstr(req->buf->data, "\r\n\r\n")))
+            && srv_cache_key_line(key, sizeof key, site->name,
+                                  req->buf->data)
+            && srv_resp_cached(resp, px->store, key, req, date)) {
+            DEBUGF(__FILE__, __LINE__, "%s from the cache\n", key);
+            return 1;
+        }
+
+        /* someone else answers, whatever the method */
+        DEBUGF(__FILE__, __LINE__, "proxying %s\n", path.full + path.rel);
+        resp->proxy = px;
+        return 1;
+    }
+
+    if (NULL != rt && ROUTE_FCGI == rt->type) {
+        /* a script's to answer, whatever the method */
+        DEBUGF(__FILE__, __LINE__, "passing %s to fastcgi\n",
+               path.full + path.rel);
+        resp->fcgi = (struct _fcgi_t *)rt->data;
+        return 1;
+    }
+
+    if (HTTP_MTHD_GET != req->meth && HTTP_MTHD_HEAD != req->meth) {
+        /* we only ever serve things up */
+        srv_resp_error(resp, RESP_HTTP_405);
+        return 1;
+    }
+
+    if (NULL != rt && ROUTE_DENY == rt->type) {
+        /* hidden, so it doesn't exist as far as they know */
+        DEBUGF(__FILE__, __LINE__, "denied request for %s\n", path.full);
+        srv_resp_error(resp, RESP_HTTP_404);
+        return 1;
+    }
+
+    if (NULL != rt && ROUTE_MODULE == rt->type) {
+        mf = (struct _modfunc *)rt->data;
+        keep = (mf->cache && NULL != cache && NULL != cache->dir
+                && _srv_resp_mod_key(key, sizeof key, site, &path, req));
+
+        if (keep && srv_resp_cached(resp, cache, key, req, date)) {
+            DEBUGF(__FILE__, __LINE__, "%s from the cache\n", key);
+            return 1;
+        }
 
-    if (NULL != (mf = (struct _modfunc *)hash_get(mps, req))) {
-        DEBUGF(__FILE__, __LINE__, "checking if %s needs a handler...\n", path);
+        DEBUGF(__FILE__, __LINE__, "handling %s with a module...\n",
+               path.full);
 
         /* gotta handle this bitch with the function */
-        if (NULL != (resp->data = mf->func(path, &mt, params, param_cnt))) {
+        if (NULL != (resp->data = mf->func(path.full, &mt, req->params,
+                                           req->param_cnt))) {
             resp->pregen = 1;
             resp->len = mt.len;
             resp->type = mt.ftype;
@@ -439,119 +798,88 @@ int srv_resp_generate(resp_t * resp, const char *root,
                      resp_status[resp->code][0],
                      resp_status[resp->code][1], date,
                      (long unsigned)resp->len, mime_types[resp->type][1]);
+
+            /* the same again, less the status line and date, for next
+             * time */
+            if (keep && mt.status) {
+                snprintf(head, sizeof head,
+                         "Connection: close\r\n" "Server: srv/0.1.1\r\n"
+                         "Content-Length: %lu\r\n"
+                         "Content-Type: %s\r\n" "\r\n",
+                         (long unsigned)resp->len, mime_types[resp->type][1]);
+                srv_cache_store(cache, key, head, strlen(head), resp->data,
+                                resp->len, blah, blah + mf->cache);
+            }
         } else {
             /* TODO: gotta add error handling */
-            srv_resp_404(resp);
+            srv_resp_error(resp, RESP_HTTP_404);
         }
 
         return 1;
     }
 
-    if (stat(path, &st)) {
+    /* a packed docroot is all there is, the filesystem is never asked */
+    if (NULL != site->pack)
+        return srv_resp_packed(resp, site->pack, &path, req, date);
+
+    srv_path_stat(&path, &site->root, blah);
+
+    if (path.err) {
         /* something happened */
-        switch (errno) {
+        switch (path.err) {
         case EACCES:
-            srv_resp_403(resp);
-            free(path);
+            srv_resp_error(resp, RESP_HTTP_403);
             return 1;
 
         default:
-            srv_resp_404(resp);
-            free(path);
-            return 1;
-        }
-    }
-    
-    /* check if this file is cached, and if so, what's the deal */
-    if (NULL != (pt = (struct _respptr *)hash_get(hide, path))) {
-        /* get the goodies */
-        resp = pt->r;
-        
-#if 0
-        if (RESP_HTTP_403 == cache->code) {
-            /* we're done! */
-            fprintf(stderr, "zoom!\n");
-            resp = cache;
-            free(path);
-            return 1;
-        } else if (st.st_mtime > cache->mtime) {
-            /* been updated since last cache */
-            if (srv_resp_cache(cache, path)) {
-                resp = cache;
-                resp->mtime = st.st_mtime;
-            }
-
-            fprintf(stderr, "sching!\n");
-
-            free(path);
+            srv_resp_error(resp, RESP_HTTP_404);
             return 1;
         }
-#endif
-
     }
 
-    if (S_ISDIR(st.st_mode)) {
-        ind_path = srv_fix_req_path(path, (char *)index);
-
-        if (!stat(ind_path, &ind)) {
+    if (S_ISDIR(path.st.st_mode)) {
+        if (path.has_index) {
             /* the index exists in this directory */
-            resp->len = ind.st_size;
-            resp->file = ind_path;    /* keep the name around */
+            resp->len = path.ind.st_size;
+            resp->file = strdup(path.index);    /* keep the name around */
+            resp->dev = path.ind.st_dev;
 
-            ext = srv_get_extension(ind_path);
-            if (NULL == ext) {
-                resp->type = 0;
-            } else {
-                for (i = 1; i < MIME_TYPE_CNT; i++) {
-                    if (!strcmp(ext, mime_types[i][0])) {
-                        /* found it! */
-                        resp->type = i;
-                        break;
-                    }
-                }
-            }
+            resp->type = srv_resp_type(path.index);
         } else {
             /* it's a directory so lets list that shiiit */
-            list = srv_list_dir(path, &cnt);
+            list = srv_list_dir(path.full, &cnt);
 
             if (NULL == list) {
                 /* couldn't build it? */
                 return 0;
             }
 
+            resp->body = srv_build_dir_index(path.full + path.rel, list, cnt);
+
+            if (NULL == resp->body) {
+                srv_filelist_free(list, cnt);
+                return 0;
+            }
+
             resp->pregen = 1;
-            resp->data = srv_build_dir_index(req, list, cnt);
-            resp->len = strlen(resp->data);
+            resp->data = resp->body->data;
+            resp->len = resp->body->len;
             resp->type = 9;        /* text/html */
 
             srv_filelist_free(list, cnt);
-            free(ind_path);        /* lose the path */
         }
     } else {
-        resp->len = st.st_size;
-
-#if 0
-        /* should we cache? */
-        if (resp->len <= 512000)
-            resp->cache = 1;
-#endif
+        resp->len = path.st.st_size;
 
-        resp->file = strdup(path);
+        resp->file = strdup(path.full);
+        resp->dev = path.st.st_dev;
 
-        ext = srv_get_extension(path);
-        if (NULL == ext) {
-            resp->type = 0;
-        } else {
-            for (i = 1; i < MIME_TYPE_CNT; i++) {
-                if (!strcmp(ext, mime_types[i][0])) {
-                    /* found it! */
-                    resp->type = i;
-                    break;
-                }
-            }
-        }
+        resp->type = srv_resp_type(path.full);
     }
 
+    if (site->warm)
+        srv_warm_hit(path.full + path.rel, path.len - path.rel);
+
     resp->code = RESP_HTTP_200;
     snprintf(resp->header, sizeof resp->header,
              "HTTP/1.1 %s %s\r\n"
@@ -565,31 +893,65 @@ int srv_resp_generate(resp_t * resp, const char *root,
              resp_status[RESP_HTTP_200][1],
              date, (long unsigned)resp->len, mime_types[resp->type][1]);
 
-#if 0
-    /* cache it */
-    if (resp->cache) {
-        srv_resp_cache(resp, path);
-        hash_insert(hide, path, resp);
-        fprintf(stderr, "foop!\n");
+    return 1;
+}
+
+/**
+ * add to a directory index being built in a chain of buffers, starting
+ * a new one at the end whenever the last is full
+ * @return the new tail of the chain, NULL if we ran out of memory
+ */
+buf_t *_srv_dir_index_add(buf_t * tail, const char *fmt, ...)
+{
+    va_list ap;
+    buf_t *next;
+    int need;
+
+    va_start(ap, fmt);
+    need = vsnprintf(tail->data + tail->len, tail->size - tail->len, fmt, ap);
+    va_end(ap);
+
+    if (need < 0)
+        return NULL;
+
+    if ((size_t)need < tail->size - tail->len) {
+        tail->len += need;
+        return tail;
     }
-#endif
 
-    free(path);
-    return 1;
+    /* doesn't fit, so it all goes in the next one */
+    if (NULL == (next = buf_get((need >= BUF_MAX_SIZE) ? need + 1 :
+                                BUF_MAX_SIZE)))
+        return NULL;
+
+    va_start(ap, fmt);
+    next->len = vsnprintf(next->data, next->size, fmt, ap);
+    va_end(ap);
+
+    tail->next = next;
+
+    return next;
 }
 
 /**
- * build a directory index page
+ * build a directory index page. it's written into a chain of pooled
+ * buffers, and copied into one big enough for all of it if it took more
+ * than one, as it goes out in a single piece.
  */
-char *srv_build_dir_index(const char *dir, file_t * list, unsigned int cnt)
+buf_t *srv_build_dir_index(const char *dir, file_t * list, unsigned int cnt)
 {
     unsigned int i;
     char size[16];
-    char buf[64 * 1024], ent[256];    /* 20 kb, huge directory */
+    buf_t *head, *tail, *b, *all;
     file_t *f;
 
+    if (NULL == (head = buf_get(BUF_MAX_SIZE))) {
+        ERRF(__FILE__, __LINE__, "allocating directory index!\n");
+        return NULL;
+    }
+
     /* the beginning of our html */
-    snprintf(buf, sizeof buf,
+    tail = _srv_dir_index_add(head,
              "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 3.2 Final//EN\">"
              "\n"
              "<html>\n"
@@ -602,8 +964,7 @@ char *srv_build_dir_index(const char *dir, file_t * list, unsigned int cnt)
              "   }\n"
              "   table {\n"
              "    font-family: courier;\n"
-             "    font-size: 12;\n" "   }\n" "  </style>\n" " </head>\n", dir);
-    snprintf(buf + strlen(buf), sizeof buf - strlen(buf),
+             "    font-size: 12;\n" "   }\n" "  </style>\n" " </head>\n"
              " <body>\n"
              "  <h2>index of %s</h2>\n"
              "  <table>\n"
@@ -611,10 +972,9 @@ char *srv_build_dir_index(const char *dir, file_t * list, unsigned int cnt)
              "    <th align=\"left\" width=\"200\">name</th>\n"
              "    <th align=\"left\" width=\"150\">last modified</th>\n"
              "    <th align=\"left\" width=\"35\">size</th>\n"
-             "   </tr>\n   <tr><th colspan=\"5\"><hr></th></tr>", dir);
+             "   </tr>\n   <tr><th colspan=\"5\"><hr></th></tr>", dir, dir);
 
-    for (i = 0; i < cnt; i++) {
-        memset(ent, 0, sizeof ent);
+    for (i = 0; NULL != tail && i < cnt; i++) {
         memset(size, 0, sizeof size);
 
         f = &list[i];
@@ -633,29 +993,50 @@ char *srv_build_dir_index(const char *dir, file_t * list, unsigned int cnt)
         }
 
         /* this part of the html */
-        snprintf(ent, sizeof ent,
+        tail = _srv_dir_index_add(tail,
                  "   <tr>\n"
-                 "    <td><a href=\"%s/%s\">%s</a></td>\n"
+                 "    <td><a href=\"%s%s%s\">%s</a></td>\n"
                  "    <td>%s</td>\n"
                  "    <td>%s</td>\n"
                  "   </tr>\n",
-                 !strcmp(dir, "/") ? "" : dir, list[i].name,
-                 list[i].name, list[i].mod, size);
-
-        strcat(buf, ent);
+                 dir, ('/' == dir[strlen(dir) - 1]) ? "" : "/",
+                 list[i].name, list[i].name, list[i].mod, size);
     }
 
     /* the end of the html block */
-    snprintf(ent, sizeof ent,
-             "   <tr>\n"
-             "    <th colspan=\"5\"><hr></th>\n"
-             "   </tr>\n"
-             "  </table>\n"
-             "  <address>server powered by srv-"
-             _SRV_VERSION
-             "  </address>\n"
-             " </body>\n" "</html>\n");
-    strcat(buf, ent);
-
-    return strdup(buf);
+    if (NULL != tail)
+        tail = _srv_dir_index_add(tail,
+                 "   <tr>\n"
+                 "    <th colspan=\"5\"><hr></th>\n"
+                 "   </tr>\n"
+                 "  </table>\n"
+                 "  <address>server powered by srv-"
+                 _SRV_VERSION
+                 "  </address>\n"
+                 " </body>\n" "</html>\n");
+
+    if (NULL == tail) {
+        ERRF(__FILE__, __LINE__, "allocating directory index!\n");
+        buf_put(head);
+        return NULL;
+    }
+
+    if (NULL == head->next)
+        return head;
+
+    /* more than one, put it all together */
+    if (NULL == (all = buf_get(buf_chain_len(head)))) {
+        ERRF(__FILE__, __LINE__, "allocating directory index!\n");
+        buf_put(head);
+        return NULL;
+    }
+
+    for (b = head; NULL != b; b = b->next) {
+        memcpy(all->data + all->len, b->data, b->len);
+        all->len += b->len;
+    }
+
+    buf_put(head);
+
+    return all;
 }
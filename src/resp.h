@@ -28,9 +28,16 @@
 #include <time.h>
 
 #include <util/hash.h>
+#include <util/chash.h>
+#include <util/buf.h>
 
 #include <srv/req.h>
 #include <srv/mod.h>
+#include <srv/route.h>
+#include <srv/path.h>
+#include <srv/pack.h>
+#include <srv/vhost.h>
+#include <srv/cache.h>
 
 /* our versioning stuff */
 #define _SRV_MAJOR            0
@@ -40,45 +47,39 @@
 
 /* supported HTTP response codes */
 #define RESP_HTTP_200         2
+#define RESP_HTTP_400        16
 #define RESP_HTTP_403        19
 #define RESP_HTTP_404        20
-
-#define RESP_403_HTML                                           \
-    "<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Strict//EN\""\
-    "    http://www.w3.org/TR/xhtml1/DTD/xhtml1-strict.dtd\">"  \
-    "<html>"                                                    \
-    " <head>"                                                   \
-    "  <title>error 403: forbidden</title>"                     \
-    "  <style>"                                                 \
-    "   body{font-family:courier new;font-size:12;}"            \
-    "   p{font-family:courier;font-size:12;}"                   \
-    "  </style>"                                                \
-    " </head>"                                                  \
-    " <body>"                                                   \
-    "  <h2>http error 403</h2>"                                 \
-    "  <p>access is forbidden to the requested file!</p>"       \
-    "   <tr>"                                                   \
-    "    <th colspan=\"5\"><hr></th>"                           \
-    "   </tr>"                                                  \
-    "  <address>server powered by srv-"                         \
-    _SRV_VERSION                                                \
-    "   </address>"                                             \
-    " </body>"                                                  \
-    "</html>"
-
-#define RESP_404_HTML                                           \
+#define RESP_HTTP_405        21
+#define RESP_HTTP_408        24
+#define RESP_HTTP_411        27
+#define RESP_HTTP_413        29
+#define RESP_HTTP_414        30
+#define RESP_HTTP_500        34
+#define RESP_HTTP_502        36
+#define RESP_HTTP_503        37
+#define RESP_HTTP_504        38
+
+/* how many of them we know by name */
+#define RESP_HTTP_CNT        40
+
+/* the most of a site's own error page we'll send */
+#define RESP_ERR_PAGE_MAX    (64 * 1024)
+
+/* the page we send with an error, unless the site has its own */
+#define RESP_ERR_HTML(code, what, why)                          \
     "<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Strict//EN\""\
     "    http://www.w3.org/TR/xhtml1/DTD/xhtml1-strict.dtd\">"  \
     "<html>"                                                    \
     " <head>"                                                   \
-    "  <title>error 404: not found</title>"                     \
+    "  <title>error " code ": " what "</title>"                 \
     "  <style>"                                                 \
     "   body{font-family:courier new;font-size:12;}"            \
     "  </style>"                                                \
     " </head>"                                                  \
     " <body>"                                                   \
-    "  <h2>http error 404</h2>"                                 \
-    "  <p>the requested file was not found!</p>"                \
+    "  <h2>http error " code "</h2>"                            \
+    "  <p>" why "</p>"                                          \
     "   <tr>"                                                   \
     "    <th colspan=\"5\"><hr></th>"                           \
     "   </tr>"                                                  \
@@ -93,10 +94,15 @@ typedef char *(*_srv_modfunc_t) (char *,
                                  struct srv_mod_trans *, struct req_param *,
                                  unsigned int);
 
+struct _proxy_t;
+struct _fcgi_t;
+
 struct _modfunc {
     dlptr_t mod;
     _srv_modfunc_t func;
     char path[256];
+    /* seconds what it makes is kept in the cache, 0 for not at all */
+    unsigned int cache;
 };
 
 typedef struct _resp_t {
@@ -105,33 +111,59 @@ typedef struct _resp_t {
 
     unsigned int code;
     char *file;
+    /* where in the file it starts */
+    unsigned long long off;
+    unsigned long long dev;
     unsigned int type;
     char header[256];
     size_t headlen;
     size_t senthead;
     size_t len;
 
-    /* should we cache? */
+    /* whether it came out of the cache, and when it went in. its
+     * segment is opened when it's found, so it can't go before it's
+     * sent */
     unsigned int cache;
     time_t mtime;
+    int fd;
 
-    /* if we pregenerate/cache content */
+    /* if we pregenerate/cache content. data lives in body when it
+     * was built in a pooled buffer, belongs to the error registry when
+     * shared, else it's ours to free */
     unsigned int pregen;
+    unsigned int shared;
     char *data;
-} resp_t;
+    buf_t *body;
 
-/* pointer to a resp_t */
-struct _respptr {
-    resp_t *r;
-};
+    /* the upstreams it's passed to, when it isn't ours to answer */
+    struct _proxy_t *proxy;
+    /* or the FastCGI backends that answer it */
+    struct _fcgi_t *fcgi;
+} resp_t;
 
-/* pregenerate a 404 */
-void srv_resp_403(resp_t *);
-void srv_resp_404(resp_t *);
+/* build every error response we send, once, with the site's own
+ * pages from a directory if it has any */
+int srv_resp_errors_init(const char *);
+/* point a response at the shared one for an error */
+void srv_resp_error(resp_t *, unsigned int);
+/* the whole of a shared error response, header and body, as it's sent */
+const char *srv_resp_error_wire(unsigned int, size_t *);
+/* let go of whatever a response is holding on to */
+void srv_resp_release(resp_t *);
+/* the response to a path found in a pack, or a 404 */
+int srv_resp_packed(resp_t *, const pack_t *, const path_t *, const req_t *,
+                    const char *);
+/* which of our mime types a file is, and its name */
+unsigned int srv_resp_type(const char *);
+const char *srv_resp_mime(unsigned int);
 /* generate/update a resp_t for a cached object */
 int srv_resp_cache(resp_t *, const char *);
-/* generate a response from a request */
-int srv_resp_generate(resp_t *, const char *, const char *,
-                      const char *, struct req_param *, unsigned int,
-                      hash_t *, hash_t *);
+/* the response kept for a key, if there's a fresh one */
+int srv_resp_cached(resp_t *, cache_t *, const char *, const req_t *,
+                    const char *);
+/* generate a response from a request, for the site it asked for,
+ * answering from the cache where it can */
+int srv_resp_generate(resp_t *, vhost_t *, req_t *, cache_t *);
+/* the scheduling class of a request path on a site */
+unsigned int srv_resp_prio(vhost_t *, const char *);
 #endif
@@ -0,0 +1,403 @@
+/* route.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <util/util.h>
+#include <util/hash.h>
+
+#include <srv/conf.h>
+#include <srv/route.h>
+
+#define ROUTE_EXT_SLOTS 64
+
+/**
+ * exact string comparison for the extension map
+ */
+int _srv_route_keycmp(const void *a, const void *b)
+{
+    return (!strcmp((const char *)a, (const char *)b)) ? 0 : 1;
+}
+
+/**
+ * the extension map keeps its own copy of each route
+ */
+void *_srv_route_valcpy(const void *arg)
+{
+    route_t *r = calloc(1, sizeof *r);
+
+    if (NULL != r)
+        memcpy(r, arg, sizeof *r);
+
+    return (void *)r;
+}
+
+/**
+ * compare two path segments
+ */
+int _srv_route_segcmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+    int res;
+
+    res = memcmp(a, b, (alen < blen) ? alen : blen);
+
+    if (res)
+        return res;
+
+    return (alen > blen) - (alen < blen);
+}
+
+/**
+ * qsort() comparison for children of a node
+ */
+int _srv_route_kidcmp(const void *a, const void *b)
+{
+    const struct _route_node *na = *(struct _route_node * const *)a;
+    const struct _route_node *nb = *(struct _route_node * const *)b;
+
+    return _srv_route_segcmp(na->seg, na->seglen, nb->seg, nb->seglen);
+}
+
+/**
+ * get the next non-empty segment of a path, NULL at the end
+ */
+const char *_srv_route_next_seg(const char *path, size_t *len)
+{
+    while ('/' == *path)
+        path++;
+
+    if ('\0' == *path)
+        return NULL;
+
+    *len = strcspn(path, "/");
+
+    return path;
+}
+
+/**
+ * find the child of a node matching a segment. children are only
+ * sorted once the table is compiled, so fall back to a scan before that.
+ */
+struct _route_node *_srv_route_find_kid(struct _route_node *node,
+                                        const char *seg, size_t len,
+                                        unsigned int sorted)
+{
+    unsigned int lo, hi, mid;
+    int res;
+
+    if (!sorted) {
+        for (lo = 0; lo < node->kid_cnt; lo++) {
+            if (!_srv_route_segcmp(seg, len, node->kids[lo]->seg,
+                                   node->kids[lo]->seglen))
+                return node->kids[lo];
+        }
+
+        return NULL;
+    }
+
+    lo = 0;
+    hi = node->kid_cnt;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        res = _srv_route_segcmp(seg, len, node->kids[mid]->seg,
+                                node->kids[mid]->seglen);
+
+        if (!res)
+            return node->kids[mid];
+        else if (res < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return NULL;
+}
+
+/**
+ * hang a new child segment off of a node
+ */
+struct _route_node *_srv_route_add_kid(struct _route_node *node,
+                                       const char *seg, size_t len)
+{
+    struct _route_node *kid, **tmp;
+    unsigned int slots;
+
+    if (node->kid_cnt == node->kid_slots) {
+        /* out of room, double it */
+        slots = (node->kid_slots) ? node->kid_slots * 2 : 4;
+        tmp = realloc(node->kids, slots * sizeof *tmp);
+
+        if (NULL == tmp) {
+            ERRF(__FILE__, __LINE__, "allocating route children!\n");
+            return NULL;
+        }
+
+        node->kids = tmp;
+        node->kid_slots = slots;
+    }
+
+    kid = calloc(1, sizeof *kid);
+
+    if (NULL == kid) {
+        ERRF(__FILE__, __LINE__, "allocating route node!\n");
+        return NULL;
+    }
+
+    kid->seg = calloc(1, len + 1);
+
+    if (NULL == kid->seg) {
+        ERRF(__FILE__, __LINE__, "allocating route segment!\n");
+        free(kid);
+        return NULL;
+    }
+
+    memcpy(kid->seg, seg, len);
+    kid->seglen = len;
+
+    node->kids[node->kid_cnt++] = kid;
+
+    return kid;
+}
+
+/**
+ * sort the children of a node and everything below it
+ */
+void _srv_route_compile_node(struct _route_node *node)
+{
+    unsigned int i;
+
+    if (node->kid_cnt > 1)
+        qsort(node->kids, node->kid_cnt, sizeof *node->kids,
+              _srv_route_kidcmp);
+
+    for (i = 0; i < node->kid_cnt; i++)
+        _srv_route_compile_node(node->kids[i]);
+}
+
+/**
+ * free a node's children, recursively
+ */
+void _srv_route_free_node(struct _route_node *node)
+{
+    unsigned int i;
+
+    for (i = 0; i < node->kid_cnt; i++) {
+        _srv_route_free_node(node->kids[i]);
+        free(node->kids[i]->seg);
+        free(node->kids[i]);
+    }
+
+    if (NULL != node->kids)
+        free(node->kids);
+
+    node->kids = NULL;
+    node->kid_cnt = 0;
+    node->kid_slots = 0;
+}
+
+/**
+ * initialize an empty routing table
+ * @param rt the table to initialize
+ */
+int srv_router_init(router_t * rt)
+{
+#ifdef DEBUG
+    assert(NULL != rt);
+#endif
+
+    memset(rt, 0, sizeof *rt);
+
+    hash_init(&rt->ext, ROUTE_EXT_SLOTS);
+    hash_set_keycmp(&rt->ext, _srv_route_keycmp);
+    hash_set_keycpy(&rt->ext, hash_default_keycpy);
+    hash_set_free_key(&rt->ext, hash_default_free_key);
+    hash_set_valcpy(&rt->ext, _srv_route_valcpy);
+    hash_set_free_val(&rt->ext, hash_default_free_val);
+
+    return 1;
+}
+
+/**
+ * add a route to the table. a deny rule is never replaced by a handler
+ * registered for the same path or extension.
+ * @param rt the routing table
+ * @param match SRV_HANDLER_FILE (exact path), _DIR (path prefix) or _EXT
+ * @param pattern the path, or the extension with or without its dot
+ * @param type ROUTE_DENY, ROUTE_MODULE, ...
+ * @param prio the SRV_PRIO_ class of requests that match
+ * @param data handed back with the route on lookup
+ */
+int srv_router_add(router_t * rt, unsigned int match, const char *pattern,
+                   unsigned int type, unsigned int prio, void *data)
+{
+    struct _route_node *node, *kid;
+    const char *seg;
+    route_t r, *cur;
+    size_t len;
+
+#ifdef DEBUG
+    assert(NULL != rt);
+    assert(NULL != pattern);
+#endif
+
+    r.type = type;
+    r.prio = prio;
+    r.data = data;
+
+    if (SRV_HANDLER_EXT == match) {
+        if ('.' == *pattern)
+            pattern++;
+
+        cur = (route_t *) hash_get(&rt->ext, pattern);
+
+        if (NULL != cur && ROUTE_DENY == cur->type)
+            return 1;
+
+        if (!hash_insert(&rt->ext, pattern, &r))
+            return 0;
+
+        ++rt->count;
+        return 1;
+    }
+
+    node = &rt->root;
+
+    for (seg = pattern; NULL != (seg = _srv_route_next_seg(seg, &len));
+         seg += len) {
+        kid = _srv_route_find_kid(node, seg, len, 0);
+
+        if (NULL == kid && NULL == (kid = _srv_route_add_kid(node, seg, len)))
+            return 0;
+
+        node = kid;
+    }
+
+    cur = (SRV_HANDLER_DIR == match) ? &node->prefix : &node->exact;
+
+    if (ROUTE_DENY != cur->type)
+        memcpy(cur, &r, sizeof *cur);
+
+    rt->compiled = 0;
+    ++rt->count;
+
+    return 1;
+}
+
+/**
+ * get the table ready for lookups, call after the last srv_router_add
+ * @param rt the routing table
+ */
+void srv_router_compile(router_t * rt)
+{
+#ifdef DEBUG
+    assert(NULL != rt);
+#endif
+
+    _srv_route_compile_node(&rt->root);
+    rt->compiled = 1;
+
+    DEBUGF(__FILE__, __LINE__, "compiled %u routes\n", rt->count);
+}
+
+/**
+ * find the route for a request path. deny rules win over everything,
+ * then an exact match, then the longest prefix, then the extension.
+ * @param rt the routing table
+ * @param path the request path, relative to the docroot
+ */
+const route_t *srv_router_lookup(router_t * rt, const char *path)
+{
+    struct _route_node *node;
+    const route_t *best, *ext;
+    const char *seg, *name, *dot;
+    size_t len;
+
+#ifdef DEBUG
+    assert(NULL != rt);
+    assert(NULL != path);
+#endif
+
+    ext = NULL;
+    best = NULL;
+    node = &rt->root;
+
+    if (ROUTE_DENY == node->prefix.type)
+        return &node->prefix;
+    else if (ROUTE_NONE != node->prefix.type)
+        best = &node->prefix;
+
+    for (seg = path; NULL != (seg = _srv_route_next_seg(seg, &len));
+         seg += len) {
+        node = _srv_route_find_kid(node, seg, len, rt->compiled);
+
+        if (NULL == node)
+            break;
+
+        if (ROUTE_DENY == node->prefix.type)
+            return &node->prefix;
+        else if (ROUTE_NONE != node->prefix.type)
+            best = &node->prefix;
+    }
+
+    if (rt->ext.count) {
+        /* only the last segment carries an extension */
+        name = strrchr(path, '/');
+        name = (NULL == name) ? path : name + 1;
+
+        if (NULL != (dot = strrchr(name, '.')) && '\0' != dot[1])
+            ext = (const route_t *)hash_get(&rt->ext, dot + 1);
+
+        if (NULL != ext && ROUTE_DENY == ext->type)
+            return ext;
+    }
+
+    if (NULL != node && NULL == seg && ROUTE_NONE != node->exact.type)
+        return &node->exact;
+
+    if (NULL != best)
+        return best;
+
+    return ext;
+}
+
+/**
+ * free everything in a routing table
+ * @param rt the routing table
+ */
+void srv_router_destroy(router_t * rt)
+{
+#ifdef DEBUG
+    assert(NULL != rt);
+#endif
+
+    _srv_route_free_node(&rt->root);
+    hash_destroy(&rt->ext);
+
+    rt->count = 0;
+    rt->compiled = 0;
+}
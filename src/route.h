@@ -0,0 +1,82 @@
+/* route.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef SRV_ROUTE_H
+#define SRV_ROUTE_H
+
+#include <util/hash.h>
+
+#include <srv/conf.h>
+
+/* what a matched route does */
+#define ROUTE_NONE    0
+#define ROUTE_DENY    1
+#define ROUTE_MODULE  2
+#define ROUTE_PROXY   3
+#define ROUTE_FCGI    4
+
+typedef struct _route_t {
+    unsigned int type;
+    unsigned int prio;
+    void *data;
+} route_t;
+
+/* one path segment in the tree */
+struct _route_node {
+    char *seg;
+    size_t seglen;
+
+    /* the path ending here, and the path plus everything below it */
+    route_t exact;
+    route_t prefix;
+
+    /* sorted by segment once compiled */
+    struct _route_node **kids;
+    unsigned int kid_cnt;
+    unsigned int kid_slots;
+};
+
+typedef struct _router_t {
+    struct _route_node root;
+
+    /* file extension -> route_t */
+    hash_t ext;
+
+    unsigned int count;
+    unsigned int compiled;
+} router_t;
+
+/* initialize an empty routing table */
+int srv_router_init(router_t *);
+/* add a route, matched by SRV_HANDLER_FILE, _DIR or _EXT */
+int srv_router_add(router_t *, unsigned int, const char *, unsigned int,
+                   unsigned int, void *);
+/* finalize the table for lookups */
+void srv_router_compile(router_t *);
+/* find the route for a request path, NULL if there is none */
+const route_t *srv_router_lookup(router_t *, const char *);
+/* free everything in the table */
+void srv_router_destroy(router_t *);
+
+#endif
@@ -22,6 +22,8 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,32 +35,95 @@
 #include <regex.h>
 #include <fcntl.h>
 #include <dlfcn.h>
+#include <stdint.h>
+#include <time.h>
+#include <signal.h>
+#include <poll.h>
 
 #include <pthread.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/sendfile.h>
 #include <pwd.h>
 #include <grp.h>
 
 #include <event.h>
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#define HAVE_EPOLL 1
+#endif
+
 #include <util/util.h>
 #include <util/hash.h>
+#include <util/chash.h>
 #include <util/stack.h>
 #include <util/thread.h>
+#include <util/cpu.h>
+#include <util/coro.h>
+#include <util/buf.h>
+#include <util/slab.h>
+#include <util/uring.h>
+#include <util/wheel.h>
 
 #include <srv/conn.h>
 #include <srv/conf.h>
 #include <srv/resp.h>
 #include <srv/req.h>
-
-#define SRV_VHOST_MAX 128
-#define SRV_TPOOL_MAX 16
-#define SRV_CONN_MAX  128
-
-struct _workunit {
-    int fd;
-};
+#include <srv/route.h>
+#include <srv/path.h>
+#include <srv/warm.h>
+#include <srv/mem.h>
+#include <srv/disk.h>
+#include <srv/vhost.h>
+#include <srv/proxy.h>
+#include <srv/fcgi.h>
+#include <srv/cache.h>
+
+#define SRV_WORKERS_PER_CPU 4
+/* descriptors beyond max_conn: listeners, open files and the like */
+#define SRV_CONN_SPARE  256
+#define SRV_ACCEPT_BATCH 64
+/* timeouts, in ms, and how finely the timing wheel keeps time */
+#define SRV_TIMEOUT_HEADER 10000
+#define SRV_TIMEOUT_SEND   30000
+#define SRV_WHEEL_TICK     100
+
+/* io_uring: queue size, and how much of a file we send at a time */
+#define SRV_URING_ENTRIES 256
+#define SRV_URING_CHUNK   (64 * 1024)
+
+/* how much of a file we send at a time otherwise */
+#define SRV_SEND_CHUNK    (16 * 1024)
+
+/* what a completion was for, kept in the top half of its data */
+#define SRV_URING_ACCEPT  1
+#define SRV_URING_RECV    2
+#define SRV_URING_HEAD    3
+#define SRV_URING_OPEN    4
+#define SRV_URING_READ    5
+#define SRV_URING_SEND    6
+#define SRV_URING_SHUT    7
+#define SRV_URING_CLOSE   8
+#define SRV_URING_DROP    9
+#define SRV_URING_TICK    10
+#define SRV_URING_WAKE    11
+
+/* epoll: events per wait, and how listeners and the wake pipe are told
+ * apart */
+#define SRV_EPOLL_EVENTS  256
+#define SRV_EPOLL_LISTEN  (1ULL << 32)
+#define SRV_EPOLL_WAKE    (1ULL << 33)
+
+/* work for the pool is a connection's fd + 1, as a NULL job is how a
+ * worker is told to stop, and fd 0 is fair game with stdin closed */
+#define SRV_JOB(fd)      ((void *)((intptr_t)(fd) + 1))
+#define SRV_JOB_FD(job)  ((int)((intptr_t)(job) - 1))
+
+#define SRV_URING_DATA(op, fd) \
+    (((unsigned long long)(op) << 32) | (unsigned int)(fd))
 
 #if 0
 #define DEBUG
@@ -69,19 +134,68 @@ struct _workunit {
 /* our global config */
 static conf_t conf;
 
-/* the pool of connections */
-static conn_t pool[SRV_CONN_MAX];
+/* the pool of connections, one for every descriptor we could get */
+static conn_t *pool;
+static unsigned int pool_slots;
+
+/* requests go through the thread pool */
+static unsigned int threaded;
 
 /* thread pool */
 static tpool_t tp;
 
-/* pregenerated 403 response */
-static resp_t rp[SRV_CACHE_MAX];
-/* list of hidden files and folders */
-static hash_t cache;
+/* module and proxied responses kept on disk */
+static cache_t cache;
+
+/* the docroot, compiled, if we're serving one */
+static pack_t pack;
+
+/* when the busiest paths were last written out, in ms */
+static unsigned long long warm_saved;
+
+/* when the memory governor last had a look, in ms */
+static unsigned long long mem_checked;
+
+/* the ring, when io_uring drives the sockets */
+static uring_t ring;
+
+/* the epoll set, when we drive it ourselves */
+static int epfd = -1;
+
+/* connections that can go on, now that the disk pool or a worker is
+ * done with them, and the pipe that wakes the event loop for them. the
+ * ring reads from it into wake_byte. */
+static pthread_mutex_t wake_mt = PTHREAD_MUTEX_INITIALIZER;
+static conn_t *wake_list;
+static int wake_pipe[2] = { -1, -1 };
+static struct event wake_ev;
+static char wake_byte[64];
+
+/* the threads that build responses for coroutines and the ring, so a
+ * slow module, stat or directory listing never holds up the event loop */
+static tpool_t offload;
+static int offloading;
+
+/* connection timeouts, moved along by the event loop. connections are
+ * closed wherever they finish, and take their timers with them, so
+ * it's locked */
+static wheel_t wheel;
+static pthread_mutex_t wheel_mt = PTHREAD_MUTEX_INITIALIZER;
+static struct event tick_ev;
+
+/* SIGUSR1 asks for the allocator stats */
+static volatile sig_atomic_t want_stats;
+
+/* the sites we serve, each with its own hidden paths and module
+ * handlers, compiled at startup */
+static vhosts_t vhosts;
+
+/* where requests under each proxy's prefix go */
+static proxy_t proxies[SRV_PROXY_MAX];
+
+/* and what each FastCGI pool answers */
+static fcgi_t fcgis[SRV_FCGI_MAX];
 
-/* list of paths and the module to execute with */
-static hash_t mps;
 /* modules */
 static struct _modfunc mods[SRV_MODULE_MAX];
 
@@ -89,140 +203,507 @@ static struct _modfunc mods[SRV_MODULE_MAX];
 
 /* accept a new connection */
 void srv_accept_new_conn(int, short, void *);
+/* set up and start on a connection we accepted */
+void srv_conn_start(int, struct sockaddr_in *);
+/* size the connection pool */
+int srv_pool_init(void);
 /* handle activity on a connection */
 void srv_conn_handle_activity(int, short, void *);
 /* threadpool handler function */
 void *srv_threadpool_handler(void *);
 /* the client has sent their request */
 int srv_conn_req_ready(conn_t *);
+/* build the response to a parsed request */
+int srv_conn_req_handle(conn_t *);
 /* we've successfully generated our response */
 int srv_conn_resp_ready(conn_t *);
 /* send some pregenerated data */
 int srv_conn_send_pregen(conn_t *);
 /* send data from a file, not pregen'd */
 int srv_conn_send_file(conn_t *);
+/* send a cache hit with sendfile */
+int srv_conn_sendfile(conn_t *);
+/* read the next chunk of a file, from memory or by the disk pool */
+ssize_t srv_conn_read_file(conn_t *, size_t);
+/* the disk pool has read a chunk for a connection */
+void srv_conn_disk_done(disk_job_t *);
+/* have the event loop resume a coroutine, from any thread */
+void srv_conn_wake(conn_t *);
+/* on the event loop: resume the coroutines that can go on */
+void srv_wake(int, short, void *);
+/* build a coroutine's response on the offload pool */
+int srv_conn_req_offload(conn_t *);
+void *srv_offload_handler(void *);
+/* the ring: a response built on the offload pool is ready to go */
+void srv_uring_handled(conn_t *);
+/* wait for a socket that would block */
+int srv_conn_wait(conn_t *, short);
+/* answer a request we won't serve with a canned error */
+void srv_conn_reject(int, unsigned int);
+/* which error a request too big for its buffer gets */
+unsigned int srv_conn_too_big(buf_t *);
+/* have the event loop tell us when a connection is ready */
+void srv_conn_watch(conn_t *, short);
+/* start the clock on a connection, and note when it gets somewhere */
+void srv_conn_timer(conn_t *);
+void srv_conn_progress(conn_t *);
+/* start or continue a connection's coroutine */
+void srv_conn_resume(conn_t *);
+/* once a tick, whatever drives the sockets */
+void srv_housekeep(void);
+/* run the server off io_uring completions */
+int srv_uring_run(void);
+/* run the server off our own epoll set */
+int srv_epoll_run(void);
 
 /* end declarations */
 
-void *srv_cache_alloc(const void *arg)
+/**
+ * a clock for queueing delays, in ms
+ */
+unsigned long long srv_now_ms(void)
 {
-    struct _respptr *pt = calloc(1, sizeof *pt);
+    struct timespec ts;
 
-    if (NULL != pt)
-        pt->r = (resp_t *) arg;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    return (void *)pt;
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-void srv_cache_free(void *a)
+/**
+ * print what the memory governor knows
+ */
+void srv_mem_report(void)
 {
-    struct _respptr *pt = (struct _respptr *)a;
-    pt->r = NULL;
+    const mem_t *m = srv_mem_state();
+
+    fprintf(stderr, "memory: %lluk used of %lluk, stalled %u.%02u%%, "
+            "pools may keep %luk of %luk, holding %luk\n",
+            m->used >> 10, m->limit >> 10, m->stall / 100, m->stall % 100,
+            (long unsigned)m->budget >> 10, (long unsigned)m->ceiling >> 10,
+            (long unsigned)m->held >> 10);
 }
 
-int srv_cache_valcmp(const void *a, const void *b)
+/**
+ * print how each device's disk threads are doing
+ */
+void srv_disk_report(const disk_stats_t * st, void *arg)
 {
-    resp_t *r1 = ((struct _respptr *)a)->r;
-    resp_t *r2 = ((struct _respptr *)b)->r;
+    fprintf(stderr, "disk %u:%u: %u threads, %u queued, %llu reads\n",
+            major(st->dev), minor(st->dev), st->depth, st->queued,
+            st->reads);
+}
 
-    return (!strncmp(r1->file, r2->file, strlen(r1->file))) ? 0 : 1;
+/**
+ * print how each slab is doing
+ */
+void srv_slab_report(const slab_stats_t * st, void *arg)
+{
+    fprintf(stderr, "slab %-16s %5lub: %llu carved, %llu in use, "
+            "%u spare, %llu allocs, %llu frees\n", st->name,
+            (unsigned long)st->size, st->carved, st->used, st->depot,
+            st->allocs, st->frees);
 }
 
-void *srv_modhash_alloc(const void *arg)
+/**
+ * print how each proxy's upstreams are doing
+ */
+void srv_proxy_report(void)
 {
-    struct _modfunc *mf = (struct _modfunc *)arg;
+    upstream_t *up;
+    unsigned int i, j;
 
-    return (void *)mf;
+    for (i = 0; i < conf.proxy_cnt; i++) {
+        for (j = 0; j < proxies[i].count; j++) {
+            up = &proxies[i].ups[j];
+            fprintf(stderr, "proxy %s -> %s: %s, %u active, %u idle, "
+                    "%llu served, %llu failed\n", proxies[i].prefix,
+                    up->name, (up->down) ? "down" : "up", up->active,
+                    up->idle_cnt, up->served, up->failed);
+        }
+    }
 }
 
-void srv_modhash_free(void *a)
+/**
+ * print how each FastCGI pool's backends are doing
+ */
+void srv_fcgi_report(void)
 {
-    struct _modfunc *mf = (struct _modfunc *)a;
+    fcgi_backend_t *back;
+    unsigned int i, j, k, open, active;
+
+    for (i = 0; i < conf.fcgi_cnt; i++) {
+        pthread_mutex_lock(&fcgis[i].mt);
+
+        for (j = 0; j < fcgis[i].count; j++) {
+            back = &fcgis[i].backs[j];
+
+            for (k = open = active = 0; k < fcgis[i].conns; k++) {
+                open += (-1 != back->conns[k].fd);
+                active += back->conns[k].active;
+            }
 
-    mf->mod = NULL;
-    mf->func = NULL;
-    memset(mf->path, '\0', sizeof mf->path);
+            fprintf(stderr, "fastcgi %s -> %s: %s, %u open, %u active, "
+                    "%llu served, %llu failed\n", fcgis[i].name, back->name,
+                    (back->down) ? "down" : "up", open, active, back->served,
+                    back->failed);
+        }
+
+        fprintf(stderr, "fastcgi %s: %u waiting, %llu turned away\n",
+                fcgis[i].name, fcgis[i].waiting, fcgis[i].rejected);
+        pthread_mutex_unlock(&fcgis[i].mt);
+    }
 }
 
-int srv_modhash_valcmp(const void *a, const void *b)
+/**
+ * print what the cache has been up to
+ */
+void srv_cache_report(void)
 {
-    struct _modfunc *mfa = (struct _modfunc *)a;
-    struct _modfunc *mfb = (struct _modfunc *)b;
+    if (NULL == cache.dir)
+        return;
+
+    fprintf(stderr, "cache: %u responses in %u segments, %llu hits, "
+            "%llu misses, %llu stored\n", chash_count(&cache.index),
+            cache.count, cache.hits, cache.misses, cache.stores);
+}
 
-    return (mfa->func == mfb->func) ? 0 : 1;
+void srv_stats_signal(int sig)
+{
+    want_stats = 1;
 }
 
-void *srv_threadpool_alloc(void *arg)
+/**
+ * the things that happen once a tick, whatever the event loop: the
+ * timing wheel moves along, we catch up on changes to the docroot, and
+ * stats get printed if asked for
+ */
+void srv_housekeep(void)
 {
-    struct _workunit *wu = calloc(1, sizeof *wu);
+    unsigned long long now = srv_now_ms();
+
+    pthread_mutex_lock(&wheel_mt);
+    wheel_advance(&wheel, now);
+    pthread_mutex_unlock(&wheel_mt);
 
-    if (NULL == wu) {
-        DEBUGF(__FILE__, __LINE__, "allocation error\n");
-        return NULL;
+    srv_path_poll();
+
+    /* keep what's busy on disk, for the next start to warm up on */
+    if (NULL != conf.warm_manifest && now - warm_saved >= SRV_WARM_SAVE_MS) {
+        warm_saved = now;
+        srv_warm_save(conf.warm_manifest);
     }
 
-    /* either set value, or empty */
-    if (NULL != arg)
-        wu->fd = (int)arg;
-    else
-        wu->fd = 0;
+    /* give idle memory back when it's needed elsewhere, and keep the
+     * cache's index to the same budget */
+    if (now - mem_checked >= SRV_MEM_POLL_MS) {
+        mem_checked = now;
+        srv_cache_trim(&cache, srv_mem_poll());
+    }
+
+    if (want_stats) {
+        want_stats = 0;
+        fprintf(stderr, "%u connections open\n", srv_conn_count());
+        srv_mem_report();
+        srv_disk_walk(srv_disk_report, NULL);
+        slab_walk(srv_slab_report, NULL);
+        srv_proxy_report();
+        srv_fcgi_report();
+        srv_cache_report();
+    }
+}
+
+/**
+ * do we have room for one more connection?
+ */
+int srv_conn_admit(int sock)
+{
+    if ((unsigned int)sock >= pool_slots)
+        return 0;
+
+    if (srv_conn_count() >= conf.max_conn)
+        return 0;
+
+    /* the workers are already this far behind */
+    if (threaded && conf.queue_max
+        && (unsigned int)tpool_pending_jobs(&tp) >= conf.queue_max)
+        return 0;
+
+    return 1;
+}
+
+/**
+ * send one of the canned error responses, in one go if the socket will
+ * take it, we're hanging up either way. whatever the client sent is
+ * read and dropped first, closing with it unread would send a reset
+ * instead of our answer.
+ */
+void srv_conn_reject(int sock, unsigned int code)
+{
+    const char *wire;
+    char buf[1024];
+    size_t len;
+
+    while (recv(sock, buf, sizeof buf, MSG_DONTWAIT) > 0) ;
+
+    wire = srv_resp_error_wire(code, &len);
+
+    if (-1 == send(sock, wire, len, MSG_DONTWAIT | MSG_NOSIGNAL))
+        DEBUGF(__FILE__, __LINE__, "(sock:%d) sending error: %s\n", sock,
+               strerror(errno));
+}
+
+/**
+ * a request that filled its buffer: either the request line never ended,
+ * or the headers after it didn't
+ */
+unsigned int srv_conn_too_big(buf_t * buf)
+{
+    return (NULL == memchr(buf->data, '\n', buf->len)) ?
+        RESP_HTTP_414 : RESP_HTTP_413;
+}
+
+/**
+ * turn a connection away with our canned 503
+ */
+void srv_conn_refuse(int sock)
+{
+    DEBUGF(__FILE__, __LINE__, "(sock:%d) full up, refusing\n", sock);
 
-    return (void *)wu;
+    srv_conn_reject(sock, RESP_HTTP_503);
+    shutdown(sock, SHUT_WR);
+    close(sock);
 }
 
 /**
- * accept a new connection
+ * accept new connections, as many as are waiting, up to accept_batch
  */
 void srv_accept_new_conn(int fd, short ev, void *arg)
 {
     int tmp_sock, y = 1;
     struct sockaddr_in tmp_addr;
     socklen_t socklen;
+    unsigned int n;
+
+    for (n = 0; n < conf.accept_batch; n++) {
+        /* accept the connection */
+        socklen = sizeof tmp_addr;
+#ifdef SOCK_NONBLOCK
+        tmp_sock = accept4(fd, (struct sockaddr *)&tmp_addr, &socklen,
+                           SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        tmp_sock = accept(fd, (struct sockaddr *)&tmp_addr, &socklen);
+#endif
+
+        if (-1 == tmp_sock) {
+            if (EAGAIN == errno || EWOULDBLOCK == errno)
+                /* that's all of them */
+                break;
+
+            if (EINTR == errno || ECONNABORTED == errno)
+                continue;
+
+            ERRF(__FILE__, __LINE__, "accepting conn: %s, %d!\n",
+                 strerror(errno), fd);
+            break;
+        }
+
+#ifndef SOCK_NONBLOCK
+        /* make the socket non-blocking */
+        if (fcntl(tmp_sock, F_SETFL, O_NONBLOCK) == -1) {
+            /* failure */
+            ERRF(__FILE__, __LINE__, "non blocking: %s!\n", strerror(errno));
+            close(tmp_sock);
+            continue;
+        }
+#endif
+
+        if (!srv_conn_admit(tmp_sock)) {
+            /* too many concurrent connections */
+            srv_conn_refuse(tmp_sock);
+            continue;
+        }
+
+        /* unset TCP_NODELAY, because that makes shit slower for sends */
+#ifdef TCP_CORK
+        if (setsockopt(tmp_sock, IPPROTO_TCP, TCP_CORK, &y, sizeof y) == -1) {
+            /* couldn't set TCP_CORK */
+            ERRF(__FILE__, __LINE__, "cork: %s!\n", strerror(errno));
+            close(tmp_sock);
+            continue;
+        }
+#endif
+
+        srv_conn_start(tmp_sock, &tmp_addr);
+    }
+}
+
+/**
+ * set up a newly accepted connection, and get it going
+ */
+void srv_conn_start(int sock, struct sockaddr_in *addr)
+{
     conn_t *clnt;
 
-    /* accept the connection */
-    socklen = sizeof tmp_addr;
-    if ((tmp_sock = accept(fd, (struct sockaddr *)&tmp_addr, &socklen)) == -1) {
-        ERRF(__FILE__, __LINE__, "accepting conn: %s, %d!\n",
-             strerror(errno), fd);
+    /* set up the clnt shit */
+    clnt = &pool[sock];
+    clnt->sock = sock;
+    memcpy(&clnt->addr, addr, sizeof clnt->addr);
+
+    clnt->state = CONN_STATE_REQ;
+    clnt->prio = SRV_PRIO_NORMAL;
+    clnt->worker = -1;
+    srv_conn_opened(clnt);
+    srv_conn_timer(clnt);
+
+    if (SRV_EXEC_CORO == conf.exec) {
+        /* the request is often here already, go straight for it */
+        srv_conn_resume(clnt);
         return;
     }
 
-    if (tmp_sock >= (signed)sizeof pool) {
-        /* too many concurrent connections */
-        ERRF(__FILE__, __LINE__, "accepting conn: too many!\n");
-        close(tmp_sock);
+    /* notify when ready to read request */
+    srv_conn_watch(clnt, EV_READ);
+}
+
+/**
+ * when a connection runs out of time: a while after it was accepted if
+ * we're still waiting on its request, or a while after it last took
+ * some of its response. conn_time caps both.
+ */
+unsigned long long srv_conn_deadline(conn_t * clnt)
+{
+    unsigned long long due;
+
+    if (CONN_STATE_REQ == __atomic_load_n(&clnt->state, __ATOMIC_RELAXED))
+        due = clnt->born + conf.timeout_header;
+    else
+        due = __atomic_load_n(&clnt->active, __ATOMIC_RELAXED)
+            + conf.timeout_send;
+
+    if (conf.conn_time && clnt->born + conf.conn_time * 1000ULL < due)
+        due = clnt->born + conf.conn_time * 1000ULL;
+
+    return due;
+}
+
+/**
+ * start the clock on a new connection. only ever on the event loop.
+ */
+void srv_conn_timer(conn_t * clnt)
+{
+    clnt->born = clnt->active = srv_now_ms();
+    clnt->timer.data = clnt;
+
+    pthread_mutex_lock(&wheel_mt);
+    wheel_add(&wheel, &clnt->timer, srv_conn_deadline(clnt));
+    pthread_mutex_unlock(&wheel_mt);
+}
+
+/**
+ * stop the clock on a connection that's closing, from any thread. once
+ * this returns its timer can't fire, or be firing, so the socket can
+ * be closed without a late timeout shutting down whatever gets its
+ * number next.
+ */
+void srv_conn_untime(conn_t * clnt)
+{
+    pthread_mutex_lock(&wheel_mt);
+    wheel_del(&wheel, &clnt->timer);
+    pthread_mutex_unlock(&wheel_mt);
+}
+
+/**
+ * note that a connection got somewhere. workers only ever touch the
+ * timestamp, the event loop looks at it when the timer comes up.
+ */
+void srv_conn_progress(conn_t * clnt)
+{
+    __atomic_store_n(&clnt->active, srv_now_ms(), __ATOMIC_RELAXED);
+}
+
+/**
+ * a connection's timer came up. if it got somewhere since it was set,
+ * set it again. otherwise shut the socket down under whoever has it, be
+ * that the event loop, a worker or a coroutine: their next recv or send
+ * fails, and they clean up as they would for any other dead client.
+ * called with the wheel locked, so the socket can't be closed under us.
+ */
+void srv_conn_expire(wtimer_t * t)
+{
+    conn_t *clnt = (conn_t *) t->data;
+    unsigned long long due;
+    const char *wire;
+    size_t len;
+    int sock;
+
+    sock = __atomic_load_n(&clnt->sock, __ATOMIC_RELAXED);
+
+    /* already cleaned up, or the ring is closing it */
+    if (-1 == sock || clnt->closing
+        || CONN_STATE_NEW == __atomic_load_n(&clnt->state, __ATOMIC_RELAXED))
         return;
-    }
 
-    /* make the socket non-blocking */
-    if (fcntl(tmp_sock, F_SETFL, O_NONBLOCK) == -1) {
-        /* failure */
-        ERRF(__FILE__, __LINE__, "non blocking: %s!\n", strerror(errno));
-        close(tmp_sock);
+    if ((due = srv_conn_deadline(clnt)) > srv_now_ms()) {
+        wheel_add(&wheel, t, due);
         return;
     }
 
-    /* unset TCP_NODELAY, because that makes shit slower for sends */
-#ifdef TCP_CORK
-    if (setsockopt(tmp_sock, IPPROTO_TCP, TCP_CORK, &y, sizeof y) == -1) {
-        /* couldn't set TCP_CORK */
-        ERRF(__FILE__, __LINE__, "cork: %s!\n", strerror(errno));
-        close(tmp_sock);
-        return;
+    DEBUGF(__FILE__, __LINE__, "(sock:%d) timed out, hanging up\n", sock);
+
+    /* never got the whole request, so tell them why. whoever has the
+     * socket may still be reading from it, so nothing is drained */
+    if (CONN_STATE_REQ == __atomic_load_n(&clnt->state, __ATOMIC_RELAXED)) {
+        wire = srv_resp_error_wire(RESP_HTTP_408, &len);
+        send(sock, wire, len, MSG_DONTWAIT | MSG_NOSIGNAL);
     }
-#endif
 
-    /* set up the clnt shit */
-    clnt = &pool[tmp_sock];
-    clnt->sock = tmp_sock;
-    memcpy(&clnt->addr, &tmp_addr, sizeof clnt->addr);
+    shutdown(sock, SHUT_RDWR);
+}
 
-    clnt->state = CONN_STATE_REQ;
+/**
+ * move the timing wheel along, for libevent
+ */
+void srv_tick(int fd, short ev, void *arg)
+{
+    struct timeval tv;
 
-    /* notify when ready to read request */
-    event_set(&clnt->ev, clnt->sock,
-              EV_READ | EV_PERSIST, srv_conn_handle_activity, NULL);
+    srv_housekeep();
+
+    tv.tv_sec = SRV_WHEEL_TICK / 1000;
+    tv.tv_usec = (SRV_WHEEL_TICK % 1000) * 1000;
+    evtimer_add(&tick_ev, &tv);
+}
+
+/**
+ * have the event loop hand us a connection once it's ready to read or
+ * write. it fires once, and has to be watched again after that. epoll
+ * does it with a single thread-safe epoll_ctl, and none at all to stop.
+ */
+void srv_conn_watch(conn_t * clnt, short ev)
+{
+#ifdef HAVE_EPOLL
+    struct epoll_event ee;
+
+    if (-1 != epfd) {
+        ee.events = EPOLLET | EPOLLONESHOT;
+        ee.events |= (EV_READ == ev) ? EPOLLIN : EPOLLOUT;
+        ee.data.u64 = clnt->sock;
+
+        /* registered once per connection, and rearmed from then on */
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, clnt->sock, &ee)
+            && (ENOENT != errno
+                || epoll_ctl(epfd, EPOLL_CTL_ADD, clnt->sock, &ee))) {
+            ERRF(__FILE__, __LINE__, "(sock:%d) epoll_ctl: %s!\n",
+                 clnt->sock, strerror(errno));
+            srv_conn_cleanup(clnt);
+        }
+
+        return;
+    }
+#endif
+
+    event_set(&clnt->ev, clnt->sock, ev, srv_conn_handle_activity, NULL);
     event_add(&clnt->ev, NULL);
 }
 
@@ -231,52 +712,160 @@ void srv_accept_new_conn(int fd, short ev, void *arg)
  */
 void srv_conn_handle_activity(int fd, short ev, void *arg)
 {
-    event_del(&pool[fd].ev);
-    tpool_add_work(&tp, (void *)fd);
+    conn_t *clnt = &pool[fd];
+
+    /* epoll disarmed it for us */
+    if (-1 == epfd)
+        event_del(&clnt->ev);
+
+    if (SRV_EXEC_CORO == conf.exec) {
+        /* pick up where it stepped aside */
+        srv_conn_resume(clnt);
+        return;
+    }
+
+    /* the SRV_PRIO_ classes line up with the pool's */
+    clnt->queued = srv_now_ms();
+
+    /* back to the worker that has our conn_t warm in its cache */
+    if (!tpool_add_work_to(&tp, SRV_JOB(fd), clnt->prio,
+                           clnt->worker)) {
+        ERRF(__FILE__, __LINE__, "(sock:%d) couldn't queue!\n", fd);
+        srv_conn_cleanup(clnt);
+    }
+}
+
+/**
+ * has this request waited longer for a worker than we allow?
+ */
+int srv_conn_overdue(conn_t * clnt)
+{
+    return (conf.queue_budget
+            && srv_now_ms() - clnt->queued > conf.queue_budget);
 }
 
-/* threadpool controller */
-void *srv_threadpool_controller(void *arg)
+/**
+ * turn away a request that waited too long, before doing any work on it
+ */
+void srv_conn_shed(conn_t * clnt)
 {
-    unsigned int i;
-    struct _worker_t *w;
-    struct _workunit *wu;
+    DEBUGF(__FILE__, __LINE__, "(sock:%d) over queue budget, shedding\n",
+           clnt->sock);
 
-    w = &tp.boss;
+    if (SRV_SHED_503 == conf.queue_shed) {
+        srv_resp_error(&clnt->resp, RESP_HTTP_503);
+        clnt->resp.headlen = strlen(clnt->resp.header);
 
-    for (;;) {
-        wu = NULL;
+        if (srv_conn_resp_ready(clnt))
+            srv_conn_send_pregen(clnt);
+    }
 
-        /* block until there is work */
-        pthread_mutex_lock(&w->mt);
+    srv_conn_cleanup(clnt);
+}
 
-        while (NULL != (wu = tpool_get_work(&tp))) {
-            /* there is a pending job */
-            for (i = 0; i < tp.cnt; i++) {
-                /* find an available thread */
-                if (!tp.pool[i].busy) {
-                    /* assign work, unlock mutex */
-                    tp.pool[i].job = wu->fd;
-                    free(wu);
-                    wu = NULL;
+/**
+ * move a parsed request into the class of the route that handles it.
+ * returns 1 if it went back on the queue, and we should leave it be.
+ */
+int srv_conn_requeue(conn_t * clnt)
+{
+    unsigned int prio;
 
-                    /* pull the trigger */
-                    pthread_mutex_unlock(&tp.pool[i].mt);
+    if (!clnt->site->prio_routes)
+        return 0;
 
-                    break;
-                }
-            }
+    prio = srv_resp_prio(clnt->site, clnt->req.path);
 
-            if (tp.cnt == i) {
-                /* there were no available threads, throw back on stack */
-                tpool_add_work(&tp, (void *)wu->fd);
-                free(wu);
-                wu = NULL;
-            }
+    if (prio <= clnt->prio) {
+        /* no less urgent than where it waited, so run it now */
+        clnt->prio = prio;
+        return 0;
+    }
+
+    /* keep the original queued time, the budget covers both waits */
+    clnt->prio = prio;
+
+    if (!tpool_add_work_to(&tp, SRV_JOB(clnt->sock), prio,
+                           clnt->worker)) {
+        ERRF(__FILE__, __LINE__, "(sock:%d) couldn't requeue!\n",
+             clnt->sock);
+        srv_conn_cleanup(clnt);
+    }
+
+    return 1;
+}
+
+/**
+ * a connection from start to finish, run as a coroutine on the event loop
+ */
+void srv_conn_coro(void *arg)
+{
+    conn_t *clnt = (conn_t *) arg;
+
+    if (!srv_conn_req_ready(clnt)) {
+        ERRF(__FILE__, __LINE__, "reading request!\n");
+    } else if (!srv_conn_req_offload(clnt)) {
+        ERRF(__FILE__, __LINE__, "handling request!\n");
+    } else if (CONN_STATE_DESTROY == clnt->state) {
+        /* proxied, there's nothing left to send */
+    } else if (!srv_conn_resp_ready(clnt)) {
+        DEBUGF(__FILE__, __LINE__,
+               "(sock:%d) problem with sending response!\n", clnt->sock);
+    } else if (!clnt->resp.pregen) {
+        if (!srv_conn_send_file(clnt)) {
+            DEBUGF(__FILE__, __LINE__,
+                   "(sock:%d) problem sending file!\n", clnt->sock);
         }
+    } else if (!srv_conn_send_pregen(clnt)) {
+        DEBUGF(__FILE__, __LINE__,
+               "(sock:%d) problem sending pregen!\n", clnt->sock);
     }
 
-    return NULL;
+    /* and we're done! */
+    srv_conn_cleanup(clnt);
+}
+
+/**
+ * run a connection's coroutine until it has to wait, or is done
+ */
+void srv_conn_resume(conn_t * clnt)
+{
+    if (NULL == clnt->co
+        && NULL == (clnt->co = coro_new(srv_conn_coro, clnt))) {
+        ERRF(__FILE__, __LINE__, "(sock:%d) couldn't start coroutine!\n",
+             clnt->sock);
+        srv_conn_cleanup(clnt);
+        return;
+    }
+
+    if (!coro_resume(clnt->co)) {
+        /* finished, the stack goes back for the next one */
+        coro_free(clnt->co);
+        clnt->co = NULL;
+    }
+}
+
+/**
+ * wait for a socket that would block. a coroutine steps aside until the
+ * event loop sees it ready, a worker thread just sits on it. either way
+ * the timing wheel hangs up on a client that takes too long, and we
+ * find out on the next recv or send.
+ */
+int srv_conn_wait(conn_t * clnt, short ev)
+{
+    struct pollfd pfd;
+
+    if (NULL != coro_self()) {
+        srv_conn_watch(clnt, ev);
+        coro_yield();
+        return 1;
+    }
+
+    pfd.fd = clnt->sock;
+    pfd.events = (EV_READ == ev) ? POLLIN : POLLOUT;
+    pfd.revents = 0;
+
+    return (poll(&pfd, 1, -1) > 0);
 }
 
 /* threadpool handler thread for all threads in the pool */
@@ -284,47 +873,66 @@ void *srv_threadpool_handler(void *arg)
 {
     struct _worker_t *w;
     conn_t *clnt;
+    void *job;
 
     /* who am i? */
-    w = &tp.pool[(int)arg];
+    w = &tp.pool[(intptr_t) arg];
 
-    /* infinite loop */
-    for (;;) {
-        /* block until we have work */
-        pthread_mutex_lock(&w->mt);
+    /* the SRV_PIN_ modes line up with the CPU_PIN_ ones */
+    cpu_pin_self(w->id, conf.workers_pin);
 
+    /* block until we have work, or the pool is shutting down */
+    while (NULL != (job = tpool_wait_work(&tp, w->id))) {
         /* let's do this */
         w->busy = 1;
+        w->job = (intptr_t) job;
 
         if (w->job) {
-            clnt = &pool[w->job];
+            clnt = &pool[SRV_JOB_FD(job)];
+            clnt->worker = w->id;
 
-            if (CONN_STATE_REQ == clnt->state) {
-                if (!srv_conn_req_ready(clnt)) {
+            if (CONN_STATE_REQ == clnt->state
+                || CONN_STATE_PARSED == clnt->state) {
+                if (CONN_STATE_REQ == clnt->state
+                    && !srv_conn_req_ready(clnt)) {
                     ERRF(__FILE__, __LINE__, "reading request!\n");
                     srv_conn_cleanup(clnt);
+                } else if (srv_conn_overdue(clnt)) {
+                    /* waited too long, don't make it worse */
+                    srv_conn_shed(clnt);
+                } else if (srv_conn_requeue(clnt)) {
+                    /* waits again, in its own class */
+                } else if (!srv_conn_req_handle(clnt)) {
+                    ERRF(__FILE__, __LINE__, "handling request!\n");
+                    srv_conn_cleanup(clnt);
+                } else if (CONN_STATE_DESTROY == clnt->state) {
+                    /* proxied, there's nothing left to send */
+                    srv_conn_cleanup(clnt);
                 } else {
-                    /* notify when ready to read request */
-                    event_set(&clnt->ev, clnt->sock,
-                              EV_WRITE | EV_PERSIST,
-                              srv_conn_handle_activity, NULL);
-                    event_add(&clnt->ev, NULL);
+                    /* notify when ready to send the response */
+                    srv_conn_watch(clnt, EV_WRITE);
                 }
-            } else if (CONN_STATE_RESP == clnt->state) {
-                /* ready to send the HTTP response to the client */
-                if (!srv_conn_resp_ready(clnt)) {
+            } else if (CONN_STATE_RESP == clnt->state
+                       || CONN_STATE_SEND == clnt->state) {
+                /* ready to send the HTTP response to the client, or back
+                 * with the next chunk of the file the disk pool read */
+                if (CONN_STATE_RESP == clnt->state
+                    && !srv_conn_resp_ready(clnt)) {
                     DEBUGF(__FILE__, __LINE__,
                            "(sock:%d) problem with sending response!\n",
                            clnt->sock);
-                    srv_conn_cleanup(clnt);
-                }
-
-                /* ready to send our data to the client */
-                if (!clnt->resp.pregen) {
+                } else if (!clnt->resp.pregen) {
                     /* sending a file */
-                    if (!srv_conn_send_file(clnt)) {
+                    switch (srv_conn_send_file(clnt)) {
+                    case 0:
                         DEBUGF(__FILE__, __LINE__,
                                "(sock:%d) problem sending file!\n", clnt->sock);
+                        break;
+
+                    case 2:
+                        /* the disk pool has it now, hands off */
+                        clnt = NULL;
+                        break;
                     }
                 } else {
                     /* sending pregenerated data, i.e. dir listing */
@@ -335,220 +943,1135 @@ void *srv_threadpool_handler(void *arg)
                     }
                 }
 
-                /* and we're done! */
-                srv_conn_cleanup(clnt);
-            } else {
-                /* and we're done! */
-                srv_conn_cleanup(clnt);
-            }
-        }
+                /* and we're done! */
+                if (NULL != clnt)
+                    srv_conn_cleanup(clnt);
+            } else {
+                /* and we're done! */
+                srv_conn_cleanup(clnt);
+            }
+        }
+
+        w->job = 0;
+        w->busy = 0;
+        clnt = NULL;
+    }
+
+    return NULL;
+}
+
+/**
+ * read a clnt's request
+ */
+int srv_conn_req_ready(conn_t * clnt)
+{
+    ssize_t got;
+    int ok;
+
+#ifdef DEBUG
+    assert(NULL != clnt);
+#endif
+
+    /* get some more shit */
+    for (;;) {
+        if (NULL == clnt->req.buf
+            && NULL == (clnt->req.buf = buf_get(SRV_REQ_MAX_LEN))) {
+            ERRF(__FILE__, __LINE__, "allocating request buffer!\n");
+            return 0;
+        }
+
+        /* leave room for the terminator */
+        got = recv(clnt->sock, clnt->req.buf->data,
+                   clnt->req.buf->size - 1, 0);
+
+        if (-1 != got)
+            break;
+
+        if (EINTR == errno)
+            continue;
+
+        if (EAGAIN == errno) {
+            /* nothing yet, don't sit on a buffer while we wait */
+            buf_put(clnt->req.buf);
+            clnt->req.buf = NULL;
+
+            if (srv_conn_wait(clnt, EV_READ))
+                continue;
+        }
+
+        /* erreur! */
+        ERRF(__FILE__, __LINE__, "receiving data: %s!\n", strerror(errno));
+        return 0;
+    }
+
+    if (!got) {
+        /* hung up on us, or we hung up on them */
+        DEBUGF(__FILE__, __LINE__, "(sock:%d) closed before request\n",
+               clnt->sock);
+        return 0;
+    }
+
+    clnt->req.buf->data[got] = '\0';
+    clnt->req.buf->len = got;
+
+    if (clnt->req.buf->size - 1 == (size_t) got
+        && NULL == strstr(clnt->req.buf->data, "\r\n\r\n")) {
+        /* request the maximum size? fuck you */
+        ERRF(__FILE__, __LINE__,
+             "buffer overflow attempt? killing connection.\n");
+        srv_conn_reject(clnt->sock, srv_conn_too_big(clnt->req.buf));
+        return 0;
+    }
+
+    /* the parse keeps its own copy, the buffer can go back now, unless
+     * a proxy or a script may want to pass the request on as it came */
+    ok = srv_req_parse(&clnt->req);
+
+    if (!conf.proxy_cnt && !conf.fcgi_cnt) {
+        buf_put(clnt->req.buf);
+        clnt->req.buf = NULL;
+    }
+
+    if (!ok) {
+        /* bad request, disconnect */
+        ERRF(__FILE__, __LINE__, "bad request.\n");
+        srv_conn_reject(clnt->sock, RESP_HTTP_400);
+        return 0;
+    }
+
+    /* which site it's for, once, before anything is looked up */
+    clnt->site = srv_vhost_find(&vhosts, clnt->req.host);
+    clnt->state = CONN_STATE_PARSED;
+    srv_conn_progress(clnt);
+
+    return 1;
+}
+
+/**
+ * generate the response to a parsed request
+ */
+int srv_conn_req_handle(conn_t * clnt)
+{
+#ifdef DEBUG
+    assert(NULL != clnt);
+#endif
+
+    if (!srv_resp_generate(&clnt->resp, clnt->site, &clnt->req, &cache)) {
+        /* couldn't build the response? */
+        ERRF(__FILE__, __LINE__, "error generating response.\n");
+        srv_resp_error(&clnt->resp, RESP_HTTP_500);
+    }
+
+    if (NULL != clnt->resp.proxy) {
+        /* someone else's to answer, and answered right here, start to
+         * finish. nothing's left to send after */
+        srv_proxy_serve(clnt->resp.proxy, clnt, srv_conn_progress);
+        clnt->state = CONN_STATE_DESTROY;
+    } else if (NULL != clnt->resp.fcgi) {
+        /* the same for a script, through its backends */
+        srv_fcgi_serve(clnt->resp.fcgi, clnt, srv_conn_progress);
+        clnt->state = CONN_STATE_DESTROY;
+    } else {
+        clnt->resp.headlen = strlen(clnt->resp.header);
+        clnt->state = CONN_STATE_RESP;
+    }
+
+    buf_put(clnt->req.buf);
+    clnt->req.buf = NULL;
+
+    return 1;
+}
+
+/**
+ * send the header
+ */
+int srv_conn_resp_ready(conn_t * clnt)
+{
+    ssize_t sent;
+    size_t pos = 0;
+
+#ifdef DEBUG
+    assert(NULL != clnt);
+#endif
+
+    while (pos < clnt->resp.headlen) {
+        if (!(sent = send(clnt->sock, &clnt->resp.header[pos],
+                          clnt->resp.headlen - pos, 0))) {
+            ERRF(__FILE__, __LINE__, "(sock:%d) sending error...\n",
+                 clnt->sock);
+            return 0;
+        } else if (sent == -1) {
+            /* errno is set */
+            switch (errno) {
+            case EINTR:
+                continue;
+
+            case EAGAIN:
+                /* full socket buffer, wait for it to drain */
+                if (srv_conn_wait(clnt, EV_WRITE))
+                    continue;
+
+                ERRF(__FILE__, __LINE__,
+                     "(sock:%d) timed out sending\n", clnt->sock);
+                return 0;
+
+            case EPIPE:
+            default:
+                /* problem */
+                ERRF(__FILE__, __LINE__,
+                     "(sock:%d) unrecoverable send error", clnt->sock);
+                return 0;
+            }
+        }
+
+        pos += sent;
+        srv_conn_progress(clnt);
+    }
+
+    /* now lets send the data! */
+    if (clnt->resp.fd) {
+        /* already open, out of the cache */
+        clnt->fd = clnt->resp.fd;
+        clnt->resp.fd = 0;
+    } else if (!clnt->resp.pregen) {
+        /* we're sending a file */
+        if (-1 == (clnt->fd = open(clnt->resp.file, O_RDONLY))) {
+            ERRF(__FILE__, __LINE__, "opening file for sending!\n");
+            clnt->fd = 0;
+            return 0;
+        }
+    }
+
+    clnt->state = CONN_STATE_SEND;
+
+    return 1;
+}
+
+/**
+ * send the pregenerated data (403/404/dir listing)
+ */
+int srv_conn_send_pregen(conn_t * clnt)
+{
+    ssize_t sent;
+
+#ifdef DEBUG
+    assert(NULL != clnt);
+#endif
+
+    /* send some of the data */
+    while (clnt->resp.pos < clnt->resp.len) {
+        if (!(sent = send(clnt->sock,
+                          &clnt->resp.data[clnt->resp.pos],
+                          clnt->resp.len - clnt->resp.pos, 0))) {
+            /* failure :'( */
+            ERRF(__FILE__, __LINE__, "send: %s!\n", strerror(errno));
+            return 0;
+        } else if (sent == -1) {
+            /* errno is set */
+            switch (errno) {
+            case EINTR:
+                continue;
+
+            case EAGAIN:
+                /* we'll wait and try again */
+                DEBUGF(__FILE__, __LINE__,
+                       "(sock:%d) minor send issue, retrying\n", clnt->sock);
+                if (srv_conn_wait(clnt, EV_WRITE))
+                    continue;
+
+                ERRF(__FILE__, __LINE__, "send: timed out!\n");
+                return 0;
+
+            case EPIPE:
+            default:
+                /* problem */
+                ERRF(__FILE__, __LINE__, "send: %s!\n", strerror(errno));
+                return 0;
+            }
+        }
+
+        /* advance our shit */
+        clnt->resp.pos += sent;
+        srv_conn_progress(clnt);
+    }
+
+    clnt->state = CONN_STATE_DESTROY;
+
+    return 1;
+}
+
+/**
+ * the disk pool has read a chunk for a connection. a worker can pick
+ * it straight back up, a coroutine is resumed by the event loop.
+ */
+void srv_conn_disk_done(disk_job_t * job)
+{
+    conn_t *clnt = (conn_t *) job->arg;
+
+    if (SRV_EXEC_CORO != conf.exec) {
+        clnt->queued = srv_now_ms();
+
+        if (!tpool_add_work_to(&tp, SRV_JOB(clnt->sock),
+                               clnt->prio, clnt->worker)) {
+            ERRF(__FILE__, __LINE__, "(sock:%d) couldn't queue!\n",
+                 clnt->sock);
+            srv_conn_cleanup(clnt);
+        }
+
+        return;
+    }
+
+    srv_conn_wake(clnt);
+}
+
+/**
+ * have the event loop resume a coroutine, which has stepped aside for
+ * some other thread to do something for it. only the event loop touches
+ * libevent, so we wake it through the pipe.
+ */
+void srv_conn_wake(conn_t * clnt)
+{
+    pthread_mutex_lock(&wake_mt);
+    clnt->woken = wake_list;
+    wake_list = clnt;
+    pthread_mutex_unlock(&wake_mt);
+
+    /* a full pipe has a wakeup coming already */
+    while (-1 == write(wake_pipe[1], "", 1) && EINTR == errno) ;
+}
+
+/**
+ * on the event loop: resume every coroutine that can go on, or under
+ * the ring, send the responses the offload pool has built
+ */
+void srv_wake(int fd, short ev, void *arg)
+{
+    conn_t *clnt, *next;
+    char drain[64];
+
+    while (read(wake_pipe[0], drain, sizeof drain) > 0) ;
+
+    pthread_mutex_lock(&wake_mt);
+    clnt = wake_list;
+    wake_list = NULL;
+    pthread_mutex_unlock(&wake_mt);
+
+    for (; NULL != clnt; clnt = next) {
+        next = clnt->woken;
+
+        if (SRV_IO_URING == conf.io)
+            srv_uring_handled(clnt);
+        else
+            srv_conn_resume(clnt);
+    }
+}
+
+/**
+ * build a coroutine's response on the offload pool, and step aside
+ * until it's done. anything could block in there: stat, a directory
+ * listing, a module. a packed docroot never touches the disk, so that's
+ * done right here.
+ */
+int srv_conn_req_offload(conn_t * clnt)
+{
+    if (!offloading || NULL == coro_self()
+        || !tpool_add_work(&offload, SRV_JOB(clnt->sock)))
+        return srv_conn_req_handle(clnt);
+
+    /* resumed once it's built, just the once */
+    coro_yield();
+
+    return 1;
+}
+
+/**
+ * an offload thread: build responses, and hand the coroutines back
+ */
+void *srv_offload_handler(void *arg)
+{
+    unsigned int id = (intptr_t) arg;
+    conn_t *clnt;
+    void *job;
+
+    while (NULL != (job = tpool_wait_work(&offload, id))) {
+        clnt = &pool[SRV_JOB_FD(job)];
+
+        srv_conn_req_handle(clnt);
+        srv_conn_wake(clnt);
+    }
+
+    return NULL;
+}
+
+/**
+ * read the next chunk of a file into clnt->iobuf. what's already in
+ * memory is read right here, the rest is left to the disk pool so we
+ * aren't stuck behind the disk. a coroutine waits for it where it is.
+ * @return what was read, -1 on failure, or -2 if the disk pool has it
+ * and the connection has to be left alone until it comes back
+ */
+ssize_t srv_conn_read_file(conn_t * clnt, size_t len)
+{
+    disk_job_t *job = &clnt->disk;
+    ssize_t got;
+
+    if (NULL != job->buf) {
+        /* back with what the disk pool read for us */
+        job->buf = NULL;
+        errno = job->err;
+        return job->got;
+    }
+
+    got = srv_disk_try(clnt->fd, clnt->iobuf->data, len,
+                       clnt->resp.off + clnt->resp.pos);
+
+    if (-1 != got || EAGAIN != errno)
+        return got;
+
+    job->fd = clnt->fd;
+    job->buf = clnt->iobuf->data;
+    job->len = len;
+    job->off = clnt->resp.off + clnt->resp.pos;
+    job->dev = clnt->resp.dev;
+    job->done = srv_conn_disk_done;
+    job->arg = clnt;
+
+    if (!srv_disk_submit(job)) {
+        /* no pool for this device, wait for it ourselves */
+        job->buf = NULL;
+
+        while (-1 == (got = pread(clnt->fd, clnt->iobuf->data, len,
+                                  clnt->resp.off + clnt->resp.pos))
+               && EINTR == errno) ;
+
+        return got;
+    }
+
+    if (NULL == coro_self())
+        return -2;
+
+    /* the event loop resumes us once it's read. it does so even if the
+     * read beats us here, so we always step aside for it, just once */
+    coro_yield();
+
+    job->buf = NULL;
+    errno = job->err;
+
+    return job->got;
+}
+
+/**
+ * send a cache hit straight out of its segment. only from a worker,
+ * which can wait on the disk if it has to; a coroutine reads it a chunk
+ * at a time like any other file.
+ */
+int srv_conn_sendfile(conn_t * clnt)
+{
+    ssize_t sent;
+    off_t off;
+
+    while (clnt->resp.pos < clnt->resp.len) {
+        off = clnt->resp.off + clnt->resp.pos;
+
+        if ((sent = sendfile(clnt->sock, clnt->fd, &off,
+                             clnt->resp.len - clnt->resp.pos)) > 0) {
+            clnt->resp.pos += sent;
+            srv_conn_progress(clnt);
+            continue;
+        }
+
+        /* the segment's shorter than the index said */
+        if (!sent)
+            break;
+
+        if (EINTR == errno)
+            continue;
+
+        if (EAGAIN == errno && srv_conn_wait(clnt, EV_WRITE))
+            continue;
+
+        ERRF(__FILE__, __LINE__, "sendfile: %s!\n", strerror(errno));
+        return 0;
+    }
+
+    clnt->state = CONN_STATE_DESTROY;
+    DEBUGF(__FILE__, __LINE__, "(sock:%d) sent %lub from the cache\n",
+           clnt->sock, (unsigned long)clnt->resp.pos);
+
+    return 1;
+}
+
+/**
+ * send a file, a chunk at a time through clnt->iobuf, from where we got
+ * to last time. resp.pos is how far into the file we've read, iopos and
+ * iolen what of the last chunk is left to send.
+ * @return 0 on failure, 1 once it's all sent, and 2 if the disk pool is
+ * reading the next chunk: the connection is woken again once it has,
+ * and must be left alone until then
+ */
+int srv_conn_send_file(conn_t * clnt)
+{
+    ssize_t sent = 0;
+    ssize_t got = 0;
+    size_t toget;
+
+#ifdef DEBUG
+    assert(NULL != clnt);
+#endif
+
+    if (clnt->resp.cache && NULL == coro_self())
+        return srv_conn_sendfile(clnt);
+
+    if (NULL == clnt->iobuf
+        && NULL == (clnt->iobuf = buf_get(SRV_SEND_CHUNK))) {
+        ERRF(__FILE__, __LINE__, "allocating send buffer!\n");
+        return 0;
+    }
+
+    for (;;) {
+        /* the rest of the last chunk first */
+        while (clnt->iopos < clnt->iolen) {
+            if (!(sent = send(clnt->sock, &clnt->iobuf->data[clnt->iopos],
+                              clnt->iolen - clnt->iopos, 0))) {
+                /* failure :'( */
+                ERRF(__FILE__, __LINE__, "send: failed!\n");
+                return 0;
+            } else if (sent == -1) {
+                /* errno is set */
+                switch (errno) {
+                case EINTR:
+                    continue;
+
+                case EAGAIN:
+                    /* back that ass up */
+                    if (srv_conn_wait(clnt, EV_WRITE))
+                        continue;
+
+                    ERRF(__FILE__, __LINE__, "send: timed out!\n");
+                    return 0;
+
+                case EPIPE:
+                default:
+                    /* problem */
+                    ERRF(__FILE__, __LINE__, "send: %s!\n", strerror(errno));
+                    return 0;
+                }
+            }
+
+            clnt->iopos += sent;
+            srv_conn_progress(clnt);
+        }
+
+        if (clnt->resp.pos >= clnt->resp.len)
+            break;
+
+        toget = clnt->resp.len - clnt->resp.pos;
+
+        if (toget > clnt->iobuf->size)
+            toget = clnt->iobuf->size;
+
+        if (-2 == (got = srv_conn_read_file(clnt, toget)))
+            return 2;
+
+        if (-1 == got) {
+            ERRF(__FILE__, __LINE__, "read: %s!\n", strerror(errno));
+            return 0;
+        }
+
+        /* shrunk since we stat'ed it, send what there was */
+        if (!got)
+            break;
+
+        clnt->resp.pos += got;
+        clnt->iolen = got;
+        clnt->iopos = 0;
+    }
+
+    clnt->state = CONN_STATE_DESTROY;
+    DEBUGF(__FILE__, __LINE__, "(sock:%d) sent %lub, made it!\n",
+           clnt->sock, (unsigned long)clnt->resp.pos);
+
+    return 1;
+}
+
+/**
+ * accept from a listener, again. multishot where the kernel takes it.
+ */
+void srv_uring_listen(int idx)
+{
+    if (!uring_prep_accept(&ring, pool[idx].sock,
+                           SRV_URING_DATA(SRV_URING_ACCEPT, idx)))
+        ERRF(__FILE__, __LINE__, "can't accept on listener %d!\n", idx);
+}
+
+/**
+ * hang up on a connection, once nothing of its is in flight
+ */
+void srv_uring_finish(conn_t * clnt)
+{
+    int ok;
+
+    if (!clnt->closing)
+        clnt->closing = 1;
+
+    if (clnt->inflight || 2 == clnt->closing)
+        return;
+
+    clnt->closing = 2;
+
+    /* the file slot, if we opened one */
+    if (!clnt->resp.pregen && NULL != clnt->resp.file)
+        uring_prep_close_direct(&ring, clnt->sock,
+                                SRV_URING_DATA(SRV_URING_DROP, clnt->sock));
+
+    /* the close goes ahead even if the shutdown fails */
+    ok = uring_reserve(&ring, 2)
+        && uring_prep_shutdown(&ring, clnt->sock, URING_HARDLINK,
+                               SRV_URING_DATA(SRV_URING_SHUT, clnt->sock))
+        && uring_prep_close(&ring, clnt->sock,
+                            SRV_URING_DATA(SRV_URING_CLOSE, clnt->sock));
+
+    if (!ok) {
+        /* do it by hand then */
+        clnt->closing = 0;
+        srv_conn_cleanup(clnt);
+    }
+}
+
+/**
+ * where the chunk being sent lives
+ */
+char *srv_uring_chunk(conn_t * clnt)
+{
+    return ((clnt->resp.pregen) ? clnt->resp.data : clnt->iobuf->data);
+}
+
+/**
+ * queue up the response: the header, then the body. a file is opened
+ * straight into the slot named after the socket, and its first chunk
+ * read and sent, all in one linked chain. after a short header send,
+ * which breaks the chain, it's queued again from where that got to.
+ */
+int srv_uring_respond(conn_t * clnt)
+{
+    const char *head = clnt->resp.header + clnt->resp.senthead;
+    size_t n, headlen = clnt->resp.headlen - clnt->resp.senthead;
+    unsigned int more;
+    int fd = clnt->sock;
+
+    more = (clnt->resp.len) ? URING_LINK | URING_MORE : 0;
+
+    clnt->resp.pos = 0;
+    clnt->iopos = 0;
+    clnt->state = CONN_STATE_SEND;
+
+    if (clnt->resp.pregen || !clnt->resp.len) {
+        clnt->iolen = clnt->resp.len;
+
+        if (!uring_reserve(&ring, 2)
+            || !uring_prep_send(&ring, fd, head, headlen, more,
+                                SRV_URING_DATA(SRV_URING_HEAD, fd)))
+            return 0;
+
+        ++clnt->inflight;
+
+        if (!clnt->resp.len)
+            return 1;
+
+        if (!uring_prep_send(&ring, fd, clnt->resp.data, clnt->resp.len, 0,
+                             SRV_URING_DATA(SRV_URING_SEND, fd)))
+            return 0;
+
+        ++clnt->inflight;
+
+        return 1;
+    }
+
+    if (NULL == clnt->iobuf
+        && NULL == (clnt->iobuf = buf_get(SRV_URING_CHUNK))) {
+        ERRF(__FILE__, __LINE__, "allocating send buffer!\n");
+        return 0;
+    }
+
+    n = (clnt->resp.len > SRV_URING_CHUNK) ?
+        SRV_URING_CHUNK : clnt->resp.len;
+    clnt->iolen = n;
+
+    if (!uring_reserve(&ring, 4))
+        return 0;
+
+    uring_prep_send(&ring, fd, head, headlen, URING_LINK | URING_MORE,
+                    SRV_URING_DATA(SRV_URING_HEAD, fd));
+
+    if (clnt->resp.fd) {
+        /* a cache segment we already have open goes in the slot, and
+         * is ours to close once it's done */
+        clnt->fd = clnt->resp.fd;
+        clnt->resp.fd = 0;
+        uring_prep_file_direct(&ring, &clnt->fd, fd, URING_LINK,
+                               SRV_URING_DATA(SRV_URING_OPEN, fd));
+    } else {
+        uring_prep_open_direct(&ring, clnt->resp.file, fd, URING_LINK,
+                               SRV_URING_DATA(SRV_URING_OPEN, fd));
+    }
+
+    uring_prep_read_direct(&ring, fd, clnt->iobuf->data, n, clnt->resp.off,
+                           URING_LINK, SRV_URING_DATA(SRV_URING_READ, fd));
+    uring_prep_send(&ring, fd, clnt->iobuf->data, n,
+                    (n < clnt->resp.len) ? URING_MORE : 0,
+                    SRV_URING_DATA(SRV_URING_SEND, fd));
+
+    clnt->inflight += 4;
+
+    return 1;
+}
+
+/**
+ * the next chunk of a file: read it, and send it once it's in
+ */
+int srv_uring_next_chunk(conn_t * clnt)
+{
+    size_t n, left = clnt->resp.len - clnt->resp.pos;
+    int fd = clnt->sock;
+
+    n = (left > SRV_URING_CHUNK) ? SRV_URING_CHUNK : left;
+    clnt->iolen = n;
+    clnt->iopos = 0;
+
+    if (!uring_reserve(&ring, 2))
+        return 0;
+
+    uring_prep_read_direct(&ring, fd, clnt->iobuf->data, n,
+                           clnt->resp.off + clnt->resp.pos, URING_LINK,
+                           SRV_URING_DATA(SRV_URING_READ, fd));
+    uring_prep_send(&ring, fd, clnt->iobuf->data, n, (n < left) ? URING_MORE : 0,
+                    SRV_URING_DATA(SRV_URING_SEND, fd));
+
+    clnt->inflight += 2;
+
+    return 1;
+}
+
+/**
+ * a new connection off the listener
+ */
+void srv_uring_accept(int idx, int res, unsigned int flags)
+{
+    conn_t *clnt;
+
+    if (!(flags & URING_CQE_MORE)) {
+        /* the multishot ran out, or the kernel never took it */
+        if (-EINVAL == res && ring.multishot) {
+            DEBUGF(__FILE__, __LINE__, "no multishot accept here\n");
+            ring.multishot = 0;
+        }
+
+        srv_uring_listen(idx);
+    }
+
+    if (res < 0) {
+        if (-EINVAL != res)
+            ERRF(__FILE__, __LINE__, "accepting conn: %s!\n",
+                 strerror(-res));
+        return;
+    }
+
+    if (!srv_conn_admit(res)) {
+        /* too many concurrent connections */
+        srv_conn_refuse(res);
+        return;
+    }
+
+    clnt = &pool[res];
+    clnt->sock = res;
+    memset(&clnt->addr, 0, sizeof clnt->addr);
+
+    clnt->state = CONN_STATE_REQ;
+    clnt->prio = SRV_PRIO_NORMAL;
+    clnt->worker = -1;
+    clnt->inflight = 0;
+    clnt->closing = 0;
+    srv_conn_opened(clnt);
+    srv_conn_timer(clnt);
+
+    if (NULL == (clnt->req.buf = buf_get(SRV_REQ_MAX_LEN))) {
+        ERRF(__FILE__, __LINE__, "allocating request buffer!\n");
+        srv_conn_cleanup(clnt);
+        return;
+    }
+
+    /* leave room for the terminator */
+    if (!uring_prep_recv(&ring, res, clnt->req.buf->data,
+                         clnt->req.buf->size - 1, 0,
+                         SRV_URING_DATA(SRV_URING_RECV, res))) {
+        srv_conn_cleanup(clnt);
+        return;
+    }
+
+    ++clnt->inflight;
+}
+
+/**
+ * the request is in, build the response and get it going
+ */
+void srv_uring_request(conn_t * clnt, int res)
+{
+    int ok;
+
+    if (res <= 0) {
+        DEBUGF(__FILE__, __LINE__, "(sock:%d) nothing to read\n",
+               clnt->sock);
+        srv_uring_finish(clnt);
+        return;
+    }
+
+    clnt->req.buf->data[res] = '\0';
+    clnt->req.buf->len = res;
+    srv_conn_progress(clnt);
+
+    if (clnt->req.buf->size - 1 == (size_t) res
+        && NULL == strstr(clnt->req.buf->data, "\r\n\r\n")) {
+        /* request the maximum size? fuck you */
+        ERRF(__FILE__, __LINE__,
+             "buffer overflow attempt? killing connection.\n");
+        srv_conn_reject(clnt->sock, srv_conn_too_big(clnt->req.buf));
+        srv_uring_finish(clnt);
+        return;
+    }
+
+    ok = srv_req_parse(&clnt->req);
+
+    if (!conf.proxy_cnt && !conf.fcgi_cnt) {
+        buf_put(clnt->req.buf);
+        clnt->req.buf = NULL;
+    }
+
+    if (!ok) {
+        /* bad request, disconnect */
+        ERRF(__FILE__, __LINE__, "bad request.\n");
+        srv_conn_reject(clnt->sock, RESP_HTTP_400);
+        srv_uring_finish(clnt);
+        return;
+    }
+
+    clnt->site = srv_vhost_find(&vhosts, clnt->req.host);
+    clnt->state = CONN_STATE_PARSED;
+
+    /* stat, listings and modules can all block, so they're built on the
+     * offload pool, and we hear back through the wake pipe */
+    if (offloading && tpool_add_work(&offload, SRV_JOB(clnt->sock))) {
+        ++clnt->inflight;
+        return;
+    }
+
+    if (!srv_conn_req_handle(clnt)
+        || (CONN_STATE_DESTROY != clnt->state && !srv_uring_respond(clnt))) {
+        ERRF(__FILE__, __LINE__, "handling request!\n");
+        srv_uring_finish(clnt);
+    } else if (CONN_STATE_DESTROY == clnt->state) {
+        srv_uring_finish(clnt);
+    }
+}
+
+/**
+ * the offload pool has built a response, send it
+ */
+void srv_uring_handled(conn_t * clnt)
+{
+    --clnt->inflight;
+
+    /* or proxied, with nothing left to send */
+    if (clnt->closing || CONN_STATE_DESTROY == clnt->state) {
+        srv_uring_finish(clnt);
+        return;
+    }
+
+    if (!srv_uring_respond(clnt)) {
+        ERRF(__FILE__, __LINE__, "handling request!\n");
+        srv_uring_finish(clnt);
+    }
+}
+
+/**
+ * read from the wake pipe again, for the next time we're woken
+ */
+void srv_uring_wake_arm(void)
+{
+    if (!uring_prep_read(&ring, wake_pipe[0], wake_byte, sizeof wake_byte,
+                         SRV_URING_DATA(SRV_URING_WAKE, 0)))
+        ERRF(__FILE__, __LINE__, "lost the wake pipe!\n");
+}
+
+/**
+ * a chunk of the body went out, or some of it did
+ */
+void srv_uring_sent(conn_t * clnt, int res)
+{
+    int fd = clnt->sock;
+
+    clnt->iopos += res;
+    clnt->resp.pos += res;
+    srv_conn_progress(clnt);
+
+    if (clnt->iopos < clnt->iolen) {
+        /* a short send, push the rest */
+        if (uring_prep_send(&ring, fd, srv_uring_chunk(clnt) + clnt->iopos,
+                            clnt->iolen - clnt->iopos,
+                            (clnt->resp.pos + clnt->iolen - clnt->iopos
+                             < clnt->resp.len) ? URING_MORE : 0,
+                            SRV_URING_DATA(SRV_URING_SEND, fd)))
+            ++clnt->inflight;
+        else
+            srv_uring_finish(clnt);
+
+        return;
+    }
+
+    if (clnt->resp.pos < clnt->resp.len) {
+        if (!srv_uring_next_chunk(clnt))
+            srv_uring_finish(clnt);
 
-        w->job = 0;
-        w->busy = 0;
-        clnt = NULL;
+        return;
     }
 
-    return NULL;
+    /* and we're done! */
+    clnt->state = CONN_STATE_DESTROY;
+    DEBUGF(__FILE__, __LINE__, "(sock:%d) sent %db, made it!\n",
+           fd, clnt->resp.pos);
+    srv_uring_finish(clnt);
 }
 
 /**
- * read a clnt's request
+ * a completion came in. anything cancelled was the tail of a chain
+ * that broke earlier, and that break has been dealt with already.
  */
-int srv_conn_req_ready(conn_t * clnt)
+void srv_uring_complete(void *arg, unsigned long long data, int res,
+                        unsigned int flags)
 {
-    ssize_t got;
-
-#ifdef DEBUG
-    assert(NULL != clnt);
-#endif
+    unsigned int op = data >> 32;
+    int fd = (int)(data & 0xffffffffUL);
+    conn_t *clnt;
 
-    /* get some more shit */
-    got = recv(clnt->sock, clnt->req.buf, sizeof clnt->req.buf, 0);
+    if (SRV_URING_ACCEPT == op) {
+        srv_uring_accept(fd, res, flags);
+        return;
+    }
 
-    if (got == -1) {
-        /* erreur! */
-        ERRF(__FILE__, __LINE__, "receiving data: %s!\n", strerror(errno));
-        return 0;
+    if (SRV_URING_WAKE == op) {
+        /* the offload pool or the disk pool is done with someone */
+        srv_wake(wake_pipe[0], EV_READ, NULL);
+        srv_uring_wake_arm();
+        return;
     }
 
-    if (sizeof clnt->req.buf == got) {
-        /* request the maximum size? fuck you */
-        ERRF(__FILE__, __LINE__,
-             "buffer overflow attempt? killing connection.\n");
-        return 0;
+    if (SRV_URING_TICK == op) {
+        /* move the timing wheel along, and wait for the next tick */
+        srv_housekeep();
+
+        if (!uring_prep_timeout(&ring, SRV_WHEEL_TICK,
+                                SRV_URING_DATA(SRV_URING_TICK, 0)))
+            ERRF(__FILE__, __LINE__, "lost the timer tick!\n");
+        return;
     }
 
-    /* got rid of allocation */
-    if (!srv_req_parse(&clnt->req)) {
-        /* bad request, disconnect */
-        ERRF(__FILE__, __LINE__, "bad request.\n");
-        return 0;
+    clnt = &pool[fd];
+
+    switch (op) {
+    case SRV_URING_SHUT:
+    case SRV_URING_DROP:
+        /* nothing to do */
+        return;
+
+    case SRV_URING_CLOSE:
+        if (res < 0)
+            ERRF(__FILE__, __LINE__, "closing socket! %s\n", strerror(-res));
+
+        if (clnt->fd)
+            close(clnt->fd);
+
+        clnt->sock = -1;
+        clnt->fd = 0;
+        clnt->state = CONN_STATE_NEW;
+        clnt->closing = 0;
+        clnt->inflight = 0;
+        srv_conn_release(clnt);
+        srv_conn_closed(clnt);
+        srv_conn_untime(clnt);
+        return;
     }
 
-    /* got rid of allocation */
-    if (!srv_resp_generate(&clnt->resp, conf.docroot,
-                           clnt->req.path, conf.index, clnt->req.params,
-                           clnt->req.param_cnt, &cache, &mps)) {
-        /* couldn't build the response? */
-        ERRF(__FILE__, __LINE__, "error generating response.\n");
-        return 0;
+    --clnt->inflight;
+
+    if (clnt->closing) {
+        srv_uring_finish(clnt);
+        return;
     }
 
-    clnt->resp.headlen = strlen(clnt->resp.header);
-    clnt->state = CONN_STATE_RESP;
+    if (-ECANCELED == res)
+        return;
 
-    return 1;
+    switch (op) {
+    case SRV_URING_RECV:
+        srv_uring_request(clnt, res);
+        break;
+
+    case SRV_URING_HEAD:
+        if (res <= 0) {
+            DEBUGF(__FILE__, __LINE__,
+                   "(sock:%d) problem with sending response!\n", fd);
+            srv_uring_finish(clnt);
+        } else if ((clnt->resp.senthead += res) < clnt->resp.headlen) {
+            /* a short send, what was linked to it was cancelled */
+            if (!srv_uring_respond(clnt))
+                srv_uring_finish(clnt);
+        } else if (!clnt->resp.len) {
+            clnt->state = CONN_STATE_DESTROY;
+            srv_uring_finish(clnt);
+        }
+        break;
+
+    case SRV_URING_OPEN:
+        if (res < 0) {
+            ERRF(__FILE__, __LINE__, "opening file for sending! %s\n",
+                 strerror(-res));
+            srv_uring_finish(clnt);
+        }
+        break;
+
+    case SRV_URING_READ:
+        if (res <= 0) {
+            ERRF(__FILE__, __LINE__, "reading file for sending!\n");
+            srv_uring_finish(clnt);
+        } else if ((size_t) res < clnt->iolen) {
+            /* a short read cancels the linked send, send what we got */
+            clnt->iolen = res;
+
+            if (uring_prep_send(&ring, fd, clnt->iobuf->data, res, URING_MORE,
+                                SRV_URING_DATA(SRV_URING_SEND, fd)))
+                ++clnt->inflight;
+            else
+                srv_uring_finish(clnt);
+        }
+        break;
+
+    case SRV_URING_SEND:
+        if (res <= 0) {
+            DEBUGF(__FILE__, __LINE__, "(sock:%d) send: %s\n", fd,
+                   strerror(-res));
+            srv_uring_finish(clnt);
+        } else {
+            srv_uring_sent(clnt, res);
+        }
+        break;
+    }
 }
 
 /**
- * send the header
+ * the io_uring event loop: submit, wait, handle what finished
  */
-int srv_conn_resp_ready(conn_t * clnt)
+int srv_uring_run(void)
 {
-    ssize_t sent;
+    unsigned int i;
 
-#ifdef DEBUG
-    assert(NULL != clnt);
-#endif
+    for (i = 0; i < conf.port_cnt; i++)
+        srv_uring_listen(i);
 
-    if (!(sent = send(clnt->sock, clnt->resp.header, clnt->resp.headlen, 0))) {
-        ERRF(__FILE__, __LINE__, "(sock:%d) sending error...\n", clnt->sock);
+    if (offloading)
+        srv_uring_wake_arm();
+
+    if (!uring_prep_timeout(&ring, SRV_WHEEL_TICK,
+                            SRV_URING_DATA(SRV_URING_TICK, 0)))
         return 0;
-    } else if (sent == -1) {
-        /* errno is set */
-        switch (errno) {
-        case EAGAIN:
-        case EINTR:
-        case EPIPE:
-        default:
-            /* problem */
-            ERRF(__FILE__, __LINE__,
-                 "(sock:%d) unrecoverable send error", clnt->sock);
-            return 0;
-        }
-    }
 
-    /* now lets send the data! */
-    if (!clnt->resp.pregen) {
-        /* we're sending a file */
-        if (!(clnt->fd = open(clnt->resp.file, O_RDONLY))) {
-            ERRF(__FILE__, __LINE__, "opening file for sending!\n");
+    for (;;) {
+        if (!uring_enter(&ring, 1))
             return 0;
-        }
-    }
 
-    clnt->state = CONN_STATE_SEND;
+        uring_reap(&ring, srv_uring_complete, NULL);
+    }
 
     return 1;
 }
 
 /**
- * send the pregenerated data (403/404/dir listing)
+ * the epoll event loop: accept on the listeners, and hand connections
+ * that became ready to the workers
  */
-int srv_conn_send_pregen(conn_t * clnt)
+int srv_epoll_run(void)
 {
-    ssize_t sent;
+#ifdef HAVE_EPOLL
+    struct epoll_event ev[SRV_EPOLL_EVENTS];
+    unsigned int idx;
+    short what;
+    int i, n;
 
-#ifdef DEBUG
-    assert(NULL != clnt);
-#endif
+    for (;;) {
+        /* wake up at least once a tick, for the timing wheel */
+        n = epoll_wait(epfd, ev, SRV_EPOLL_EVENTS, SRV_WHEEL_TICK);
 
-    /* send some of the data */
-    while (clnt->resp.pos < clnt->resp.len) {
-        if (!(sent = send(clnt->sock,
-                          &clnt->resp.data[clnt->resp.pos],
-                          clnt->resp.len - clnt->resp.pos, 0))) {
-            /* failure :'( */
-            ERRF(__FILE__, __LINE__, "send: %s!\n", strerror(errno));
+        /* before housekeeping has a chance to clobber errno */
+        if (-1 == n && EINTR != errno) {
+            ERRF(__FILE__, __LINE__, "epoll_wait: %s!\n", strerror(errno));
             return 0;
-        } else if (sent == -1) {
-            /* errno is set */
-            switch (errno) {
-            case EAGAIN:
-            case EINTR:
-                /* we'll wait and try again */
-                DEBUGF(__FILE__, __LINE__,
-                       "(sock:%d) minor send issue, retrying\n", clnt->sock);
+        }
+
+        srv_housekeep();
+
+        for (i = 0; i < n; i++) {
+            if (ev[i].data.u64 & SRV_EPOLL_WAKE) {
+                srv_wake(wake_pipe[0], EV_READ, NULL);
                 continue;
+            }
 
-            case EPIPE:
-            default:
-                /* problem */
-                ERRF(__FILE__, __LINE__, "send: %s!\n", strerror(errno));
-                return 0;
+            if (ev[i].data.u64 & SRV_EPOLL_LISTEN) {
+                idx = (unsigned int)(ev[i].data.u64 & ~SRV_EPOLL_LISTEN);
+                srv_accept_new_conn(pool[idx].sock, EV_READ, NULL);
+                continue;
             }
-        }
 
-        /* advance our shit */
-        clnt->resp.pos += sent;
-    }
+            /* errors and hangups show up on the next recv or send */
+            what = 0;
+            if (ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                what |= EV_READ;
+            if (ev[i].events & EPOLLOUT)
+                what |= EV_WRITE;
 
-    clnt->state = CONN_STATE_DESTROY;
+            srv_conn_handle_activity((int)ev[i].data.u64, what, NULL);
+        }
+    }
+#endif
 
-    return 1;
+    return 0;
 }
 
 /**
- * send a file
+ * make room for max_conn connections: enough descriptors, and a conn_t
+ * for each
  */
-int srv_conn_send_file(conn_t * clnt)
+int srv_pool_init(void)
 {
-    ssize_t sent = 0;
-    ssize_t total = 0;
-    ssize_t bytes = 0;
-    ssize_t count = 0;
-    ssize_t toget = 0;
-    char buf[4096];
-
-#ifdef DEBUG
-    assert(NULL != clnt);
-#endif
-
-    toget = sizeof buf;
-    memset(buf, '\0', sizeof buf);
+    struct rlimit rl;
 
-    while ((bytes = read(clnt->fd, buf, toget))) {
-        while (bytes) {
-            if (!(sent = send(clnt->sock, &buf[count], bytes, 0))) {
-                /* failure :'( */
-                ERRF(__FILE__, __LINE__, "send: failed!\n");
-                return 0;
-            } else if (sent == -1) {
-                /* errno is set */
-                switch (errno) {
-                case EAGAIN:
-                case EINTR:
-                    /* back that ass up */
-                    continue;
-
-                case EPIPE:
-                default:
-                    /* problem */
-                    ERRF(__FILE__, __LINE__, "send: %s!\n", strerror(errno));
-                    return 0;
-                }
-            }
+    pool_slots = conf.max_conn + SRV_CONN_SPARE;
 
-            /* subtract the amt we sent */
-            count += sent;
-            bytes -= sent;
-            total += sent;
+    if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < pool_slots) {
+        /* take what we're allowed to */
+        rl.rlim_cur = (RLIM_INFINITY != rl.rlim_max
+                       && rl.rlim_max < pool_slots) ?
+            rl.rlim_max : pool_slots;
+        setrlimit(RLIMIT_NOFILE, &rl);
 
-            toget =
-                ((clnt->resp.len - total) >
-                 sizeof buf) ? sizeof buf : clnt->resp.len - total;
+        if (rl.rlim_cur < pool_slots) {
+            ERRF(__FILE__, __LINE__,
+                 "only %lu descriptors allowed, lowering max_conn\n",
+                 (unsigned long)rl.rlim_cur);
+            pool_slots = rl.rlim_cur;
+            conf.max_conn = (pool_slots > 2 * SRV_CONN_SPARE) ?
+                pool_slots - SRV_CONN_SPARE : pool_slots / 2;
         }
-
-        /* reset bytes to 0 */
-        memset(buf, '\0', sizeof buf);
-        bytes = count = sent = 0;
     }
 
-    clnt->state = CONN_STATE_DESTROY;
-    DEBUGF(__FILE__, __LINE__, "(sock:%d) sent %db, made it!\n",
-           clnt->sock, total);
-
-    return 1;
+    return (NULL != (pool = calloc(pool_slots, sizeof *pool)));
 }
 
 /**
@@ -556,9 +2079,14 @@ int srv_conn_send_file(conn_t * clnt)
  */
 int main(int argc, char *argv[])
 {
-    unsigned int i, j;
+    unsigned int i, cpus;
+    unsigned long long start;
+    char *dev, *sp;
     struct passwd *user;
     struct group *group;
+#ifdef HAVE_EPOLL
+    struct epoll_event ee;
+#endif
 
     /* lets set our shit up */
     if (argc > 1) {
@@ -576,6 +2104,51 @@ int main(int argc, char *argv[])
         }
     }
 
+    /* size the pool for the cpus we were given, not the whole box. the
+     * extra room above that is for workers stuck in modules or disk. */
+    cpus = cpu_usable();
+
+    if (!conf.workers)
+        conf.workers = cpus;
+
+    if (!conf.workers_max)
+        conf.workers_max = conf.workers * SRV_WORKERS_PER_CPU;
+
+    if (!conf.accept_batch)
+        conf.accept_batch = SRV_ACCEPT_BATCH;
+
+    if (!conf.timeout_header)
+        conf.timeout_header = SRV_TIMEOUT_HEADER;
+
+    if (!conf.timeout_send)
+        conf.timeout_send = SRV_TIMEOUT_SEND;
+
+    /* every error we might send, rendered up front */
+    if (!srv_resp_errors_init(conf.errors)) {
+        ERRF(__FILE__, __LINE__, "error setting up the error pages!\n");
+        return 1;
+    }
+
+    /* a packed docroot is mapped once, here, and never looked past */
+    if (NULL != conf.pack) {
+        if (!srv_pack_open(&pack, conf.pack)) {
+            ERRF(__FILE__, __LINE__, "error opening pack %s!\n", conf.pack);
+            return 1;
+        }
+    }
+
+    /* a jail only has room for one docroot */
+    if (conf.chroot && conf.vhost_cnt) {
+        ERRF(__FILE__, __LINE__, "jail can't be used with vhosts!\n");
+        return 1;
+    }
+
+    /* one conn_t per descriptor, before anything takes a descriptor */
+    if (!srv_pool_init()) {
+        ERRF(__FILE__, __LINE__, "error setting up the connection pool!\n");
+        return 1;
+    }
+
     /* dump a bunch of startup info */
     printf("srv %d.%d.%d\n", _SRV_MAJOR, _SRV_MINOR, _SRV_REV);
 #ifdef DEBUG
@@ -591,9 +2164,17 @@ int main(int argc, char *argv[])
 
     printf("\n");
     printf("  docroot:   %s\n", conf.docroot);
+    printf("  pack:      %s\n", (conf.pack) ? conf.pack : "none");
     printf("  index:     %s\n", conf.index);
     printf("  hostname:  %s\n", conf.hostname);
+    printf("  vhosts:    %u\n", conf.vhost_cnt);
     printf("  chroot:    %s\n", (conf.chroot) ? "yes" : "no");
+    printf("  workers:   %u to %u, for %u cpu(s) on %u node(s)\n",
+           conf.workers, conf.workers_max, cpus, cpu_node_count());
+    printf("  conns:     up to %u, %u per accept\n",
+           conf.max_conn, conf.accept_batch);
+    printf("  exec:      %s\n",
+           (SRV_EXEC_CORO == conf.exec) ? "coroutines" : "threads");
 
     /* if we're running as root... */
     if (conf.chroot) {
@@ -625,6 +2206,14 @@ int main(int argc, char *argv[])
     }
 #endif
 
+    /* a client hanging up mid-send is an error on the send, not a
+     * reason to die */
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGUSR1, srv_stats_signal);
+
+    /* connection timeouts */
+    wheel_init(&wheel, SRV_WHEEL_TICK, srv_now_ms(), srv_conn_expire);
+
     /* initialize libevent */
     event_init();
 
@@ -639,41 +2228,7 @@ int main(int argc, char *argv[])
         }
     }
 
-    /* set up our hashtables */
-    hash_init(&mps, SRV_MODULE_MAX);
-    hash_init(&cache, SRV_CACHE_MAX);
-
-    /* key functions... basic string type */
-    hash_set_keycmp(&mps, hash_default_keycmp);
-    hash_set_keycpy(&mps, hash_default_keycpy);
-    hash_set_free_key(&mps, hash_default_free_key);
-    hash_set_keycmp(&cache, hash_default_keycmp);
-    hash_set_keycpy(&cache, hash_default_keycpy);
-    hash_set_free_key(&cache, hash_default_free_key);
-
-    /* val functions... pointer into module array */
-    hash_set_valcmp(&mps, srv_modhash_valcmp);
-    hash_set_valcpy(&mps, srv_modhash_alloc);
-    hash_set_free_val(&mps, srv_modhash_free);
-    hash_set_valcmp(&cache, srv_cache_valcmp);
-    hash_set_free_val(&cache, hash_default_free_key);
-    hash_set_valcpy(&cache, srv_cache_alloc);
-
-    /* set up our hidden and cached files. we set it up
-     * so that hidden files, which 403, are treated as cached
-     * files with the html served up being the preprocessor
-     * strings defined in resp.h
-     */
-
-    /* first the pregenerated 404 response */
-    srv_resp_403(&rp[0]);
-
-    for (i = 0; i < conf.hide_cnt; ++i) {
-        hash_insert(&cache, conf.hide[i], &rp[0]);
-        DEBUGF(__FILE__, __LINE__, "hid file %s!\n", conf.hide[i]);
-    }
-
-    /* set up our modules, insert paths into hashtable */
+    /* set up our modules, their paths go in each site's routing table */
     for (i = 0; i < conf.mod_cnt; ++i) {
         /* get ready for it */
         memset(&mods[i], '\0', sizeof mods[i]);
@@ -688,7 +2243,8 @@ int main(int argc, char *argv[])
         mods[i].mod = dlopen(mods[i].path, RTLD_LAZY);
 
         if (NULL == mods[i].mod) {
-            ERRF(__FILE__, __LINE__, "couldn't load module %s!\n");
+            ERRF(__FILE__, __LINE__, "couldn't load module %s!\n",
+                 conf.mods[i].name);
             continue;
         }
 
@@ -697,24 +2253,58 @@ int main(int argc, char *argv[])
                conf.mods[i].func, mods[i].path);
         mods[i].func = (_srv_modfunc_t) dlsym(mods[i].mod, conf.mods[i].func);
 
-        if (NULL == mods[i].func) {
+        if (NULL == mods[i].func)
             ERRF(__FILE__, __LINE__, "couldn't get function %s\n",
                  conf.mods[i].func);
+    }
+
+    /* what was busy last time, read while it's still in reach */
+    if (NULL != conf.warm_manifest) {
+        if (!srv_warm_load(&conf.warm, conf.warm_manifest))
+            DEBUGF(__FILE__, __LINE__, "no warm manifest at %s yet\n",
+                   conf.warm_manifest);
+
+        srv_warm_track();
+    }
+
+    /* the disk threads, and the devices that get a depth of their own */
+    srv_disk_init((-1 == conf.disk_depth) ? SRV_DISK_DEPTH : conf.disk_depth);
+
+    for (i = 0; i < conf.disk_devs.count; i++) {
+        dev = *(char **)vector_get_at(&conf.disk_devs, i);
+
+        /* "path depth" */
+        if (NULL == (sp = strrchr(dev, ' '))) {
+            ERRF(__FILE__, __LINE__, "disk_depth.dev %s has no depth!\n",
+                 dev);
             continue;
         }
 
-        for (j = 0; j < conf.mods[i].hnd_cnt; j++) {
-            /* insert into hash */
-            if (conf.mods[i].hnd[j].type == SRV_HANDLER_FILE) {
-                /* add this path to handler hash */
-                DEBUGF(__FILE__, __LINE__,
-                       "request path %s to be handled with %s...\n",
-                       conf.mods[i].hnd[j].data, conf.mods[i].func);
-                hash_insert(&mps, conf.mods[i].hnd[j].data, &mods[i]);
-            }
+        *sp = '\0';
+        srv_disk_depth(dev, strtol(sp + 1, NULL, 0));
+    }
+
+    /* where proxied requests go, looked up while /etc is in reach */
+    for (i = 0; i < conf.proxy_cnt; i++) {
+        if (!srv_proxy_init(&proxies[i], &conf.proxies[i])
+            || !srv_proxy_watch(&proxies[i])) {
+            ERRF(__FILE__, __LINE__, "error setting up proxy %s!\n",
+                 conf.proxies[i].prefix);
+            return 1;
         }
     }
 
+    for (i = 0; i < conf.fcgi_cnt; i++) {
+        if (!srv_fcgi_init(&fcgis[i], &conf.fcgis[i])) {
+            ERRF(__FILE__, __LINE__, "error setting up fastcgi %d!\n", i + 1);
+            return 1;
+        }
+    }
+
+    /* the governor needs /proc and /sys, which a jail would hide */
+    if (!srv_mem_init(conf.mem_limit, SRV_EXEC_CORO == conf.exec))
+        DEBUGF(__FILE__, __LINE__, "no memory limit or pressure to go by\n");
+
     /* everything else we don't need to do as root */
     if (!geteuid()) {
         if (NULL != conf.user && NULL != conf.group) {
@@ -792,22 +2382,182 @@ int main(int argc, char *argv[])
         }
     }
 
-    /* set up the thread pool handler */
-    tpool_init(&tp, SRV_TPOOL_MAX, srv_threadpool_controller,
-               srv_threadpool_handler);
-    stack_set_data_alloc(&tp.work, srv_threadpool_alloc);
-    stack_set_data_free(&tp.work, free);
+    /* the cache, read back in as whoever writes to it from now on */
+    if (NULL != conf.cache_dir) {
+        if (!srv_cache_init(&cache, conf.cache_dir, conf.cache_size,
+                            conf.cache_segment)) {
+            ERRF(__FILE__, __LINE__, "error setting up the cache!\n");
+            return 1;
+        }
+
+        for (i = 0; i < conf.mod_cnt; i++)
+            mods[i].cache = conf.mods[i].cache;
+
+        for (i = 0; i < conf.proxy_cnt; i++)
+            if (conf.proxies[i].cache)
+                proxies[i].store = &cache;
+    }
+
+    /* backends we run ourselves, as whoever we are from now on */
+    for (i = 0; i < conf.fcgi_cnt; i++) {
+        if (!srv_fcgi_spawn(&fcgis[i])) {
+            ERRF(__FILE__, __LINE__, "error starting fastcgi %s!\n",
+                 fcgis[i].name);
+            return 1;
+        }
+    }
+
+    /* every site, now the docroot is where it'll stay. hidden paths
+     * become deny rules, which are checked before we ever touch the
+     * filesystem, and appear to the client as a 404.
+     */
+    if (!srv_vhosts_init(&vhosts, &conf, mods, proxies, fcgis,
+                         (NULL != conf.pack) ? &pack : NULL)) {
+        ERRF(__FILE__, __LINE__, "error setting up the vhosts!\n");
+        return 1;
+    }
+
+    /* misses under a docroot are remembered until something new turns
+     * up in it, or for a few seconds if we can't watch it */
+    for (i = 0; i < vhosts.count; i++) {
+        if (NULL == vhosts.sites[i].pack
+            && !srv_path_watch(&vhosts.sites[i].root))
+            DEBUGF(__FILE__, __LINE__, "not watching %s for changes\n",
+                   vhosts.sites[i].root.dir);
+    }
+
+    /* get what's wanted into memory before anyone is let in */
+    if (conf.warm.count) {
+        start = srv_now_ms();
+        i = srv_warm_run(&conf.warm, conf.workers, &vhosts.sites[0].root,
+                         &vhosts.sites[0].routes, vhosts.sites[0].pack);
+        printf("warmed %u of %u paths in %llums\n", i, conf.warm.count,
+               srv_now_ms() - start);
+    }
+
+    warm_saved = srv_now_ms();
+
+    /* io_uring if we asked for it and the kernel is up to it */
+    if (SRV_IO_URING == conf.io
+        && !uring_init(&ring, SRV_URING_ENTRIES, pool_slots)) {
+        ERRF(__FILE__, __LINE__,
+             "io_uring isn't available, falling back to libevent.\n");
+        conf.io = SRV_IO_EVENT;
+    }
+
+    /* or our own epoll set */
+    if (SRV_IO_EPOLL == conf.io) {
+#ifdef HAVE_EPOLL
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+#endif
+        if (-1 == epfd) {
+            ERRF(__FILE__, __LINE__,
+                 "epoll isn't available, falling back to libevent.\n");
+            conf.io = SRV_IO_EVENT;
+        }
+    }
+
+    /* set up the thread pool handler, the event loop handles requests
+     * itself for coroutines and io_uring */
+    if (SRV_EXEC_CORO != conf.exec && SRV_IO_URING != conf.io) {
+        if (!tpool_init(&tp, conf.workers, conf.workers_max,
+                        (SRV_POOL_STEAL == conf.queue_mode) ?
+                        TPOOL_STEAL : TPOOL_SHARED, srv_threadpool_handler)) {
+            ERRF(__FILE__, __LINE__, "error starting the thread pool!\n");
+            return 1;
+        }
+
+        threaded = 1;
+
+        if (SRV_QUEUE_LIFO == conf.queue_order)
+            tpool_set_order(&tp, TPOOL_LIFO);
+    }
 
     /* now set up handlers for when we have incoming connections! */
-    for (i = 0; i < conf.port_cnt; i++) {
+    for (i = 0; SRV_IO_URING != conf.io && i < conf.port_cnt; i++) {
+#ifdef HAVE_EPOLL
+        if (-1 != epfd) {
+            /* level-triggered, so whatever is left past the accept
+             * batch wakes us up again */
+            ee.events = EPOLLIN;
+            ee.data.u64 = SRV_EPOLL_LISTEN | i;
+
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, pool[i].sock, &ee)) {
+                ERRF(__FILE__, __LINE__, "epoll_ctl: %s!\n", strerror(errno));
+                return 1;
+            }
+
+            continue;
+        }
+#endif
+
         /* set up the accept event */
         event_set(&pool[i].ev, pool[i].sock,
                   EV_READ | EV_PERSIST, srv_accept_new_conn, NULL);
         event_add(&pool[i].ev, NULL);
     }
 
+    /* coroutines and the ring get woken through a pipe once another
+     * thread is done with them, which mustn't touch the loop itself */
+    if (SRV_EXEC_CORO == conf.exec || SRV_IO_URING == conf.io) {
+        if (pipe(wake_pipe)
+            || -1 == fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK)
+            || -1 == fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK)) {
+            ERRF(__FILE__, __LINE__, "wake pipe: %s!\n", strerror(errno));
+            return 1;
+        }
+#ifdef HAVE_EPOLL
+        if (-1 != epfd) {
+            ee.events = EPOLLIN;
+            ee.data.u64 = SRV_EPOLL_WAKE;
+
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, wake_pipe[0], &ee)) {
+                ERRF(__FILE__, __LINE__, "epoll_ctl: %s!\n", strerror(errno));
+                return 1;
+            }
+        }
+#endif
+        if (SRV_IO_EVENT == conf.io) {
+            event_set(&wake_ev, wake_pipe[0], EV_READ | EV_PERSIST,
+                      srv_wake, NULL);
+            event_add(&wake_ev, NULL);
+        }
+
+        /* and the threads that build responses, unless the pack has
+         * them all in memory already and there are no modules,
+         * proxies or scripts */
+        if (NULL == conf.pack || conf.mod_cnt || conf.proxy_cnt
+            || conf.fcgi_cnt) {
+            if (!tpool_init(&offload, conf.workers, conf.workers_max,
+                            TPOOL_SHARED, srv_offload_handler)) {
+                ERRF(__FILE__, __LINE__, "error starting the offload pool!\n");
+                return 1;
+            }
+
+            offloading = 1;
+        }
+    }
+
+    /* the reactor lives with the first worker */
+    cpu_pin_self(0, conf.workers_pin);
+
+    /* keep the timing wheel turning under libevent */
+    if (SRV_IO_EVENT == conf.io) {
+        evtimer_set(&tick_ev, srv_tick, NULL);
+        srv_tick(-1, 0, NULL);
+    }
+
+    /* everything's set up, tell whoever is waiting on us */
+    printf("ready\n");
+    fflush(stdout);
+
     /* begin our main loop */
-    event_dispatch();
+    if (SRV_IO_URING == conf.io)
+        srv_uring_run();
+    else if (SRV_IO_EPOLL == conf.io)
+        srv_epoll_run();
+    else
+        event_dispatch();
 
     /* this is kinda useless but fuck it */
     for (i = 0; i < conf.port_cnt; i++) {
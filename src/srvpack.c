@@ -0,0 +1,665 @@
+/* srvpack.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+/* srvpack: compile a docroot into a pack the server can map. it reads
+ * the same config as the server, so the docroot, index and hidden
+ * paths are the ones it would use, and paths a module handles are left
+ * out. a file with a .gz next to it gets that as its gzipped body.
+ *
+ *   srvpack srv.conf site.pack
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <util/hash.h>
+#include <util/util.h>
+#include <util/vector.h>
+
+#include <srv/conf.h>
+#include <srv/route.h>
+#include <srv/resp.h>
+#include <srv/pack.h>
+
+/* give up on a seed after this many displacements for one bucket */
+#define SRVPACK_DISP_MAX   (1 << 20)
+#define SRVPACK_SEEDS      16
+
+/* a path going into the pack */
+struct _pk_file {
+    char *key;
+    size_t keylen;
+
+    /* where its bodies come from, NULL for a directory's index, which
+     * borrows them from the index file's entry */
+    char *file;
+    char *gz;
+    char *alias;
+    struct stat st;
+
+    unsigned int type;
+    unsigned long long hash;
+    size_t path;
+    struct _pack_var var[PACK_VAR_CNT];
+};
+
+static conf_t conf;
+static router_t routes;
+
+static struct _pk_file *files;
+static unsigned int file_cnt;
+static unsigned int file_slots;
+static size_t root_len;
+
+/**
+ * would the server ever serve this path from the pack?
+ */
+int srvpack_wanted(const char *key)
+{
+    const route_t *rt = srv_router_lookup(&routes, key);
+
+    return (NULL == rt || ROUTE_NONE == rt->type);
+}
+
+/**
+ * add a path to the list
+ */
+struct _pk_file *srvpack_add(const char *key, const char *file,
+                             const struct stat *st)
+{
+    struct _pk_file *f;
+
+    if (file_cnt == file_slots) {
+        file_slots = (file_slots) ? file_slots * 2 : 256;
+
+        if (NULL == (f = realloc(files, file_slots * sizeof *files))) {
+            ERRF(__FILE__, __LINE__, "out of memory!\n");
+            exit(1);
+        }
+
+        files = f;
+    }
+
+    f = &files[file_cnt++];
+    memset(f, 0, sizeof *f);
+
+    f->key = strdup(key);
+    f->keylen = strlen(key);
+    f->type = srv_resp_type(key);
+
+    if (NULL != file) {
+        f->file = strdup(file);
+        f->st = *st;
+    }
+
+    return f;
+}
+
+/**
+ * is there a regular file here?
+ */
+int srvpack_is_file(const char *file, struct stat *st)
+{
+    return (!stat(file, st) && S_ISREG(st->st_mode));
+}
+
+/**
+ * nftw callback: files go in as themselves, directories with an index
+ * go in pointing at it
+ */
+int srvpack_walk(const char *fpath, const struct stat *sb, int flag,
+                 struct FTW *ftw)
+{
+    char other[PATH_MAX + 8], slash[PATH_MAX + 2];
+    const char *key = fpath + root_len;
+    struct _pk_file *f;
+    struct stat st;
+    size_t len;
+
+    if (FTW_F == flag && S_ISREG(sb->st_mode)) {
+        if (!srvpack_wanted(key))
+            return 0;
+
+        /* a gzipped copy of another file rides along with it */
+        len = strlen(fpath);
+
+        if (len > 3 && !strcmp(fpath + len - 3, ".gz")
+            && len - 3 < sizeof other) {
+            memcpy(other, fpath, len - 3);
+            other[len - 3] = '\0';
+
+            if (srvpack_is_file(other, &st))
+                return 0;
+        }
+
+        f = srvpack_add(key, fpath, sb);
+        snprintf(other, sizeof other, "%s.gz", fpath);
+
+        if (srvpack_is_file(other, &st))
+            f->gz = strdup(other);
+
+        return 0;
+    }
+
+    if (FTW_D != flag)
+        return 0;
+
+    /* the directory's index, joined with just the one slash */
+    snprintf(other, sizeof other, "%s%s%s", fpath,
+             ('/' == *conf.index) ? "" : "/", conf.index);
+
+    if (!srvpack_is_file(other, &st) || !srvpack_wanted(other + root_len))
+        return 0;
+
+    /* with and without the slash, the server takes either */
+    snprintf(slash, sizeof slash, "%s/", key);
+
+    if (srvpack_wanted(slash)) {
+        f = srvpack_add(slash, NULL, NULL);
+        f->alias = strdup(other + root_len);
+        f->type = srv_resp_type(f->alias);
+    }
+
+    if (*key && srvpack_wanted(key)) {
+        f = srvpack_add(key, NULL, NULL);
+        f->alias = strdup(other + root_len);
+        f->type = srv_resp_type(f->alias);
+    }
+
+    return 0;
+}
+
+/**
+ * copy a file into the pack at off, 0 if it couldn't be
+ */
+int srvpack_copy(int out, const char *file, unsigned long long off,
+                 unsigned long long len)
+{
+    char buf[64 * 1024];
+    unsigned long long done = 0;
+    ssize_t got;
+    int fd;
+
+    if (-1 == (fd = open(file, O_RDONLY))) {
+        ERRF(__FILE__, __LINE__, "opening %s: %s!\n", file, strerror(errno));
+        return 0;
+    }
+
+    while (done < len && 0 < (got = read(fd, buf, sizeof buf))) {
+        if (got != pwrite(out, buf, got, off + done)) {
+            ERRF(__FILE__, __LINE__, "writing pack: %s!\n", strerror(errno));
+            close(fd);
+            return 0;
+        }
+
+        done += got;
+    }
+
+    close(fd);
+
+    if (done != len) {
+        ERRF(__FILE__, __LINE__, "%s changed while we read it!\n", file);
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * write one body and its header. the header is everything after the
+ * date, which the server fills in as it sends it.
+ */
+int srvpack_var(int out, struct _pk_file *f, unsigned int v,
+                const char *file, unsigned long long *off,
+                char *meta, size_t * metalen)
+{
+    struct _pack_var *var = &f->var[v];
+    struct stat st;
+    int n;
+
+    if (stat(file, &st)) {
+        ERRF(__FILE__, __LINE__, "%s: %s!\n", file, strerror(errno));
+        return 0;
+    }
+
+    var->body = *off;
+    var->len = st.st_size;
+
+    if (!srvpack_copy(out, file, var->body, var->len))
+        return 0;
+
+    /* the next body starts on a page of its own */
+    *off += (var->len + PACK_ALIGN - 1) & ~((unsigned long long)PACK_ALIGN - 1);
+
+    n = snprintf(meta + *metalen, PACK_HEAD_MAX + 1,
+                 "Server: srv/" _SRV_VERSION "\r\n"
+                 "Content-Length: %llu\r\n"
+                 "Content-Type: %s\r\n"
+                 "ETag: \"%lx-%llx%s\"\r\n"
+                 "%s%s"
+                 "\r\n",
+                 var->len, srv_resp_mime(f->type),
+                 (unsigned long)f->st.st_mtime,
+                 (unsigned long long)f->st.st_size,
+                 (PACK_VAR_GZIP == v) ? "-gz" : "",
+                 (NULL != f->gz) ? "Vary: Accept-Encoding\r\n" : "",
+                 (PACK_VAR_GZIP == v) ? "Content-Encoding: gzip\r\n" : "");
+
+    if (n > PACK_HEAD_MAX) {
+        ERRF(__FILE__, __LINE__, "header for %s is too long!\n", f->key);
+        return 0;
+    }
+
+    var->headlen = n;
+    var->head = *metalen;
+    *metalen += n;
+
+    return 1;
+}
+
+/**
+ * by key, for finding what an index points at
+ */
+int srvpack_cmp(const void *a, const void *b)
+{
+    return strcmp(((const struct _pk_file *)a)->key,
+                  ((const struct _pk_file *)b)->key);
+}
+
+/**
+ * by bucket size, biggest first, then by bucket so they stay together
+ */
+static unsigned int *bucket_size;
+
+int srvpack_bucket_cmp(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a;
+    unsigned int y = *(const unsigned int *)b;
+
+    if (bucket_size[x] != bucket_size[y])
+        return (bucket_size[x] < bucket_size[y]) ? 1 : -1;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * find a displacement for every bucket so each key lands in a slot of
+ * its own. returns the slot for each file in where, 0 if this seed
+ * didn't work out.
+ */
+int srvpack_hash(unsigned long long seed, unsigned int buckets,
+                 unsigned int slots, unsigned int *disp, unsigned int *where)
+{
+    unsigned int *order, *members, *start, *taken;
+    unsigned int i, j, b, d, s, cnt;
+    int ok = 0;
+
+    order = calloc(buckets, sizeof *order);
+    start = calloc(buckets + 1, sizeof *start);
+    members = calloc(file_cnt, sizeof *members);
+    taken = calloc(slots, sizeof *taken);
+    bucket_size = calloc(buckets, sizeof *bucket_size);
+
+    if (NULL == order || NULL == start || NULL == members
+        || NULL == taken || NULL == bucket_size)
+        goto done;
+
+    for (i = 0; i < file_cnt; ++i) {
+        files[i].hash = hash_bytes_seed(files[i].key, files[i].keylen, seed);
+        ++bucket_size[(files[i].hash >> 32) % buckets];
+    }
+
+    /* lay the buckets' members out back to back */
+    for (b = 0; b < buckets; ++b) {
+        start[b + 1] = start[b] + bucket_size[b];
+        order[b] = b;
+    }
+
+    for (i = 0; i < file_cnt; ++i) {
+        b = (files[i].hash >> 32) % buckets;
+        members[start[b] + --bucket_size[b]] = i;
+    }
+
+    for (b = 0; b < buckets; ++b)
+        bucket_size[b] = start[b + 1] - start[b];
+
+    /* the crowded buckets are placed while there's still room */
+    qsort(order, buckets, sizeof *order, srvpack_bucket_cmp);
+
+    for (i = 0; i < buckets && bucket_size[order[i]]; ++i) {
+        b = order[i];
+        cnt = bucket_size[b];
+
+        for (d = 0; d < SRVPACK_DISP_MAX; ++d) {
+            for (j = 0; j < cnt; ++j) {
+                s = srv_pack_slot(files[members[start[b] + j]].hash, d,
+                                  slots);
+
+                /* taken holds the bucket + 1 while we try it */
+                if (taken[s])
+                    break;
+
+                taken[s] = b + 1;
+                where[members[start[b] + j]] = s;
+            }
+
+            if (j == cnt)
+                break;
+
+            /* didn't fit, give back what this try took */
+            while (j--)
+                taken[where[members[start[b] + j]]] = 0;
+        }
+
+        if (SRVPACK_DISP_MAX == d)
+            goto done;
+
+        disp[b] = d;
+    }
+
+    ok = 1;
+
+  done:
+    free(order);
+    free(start);
+    free(members);
+    free(taken);
+    free(bucket_size);
+    bucket_size = NULL;
+
+    return ok;
+}
+
+/**
+ * a seed for the perfect hash
+ */
+unsigned long long srvpack_seed(void)
+{
+    unsigned long long seed = 0;
+    int fd;
+
+    if (-1 != (fd = open("/dev/urandom", O_RDONLY))) {
+        if (sizeof seed != read(fd, &seed, sizeof seed))
+            seed = 0;
+
+        close(fd);
+    }
+
+    return seed ^ ((unsigned long long)time(NULL) << 20) ^ getpid();
+}
+
+/**
+ * write the pack out
+ */
+int srvpack_write(const char *out)
+{
+    unsigned int buckets, slots, i, v, *disp, *where;
+    unsigned long long off, meta_off, seed;
+    struct _pk_file key, *f, *t;
+    pack_ent_t *ents;
+    pack_hdr_t hdr;
+    size_t metalen, metaroom;
+    char tmp[PATH_MAX];
+    char *meta;
+    int fd, ok = 0;
+
+    buckets = file_cnt / 4 + 1;
+    slots = file_cnt + file_cnt / 8 + 1;
+
+    disp = calloc(buckets, sizeof *disp);
+    where = calloc(file_cnt + 1, sizeof *where);
+    ents = calloc(slots, sizeof *ents);
+    /* room for every path, and the headers of everything with a body */
+    for (metaroom = 1, i = 0; i < file_cnt; ++i)
+        metaroom += files[i].keylen + ((NULL != files[i].file)
+                                       + (NULL != files[i].gz))
+            * (PACK_HEAD_MAX + 1);
+
+    meta = malloc(metaroom);
+
+    if (NULL == disp || NULL == where || NULL == ents || NULL == meta) {
+        ERRF(__FILE__, __LINE__, "out of memory!\n");
+        goto done;
+    }
+
+    snprintf(tmp, sizeof tmp, "%s.tmp", out);
+
+    if (-1 == (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644))) {
+        ERRF(__FILE__, __LINE__, "creating %s: %s!\n", tmp, strerror(errno));
+        goto done;
+    }
+
+    /* bodies first, after the header's page */
+    off = PACK_ALIGN;
+    metalen = 0;
+
+    for (i = 0; i < file_cnt; ++i) {
+        f = &files[i];
+
+        if (NULL == f->file)
+            continue;
+
+        if (!srvpack_var(fd, f, PACK_VAR_PLAIN, f->file, &off, meta, &metalen)
+            || (NULL != f->gz
+                && !srvpack_var(fd, f, PACK_VAR_GZIP, f->gz, &off, meta,
+                                &metalen)))
+            goto fail;
+    }
+
+    /* directories share their index's bodies */
+    for (i = 0; i < file_cnt; ++i) {
+        f = &files[i];
+
+        if (NULL == f->alias)
+            continue;
+
+        key.key = f->alias;
+        t = bsearch(&key, files, file_cnt, sizeof *files, srvpack_cmp);
+
+        if (NULL == t || NULL == t->file) {
+            ERRF(__FILE__, __LINE__, "index %s went missing!\n", f->alias);
+            goto fail;
+        }
+
+        memcpy(f->var, t->var, sizeof f->var);
+        f->type = t->type;
+    }
+
+    /* then the paths */
+    for (i = 0; i < file_cnt; ++i) {
+        memcpy(meta + metalen, files[i].key, files[i].keylen);
+        files[i].path = metalen;
+        metalen += files[i].keylen;
+    }
+
+    meta_off = off;
+    off = (meta_off + metalen + 7) & ~7ULL;
+
+    for (i = 0; i < SRVPACK_SEEDS; ++i) {
+        seed = srvpack_seed();
+
+        if (srvpack_hash(seed, buckets, slots, disp, where))
+            break;
+    }
+
+    if (SRVPACK_SEEDS == i) {
+        ERRF(__FILE__, __LINE__, "couldn't build the path index!\n");
+        goto fail;
+    }
+
+    for (i = 0; i < file_cnt; ++i) {
+        f = &files[i];
+
+        ents[where[i]].hash = f->hash;
+        ents[where[i]].path = meta_off + f->path;
+        ents[where[i]].pathlen = f->keylen;
+        ents[where[i]].type = f->type;
+
+        for (v = 0; v < PACK_VAR_CNT; ++v) {
+            ents[where[i]].var[v] = f->var[v];
+
+            if (f->var[v].headlen)
+                ents[where[i]].var[v].head = meta_off + f->var[v].head;
+        }
+    }
+
+    memset(&hdr, 0, sizeof hdr);
+    memcpy(hdr.magic, PACK_MAGIC, sizeof hdr.magic);
+    hdr.order = 1;
+    hdr.count = file_cnt;
+    hdr.seed = seed;
+    hdr.buckets = buckets;
+    hdr.slots = slots;
+    hdr.disp = off;
+    hdr.ents = (off + buckets * sizeof *disp + 7) & ~7ULL;
+    hdr.size = hdr.ents + slots * sizeof *ents;
+
+    if ((ssize_t) metalen != pwrite(fd, meta, metalen, meta_off)
+        || (ssize_t) (buckets * sizeof *disp) !=
+        pwrite(fd, disp, buckets * sizeof *disp, hdr.disp)
+        || (ssize_t) (slots * sizeof *ents) !=
+        pwrite(fd, ents, slots * sizeof *ents, hdr.ents)
+        || (ssize_t) sizeof hdr != pwrite(fd, &hdr, sizeof hdr, 0)
+        || ftruncate(fd, hdr.size) || fsync(fd)) {
+        ERRF(__FILE__, __LINE__, "writing pack: %s!\n", strerror(errno));
+        goto fail;
+    }
+
+    /* in one piece, or not at all */
+    if (rename(tmp, out)) {
+        ERRF(__FILE__, __LINE__, "renaming %s: %s!\n", tmp, strerror(errno));
+        goto fail;
+    }
+
+    printf("packed %u paths into %s, %llu bytes\n", file_cnt, out,
+           (unsigned long long)hdr.size);
+    ok = 1;
+
+  fail:
+    close(fd);
+
+    if (!ok)
+        unlink(tmp);
+
+  done:
+    free(disp);
+    free(where);
+    free(ents);
+    free(meta);
+
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    struct _srvhndlr_conf_t *hnd;
+    unsigned int i, j;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <config> <pack>\n", argv[0]);
+        return 1;
+    }
+
+    if (!srv_conf_parse(&conf, argv[1])) {
+        ERRF(__FILE__, __LINE__, "invalid config: %s!\n", argv[1]);
+        return 1;
+    }
+
+    /* the same routes the server would have, modules, proxies and
+     * FastCGI pools just mark their paths as not ours */
+    srv_router_init(&routes);
+
+    for (i = 0; i < conf.hide.count; ++i) {
+        hnd = (struct _srvhndlr_conf_t *)vector_get_at(&conf.hide, i);
+        srv_router_add(&routes, hnd->type, hnd->data, ROUTE_DENY,
+                       SRV_PRIO_NORMAL, NULL);
+    }
+
+    for (i = 0; i < conf.mod_cnt; ++i) {
+        for (j = 0; j < conf.mods[i].hnd.count; ++j) {
+            hnd = (struct _srvhndlr_conf_t *)
+                vector_get_at(&conf.mods[i].hnd, j);
+            srv_router_add(&routes, hnd->type, hnd->data, ROUTE_MODULE,
+                           conf.mods[i].prio, NULL);
+        }
+    }
+
+    for (i = 0; i < conf.proxy_cnt; ++i) {
+        if (NULL == conf.proxies[i].vhost
+            || (NULL != conf.hostname
+                && !strcasecmp(conf.proxies[i].vhost, conf.hostname)))
+            srv_router_add(&routes, SRV_HANDLER_DIR, conf.proxies[i].prefix,
+                           ROUTE_PROXY, SRV_PRIO_NORMAL, NULL);
+    }
+
+    for (i = 0; i < conf.fcgi_cnt; ++i) {
+        if (NULL != conf.fcgis[i].vhost
+            && (NULL == conf.hostname
+                || strcasecmp(conf.fcgis[i].vhost, conf.hostname)))
+            continue;
+
+        for (j = 0; j < conf.fcgis[i].hnd.count; ++j) {
+            hnd = (struct _srvhndlr_conf_t *)
+                vector_get_at(&conf.fcgis[i].hnd, j);
+            srv_router_add(&routes, hnd->type, hnd->data, ROUTE_FCGI,
+                           SRV_PRIO_NORMAL, NULL);
+        }
+    }
+
+    srv_router_compile(&routes);
+
+    /* keys start at the slash after the docroot */
+    for (root_len = strlen(conf.docroot);
+         root_len > 1 && '/' == conf.docroot[root_len - 1]; --root_len) ;
+
+    conf.docroot[root_len] = '\0';
+
+    if (nftw(conf.docroot, srvpack_walk, 32, 0)) {
+        ERRF(__FILE__, __LINE__, "walking %s: %s!\n", conf.docroot,
+             strerror(errno));
+        return 1;
+    }
+
+    if (!file_cnt) {
+        ERRF(__FILE__, __LINE__, "nothing to pack in %s!\n", conf.docroot);
+        return 1;
+    }
+
+    qsort(files, file_cnt, sizeof *files, srvpack_cmp);
+
+    return (srvpack_write(argv[2])) ? 0 : 1;
+}
@@ -0,0 +1,349 @@
+/* buf.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "buf.h"
+
+/* each thread's own stash of free buffers */
+struct _buf_cache {
+    buf_t *free[BUF_CLASSES];
+    unsigned int cnt[BUF_CLASSES];
+};
+
+/* what the threads spill into, and refill from */
+static pthread_mutex_t buf_pool_mt = PTHREAD_MUTEX_INITIALIZER;
+static buf_t *buf_pool[BUF_CLASSES];
+static unsigned int buf_pool_cnt[BUF_CLASSES];
+/* how many of each class it may keep, set by buf_pool_limit */
+static unsigned int buf_pool_cap = BUF_POOL_MAX;
+
+static pthread_once_t buf_once = PTHREAD_ONCE_INIT;
+static pthread_key_t buf_key;
+
+/**
+ * move up to n buffers of a class from a cache to the shared pool,
+ * freeing whatever the pool has no room for
+ */
+void _buf_spill(struct _buf_cache *bc, unsigned int cls, unsigned int n)
+{
+    buf_t *b;
+
+    pthread_mutex_lock(&buf_pool_mt);
+
+    while (n-- && NULL != (b = bc->free[cls])) {
+        bc->free[cls] = b->next;
+        --bc->cnt[cls];
+
+        if (buf_pool_cnt[cls] >= buf_pool_cap) {
+            free(b);
+            continue;
+        }
+
+        b->next = buf_pool[cls];
+        buf_pool[cls] = b;
+        ++buf_pool_cnt[cls];
+    }
+
+    pthread_mutex_unlock(&buf_pool_mt);
+}
+
+/**
+ * a thread is exiting, hand its cache over
+ */
+void _buf_cache_free(void *arg)
+{
+    struct _buf_cache *bc = (struct _buf_cache *)arg;
+    unsigned int i;
+
+    for (i = 0; i < BUF_CLASSES; ++i)
+        _buf_spill(bc, i, bc->cnt[i]);
+
+    free(bc);
+}
+
+void _buf_init(void)
+{
+    pthread_key_create(&buf_key, _buf_cache_free);
+}
+
+/**
+ * this thread's cache, NULL if we can't have one
+ */
+struct _buf_cache *_buf_cache(void)
+{
+    struct _buf_cache *bc;
+
+    pthread_once(&buf_once, _buf_init);
+
+    if (NULL != (bc = pthread_getspecific(buf_key)))
+        return bc;
+
+    if (NULL == (bc = calloc(1, sizeof *bc)))
+        return NULL;
+
+    if (pthread_setspecific(buf_key, bc)) {
+        free(bc);
+        return NULL;
+    }
+
+    return bc;
+}
+
+/**
+ * the smallest class that holds this much, BUF_CLASSES if none does
+ */
+unsigned int _buf_class(size_t size)
+{
+    unsigned int cls = 0;
+    size_t room = BUF_MIN_SIZE;
+
+    while (cls < BUF_CLASSES && room < size) {
+        room <<= 2;
+        ++cls;
+    }
+
+    return cls;
+}
+
+/**
+ * borrow a buffer
+ * @param size how much room we need
+ */
+buf_t *buf_get(size_t size)
+{
+    struct _buf_cache *bc;
+    unsigned int cls, n;
+    buf_t *b = NULL;
+
+    cls = _buf_class(size);
+
+    if (BUF_CLASSES == cls) {
+        /* too big to pool */
+        if (NULL == (b = malloc(sizeof *b + size)))
+            return NULL;
+
+        b->size = size;
+        goto done;
+    }
+
+    bc = _buf_cache();
+
+    if (NULL != bc && NULL == bc->free[cls]) {
+        /* run dry, take a handful from the shared pool */
+        pthread_mutex_lock(&buf_pool_mt);
+
+        for (n = 0; n < BUF_CACHE_MAX / 2 && NULL != buf_pool[cls]; ++n) {
+            b = buf_pool[cls];
+            buf_pool[cls] = b->next;
+            --buf_pool_cnt[cls];
+
+            b->next = bc->free[cls];
+            bc->free[cls] = b;
+            ++bc->cnt[cls];
+        }
+
+        pthread_mutex_unlock(&buf_pool_mt);
+    }
+
+    if (NULL != bc && NULL != (b = bc->free[cls])) {
+        bc->free[cls] = b->next;
+        --bc->cnt[cls];
+    } else {
+        if (NULL == (b = malloc(sizeof *b + ((size_t)BUF_MIN_SIZE
+                                             << (2 * cls)))))
+            return NULL;
+
+        b->size = (size_t)BUF_MIN_SIZE << (2 * cls);
+    }
+
+  done:
+    b->next = NULL;
+    b->refs = 1;
+    b->cls = cls;
+    b->len = 0;
+
+    return b;
+}
+
+/**
+ * take another reference
+ * @param b the buffer, and whatever is chained after it
+ */
+buf_t *buf_ref(buf_t * b)
+{
+#ifdef DEBUG
+    assert(NULL != b);
+#endif
+
+    __atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED);
+
+    return b;
+}
+
+/**
+ * drop a reference. a buffer nobody refers to any more goes back to
+ * this thread's cache, and lets go of the rest of its chain.
+ * @param b the head of the chain, may be NULL
+ */
+void buf_put(buf_t * b)
+{
+    struct _buf_cache *bc;
+    buf_t *next;
+
+    while (NULL != b) {
+        if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL))
+            return;
+
+        next = b->next;
+
+        if (BUF_CLASSES == b->cls || NULL == (bc = _buf_cache())) {
+            free(b);
+        } else {
+            b->next = bc->free[b->cls];
+            bc->free[b->cls] = b;
+
+            if (++bc->cnt[b->cls] > BUF_CACHE_MAX)
+                _buf_spill(bc, b->cls, BUF_CACHE_MAX / 2);
+        }
+
+        b = next;
+    }
+}
+
+/**
+ * add a buffer to the end of a chain
+ * @param head the chain, may be NULL
+ * @param b what goes on the end
+ */
+buf_t *buf_append(buf_t * head, buf_t * b)
+{
+    buf_t *tail;
+
+    if (NULL == head)
+        return b;
+
+    for (tail = head; NULL != tail->next; tail = tail->next) ;
+    tail->next = b;
+
+    return head;
+}
+
+/**
+ * count the bytes held by a chain
+ */
+size_t buf_chain_len(buf_t * b)
+{
+    size_t len = 0;
+
+    for (; NULL != b; b = b->next)
+        len += b->len;
+
+    return len;
+}
+
+/**
+ * the most the shared pool would ever hold, in bytes
+ */
+size_t buf_pool_max(void)
+{
+    size_t max = 0;
+    unsigned int cls;
+
+    for (cls = 0; cls < BUF_CLASSES; ++cls)
+        max += (size_t)BUF_POOL_MAX << (2 * cls);
+
+    return max * BUF_MIN_SIZE;
+}
+
+/**
+ * how many bytes the shared pool is holding
+ */
+size_t buf_pool_held(void)
+{
+    unsigned int cls;
+    size_t held = 0;
+
+    pthread_mutex_lock(&buf_pool_mt);
+
+    for (cls = 0; cls < BUF_CLASSES; ++cls)
+        held += (size_t)buf_pool_cnt[cls] * BUF_MIN_SIZE << (2 * cls);
+
+    pthread_mutex_unlock(&buf_pool_mt);
+
+    return held;
+}
+
+/**
+ * let the shared pool keep about this many bytes, every class cut back
+ * by the same share. what it has over goes back to the heap, coldest
+ * first. the threads' own caches are left alone.
+ * @param room bytes, anything past buf_pool_max is no limit
+ * @return how many bytes were freed
+ */
+size_t buf_pool_limit(size_t room)
+{
+    size_t max = buf_pool_max(), freed = 0;
+    unsigned int cls, n;
+    buf_t *b, *cold;
+
+    pthread_mutex_lock(&buf_pool_mt);
+
+    buf_pool_cap = (room >= max) ? BUF_POOL_MAX
+        : (unsigned int)((unsigned long long)room * BUF_POOL_MAX / max);
+
+    for (cls = 0; cls < BUF_CLASSES; ++cls) {
+        if (buf_pool_cnt[cls] <= buf_pool_cap)
+            continue;
+
+        /* the most recently given back are at the front */
+        if (!buf_pool_cap) {
+            cold = buf_pool[cls];
+            buf_pool[cls] = NULL;
+        } else {
+            for (b = buf_pool[cls], n = 1; n < buf_pool_cap; ++n)
+                b = b->next;
+
+            cold = b->next;
+            b->next = NULL;
+        }
+
+        while (NULL != (b = cold)) {
+            cold = b->next;
+            freed += b->size;
+            free(b);
+        }
+
+        buf_pool_cnt[cls] = buf_pool_cap;
+    }
+
+    pthread_mutex_unlock(&buf_pool_mt);
+
+    return freed;
+}
@@ -0,0 +1,76 @@
+/* buf.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef UTIL_BUF_H
+#define UTIL_BUF_H
+
+#include <stddef.h>
+
+/* pooled i/o buffers in a few size classes: 1k, 4k, 16k and 64k. each
+ * thread keeps a small cache of its own so the common borrow and give
+ * back never take a lock, and spills to (or refills from) a shared pool
+ * when its cache runs long or dry. anything bigger than the largest
+ * class comes straight from the heap and goes straight back.
+ *
+ * buffers are reference counted, and can be linked into chains through
+ * next. dropping the last reference on the head of a chain drops one on
+ * everything after it too.
+ */
+
+#define BUF_CLASSES      4
+#define BUF_MIN_SIZE     1024
+#define BUF_MAX_SIZE     (BUF_MIN_SIZE << (2 * (BUF_CLASSES - 1)))
+#define BUF_CACHE_MAX    32
+#define BUF_POOL_MAX     512
+
+typedef struct _buf_t {
+    /* the rest of the chain, or the free list while pooled */
+    struct _buf_t *next;
+    unsigned int refs;
+    unsigned int cls;
+
+    /* room, and how much of it is used */
+    size_t size;
+    size_t len;
+
+    char data[];
+} buf_t;
+
+/* borrow a buffer with room for at least this much */
+buf_t *buf_get(size_t);
+/* take another reference on a buffer */
+buf_t *buf_ref(buf_t *);
+/* drop a reference on a chain, giving back whatever is left unused */
+void buf_put(buf_t *);
+/* add a buffer to the end of a chain, returns the new head */
+buf_t *buf_append(buf_t *, buf_t *);
+/* how many bytes a chain holds */
+size_t buf_chain_len(buf_t *);
+/* the most the shared pool would hold, what it holds, and a new limit
+ * on it, which returns what was freed to get under it */
+size_t buf_pool_max(void);
+size_t buf_pool_held(void);
+size_t buf_pool_limit(size_t);
+
+#endif
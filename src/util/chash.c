@@ -0,0 +1,836 @@
+/* chash.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "util.h"
+#include "hash.h"
+#include "slab.h"
+#include "chash.h"
+
+#define CHASH_LOAD(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define CHASH_STORE(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* nodes and retire records, shared by every table */
+static slab_t chash_nodes = SLAB_INITIALIZER("chash node", chash_node_t);
+static slab_t chash_retired =
+    SLAB_INITIALIZER("chash retired", struct _chash_retired);
+
+/* left in an old bucket once it has been copied to the next table */
+static chash_node_t chash_moved;
+#define CHASH_MOVED (&chash_moved)
+
+/**
+ * retired node: the key and value went with it
+ */
+void _chash_free_node(void *arg, void *ptr)
+{
+    chash_t *ch = (chash_t *)arg;
+    chash_node_t *n = (chash_node_t *)ptr;
+
+    ch->free_key(n->key);
+    ch->free_val(n->val);
+    slab_free(&chash_nodes, n);
+}
+
+/**
+ * retired node that was copied to a bigger table: the copy owns the
+ * key and value now
+ */
+void _chash_free_shell(void *arg, void *ptr)
+{
+    slab_free(&chash_nodes, ptr);
+}
+
+/**
+ * retired value, replaced by an insert
+ */
+void _chash_free_val(void *arg, void *ptr)
+{
+    ((chash_t *)arg)->free_val(ptr);
+}
+
+/**
+ * retired table, every bucket has moved on
+ */
+void _chash_free_table(void *arg, void *ptr)
+{
+    chash_table_t *t = (chash_table_t *)ptr;
+
+    free(t->data);
+    free(t);
+}
+
+/**
+ * allocate an empty table
+ */
+chash_table_t *_chash_table_new(unsigned int slots)
+{
+    chash_table_t *t = calloc(1, sizeof *t);
+
+    if (NULL == t) {
+        ERRF(__FILE__, __LINE__, "allocating chash table!\n");
+        return NULL;
+    }
+
+    t->slots = slots;
+    t->data = calloc(slots, sizeof *t->data);
+
+    if (NULL == t->data) {
+        ERRF(__FILE__, __LINE__, "allocating chash buckets!\n");
+        free(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+/**
+ * which shard a hash belongs to. the bucket uses the low bits, so
+ * spread the high ones.
+ */
+chash_shard_t *_chash_shard(chash_t * ch, unsigned int hash)
+{
+    if (!ch->shard_bits)
+        return ch->shards;
+
+    return &ch->shards[(hash * 0x9e3779b1U) >> (32 - ch->shard_bits)];
+}
+
+/**
+ * free anything that no reader can still be looking at. called with
+ * gc_mt held.
+ */
+void _chash_collect(chash_t * ch)
+{
+    struct _chash_retired *rt, **prev;
+    struct _chash_reader *r;
+    unsigned long epoch, oldest, state;
+
+    /* pairs with the fence in chash_enter */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    epoch = ch->epoch;
+    oldest = epoch + 1;
+
+    for (r = CHASH_LOAD(&ch->readers); NULL != r; r = r->next) {
+        state = __atomic_load_n(&r->state, __ATOMIC_SEQ_CST);
+
+        if ((state & 1) && (state >> 1) < oldest)
+            oldest = state >> 1;
+    }
+
+    /* anything unlinked before the oldest reader came in is garbage */
+    for (prev = &ch->retired; NULL != (rt = *prev);) {
+        if (rt->epoch < oldest) {
+            *prev = rt->next;
+            rt->func(ch, rt->ptr);
+            slab_free(&chash_retired, rt);
+            --ch->retired_cnt;
+        } else {
+            prev = &rt->next;
+        }
+    }
+
+    __atomic_store_n(&ch->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * wait until no reader is left in epoch or any before it. readers never
+ * wait on a writer, so this always ends.
+ */
+void _chash_quiesce(chash_t * ch, unsigned long epoch)
+{
+    struct _chash_reader *r;
+    unsigned long state;
+
+    /* pairs with the fence in chash_enter */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (r = CHASH_LOAD(&ch->readers); NULL != r; r = r->next) {
+        for (;;) {
+            state = __atomic_load_n(&r->state, __ATOMIC_SEQ_CST);
+
+            if (!(state & 1) || (state >> 1) > epoch)
+                break;
+
+            sched_yield();
+        }
+    }
+}
+
+/**
+ * hand something a writer unlinked to the garbage collector
+ */
+void _chash_retire(chash_t * ch, void *ptr, void (*func) (void *, void *))
+{
+    struct _chash_retired *rt;
+    unsigned long epoch;
+
+    pthread_mutex_lock(&ch->gc_mt);
+
+    /* collecting hands records back, so try again after */
+    if (NULL == (rt = slab_alloc(&chash_retired))) {
+        _chash_collect(ch);
+        rt = slab_alloc(&chash_retired);
+    }
+
+    if (NULL == rt) {
+        /* no memory to remember it, so wait it out right here: anyone
+         * who comes in from now on can't find it */
+        ERRF(__FILE__, __LINE__, "allocating chash retire record!\n");
+
+        epoch = ch->epoch;
+        __atomic_store_n(&ch->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&ch->gc_mt);
+
+        _chash_quiesce(ch, epoch);
+        func(ch, ptr);
+        return;
+    }
+
+    rt->ptr = ptr;
+    rt->func = func;
+    rt->epoch = ch->epoch;
+    rt->next = ch->retired;
+    ch->retired = rt;
+
+    if (++ch->retired_cnt >= CHASH_GC_BATCH)
+        _chash_collect(ch);
+
+    pthread_mutex_unlock(&ch->gc_mt);
+}
+
+/**
+ * a thread went away, let someone else have its reader slot
+ */
+void _chash_reader_exit(void *arg)
+{
+    struct _chash_reader *r = (struct _chash_reader *)arg;
+
+    r->depth = 0;
+    __atomic_store_n(&r->state, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->used, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * get this thread's reader slot, registering it the first time
+ */
+struct _chash_reader *_chash_reader(chash_t * ch)
+{
+    struct _chash_reader *r;
+    unsigned int unused;
+
+    if (NULL != (r = pthread_getspecific(ch->key)))
+        return r;
+
+    for (r = CHASH_LOAD(&ch->readers); NULL != r; r = r->next) {
+        unused = 0;
+
+        if (__atomic_compare_exchange_n(&r->used, &unused, 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+
+    if (NULL == r) {
+        if (NULL == (r = calloc(1, sizeof *r))) {
+            ERRF(__FILE__, __LINE__, "allocating chash reader!\n");
+            exit(1);
+        }
+
+        r->used = 1;
+
+        pthread_mutex_lock(&ch->gc_mt);
+        r->next = ch->readers;
+        CHASH_STORE(&ch->readers, r);
+        pthread_mutex_unlock(&ch->gc_mt);
+    }
+
+    pthread_setspecific(ch->key, r);
+
+    return r;
+}
+
+/**
+ * whether this thread is between chash_enter and chash_leave
+ */
+int _chash_reading(chash_t * ch)
+{
+    struct _chash_reader *r = pthread_getspecific(ch->key);
+
+    return (NULL != r && r->depth);
+}
+
+/**
+ * copy one bucket of a growing shard into the next table, then point
+ * readers at it. the old nodes stay intact until the readers are gone.
+ */
+int _chash_migrate_bucket(chash_t * ch, chash_shard_t * sh, unsigned int i)
+{
+    chash_table_t *old, *nt;
+    chash_node_t *n, *cp, *copies, *next, **b;
+
+    old = sh->tbl;
+    nt = old->next;
+
+    if (CHASH_MOVED == old->data[i])
+        return 1;
+
+    /* copy everything first, so a failure leaves nothing half done */
+    for (copies = NULL, n = old->data[i]; NULL != n; n = n->next) {
+        if (NULL == (cp = slab_alloc(&chash_nodes))) {
+            ERRF(__FILE__, __LINE__, "allocating chash node copy!\n");
+
+            for (; NULL != copies; copies = next) {
+                next = copies->next;
+                slab_free(&chash_nodes, copies);
+            }
+
+            return 0;
+        }
+
+        cp->key = n->key;
+        cp->val = n->val;
+        cp->hash = n->hash;
+        cp->next = copies;
+        copies = cp;
+    }
+
+    for (; NULL != copies; copies = next) {
+        next = copies->next;
+        b = &nt->data[copies->hash & (nt->slots - 1)];
+        copies->next = *b;
+        CHASH_STORE(b, copies);
+    }
+
+    n = old->data[i];
+    CHASH_STORE(&old->data[i], CHASH_MOVED);
+    ++sh->moved;
+
+    for (; NULL != n; n = next) {
+        next = n->next;
+        _chash_retire(ch, n, _chash_free_shell);
+    }
+
+    return 1;
+}
+
+/**
+ * if a shard is growing, move the bucket a key lives in plus a few more,
+ * so writes always land in the new table. called with the shard locked.
+ */
+int _chash_migrate(chash_t * ch, chash_shard_t * sh, unsigned int hash)
+{
+    chash_table_t *old;
+    unsigned int i;
+
+    old = sh->tbl;
+
+    if (NULL == old->next)
+        return 1;
+
+    if (!_chash_migrate_bucket(ch, sh, hash & (old->slots - 1)))
+        return 0;
+
+    for (i = 0; i < CHASH_MIGRATE && sh->cursor < old->slots; sh->cursor++) {
+        if (CHASH_MOVED == old->data[sh->cursor])
+            continue;
+
+        if (!_chash_migrate_bucket(ch, sh, sh->cursor))
+            return 0;
+
+        i++;
+    }
+
+    if (sh->moved == old->slots) {
+        /* all done, readers can start at the new table */
+        CHASH_STORE(&sh->tbl, old->next);
+        sh->moved = 0;
+        sh->cursor = 0;
+        _chash_retire(ch, old, _chash_free_table);
+    }
+
+    return 1;
+}
+
+/**
+ * create a new concurrent hash table
+ * @param shards the number of writer shards, 0 for the default
+ * @param slots the number of buckets to start with, across all shards
+ */
+chash_t *chash_new(unsigned int shards, unsigned int slots)
+{
+    chash_t *ch = calloc(1, sizeof *ch);
+
+    if (NULL == ch) {
+        ERRF(__FILE__, __LINE__, "allocating memory for new chash_t!\n");
+        return NULL;
+    }
+
+    if (!chash_init(ch, shards, slots)) {
+        free(ch);
+        return NULL;
+    }
+
+    return ch;
+}
+
+/**
+ * initialise an allocated concurrent hash table
+ * @param ch the table to initialise
+ * @param shards the number of writer shards, rounded up to a power of two
+ * @param slots the number of buckets to start with, across all shards
+ */
+int chash_init(chash_t * ch, unsigned int shards, unsigned int slots)
+{
+    unsigned int i, per;
+
+#ifdef DEBUG
+    assert(NULL != ch);
+#endif
+
+    memset(ch, 0, sizeof *ch);
+
+    if (!shards)
+        shards = CHASH_SHARDS;
+
+    for (ch->shard_cnt = 1; ch->shard_cnt < shards; ch->shard_cnt <<= 1)
+        ch->shard_bits++;
+
+    for (per = 8; per * ch->shard_cnt < slots; per <<= 1) ;
+
+    ch->shards = calloc(ch->shard_cnt, sizeof *ch->shards);
+
+    if (NULL == ch->shards) {
+        ERRF(__FILE__, __LINE__, "allocating chash shards!\n");
+        return 0;
+    }
+
+    for (i = 0; i < ch->shard_cnt; i++) {
+        pthread_mutex_init(&ch->shards[i].mt, NULL);
+
+        if (NULL == (ch->shards[i].tbl = _chash_table_new(per)))
+            return 0;
+    }
+
+    pthread_mutex_init(&ch->gc_mt, NULL);
+    pthread_key_create(&ch->key, _chash_reader_exit);
+
+    return 1;
+}
+
+/**
+ * start reading. nothing found by chash_get is freed until chash_leave.
+ * @param ch the table
+ */
+void chash_enter(chash_t * ch)
+{
+    struct _chash_reader *r = _chash_reader(ch);
+
+    if (r->depth++)
+        return;
+
+    __atomic_store_n(&r->state,
+                     (__atomic_load_n(&ch->epoch, __ATOMIC_SEQ_CST) << 1) | 1,
+                     __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * done reading
+ * @param ch the table
+ */
+void chash_leave(chash_t * ch)
+{
+    struct _chash_reader *r = _chash_reader(ch);
+
+#ifdef DEBUG
+    assert(r->depth > 0);
+#endif
+
+    if (--r->depth)
+        return;
+
+    __atomic_store_n(&r->state, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * insert a key/value pair, replacing the value if the key is there
+ * @param ch the table
+ * @param key the key
+ * @param val the value to map to the key
+ */
+int chash_insert(chash_t * ch, const void *key, const void *val)
+{
+    chash_shard_t *sh;
+    chash_table_t *t, *nt;
+    chash_node_t *n, **b;
+    unsigned int hash;
+    void *old;
+
+#ifdef DEBUG
+    assert(NULL != ch);
+    assert(NULL != key);
+    assert(!_chash_reading(ch));
+#endif
+
+    hash = hash_func(key);
+    sh = _chash_shard(ch, hash);
+
+    pthread_mutex_lock(&sh->mt);
+
+    if (!_chash_migrate(ch, sh, hash)) {
+        pthread_mutex_unlock(&sh->mt);
+        return 0;
+    }
+
+    t = (NULL != sh->tbl->next) ? sh->tbl->next : sh->tbl;
+    b = &t->data[hash & (t->slots - 1)];
+
+    for (n = *b; NULL != n; n = n->next) {
+        if (n->hash == hash && !ch->keycmp(key, n->key)) {
+            /* swap in the new value, the old one waits for readers */
+            old = n->val;
+            CHASH_STORE(&n->val, ch->valcpy(val));
+            _chash_retire(ch, old, _chash_free_val);
+
+            pthread_mutex_unlock(&sh->mt);
+            return 1;
+        }
+    }
+
+    if (NULL == (n = slab_alloc(&chash_nodes))) {
+        ERRF(__FILE__, __LINE__, "allocating chash node!\n");
+        pthread_mutex_unlock(&sh->mt);
+        return 0;
+    }
+
+    n->key = ch->keycpy(key);
+    n->val = ch->valcpy(val);
+    n->hash = hash;
+    n->next = *b;
+    CHASH_STORE(b, n);
+    __atomic_add_fetch(&sh->count, 1, __ATOMIC_RELAXED);
+
+    if (t == sh->tbl && sh->count > t->slots * 2) {
+        /* chains are getting long, start growing */
+        if (NULL != (nt = _chash_table_new(t->slots * 2)))
+            CHASH_STORE(&t->next, nt);
+    }
+
+    pthread_mutex_unlock(&sh->mt);
+
+    return 1;
+}
+
+/**
+ * get a value by key, only good until chash_leave
+ * @param ch the table
+ * @param key the key to look for
+ */
+void *chash_get(chash_t * ch, const void *key)
+{
+    chash_table_t *t;
+    chash_node_t *n;
+    unsigned int hash;
+
+#ifdef DEBUG
+    assert(NULL != ch);
+    assert(NULL != key);
+#endif
+
+    hash = hash_func(key);
+    t = CHASH_LOAD(&_chash_shard(ch, hash)->tbl);
+
+    for (;;) {
+        n = CHASH_LOAD(&t->data[hash & (t->slots - 1)]);
+
+        if (CHASH_MOVED != n)
+            break;
+
+        /* this bucket already went to the bigger table */
+        t = CHASH_LOAD(&t->next);
+    }
+
+    for (; NULL != n; n = CHASH_LOAD(&n->next)) {
+        if (n->hash == hash && !ch->keycmp(key, n->key))
+            return CHASH_LOAD(&n->val);
+    }
+
+    return NULL;
+}
+
+/**
+ * remove a key
+ * @param ch the table
+ * @param key the key to remove
+ */
+int chash_delete(chash_t * ch, const void *key)
+{
+    chash_shard_t *sh;
+    chash_table_t *t;
+    chash_node_t *n, **prev;
+    unsigned int hash;
+
+#ifdef DEBUG
+    assert(NULL != ch);
+    assert(NULL != key);
+    assert(!_chash_reading(ch));
+#endif
+
+    hash = hash_func(key);
+    sh = _chash_shard(ch, hash);
+
+    pthread_mutex_lock(&sh->mt);
+
+    if (!_chash_migrate(ch, sh, hash)) {
+        pthread_mutex_unlock(&sh->mt);
+        return 0;
+    }
+
+    t = (NULL != sh->tbl->next) ? sh->tbl->next : sh->tbl;
+
+    for (prev = &t->data[hash & (t->slots - 1)]; NULL != (n = *prev);
+         prev = &n->next) {
+        if (n->hash == hash && !ch->keycmp(key, n->key)) {
+            /* readers already on n can still step past it */
+            CHASH_STORE(prev, n->next);
+            __atomic_sub_fetch(&sh->count, 1, __ATOMIC_RELAXED);
+            _chash_retire(ch, n, _chash_free_node);
+
+            pthread_mutex_unlock(&sh->mt);
+            return 1;
+        }
+    }
+
+    pthread_mutex_unlock(&sh->mt);
+
+    return 0;
+}
+
+/**
+ * how many keys are in the table, give or take concurrent writers
+ * @param ch the table
+ */
+unsigned int chash_count(chash_t * ch)
+{
+    unsigned int i, cnt = 0;
+
+    for (i = 0; i < ch->shard_cnt; i++)
+        cnt += __atomic_load_n(&ch->shards[i].count, __ATOMIC_RELAXED);
+
+    return cnt;
+}
+
+/**
+ * walk one table, skipping buckets that moved on
+ */
+int _chash_foreach_table(chash_table_t * t,
+                         int (*foreach) (const void *, void *, void *),
+                         void *userptr)
+{
+    chash_node_t *n;
+    unsigned int i;
+
+    for (i = 0; i < t->slots; i++) {
+        n = CHASH_LOAD(&t->data[i]);
+
+        if (CHASH_MOVED == n)
+            continue;
+
+        for (; NULL != n; n = CHASH_LOAD(&n->next))
+            if (!foreach(n->key, CHASH_LOAD(&n->val), userptr))
+                return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * call a function for each key/value pair. a key that moves while a
+ * shard is growing may be seen twice.
+ * @param ch the table
+ * @param foreach called with the key, value and userptr, 0 to stop
+ * @param userptr passed along to foreach
+ */
+int chash_foreach(chash_t * ch, int (*foreach) (const void *, void *, void *),
+                  void *userptr)
+{
+    chash_table_t *t;
+    unsigned int i;
+
+#ifdef DEBUG
+    assert(NULL != ch);
+    assert(NULL != foreach);
+#endif
+
+    for (i = 0; i < ch->shard_cnt; i++) {
+        for (t = CHASH_LOAD(&ch->shards[i].tbl); NULL != t;
+             t = CHASH_LOAD(&t->next)) {
+            if (!_chash_foreach_table(t, foreach, userptr))
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * destroy a concurrent hash table. no other thread may be using it.
+ * @param ch the table
+ */
+void chash_destroy(chash_t * ch)
+{
+    struct _chash_retired *rt;
+    struct _chash_reader *r;
+    chash_table_t *t, *next;
+    chash_node_t *n, *nn;
+    unsigned int i, j;
+
+#ifdef DEBUG
+    assert(NULL != ch);
+#endif
+
+    /* nobody is reading, so all the garbage can go */
+    for (; NULL != (rt = ch->retired); slab_free(&chash_retired, rt)) {
+        ch->retired = rt->next;
+        rt->func(ch, rt->ptr);
+    }
+
+    for (i = 0; i < ch->shard_cnt; i++) {
+        for (t = ch->shards[i].tbl; NULL != t; t = next) {
+            next = t->next;
+
+            for (j = 0; j < t->slots; j++) {
+                if (CHASH_MOVED == (n = t->data[j]))
+                    continue;
+
+                for (; NULL != n; n = nn) {
+                    nn = n->next;
+                    _chash_free_node(ch, n);
+                }
+            }
+
+            _chash_free_table(ch, t);
+        }
+
+        pthread_mutex_destroy(&ch->shards[i].mt);
+    }
+
+    for (; NULL != (r = ch->readers); free(r))
+        ch->readers = r->next;
+
+    free(ch->shards);
+    pthread_key_delete(ch->key);
+    pthread_mutex_destroy(&ch->gc_mt);
+
+    ch->shards = NULL;
+    ch->shard_cnt = 0;
+    ch->retired_cnt = 0;
+}
+
+/**
+ * free a concurrent hash table
+ * @param ch the table
+ */
+void chash_free(chash_t * ch)
+{
+    chash_destroy(ch);
+    free(ch);
+}
+
+/**
+ * set the key comparison function
+ * @param ch the table to set the function for
+ * @param keycmp the key comparison function
+ */
+void chash_set_keycmp(chash_t * ch, int (*keycmp) (const void *, const void *))
+{
+    ch->keycmp = keycmp;
+}
+
+/**
+ * set the key copying function
+ * @param ch the table to set the function for
+ * @param keycpy the key copying function
+ */
+void chash_set_keycpy(chash_t * ch, void *(*keycpy) (const void *))
+{
+    ch->keycpy = keycpy;
+}
+
+/**
+ * set the value copying function
+ * @param ch the table to set the function for
+ * @param valcpy the value copying function
+ */
+void chash_set_valcpy(chash_t * ch, void *(*valcpy) (const void *))
+{
+    ch->valcpy = valcpy;
+}
+
+/**
+ * set the key free'ing function
+ * @param ch the table to set the function for
+ * @param free_key the key free'ing function
+ */
+void chash_set_free_key(chash_t * ch, void (*free_key) (void *))
+{
+    ch->free_key = free_key;
+}
+
+/**
+ * set the value free'ing function
+ * @param ch the table to set the function for
+ * @param free_val the value free'ing function
+ */
+void chash_set_free_val(chash_t * ch, void (*free_val) (void *))
+{
+    ch->free_val = free_val;
+}
+
+/**
+ * initialize a table with string keys and values
+ * @param ch the table
+ * @param shards the number of writer shards
+ * @param slots the number of buckets to start with
+ */
+int chash_init_string(chash_t * ch, unsigned int shards, unsigned int slots)
+{
+    if (!chash_init(ch, shards, slots))
+        return 0;
+
+    chash_set_keycmp(ch, hash_default_keycmp);
+    chash_set_keycpy(ch, hash_default_keycpy);
+    chash_set_valcpy(ch, hash_default_valcpy);
+    chash_set_free_key(ch, hash_default_free_key);
+    chash_set_free_val(ch, hash_default_free_val);
+
+    return 1;
+}
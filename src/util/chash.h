@@ -0,0 +1,149 @@
+/* chash.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef UTIL_CHASH_H
+#define UTIL_CHASH_H
+
+#include <pthread.h>
+
+/* a hash table for data that is read by every thread and written by
+ * few. readers never take a lock: they walk immutable nodes inside an
+ * epoch (chash_enter/chash_leave), and anything a writer unlinks is only
+ * freed once every reader that could have seen it has left. writers
+ * lock one shard each, and a shard grows by copying a few buckets per
+ * write into a table twice the size, leaving a forwarding marker behind.
+ */
+
+#define CHASH_SHARDS     16
+#define CHASH_MIGRATE     4
+#define CHASH_GC_BATCH   64
+
+typedef struct _chash_node_t {
+    void *key;
+    void *val;
+    unsigned int hash;
+
+    struct _chash_node_t *next;
+} chash_node_t;
+
+typedef struct _chash_table_t {
+    unsigned int slots;
+    chash_node_t **data;
+
+    /* the table we are being copied into, while growing */
+    struct _chash_table_t *next;
+} chash_table_t;
+
+typedef struct _chash_shard_t {
+    pthread_mutex_t mt;
+
+    /* readers start here, and follow ->next past moved buckets */
+    chash_table_t *tbl;
+    unsigned int count;
+
+    /* progress copying into tbl->next */
+    unsigned int moved;
+    unsigned int cursor;
+} chash_shard_t;
+
+/* one per thread that has ever read the table */
+struct _chash_reader {
+    /* (epoch << 1) | 1 while inside, 0 while outside */
+    unsigned long state;
+    unsigned int depth;
+    unsigned int used;
+
+    struct _chash_reader *next;
+};
+
+/* something unlinked, waiting for readers to move on */
+struct _chash_retired {
+    void *ptr;
+    void (*func) (void *, void *);
+    unsigned long epoch;
+
+    struct _chash_retired *next;
+};
+
+typedef struct _chash_t {
+    chash_shard_t *shards;
+    unsigned int shard_cnt;
+    unsigned int shard_bits;
+
+    /* epoch based reclamation */
+    unsigned long epoch;
+    pthread_key_t key;
+    pthread_mutex_t gc_mt;
+    struct _chash_reader *readers;
+    struct _chash_retired *retired;
+    unsigned int retired_cnt;
+
+    /* key comparison/copying/freeing functions */
+    int (*keycmp) (const void *, const void *);
+
+    void *(*keycpy) (const void *);
+    void *(*valcpy) (const void *);
+
+    void (*free_key) (void *);
+    void (*free_val) (void *);
+} chash_t;
+
+/* create a new concurrent hash table */
+chash_t *chash_new(unsigned int, unsigned int);
+/* initialise a concurrent hash table: shards, total slots */
+int chash_init(chash_t *, unsigned int, unsigned int);
+/* destroy a concurrent hash table, nobody may be using it */
+void chash_destroy(chash_t *);
+/* free a concurrent hash table */
+void chash_free(chash_t *);
+
+/* start reading, pointers from chash_get are good until chash_leave */
+void chash_enter(chash_t *);
+/* done reading */
+void chash_leave(chash_t *);
+
+/* insert or replace a key/value pair. neither this nor chash_delete may
+ * be called between chash_enter and chash_leave */
+int chash_insert(chash_t *, const void *, const void *);
+/* get a value by key, call between chash_enter and chash_leave */
+void *chash_get(chash_t *, const void *);
+/* remove a key */
+int chash_delete(chash_t *, const void *);
+/* how many keys we hold */
+unsigned int chash_count(chash_t *);
+/* call a function for each pair, from inside chash_enter/chash_leave */
+int chash_foreach(chash_t *, int (*foreach) (const void *, void *, void *),
+                  void *);
+
+/* assign the functions */
+void chash_set_keycmp(chash_t *, int (*keycmp) (const void *, const void *));
+void chash_set_keycpy(chash_t *, void *(*keycpy) (const void *));
+void chash_set_valcpy(chash_t *, void *(*valcpy) (const void *));
+void chash_set_free_key(chash_t *, void (*free_key) (void *));
+void chash_set_free_val(chash_t *, void (*free_val) (void *));
+
+/* a table with string keys and values */
+int chash_init_string(chash_t *, unsigned int, unsigned int);
+
+#endif
@@ -0,0 +1,300 @@
+/* coro.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "util.h"
+#include "coro.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* stacks nobody is using */
+static pthread_mutex_t coro_pool_mt = PTHREAD_MUTEX_INITIALIZER;
+static coro_t *coro_pool;
+static unsigned int coro_pool_cnt;
+/* how many it may keep, set by coro_pool_limit */
+static unsigned int coro_pool_cap = CORO_POOL_MAX;
+
+/* what each thread is running */
+static pthread_once_t coro_once = PTHREAD_ONCE_INIT;
+static pthread_key_t coro_key;
+
+void _coro_init(void)
+{
+    pthread_key_create(&coro_key, NULL);
+}
+
+/**
+ * map a fresh stack, guard page at the bottom, coro_t at the top
+ */
+coro_t *_coro_map(void)
+{
+    size_t page, len;
+    char *map;
+    coro_t *co;
+
+    page = sysconf(_SC_PAGESIZE);
+    len = CORO_STACK_SIZE + page;
+
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (MAP_FAILED == map) {
+        ERRF(__FILE__, __LINE__, "mapping coroutine stack!\n");
+        return NULL;
+    }
+
+    if (mprotect(map, page, PROT_NONE)) {
+        ERRF(__FILE__, __LINE__, "protecting coroutine guard page!\n");
+        munmap(map, len);
+        return NULL;
+    }
+
+    co = (coro_t *) (map + len - sizeof *co);
+    co = (coro_t *) ((uintptr_t) co & ~(uintptr_t) 15);
+    co->map = map;
+    co->maplen = len;
+
+    return co;
+}
+
+/**
+ * every coroutine starts here. makecontext only passes ints, so the
+ * pointer comes in two halves.
+ */
+void _coro_start(unsigned int hi, unsigned int lo)
+{
+    coro_t *co = (coro_t *) (((uintptr_t) hi << 16 << 16) | lo);
+
+    co->func(co->arg);
+    co->done = 1;
+
+    /* uc_link takes us back to coro_resume */
+}
+
+/**
+ * create a coroutine
+ * @param func what to run
+ * @param arg handed to func
+ */
+coro_t *coro_new(void (*func) (void *), void *arg)
+{
+    coro_t *co;
+    void *map;
+    size_t maplen;
+
+#ifdef DEBUG
+    assert(NULL != func);
+#endif
+
+    pthread_once(&coro_once, _coro_init);
+
+    pthread_mutex_lock(&coro_pool_mt);
+
+    if (NULL != (co = coro_pool)) {
+        coro_pool = co->next;
+        --coro_pool_cnt;
+    }
+
+    pthread_mutex_unlock(&coro_pool_mt);
+
+    if (NULL == co && NULL == (co = _coro_map()))
+        return NULL;
+
+    map = co->map;
+    maplen = co->maplen;
+    memset(co, 0, sizeof *co);
+    co->map = map;
+    co->maplen = maplen;
+    co->func = func;
+    co->arg = arg;
+
+    if (getcontext(&co->ctx)) {
+        ERRF(__FILE__, __LINE__, "getting coroutine context!\n");
+        coro_free(co);
+        return NULL;
+    }
+
+    /* the stack runs from above the guard page up to the coro_t */
+    co->ctx.uc_stack.ss_sp = (char *)map + sysconf(_SC_PAGESIZE);
+    co->ctx.uc_stack.ss_size = (char *)co - (char *)co->ctx.uc_stack.ss_sp;
+    co->ctx.uc_link = &co->caller;
+
+    makecontext(&co->ctx, (void (*)(void))_coro_start, 2,
+                (unsigned int)((uintptr_t) co >> 16 >> 16),
+                (unsigned int)((uintptr_t) co & 0xffffffffUL));
+
+    return co;
+}
+
+/**
+ * switch into a coroutine until it yields or finishes
+ * @param co the coroutine
+ */
+int coro_resume(coro_t * co)
+{
+    coro_t *prev;
+
+#ifdef DEBUG
+    assert(NULL != co);
+    assert(!co->done);
+#endif
+
+    pthread_once(&coro_once, _coro_init);
+
+    prev = pthread_getspecific(coro_key);
+    pthread_setspecific(coro_key, co);
+
+    swapcontext(&co->caller, &co->ctx);
+
+    pthread_setspecific(coro_key, prev);
+
+    return !co->done;
+}
+
+/**
+ * hand control back to whoever resumed the running coroutine
+ */
+void coro_yield(void)
+{
+    coro_t *co = coro_self();
+
+#ifdef DEBUG
+    assert(NULL != co);
+#endif
+
+    swapcontext(&co->ctx, &co->caller);
+}
+
+/**
+ * the coroutine this thread is running, if any
+ */
+coro_t *coro_self(void)
+{
+    pthread_once(&coro_once, _coro_init);
+
+    return (coro_t *) pthread_getspecific(coro_key);
+}
+
+/**
+ * give a coroutine's stack back to the pool. anything still on an
+ * abandoned coroutine's stack is simply forgotten.
+ * @param co the coroutine
+ */
+void coro_free(coro_t * co)
+{
+    if (NULL == co)
+        return;
+
+    pthread_mutex_lock(&coro_pool_mt);
+
+    if (coro_pool_cnt < coro_pool_cap) {
+        co->next = coro_pool;
+        coro_pool = co;
+        ++coro_pool_cnt;
+        co = NULL;
+    }
+
+    pthread_mutex_unlock(&coro_pool_mt);
+
+    if (NULL != co)
+        munmap(co->map, co->maplen);
+}
+
+/**
+ * the most the stack pool would ever hold, in bytes
+ */
+size_t coro_pool_max(void)
+{
+    return (size_t)CORO_POOL_MAX * (CORO_STACK_SIZE + sysconf(_SC_PAGESIZE));
+}
+
+/**
+ * how many bytes of stacks the pool is holding
+ */
+size_t coro_pool_held(void)
+{
+    size_t held;
+
+    pthread_mutex_lock(&coro_pool_mt);
+    held = (size_t)coro_pool_cnt * (CORO_STACK_SIZE + sysconf(_SC_PAGESIZE));
+    pthread_mutex_unlock(&coro_pool_mt);
+
+    return held;
+}
+
+/**
+ * let the stack pool keep about this many bytes. stacks over that are
+ * unmapped, the ones that sat longest first.
+ * @param room bytes, anything past coro_pool_max is no limit
+ * @return how many bytes were unmapped
+ */
+size_t coro_pool_limit(size_t room)
+{
+    size_t each = CORO_STACK_SIZE + sysconf(_SC_PAGESIZE), freed = 0;
+    coro_t *co, *cold;
+    unsigned int n;
+
+    pthread_mutex_lock(&coro_pool_mt);
+
+    coro_pool_cap = (room / each < CORO_POOL_MAX) ?
+        (unsigned int)(room / each) : CORO_POOL_MAX;
+
+    if (coro_pool_cnt <= coro_pool_cap) {
+        pthread_mutex_unlock(&coro_pool_mt);
+        return 0;
+    }
+
+    /* the most recently freed are at the front */
+    if (!coro_pool_cap) {
+        cold = coro_pool;
+        coro_pool = NULL;
+    } else {
+        for (co = coro_pool, n = 1; n < coro_pool_cap; ++n)
+            co = co->next;
+
+        cold = co->next;
+        co->next = NULL;
+    }
+
+    coro_pool_cnt = coro_pool_cap;
+    pthread_mutex_unlock(&coro_pool_mt);
+
+    while (NULL != (co = cold)) {
+        cold = co->next;
+        freed += co->maplen;
+        munmap(co->map, co->maplen);
+    }
+
+    return freed;
+}
@@ -0,0 +1,72 @@
+/* coro.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef UTIL_CORO_H
+#define UTIL_CORO_H
+
+#include <stddef.h>
+#include <ucontext.h>
+
+/* stackful coroutines. each one gets a stack from a shared pool, with
+ * an unmapped guard page below it so an overflow faults instead of
+ * scribbling on a neighbour. the coro_t itself lives at the top of its
+ * stack, so starting one on a warm pool allocates nothing.
+ */
+
+#define CORO_STACK_SIZE  (256 * 1024)
+#define CORO_POOL_MAX    256
+
+typedef struct _coro_t {
+    ucontext_t ctx;
+    ucontext_t caller;
+
+    void (*func) (void *);
+    void *arg;
+    int done;
+
+    /* the whole mapping, guard page included */
+    void *map;
+    size_t maplen;
+
+    /* while pooled */
+    struct _coro_t *next;
+} coro_t;
+
+/* create a coroutine, it runs on the first coro_resume */
+coro_t *coro_new(void (*)(void *), void *);
+/* run it until it yields or returns, 1 if it can be resumed again */
+int coro_resume(coro_t *);
+/* go back to whoever resumed us */
+void coro_yield(void);
+/* the coroutine we are running in, NULL outside of one */
+coro_t *coro_self(void);
+/* give a finished (or abandoned) coroutine's stack back */
+void coro_free(coro_t *);
+/* the most the stack pool would hold, what it holds, and a new limit
+ * on it, which returns what was unmapped to get under it */
+size_t coro_pool_max(void);
+size_t coro_pool_held(void);
+size_t coro_pool_limit(size_t);
+
+#endif
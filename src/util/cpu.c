@@ -0,0 +1,248 @@
+/* cpu.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "util.h"
+#include "cpu.h"
+
+#define CPU_NODE_MAX 64
+
+#ifdef __linux__
+/* the mask we started with, before anyone got pinned */
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+static cpu_set_t cpu_mask;
+
+void _cpu_init(void)
+{
+    unsigned int i;
+
+    CPU_ZERO(&cpu_mask);
+
+    if (sched_getaffinity(0, sizeof cpu_mask, &cpu_mask)) {
+        /* no idea, so everything that is online */
+        for (i = 0; i < (unsigned)sysconf(_SC_NPROCESSORS_ONLN)
+             && i < CPU_SETSIZE; i++)
+            CPU_SET(i, &cpu_mask);
+    }
+}
+
+/**
+ * read a file holding a line or two of numbers
+ */
+int _cpu_read(const char *file, char *buf, size_t len)
+{
+    FILE *fp;
+
+    if (NULL == (fp = fopen(file, "r")))
+        return 0;
+
+    if (NULL == fgets(buf, len, fp)) {
+        fclose(fp);
+        return 0;
+    }
+
+    fclose(fp);
+    return 1;
+}
+
+/**
+ * parse a sysfs cpu list, like "0-3,8,10-11", into a mask
+ */
+void _cpu_parse_list(const char *list, cpu_set_t * set)
+{
+    char *end;
+    long lo, hi;
+
+    CPU_ZERO(set);
+
+    while ('\0' != *list && '\n' != *list) {
+        lo = strtol(list, &end, 10);
+        if (end == list)
+            break;
+
+        hi = lo;
+        list = end;
+
+        if ('-' == *list) {
+            hi = strtol(list + 1, &end, 10);
+            list = end;
+        }
+
+        for (; lo <= hi && lo < CPU_SETSIZE; lo++)
+            CPU_SET(lo, set);
+
+        if (',' == *list)
+            list++;
+    }
+}
+#endif
+
+/**
+ * how many cpus our affinity mask lets us use
+ */
+unsigned int cpu_count(void)
+{
+#ifdef __linux__
+    pthread_once(&cpu_once, _cpu_init);
+    return CPU_COUNT(&cpu_mask) ? CPU_COUNT(&cpu_mask) : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? n : 1;
+#endif
+}
+
+/**
+ * how many cpus worth of time the cgroup lets us have, rounded up.
+ * 0 if there is no quota.
+ */
+unsigned int cpu_quota(void)
+{
+#ifdef __linux__
+    char buf[128];
+    long long quota, period;
+
+    /* cgroup v2: "max 100000" or "200000 100000" */
+    if (_cpu_read("/sys/fs/cgroup/cpu.max", buf, sizeof buf)) {
+        if (!strncmp(buf, "max", 3))
+            return 0;
+
+        if (2 == sscanf(buf, "%lld %lld", &quota, &period) && period > 0)
+            return (quota + period - 1) / period;
+
+        return 0;
+    }
+
+    /* cgroup v1 */
+    if (_cpu_read("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", buf, sizeof buf)
+        && 0 < (quota = strtoll(buf, NULL, 10))
+        && _cpu_read("/sys/fs/cgroup/cpu/cpu.cfs_period_us", buf, sizeof buf)
+        && 0 < (period = strtoll(buf, NULL, 10)))
+        return (quota + period - 1) / period;
+#endif
+
+    return 0;
+}
+
+/**
+ * how many cpus we can really keep busy
+ */
+unsigned int cpu_usable(void)
+{
+    unsigned int cnt = cpu_count(), quota = cpu_quota();
+
+    if (quota && quota < cnt)
+        cnt = quota;
+
+    return cnt ? cnt : 1;
+}
+
+/**
+ * how many numa nodes there are
+ */
+unsigned int cpu_node_count(void)
+{
+#ifdef __linux__
+    char file[128], buf[8];
+    unsigned int i;
+
+    for (i = 0; i < CPU_NODE_MAX; i++) {
+        snprintf(file, sizeof file,
+                 "/sys/devices/system/node/node%u/cpulist", i);
+
+        if (!_cpu_read(file, buf, sizeof buf))
+            break;
+    }
+
+    return i ? i : 1;
+#else
+    return 1;
+#endif
+}
+
+/**
+ * pin the calling thread. CPU_PIN_CPU gives the nth thread the nth cpu
+ * we may use, CPU_PIN_NUMA gives it every cpu on the nth node, so
+ * threads are spread evenly across the nodes.
+ * @param n which thread of its kind this is
+ * @param how CPU_PIN_NONE, CPU_PIN_CPU or CPU_PIN_NUMA
+ */
+int cpu_pin_self(unsigned int n, unsigned int how)
+{
+#ifdef __linux__
+    char file[128], buf[1024];
+    cpu_set_t set, node;
+    unsigned int i, cnt;
+
+    if (CPU_PIN_NONE == how)
+        return 1;
+
+    cnt = cpu_count();
+    CPU_ZERO(&set);
+
+    if (CPU_PIN_NUMA == how) {
+        snprintf(file, sizeof file,
+                 "/sys/devices/system/node/node%u/cpulist",
+                 n % cpu_node_count());
+
+        if (!_cpu_read(file, buf, sizeof buf))
+            return 0;
+
+        _cpu_parse_list(buf, &node);
+        CPU_AND(&set, &node, &cpu_mask);
+    } else {
+        /* the (n % cnt)th cpu in our mask */
+        for (i = 0, n %= cnt; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &cpu_mask) && !n--) {
+                CPU_SET(i, &set);
+                break;
+            }
+        }
+    }
+
+    if (!CPU_COUNT(&set))
+        return 0;
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof set, &set)) {
+        ERRF(__FILE__, __LINE__, "pinning thread %u!\n", n);
+        return 0;
+    }
+
+    return 1;
+#else
+    return (CPU_PIN_NONE == how);
+#endif
+}
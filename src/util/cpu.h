@@ -0,0 +1,46 @@
+/* cpu.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef UTIL_CPU_H
+#define UTIL_CPU_H
+
+/* what the machine, or the container we were put in, gives us */
+
+/* how to pin a thread */
+#define CPU_PIN_NONE  0
+#define CPU_PIN_CPU   1
+#define CPU_PIN_NUMA  2
+
+/* cpus we may run on, from our affinity mask */
+unsigned int cpu_count(void);
+/* cpus worth of time the cgroup quota allows, 0 for no quota */
+unsigned int cpu_quota(void);
+/* the smaller of the two, at least 1 */
+unsigned int cpu_usable(void);
+/* how many numa nodes there are, at least 1 */
+unsigned int cpu_node_count(void);
+/* pin the calling thread, the nth one of its kind */
+int cpu_pin_self(unsigned int, unsigned int);
+
+#endif
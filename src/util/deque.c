@@ -0,0 +1,239 @@
+/* deque.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "util.h"
+#include "deque.h"
+
+#define DEQUE_LOAD(p, m)     __atomic_load_n((p), (m))
+#define DEQUE_STORE(p, v, m) __atomic_store_n((p), (v), (m))
+
+/**
+ * allocate a ring of the given size, a power of two
+ */
+struct _deque_ring *_deque_ring_new(long slots)
+{
+    struct _deque_ring *r = calloc(1, sizeof *r);
+
+    if (NULL == r) {
+        ERRF(__FILE__, __LINE__, "allocating deque ring!\n");
+        return NULL;
+    }
+
+    r->slots = slots;
+    r->data = calloc(slots, sizeof *r->data);
+
+    if (NULL == r->data) {
+        ERRF(__FILE__, __LINE__, "allocating deque slots!\n");
+        free(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+/**
+ * initialize a deque
+ * @param dq the deque
+ * @param slots how many entries to make room for up front
+ */
+int deque_init(deque_t * dq, long slots)
+{
+    long n;
+
+#ifdef DEBUG
+    assert(NULL != dq);
+#endif
+
+    for (n = DEQUE_MIN_SLOTS; n < slots; n <<= 1) ;
+
+    dq->top = 0;
+    dq->bottom = 0;
+
+    return (NULL != (dq->ring = _deque_ring_new(n)));
+}
+
+/**
+ * free a deque and every ring it ever had
+ * @param dq the deque
+ */
+void deque_destroy(deque_t * dq)
+{
+    struct _deque_ring *r, *prev;
+
+#ifdef DEBUG
+    assert(NULL != dq);
+#endif
+
+    for (r = dq->ring; NULL != r; r = prev) {
+        prev = r->prev;
+        free(r->data);
+        free(r);
+    }
+
+    dq->ring = NULL;
+    dq->top = 0;
+    dq->bottom = 0;
+}
+
+/**
+ * double the ring, copying the live entries across
+ */
+struct _deque_ring *_deque_grow(deque_t * dq, long top, long bottom)
+{
+    struct _deque_ring *old = dq->ring, *r;
+    long i;
+
+    if (NULL == (r = _deque_ring_new(old->slots * 2)))
+        return NULL;
+
+    for (i = top; i < bottom; i++)
+        r->data[i & (r->slots - 1)] = old->data[i & (old->slots - 1)];
+
+    /* thieves may still be reading the old one */
+    r->prev = old;
+    DEQUE_STORE(&dq->ring, r, __ATOMIC_RELEASE);
+
+    return r;
+}
+
+/**
+ * add an entry at the bottom. only the owner may call this.
+ * @param dq the deque
+ * @param entry the entry, not NULL
+ */
+int deque_push(deque_t * dq, void *entry)
+{
+    struct _deque_ring *r;
+    long b, t;
+
+#ifdef DEBUG
+    assert(NULL != dq);
+    assert(NULL != entry);
+#endif
+
+    b = DEQUE_LOAD(&dq->bottom, __ATOMIC_RELAXED);
+    t = DEQUE_LOAD(&dq->top, __ATOMIC_ACQUIRE);
+    r = DEQUE_LOAD(&dq->ring, __ATOMIC_RELAXED);
+
+    if (b - t > r->slots - 1 && NULL == (r = _deque_grow(dq, t, b)))
+        return 0;
+
+    DEQUE_STORE(&r->data[b & (r->slots - 1)], entry, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    DEQUE_STORE(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+/**
+ * take the entry at the bottom. only the owner may call this.
+ * @param dq the deque
+ */
+void *deque_take(deque_t * dq)
+{
+    struct _deque_ring *r;
+    void *entry = NULL;
+    long b, t;
+
+#ifdef DEBUG
+    assert(NULL != dq);
+#endif
+
+    b = DEQUE_LOAD(&dq->bottom, __ATOMIC_RELAXED) - 1;
+    r = DEQUE_LOAD(&dq->ring, __ATOMIC_RELAXED);
+    DEQUE_STORE(&dq->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = DEQUE_LOAD(&dq->top, __ATOMIC_RELAXED);
+
+    if (t <= b) {
+        entry = DEQUE_LOAD(&r->data[b & (r->slots - 1)], __ATOMIC_RELAXED);
+
+        if (t == b) {
+            /* the last one, race the thieves for it */
+            if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0,
+                                             __ATOMIC_SEQ_CST,
+                                             __ATOMIC_RELAXED))
+                entry = NULL;
+
+            DEQUE_STORE(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        /* it was empty */
+        DEQUE_STORE(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+
+    return entry;
+}
+
+/**
+ * take the entry at the top, from any thread
+ * @param dq the deque
+ */
+void *deque_steal(deque_t * dq)
+{
+    struct _deque_ring *r;
+    void *entry;
+    long b, t;
+
+#ifdef DEBUG
+    assert(NULL != dq);
+#endif
+
+    t = DEQUE_LOAD(&dq->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = DEQUE_LOAD(&dq->bottom, __ATOMIC_ACQUIRE);
+
+    if (t >= b)
+        return NULL;
+
+    r = DEQUE_LOAD(&dq->ring, __ATOMIC_ACQUIRE);
+    entry = DEQUE_LOAD(&r->data[t & (r->slots - 1)], __ATOMIC_RELAXED);
+
+    if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        /* someone beat us to it */
+        return NULL;
+    }
+
+    return entry;
+}
+
+/**
+ * how many entries there are, as of some recent moment
+ * @param dq the deque
+ */
+long deque_size(deque_t * dq)
+{
+    long b, t;
+
+    b = DEQUE_LOAD(&dq->bottom, __ATOMIC_RELAXED);
+    t = DEQUE_LOAD(&dq->top, __ATOMIC_RELAXED);
+
+    return (b > t) ? b - t : 0;
+}
@@ -0,0 +1,63 @@
+/* deque.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef UTIL_DEQUE_H
+#define UTIL_DEQUE_H
+
+/* a chase-lev work stealing deque. one thread owns it and pushes and
+ * takes at the bottom without a lock, any other thread may steal from
+ * the top. the ring grows as needed; old rings are kept until the deque
+ * is destroyed, since a thief may still be reading one.
+ */
+
+#define DEQUE_MIN_SLOTS 64
+
+struct _deque_ring {
+    long slots;
+    void **data;
+
+    struct _deque_ring *prev;
+};
+
+typedef struct _deque_t {
+    long top;
+    long bottom;
+    struct _deque_ring *ring;
+} deque_t;
+
+/* initialize a deque */
+int deque_init(deque_t *, long);
+/* free everything, nobody may be using it */
+void deque_destroy(deque_t *);
+
+/* owner only: add at the bottom */
+int deque_push(deque_t *, void *);
+/* owner only: take from the bottom, NULL if empty */
+void *deque_take(deque_t *);
+/* anyone: take from the top, NULL if empty or we lost a race */
+void *deque_steal(deque_t *);
+/* roughly how many entries there are */
+long deque_size(deque_t *);
+
+#endif
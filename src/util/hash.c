@@ -27,11 +27,129 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <assert.h>
-#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "util.h"
 #include "hash.h"
 
+/* mixing constants for hash_bytes */
+#define HASH_P0 0xa0761d6478bd642fULL
+#define HASH_P1 0xe7037ed1a0b428dbULL
+#define HASH_P2 0x8ebc6af09c88c6e3ULL
+
+/* per-process seed, so clients can't precompute colliding keys */
+static unsigned long long hash_seed;
+static pthread_once_t hash_seed_once = PTHREAD_ONCE_INIT;
+
+/**
+ * pick the per-process hash seed
+ */
+void _hash_seed_init(void)
+{
+    int fd;
+
+    if (-1 != (fd = open("/dev/urandom", O_RDONLY))) {
+        if (sizeof hash_seed == read(fd, &hash_seed, sizeof hash_seed)) {
+            close(fd);
+            return;
+        }
+
+        close(fd);
+    }
+
+    /* no urandom, do the best we can */
+    hash_seed = (unsigned long long)time(NULL) * HASH_P2;
+    hash_seed ^= (unsigned long long)getpid() << 32;
+    hash_seed ^= (unsigned long long)(size_t) & hash_seed;
+}
+
+/**
+ * multiply two 64 bit values and fold the 128 bit product
+ */
+unsigned long long _hash_mix(unsigned long long a, unsigned long long b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t) a * b;
+
+    return (unsigned long long)(r >> 64) ^ (unsigned long long)r;
+#else
+    unsigned long long r = a * (b | 1);
+
+    return r ^ (r >> 29) ^ (b >> 31);
+#endif
+}
+
+/**
+ * round up to a power of two
+ */
+unsigned int _hash_round_slots(unsigned int slots)
+{
+    unsigned int n = HASH_MIN_SLOTS;
+
+    while (n < slots)
+        n <<= 1;
+
+    return n;
+}
+
+/**
+ * place an entry into a table, robin hood style: whoever is further
+ * from home keeps the slot, and the other one keeps probing
+ * @param data the table
+ * @param mask the slot count minus one
+ * @param he the entry to place, trashed on return
+ */
+void _hash_place(hash_entry_t * data, unsigned int mask, hash_entry_t * he)
+{
+    hash_entry_t tmp;
+    unsigned int i;
+
+    he->dist = 1;
+
+    for (i = he->hash & mask;; i = (i + 1) & mask, he->dist++) {
+        if (!data[i].dist) {
+            /* empty, all ours */
+            data[i] = *he;
+            return;
+        }
+
+        if (data[i].dist < he->dist) {
+            /* they're richer than us, take their spot */
+            tmp = data[i];
+            data[i] = *he;
+            *he = tmp;
+        }
+    }
+}
+
+/**
+ * find the slot holding a key
+ * @param ht the hash table
+ * @param key the key to look for
+ * @param hash the key's hash
+ */
+hash_entry_t *_hash_find(hash_t * ht, const void *key, unsigned int hash)
+{
+    unsigned int i, dist, mask;
+    hash_entry_t *he;
+
+    mask = ht->slots - 1;
+
+    for (i = hash & mask, dist = 1;; i = (i + 1) & mask, dist++) {
+        he = &ht->data[i];
+
+        /* we'd have been placed before anyone this close to home */
+        if (he->dist < dist)
+            return NULL;
+
+        if (he->hash == hash && !ht->keycmp(key, he->key))
+            return he;
+    }
+}
+
 /**
  * create a new hash table
  * @param slots the number of slots to create the hash table with
@@ -53,7 +171,8 @@ hash_t *hash_new(unsigned int slots)
 /**
  * initialise an allocated hash table
  * @param ht the hash table to initialise
- * @param slots the number of slots to start with
+ * @param slots the number of slots to start with, rounded up to a
+ *              power of two
  */
 void hash_init(hash_t * ht, unsigned int slots)
 {
@@ -61,16 +180,10 @@ void hash_init(hash_t * ht, unsigned int slots)
     assert(NULL != ht);
 #endif
 
-    /* for now, we comment this out.  I need to come up with a better way
-     * to round the slots, and this kind of sucks.  But whatever...we'll
-     * just take whatever the user provides.
-     *
-     * ht->slots = (unsigned int) ceil (sqrt (slots) * log (slots));
-     */
+    pthread_once(&hash_seed_once, _hash_seed_init);
 
-    ht->slots = slots;
+    ht->slots = _hash_round_slots(slots);
     ht->count = 0;
-    ht->unique = 0;
 
     ht->data = calloc(ht->slots, sizeof *ht->data);
     if (NULL == ht->data) {
@@ -80,48 +193,38 @@ void hash_init(hash_t * ht, unsigned int slots)
 }
 
 /**
- * double the size of the hash table
+ * double the size of the hash table. entries are moved over with their
+ * cached hashes, the keys and values themselves are left alone.
  * @param ht the hash table to make larger
  */
 int hash_resize(hash_t * ht)
 {
-    hash_entry_t **tmp, *he;
+    hash_entry_t *tmp, he;
     unsigned int index, slots;
 
 #ifdef DEBUG
     assert(NULL != ht);
 #endif
 
-    tmp = ht->data;
-    ht->data = NULL;
-    slots = ht->slots;
-
-    hash_init(ht, slots * 2);
-
-    /* tmp retains the proper pointer for now */
-    for (index = 0; index < slots; index++) {
-        if (NULL != (he = tmp[index])) {
-            while (NULL != he) {
-                /* insert into new data table */
-                hash_insert(ht, he->key, he->val);
-
-                ht->free_key(he->key);
-                ht->free_val(he->val);
-
-                /* "remove" the entry from the linked list */
-                if (NULL != he->next) {
-                    tmp[index] = he->next;
-                    free(he);
-                    he = tmp[index];
-                } else {
-                    free(he);
-                    he = tmp[index] = NULL;
-                }
-            }
+    slots = ht->slots * 2;
+    tmp = calloc(slots, sizeof *tmp);
+
+    if (NULL == tmp) {
+        ERRF(__FILE__, __LINE__, "allocating memory to resize hash!\n");
+        return 0;
+    }
+
+    for (index = 0; index < ht->slots; index++) {
+        if (ht->data[index].dist) {
+            he = ht->data[index];
+            _hash_place(tmp, slots - 1, &he);
         }
     }
 
-    free(tmp);
+    free(ht->data);
+    ht->data = tmp;
+    ht->slots = slots;
+
     return 1;
 }
 
@@ -133,8 +236,8 @@ int hash_resize(hash_t * ht)
  */
 int hash_insert(hash_t * ht, const void *key, const void *val)
 {
-    hash_entry_t *he;
-    unsigned int hash, index;
+    hash_entry_t *he, tmp;
+    unsigned int hash;
 
 #ifdef DEBUG
     assert(NULL != ht);
@@ -148,49 +251,30 @@ int hash_insert(hash_t * ht, const void *key, const void *val)
         return 0;
     }
 
-    if (ht->count >= ht->slots) {
-        /* we're out of space ! */
-        if (!hash_resize(ht)) {
-            /* that sucks... errors allocating */
-            return 0;
-        }
-    }
-
     hash = hash_func(key);
-    index = hash % ht->slots;
 
-    if (NULL != (he = ht->data[index])) {
+    if (NULL != (he = _hash_find(ht, key, hash))) {
+        /* keys match. free value, and copy new one */
         DEBUGF(__FILE__, __LINE__, "got a duplicate...\n");
+        ht->free_val(he->val);
+        he->val = ht->valcpy(val);
 
-        while (NULL != he) {
-            if (!ht->keycmp(key, he->key)) {
-                /* keys match. free value, and copy new one */
-                ht->free_val(he->val);
-                he->val = ht->valcpy(val);
-
-                return 1;
-            }
-
-            he = he->next;
-        }
-    } else {
-        ht->unique++;
+        return 1;
     }
 
-    he = calloc(1, sizeof *he);
-    if (NULL == he) {
-        ERRF(__FILE__, __LINE__,
-             "allocating memory for a new hash_entry_t struct!\n");
-        exit(1);
+    if ((ht->count + 1) * HASH_LOAD_DEN > ht->slots * HASH_LOAD_NUM) {
+        /* we're getting full! */
+        if (!hash_resize(ht)) {
+            /* that sucks... errors allocating */
+            return 0;
+        }
     }
 
-    he->key = ht->keycpy(key);
-    he->val = ht->valcpy(val);
-
-    /* do some linked list hax */
-    he->next = ht->data[index];
-    ht->data[index] = he;
+    tmp.key = ht->keycpy(key);
+    tmp.val = ht->valcpy(val);
+    tmp.hash = hash;
 
+    _hash_place(ht->data, ht->slots - 1, &tmp);
     ++ht->count;
 
     return 1;
@@ -203,7 +287,6 @@ int hash_insert(hash_t * ht, const void *key, const void *val)
  */
 void *hash_get(hash_t * ht, const void *key)
 {
-    unsigned int hash, index;
     hash_entry_t *he;
 
 #ifdef DEBUG
@@ -211,19 +294,11 @@ void *hash_get(hash_t * ht, const void *key)
     assert(NULL != key);
 #endif
 
-    hash = hash_func(key);
-    index = hash % ht->slots;
-
-    if (NULL != (he = ht->data[index])) {
-        while (NULL != he) {
-            if (!ht->keycmp(key, he->key)) {
-                /* k they are equal */
-                return he->val;
-            }
+    if (!ht->count)
+        return NULL;
 
-            he = he->next;
-        }
-    }
+    if (NULL != (he = _hash_find(ht, key, hash_func(key))))
+        return he->val;
 
     return NULL;
 }
@@ -241,13 +316,14 @@ int _hash_delete_foreach(const void *key, void *userptr)
 }
 
 /**
- * remove an entry from a hash table
+ * remove an entry from a hash table. everyone after it in the probe
+ * sequence shifts back a slot, so there are no tombstones.
  * @param ht the hash table to remove the entry from
  * @param key the key to remove from the table
  */
 int hash_delete(hash_t * ht, const void *key)
 {
-    unsigned int hash, index;
+    unsigned int i, next, mask;
     hash_entry_t *he;
 
 #ifdef DEBUG
@@ -255,38 +331,30 @@ int hash_delete(hash_t * ht, const void *key)
     assert(NULL != key);
 #endif
 
-    hash = hash_func(key);
-    index = hash % ht->slots;
-
-    if (NULL != (he = ht->data[index])) {
-        while (NULL != he) {
-            if (!ht->keycmp(key, he->key)) {
-                /* k they are equal */
-                ht->free_key(he->key);
-                ht->free_val(he->val);
-
-                /* "remove" the entry from the linked list */
-                if (he->next) {
-                    ht->data[index] = he->next;
-                    free(he);
-                } else {
-                    free(he);
-                    ht->data[index] = NULL;
-                }
-
-                --ht->count;
-                return 1;
-            }
-
-            he = he->next;
-        }
+    if (!ht->count || NULL == (he = _hash_find(ht, key, hash_func(key))))
+        return 0;
+
+    ht->free_key(he->key);
+    ht->free_val(he->val);
+
+    mask = ht->slots - 1;
+    i = (unsigned int)(he - ht->data);
+
+    for (next = (i + 1) & mask; ht->data[next].dist > 1;
+         i = next, next = (next + 1) & mask) {
+        ht->data[i] = ht->data[next];
+        ht->data[i].dist--;
     }
 
-    return 0;
+    memset(&ht->data[i], 0, sizeof ht->data[i]);
+    --ht->count;
+
+    return 1;
 }
 
 /**
- * execute a function for each key in a hash table
+ * execute a function for each key in a hash table. the function may
+ * delete the key it was handed.
  * @param ht the hash table to iterate over
  * @param foreach the function to call for each key
  * @param userptr the additional argument the user can pass (can be NULL)
@@ -295,7 +363,7 @@ int hash_foreach(hash_t * ht, int (*foreach) (const void *, void *),
                  void *userptr)
 {
     unsigned int i;
-    hash_entry_t *he;
+    void *key;
 
 #ifdef DEBUG
     assert(NULL != ht);
@@ -307,41 +375,99 @@ int hash_foreach(hash_t * ht, int (*foreach) (const void *, void *),
         return 0;
     }
 
-    for (i = 0; i < ht->slots; i++) {
-        if (NULL != (he = ht->data[i])) {
-            while (NULL != he) {
-                if (!foreach(he->key, userptr)) {
-                    /* I might change this. If the foreach () function
-                     * that the user passes returns 0, do we REALLY want
-                     * to exit, or are we just going to ignore this value?
-                     * For now, I'm going to have it return 0, but I may
-                     * very well change this.
-                     */
-                    return 0;
-                }
-
-                he = he->next;
-            }
+    for (i = 0; i < ht->slots;) {
+        if (!ht->data[i].dist) {
+            i++;
+            continue;
+        }
+
+        key = ht->data[i].key;
+
+        if (!foreach(key, userptr)) {
+            /* I might change this. If the foreach () function
+             * that the user passes returns 0, do we REALLY want
+             * to exit, or are we just going to ignore this value?
+             * For now, I'm going to have it return 0, but I may
+             * very well change this.
+             */
+            return 0;
         }
+
+        /* if that deleted the key, its neighbour may have shifted
+         * into this slot, so take another look
+         */
+        if (!ht->data[i].dist || ht->data[i].key == key)
+            i++;
     }
 
     return 1;
 }
 
 /**
- * Daniel J. Bernstein's hashing function. Pizza says it's good!
+ * hash a buffer with the per-process seed
+ * @param buf the bytes to hash
+ * @param len how many of them
+ */
+unsigned long long hash_bytes(const void *buf, size_t len)
+{
+    pthread_once(&hash_seed_once, _hash_seed_init);
+
+    return hash_bytes_seed(buf, len, hash_seed);
+}
+
+/**
+ * hash a buffer. reads eight bytes at a time and folds them in with
+ * a wide multiply, in the style of wyhash. the same seed always gives
+ * the same hash, so it can be written down and used again later.
+ * @param buf the bytes to hash
+ * @param len how many of them
+ * @param seed what to start from
+ */
+unsigned long long hash_bytes_seed(const void *buf, size_t len,
+                                   unsigned long long seed)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    unsigned long long h, a, b;
+    unsigned int lo, hi;
+    size_t left;
+
+    h = seed ^ HASH_P0;
+    a = b = 0;
+
+    for (left = len; left > 16; left -= 16, p += 16) {
+        memcpy(&a, p, 8);
+        memcpy(&b, p + 8, 8);
+        h = _hash_mix(a ^ HASH_P1, b ^ h);
+    }
+
+    if (left >= 8) {
+        memcpy(&a, p, 8);
+        memcpy(&b, p + left - 8, 8);
+    } else if (left >= 4) {
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + left - 4, 4);
+        a = lo;
+        b = hi;
+    } else if (left) {
+        a = ((unsigned long long)p[0] << 16) |
+            ((unsigned long long)p[left >> 1] << 8) | p[left - 1];
+        b = 0;
+    }
+
+    return _hash_mix(HASH_P1 ^ len, _hash_mix(a ^ HASH_P1, b ^ h));
+}
+
+/**
+ * hash a string key
  * @param str the string to turn into a number :O O:
  */
 unsigned int hash_func(const void *str)
 {
-    char *c;
-    register unsigned int h = 5381;
+    unsigned long long h;
 
-    for (c = (char *)str; *c != '\0'; c++) {
-        h = (h + (h << 5)) + *c;
-    }
+    h = hash_bytes(str, strlen((const char *)str));
 
-    return h;
+    return (unsigned int)(h ^ (h >> 32));
 }
 
 /**
@@ -358,9 +484,9 @@ void hash_destroy(hash_t * ht)
 
     free(ht->data);
 
+    ht->data = NULL;
     ht->count = 0;
     ht->slots = 0;
-    ht->unique = 0;
 
     ht->keycmp = NULL;
     ht->valcmp = NULL;
@@ -508,7 +634,7 @@ void hash_set_free_val(hash_t * ht, void (*free_val) (void *))
  */
 int hash_default_keycmp(const void *key, const void *str)
 {
-    if (!strncmp((char *)key, (char *)str, strlen((char *)key))) {
+    if (!strcmp((char *)key, (char *)str)) {
         /* key and string are equal, true */
         return 0;
     }
@@ -585,6 +711,19 @@ void hash_default_free_val(void *val)
     }
 }
 
+/**
+ * give a hash table the string functions
+ */
+void _hash_set_string(hash_t * ht)
+{
+    hash_set_keycpy(ht, hash_default_keycpy);
+    hash_set_valcpy(ht, hash_default_valcpy);
+    hash_set_keycmp(ht, hash_default_keycmp);
+    hash_set_valcmp(ht, hash_default_valcmp);
+    hash_set_free_key(ht, hash_default_free_key);
+    hash_set_free_val(ht, hash_default_free_val);
+}
+
 /**
  * create a hash for string keys and values
  * @param slots the number of slots to give the table
@@ -593,8 +732,10 @@ hash_t *hash_new_string(unsigned int slots)
 {
     hash_t *ht;
 
-    ht = hash_new(slots);
-    hash_init_string(ht, slots);
+    if (NULL == (ht = hash_new(slots)))
+        return NULL;
+
+    _hash_set_string(ht);
 
     return ht;
 }
@@ -607,11 +748,5 @@ hash_t *hash_new_string(unsigned int slots)
 void hash_init_string(hash_t * ht, unsigned int slots)
 {
     hash_init(ht, slots);
-
-    hash_set_keycpy(ht, hash_default_keycpy);
-    hash_set_valcpy(ht, hash_default_valcpy);
-    hash_set_keycmp(ht, hash_default_keycmp);
-    hash_set_valcmp(ht, hash_default_valcmp);
-    hash_set_free_key(ht, hash_default_free_key);
-    hash_set_free_val(ht, hash_default_free_val);
+    _hash_set_string(ht);
 }
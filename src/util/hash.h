@@ -25,21 +25,32 @@
 #ifndef UTIL_HASH_H
 #define UTIL_HASH_H
 
+#include <stddef.h>
+
+/* grow once the table is this full (7/8) */
+#define HASH_LOAD_NUM   7
+#define HASH_LOAD_DEN   8
+#define HASH_MIN_SLOTS  8
+
 typedef struct _hash_entry_t {
     void *key;
     void *val;
 
-    /* next entry for linked list */
-    struct _hash_entry_t *next;
+    /* the key's hash, so we never rehash a key or compare on a miss */
+    unsigned int hash;
+    /* probe distance from the home slot, plus one. 0 means empty */
+    unsigned int dist;
 } hash_entry_t;
 
+/* open addressing with robin hood probing. the slot count is always a
+ * power of two, and entries live inline in the table.
+ */
 typedef struct _hash_t {
     unsigned int slots;
     unsigned int count;
-    unsigned int unique;
 
     /* the table */
-    struct _hash_entry_t **data;
+    struct _hash_entry_t *data;
 
     /* key comparison/copying/freeing functions */
     int (*keycmp) (const void *, const void *);
@@ -68,8 +79,12 @@ void *hash_get(hash_t *, const void *);
 int hash_delete(hash_t *, const void *);
 /* execute the provided function for each key */
 int hash_foreach(hash_t *, int (*foreach) (const void *, void *), void *);
-/* hashing function */
+/* hashing function, for strings */
 unsigned int hash_func(const void *);
+/* hash a buffer with the per-process seed */
+unsigned long long hash_bytes(const void *, size_t);
+/* hash a buffer with a seed of our own */
+unsigned long long hash_bytes_seed(const void *, size_t, unsigned long long);
 /* double the size of the hash, not enough slots */
 int hash_resize(hash_t *);
 
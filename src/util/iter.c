@@ -84,28 +84,14 @@ int hash_iter_next(hash_iter_t * iter)
 #endif
 
     if (NULL != iter->he) {
-        if (NULL != iter->he->next) {
-            /* there was a collision */
-            iter->he = iter->he->next;
-
-            iter->first = iter->he->key;
-            iter->second = iter->he->val;
-
-            ++iter->depth;
-
-            return 1;
-        } else {
-            /* move up one... */
-            ++iter->pos;
-        }
+        /* move up one... */
+        ++iter->pos;
     }
 
-    /* reset the depth */
-    iter->depth = 0;
-
     for (; iter->pos < iter->ht->slots; iter->pos++) {
-        if (NULL != (iter->he = iter->ht->data[iter->pos])) {
+        if (iter->ht->data[iter->pos].dist) {
             /* we hit an allocated entry... */
+            iter->he = &iter->ht->data[iter->pos];
             iter->first = iter->he->key;
             iter->second = iter->he->val;
 
@@ -133,24 +119,12 @@ int hash_iter_prev(hash_iter_t * iter)
         return 0;
     }
 
-    if (iter->depth > 0) {
-        for (iter->he = iter->ht->data[iter->pos], i = 0; i < iter->depth; i++) {
-            /* descend to one level below where we are now */
-            iter->he = iter->he->next;
-        }
-
-        --iter->depth;
-        return 1;
-    }
-
-    for (; iter->pos; iter->pos--) {
-        if (NULL != (iter->he = iter->ht->data[iter->pos])) {
-            while (NULL != iter->he->next) {
-                /* proceed along through the linked list */
-                iter->he = iter->he->next;
-
-                ++iter->depth;
-            }
+    for (i = iter->pos; i--;) {
+        if (iter->ht->data[i].dist) {
+            iter->pos = i;
+            iter->he = &iter->ht->data[i];
+            iter->first = iter->he->key;
+            iter->second = iter->he->val;
 
             return 1;
         }
@@ -35,7 +35,7 @@
 
 typedef struct _hash_iter_t {
     unsigned int pos;
-    unsigned int depth;
+    unsigned int depth;            /* unused since open addressing */
 
     /* pointer to a place in the hash's data table */
     hash_entry_t *he;
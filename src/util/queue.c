@@ -0,0 +1,225 @@
+/* queue.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "util.h"
+#include "queue.h"
+
+/**
+ * create a new queue
+ * @param slots how many entries to make room for up front
+ */
+queue_t *queue_new(unsigned int slots)
+{
+    queue_t *q = calloc(1, sizeof *q);
+
+    if (NULL == q) {
+        ERRF(__FILE__, __LINE__, "allocating for a new queue!\n");
+        return NULL;
+    }
+
+    if (!queue_init(q, slots)) {
+        free(q);
+        return NULL;
+    }
+
+    return q;
+}
+
+/**
+ * initialize an allocated queue
+ * @param q the queue to initialize
+ * @param slots how many entries to make room for, rounded up to a
+ *              power of two
+ */
+int queue_init(queue_t * q, unsigned int slots)
+{
+#ifdef DEBUG
+    assert(NULL != q);
+#endif
+
+    for (q->slots = QUEUE_MIN_SLOTS; q->slots < slots; q->slots <<= 1) ;
+
+    q->head = 0;
+    q->count = 0;
+    q->data = calloc(q->slots, sizeof *q->data);
+
+    if (NULL == q->data) {
+        ERRF(__FILE__, __LINE__, "allocating queue slots!\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * destroy a queue, the entries are left alone
+ * @param q the queue to destroy
+ */
+void queue_destroy(queue_t * q)
+{
+#ifdef DEBUG
+    assert(NULL != q);
+#endif
+
+    free(q->data);
+    q->data = NULL;
+    q->slots = 0;
+    q->head = 0;
+    q->count = 0;
+}
+
+/**
+ * free a queue
+ * @param q the queue to free
+ */
+void queue_free(queue_t * q)
+{
+    queue_destroy(q);
+    free(q);
+}
+
+/**
+ * double the ring, unwrapping it as we go
+ */
+int _queue_grow(queue_t * q)
+{
+    void **tmp;
+    unsigned int first;
+
+    tmp = calloc(q->slots * 2, sizeof *tmp);
+
+    if (NULL == tmp) {
+        ERRF(__FILE__, __LINE__, "allocating to grow queue!\n");
+        return 0;
+    }
+
+    first = q->slots - q->head;
+    if (first > q->count)
+        first = q->count;
+
+    memcpy(tmp, &q->data[q->head], first * sizeof *tmp);
+    memcpy(&tmp[first], q->data, (q->count - first) * sizeof *tmp);
+
+    free(q->data);
+    q->data = tmp;
+    q->slots *= 2;
+    q->head = 0;
+
+    return 1;
+}
+
+/**
+ * add an entry at the tail of the queue
+ * @param q the queue
+ * @param entry the entry to add
+ */
+int queue_push(queue_t * q, void *entry)
+{
+#ifdef DEBUG
+    assert(NULL != q);
+#endif
+
+    if (q->count == q->slots && !_queue_grow(q))
+        return 0;
+
+    q->data[(q->head + q->count) & (q->slots - 1)] = entry;
+    ++q->count;
+
+    return 1;
+}
+
+/**
+ * put an entry back at the head of the queue
+ * @param q the queue
+ * @param entry the entry to add
+ */
+int queue_push_head(queue_t * q, void *entry)
+{
+#ifdef DEBUG
+    assert(NULL != q);
+#endif
+
+    if (q->count == q->slots && !_queue_grow(q))
+        return 0;
+
+    q->head = (q->head - 1) & (q->slots - 1);
+    q->data[q->head] = entry;
+    ++q->count;
+
+    return 1;
+}
+
+/**
+ * take the entry at the head of the queue, the oldest one
+ * @param q the queue
+ */
+void *queue_pop(queue_t * q)
+{
+    void *entry;
+
+#ifdef DEBUG
+    assert(NULL != q);
+#endif
+
+    if (!q->count)
+        return NULL;
+
+    entry = q->data[q->head];
+    q->head = (q->head + 1) & (q->slots - 1);
+    --q->count;
+
+    return entry;
+}
+
+/**
+ * take the entry at the tail of the queue, the newest one
+ * @param q the queue
+ */
+void *queue_pop_tail(queue_t * q)
+{
+#ifdef DEBUG
+    assert(NULL != q);
+#endif
+
+    if (!q->count)
+        return NULL;
+
+    --q->count;
+
+    return q->data[(q->head + q->count) & (q->slots - 1)];
+}
+
+/**
+ * look at the entry at the head of the queue
+ * @param q the queue
+ */
+void *queue_peek(queue_t * q)
+{
+    return (q->count) ? q->data[q->head] : NULL;
+}
@@ -0,0 +1,62 @@
+/* queue.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef UTIL_QUEUE_H
+#define UTIL_QUEUE_H
+
+/* a growable ring of pointers. entries go in at the tail and usually
+ * come out at the head, oldest first. the ring only ever grows, so once
+ * it has seen its busiest moment queueing does no allocation.
+ */
+
+#define QUEUE_MIN_SLOTS 16
+
+typedef struct _queue_t {
+    void **data;
+    unsigned int slots;
+    unsigned int head;
+    unsigned int count;
+} queue_t;
+
+/* create a new queue */
+queue_t *queue_new(unsigned int);
+/* initialize an allocated queue */
+int queue_init(queue_t *, unsigned int);
+/* destroy a queue */
+void queue_destroy(queue_t *);
+/* free a queue */
+void queue_free(queue_t *);
+
+/* add an entry at the tail */
+int queue_push(queue_t *, void *);
+/* add an entry at the head, to be taken next */
+int queue_push_head(queue_t *, void *);
+/* take the oldest entry */
+void *queue_pop(queue_t *);
+/* take the newest entry */
+void *queue_pop_tail(queue_t *);
+/* look at the oldest entry */
+void *queue_peek(queue_t *);
+
+#endif
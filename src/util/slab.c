@@ -0,0 +1,362 @@
+/* slab.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "slab.h"
+
+/* a thread's free objects of one kind, and what it did with them */
+struct _slab_mag {
+    slab_t *slab;
+    void *free;
+    unsigned int cnt;
+
+    unsigned long long allocs;
+    unsigned long long frees;
+
+    struct _slab_mag *next;
+    struct _slab_mag *prev;
+};
+
+/* a thread's magazines, one per slab */
+struct _slab_set {
+    struct _slab_mag *mags[SLAB_MAX];
+};
+
+/* every slab that has been used */
+static pthread_mutex_t slab_reg_mt = PTHREAD_MUTEX_INITIALIZER;
+static slab_t *slab_reg[SLAB_MAX];
+static unsigned int slab_reg_cnt;
+
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t slab_key;
+
+/* free objects are linked through their first word */
+#define SLAB_NEXT(p) (*(void **)(p))
+
+/**
+ * move up to n objects from one free list to another
+ */
+unsigned int _slab_move(void **from, void **to, unsigned int n)
+{
+    unsigned int i;
+    void *p;
+
+    for (i = 0; i < n && NULL != (p = *from); ++i) {
+        *from = SLAB_NEXT(p);
+        SLAB_NEXT(p) = *to;
+        *to = p;
+    }
+
+    return i;
+}
+
+/**
+ * a thread is exiting, its objects and its counts go to the slabs
+ */
+void _slab_set_free(void *arg)
+{
+    struct _slab_set *set = (struct _slab_set *)arg;
+    struct _slab_mag *m;
+    slab_t *s;
+    unsigned int i;
+
+    for (i = 0; i < SLAB_MAX; ++i) {
+        if (NULL == (m = set->mags[i]))
+            continue;
+
+        s = m->slab;
+
+        pthread_mutex_lock(&s->mt);
+
+        s->depot_cnt += _slab_move(&m->free, &s->depot, m->cnt);
+        s->allocs += m->allocs;
+        s->frees += m->frees;
+
+        if (NULL != m->prev)
+            m->prev->next = m->next;
+        else
+            s->mags = m->next;
+
+        if (NULL != m->next)
+            m->next->prev = m->prev;
+
+        pthread_mutex_unlock(&s->mt);
+
+        free(m);
+    }
+
+    free(set);
+}
+
+void _slab_init(void)
+{
+    pthread_key_create(&slab_key, _slab_set_free);
+}
+
+/**
+ * give a slab its id, the first time it's used
+ */
+int _slab_register(slab_t * s)
+{
+    pthread_mutex_lock(&slab_reg_mt);
+
+    if (!s->id) {
+        if (SLAB_MAX == slab_reg_cnt) {
+            pthread_mutex_unlock(&slab_reg_mt);
+            ERRF(__FILE__, __LINE__, "too many slabs for %s!\n", s->name);
+            return 0;
+        }
+
+        /* room for the free list link, and keep things aligned */
+        if (s->size < sizeof(void *))
+            s->size = sizeof(void *);
+
+        s->size = (s->size + 15) & ~(size_t)15;
+
+        slab_reg[slab_reg_cnt++] = s;
+        __atomic_store_n(&s->id, slab_reg_cnt, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&slab_reg_mt);
+
+    return 1;
+}
+
+/**
+ * this thread's magazine for a slab
+ */
+struct _slab_mag *_slab_mag(slab_t * s)
+{
+    struct _slab_set *set;
+    struct _slab_mag *m;
+    unsigned int id;
+
+    pthread_once(&slab_once, _slab_init);
+
+    if (!(id = __atomic_load_n(&s->id, __ATOMIC_ACQUIRE))) {
+        if (!_slab_register(s))
+            return NULL;
+
+        id = s->id;
+    }
+
+    if (NULL == (set = pthread_getspecific(slab_key))) {
+        if (NULL == (set = calloc(1, sizeof *set)))
+            return NULL;
+
+        if (pthread_setspecific(slab_key, set)) {
+            free(set);
+            return NULL;
+        }
+    }
+
+    if (NULL != (m = set->mags[id - 1]))
+        return m;
+
+    if (NULL == (m = calloc(1, sizeof *m)))
+        return NULL;
+
+    m->slab = s;
+
+    pthread_mutex_lock(&s->mt);
+
+    if (NULL != (m->next = s->mags))
+        m->next->prev = m;
+
+    s->mags = m;
+
+    pthread_mutex_unlock(&s->mt);
+
+    set->mags[id - 1] = m;
+
+    return m;
+}
+
+/**
+ * refill a dry magazine from the depot, carving a new chunk if the
+ * depot is dry too
+ */
+int _slab_refill(slab_t * s, struct _slab_mag *m)
+{
+    unsigned int i;
+    char *chunk;
+
+    pthread_mutex_lock(&s->mt);
+
+    i = _slab_move(&s->depot, &m->free, SLAB_MAG_MAX / 2);
+    s->depot_cnt -= i;
+    m->cnt += i;
+
+    if (!i) {
+        if (NULL == (chunk = malloc(SLAB_CHUNK * s->size))) {
+            pthread_mutex_unlock(&s->mt);
+            return 0;
+        }
+
+        for (i = 0; i < SLAB_CHUNK; ++i) {
+            SLAB_NEXT(chunk + i * s->size) = m->free;
+            m->free = chunk + i * s->size;
+        }
+
+        m->cnt += SLAB_CHUNK;
+        s->carved += SLAB_CHUNK;
+    }
+
+    pthread_mutex_unlock(&s->mt);
+
+    return 1;
+}
+
+/**
+ * get an object
+ * @param s the slab
+ */
+void *slab_alloc(slab_t * s)
+{
+    struct _slab_mag *m;
+    void *p;
+
+#ifdef DEBUG
+    assert(NULL != s);
+#endif
+
+    if (NULL == (m = _slab_mag(s))
+        || (NULL == m->free && !_slab_refill(s, m))) {
+        ERRF(__FILE__, __LINE__, "allocating from slab %s!\n", s->name);
+        return NULL;
+    }
+
+    p = m->free;
+    m->free = SLAB_NEXT(p);
+    --m->cnt;
+    __atomic_store_n(&m->allocs, m->allocs + 1, __ATOMIC_RELAXED);
+
+    memset(p, 0, s->size);
+
+    return p;
+}
+
+/**
+ * give an object back. it goes to this thread's magazine, whichever
+ * thread it came from.
+ * @param s the slab it came from
+ * @param p the object, may be NULL
+ */
+void slab_free(slab_t * s, void *p)
+{
+    struct _slab_mag *m;
+    unsigned int i;
+
+#ifdef DEBUG
+    assert(NULL != s);
+#endif
+
+    if (NULL == p)
+        return;
+
+    if (NULL == (m = _slab_mag(s))) {
+        /* no magazine, straight to the depot */
+        pthread_mutex_lock(&s->mt);
+        SLAB_NEXT(p) = s->depot;
+        s->depot = p;
+        ++s->depot_cnt;
+        ++s->frees;
+        pthread_mutex_unlock(&s->mt);
+        return;
+    }
+
+    SLAB_NEXT(p) = m->free;
+    m->free = p;
+    __atomic_store_n(&m->frees, m->frees + 1, __ATOMIC_RELAXED);
+
+    if (++m->cnt > SLAB_MAG_MAX) {
+        /* holding too many, share half of them */
+        pthread_mutex_lock(&s->mt);
+        i = _slab_move(&m->free, &s->depot, SLAB_MAG_MAX / 2);
+        s->depot_cnt += i;
+        pthread_mutex_unlock(&s->mt);
+
+        m->cnt -= i;
+    }
+}
+
+/**
+ * fill in how a slab is doing. the counts of threads still running are
+ * read as they are, so they're only as fresh as their last update.
+ */
+void slab_stats(slab_t * s, slab_stats_t * st)
+{
+    struct _slab_mag *m;
+
+#ifdef DEBUG
+    assert(NULL != s);
+    assert(NULL != st);
+#endif
+
+    pthread_mutex_lock(&s->mt);
+
+    st->name = s->name;
+    st->size = s->size;
+    st->carved = s->carved;
+    st->allocs = s->allocs;
+    st->frees = s->frees;
+    st->depot = s->depot_cnt;
+
+    for (m = s->mags; NULL != m; m = m->next) {
+        st->allocs += __atomic_load_n(&m->allocs, __ATOMIC_RELAXED);
+        st->frees += __atomic_load_n(&m->frees, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&s->mt);
+
+    st->used = (st->allocs > st->frees) ? st->allocs - st->frees : 0;
+}
+
+/**
+ * report on every slab in use
+ * @param func called with each slab's stats
+ * @param arg handed to func
+ */
+void slab_walk(void (*func) (const slab_stats_t *, void *), void *arg)
+{
+    slab_t *all[SLAB_MAX];
+    slab_stats_t st;
+    unsigned int i, cnt;
+
+    pthread_mutex_lock(&slab_reg_mt);
+    cnt = slab_reg_cnt;
+    memcpy(all, slab_reg, cnt * sizeof *all);
+    pthread_mutex_unlock(&slab_reg_mt);
+
+    for (i = 0; i < cnt; ++i) {
+        slab_stats(all[i], &st);
+        func(&st, arg);
+    }
+}
@@ -0,0 +1,95 @@
+/* slab.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef UTIL_SLAB_H
+#define UTIL_SLAB_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/* an allocator for objects that all have the same size. objects are
+ * carved SLAB_CHUNK at a time, and freed ones are kept in a magazine
+ * belonging to the thread that freed them, so allocating and freeing
+ * on the hot path takes no lock and never goes near malloc. a thread
+ * whose magazine runs long moves half of it to the slab's depot, and
+ * one that runs dry refills from there, so memory freed on one thread
+ * and allocated on another doesn't pile up. chunks are never given
+ * back; a slab stays at its high water mark.
+ *
+ * a slab is usually a static, set up with SLAB_INITIALIZER. it
+ * registers itself the first time it's used, after which slab_walk
+ * will report on it.
+ */
+
+#define SLAB_MAX        32
+#define SLAB_CHUNK      64
+#define SLAB_MAG_MAX   256
+
+typedef struct _slab_t {
+    const char *name;
+    size_t size;
+
+    /* our magazine in each thread's set, 0 until first used */
+    unsigned int id;
+
+    /* the depot, and the live magazines, for stats */
+    pthread_mutex_t mt;
+    void *depot;
+    unsigned int depot_cnt;
+    struct _slab_mag *mags;
+
+    /* how many objects we've carved, and the counts left behind by
+     * threads that have exited */
+    unsigned long long carved;
+    unsigned long long allocs;
+    unsigned long long frees;
+} slab_t;
+
+typedef struct _slab_stats_t {
+    const char *name;
+    size_t size;
+
+    unsigned long long carved;
+    unsigned long long allocs;
+    unsigned long long frees;
+    /* handed out right now */
+    unsigned long long used;
+    /* sitting in the depot */
+    unsigned int depot;
+} slab_stats_t;
+
+#define SLAB_INITIALIZER(name, type)                            \
+    { (name), sizeof(type), 0, PTHREAD_MUTEX_INITIALIZER,       \
+      NULL, 0, NULL, 0, 0, 0 }
+
+/* get a zeroed object */
+void *slab_alloc(slab_t *);
+/* give one back, from any thread */
+void slab_free(slab_t *, void *);
+/* how a slab is doing */
+void slab_stats(slab_t *, slab_stats_t *);
+/* report on every slab that has been used */
+void slab_walk(void (*)(const slab_stats_t *, void *), void *);
+
+#endif
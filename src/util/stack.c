@@ -27,8 +27,35 @@
 #include <assert.h>
 
 #include "util.h"
+#include "slab.h"
 #include "stack.h"
 
+/* nodes come out of a slab rather than malloc */
+static slab_t stack_nodes = SLAB_INITIALIZER("stack node", stacknode_t);
+
+/**
+ * get a node
+ */
+stacknode_t *_stack_node_get(void)
+{
+    stacknode_t *node;
+
+    if (NULL == (node = slab_alloc(&stack_nodes))) {
+        ERRF(__FILE__, __LINE__, "ERROR: allocating for a new stack node!\n");
+        exit(1);
+    }
+
+    return node;
+}
+
+/**
+ * give a node back
+ */
+void _stack_node_put(stacknode_t * node)
+{
+    slab_free(&stack_nodes, node);
+}
+
 /**
  * create a new stack
  */
@@ -58,7 +85,6 @@ void stack_init(sstack_t * stk)
 #endif
 
     stk->count = 0;
-    stk->first = NULL;
     stk->node = NULL;
     stk->data_alloc = NULL;
     stk->data_free = NULL;
@@ -68,56 +94,35 @@ void stack_init(sstack_t * stk)
  * push an entry onto the stack
  * @param stack the stack to push on to
  * @param entry the data to place in the node
+ * @return 0, with nothing pushed, if data_alloc failed
  */
-void stack_push(sstack_t * stk, void *entry)
+int stack_push(sstack_t * stk, void *entry)
 {
     stacknode_t *node;
     void *tmp;
 
 #ifdef DEBUG
     assert(NULL != stk);
-    assert(NULL != stk->data_alloc);
 #endif
 
-    if (NULL == entry) {
-        tmp = stk->data_alloc(NULL);
-        if (NULL == tmp) {
-            /* sigh... */
-            ERRF(__FILE__, __LINE__,
-                 "ERROR: allocating for new data entry in stack node!\n");
-            exit(1);
-        }
-    } else {
-        tmp = stk->data_alloc(entry);
+    if (NULL == stk->data_alloc) {
+        /* store it as is */
+        tmp = entry;
+    } else if (NULL == (tmp = stk->data_alloc(entry))) {
+        /* sigh... */
+        ERRF(__FILE__, __LINE__,
+             "ERROR: allocating for new data entry in stack node!\n");
+        return 0;
     }
 
-    if (NULL == stk->node) {
-        stk->node = calloc(1, sizeof *(stk->node));
-        if (NULL == stk->node) {
-            ERRF(__FILE__, __LINE__,
-                 "ERROR: allocating for a new stack node!\n");
-            exit(1);
-        }
-
-        stk->node->next = NULL;
-        stk->node->prev = NULL;
-        stk->node->data = tmp;
-        stk->first = stk->node;
-    } else {
-        node = calloc(1, sizeof *node);
-        if (NULL == node) {
-            ERRF(__FILE__, __LINE__,
-                 "ERROR: allocating for a new stack node!\n");
-            exit(1);
-        }
-
-        node->prev = stk->node;
-        node->next = NULL;
-        node->data = tmp;
-        stk->node = node;
-    }
+    node = _stack_node_get();
+    node->data = tmp;
+    node->next = stk->node;
+    stk->node = node;
 
     ++stk->count;
+
+    return 1;
 }
 
 /**
@@ -133,35 +138,66 @@ void *stack_pop(sstack_t * stk)
     assert(NULL != stk);
 #endif
 
-    if (NULL == stk->node || !(stk->count)) {
+    if (NULL == (node = stk->node)) {
         /* nothing to report */
         return NULL;
-    } else if (1 == stk->count) {
-        data = stk->first->data;
-
-        stk->first->data = NULL;
-        stk->first->next = NULL;
-        stk->first->prev = NULL;
-        free(stk->first);
-        stk->first = NULL;
-        stk->node = NULL;
-    } else if (2 == stk->count) {
-        data = stk->first->data;
-        stk->first->data = NULL;
-        stk->first->next = NULL;
-        stk->first->prev = NULL;
-        free(stk->first);
-        stk->first = stk->node;
-    } else {
-        data = stk->first->data;
-        stk->first = stk->first->next;
     }
 
+    data = node->data;
+    stk->node = node->next;
     --stk->count;
 
+    _stack_node_put(node);
+
     return data;
 }
 
+/**
+ * push a number of entries at once
+ * @param stack the stack to push on to
+ * @param entries the entries, pushed in order
+ * @param cnt how many entries there are
+ * @return how many were pushed, short of cnt if data_alloc failed
+ */
+unsigned int stack_push_batch(sstack_t * stk, void **entries,
+                              unsigned int cnt)
+{
+    unsigned int i;
+
+#ifdef DEBUG
+    assert(NULL != stk);
+    assert(NULL != entries || !cnt);
+#endif
+
+    for (i = 0; i < cnt; i++) {
+        if (!stack_push(stk, entries[i]))
+            break;
+    }
+
+    return i;
+}
+
+/**
+ * pop up to a number of entries at once
+ * @param stack the stack to pop from
+ * @param entries where to put them, the top of the stack first
+ * @param max the most to pop
+ */
+unsigned int stack_pop_batch(sstack_t * stk, void **entries, unsigned int max)
+{
+    unsigned int i;
+
+#ifdef DEBUG
+    assert(NULL != stk);
+    assert(NULL != entries || !max);
+#endif
+
+    for (i = 0; i < max && NULL != stk->node; i++)
+        entries[i] = stack_pop(stk);
+
+    return i;
+}
+
 /**
  * look at the data on the top of the stack without popping it
  * @param stack the stack to peek at
@@ -191,7 +227,6 @@ void stack_destroy(sstack_t * stk)
     stk->data_alloc = NULL;
     stk->data_free = NULL;
 }
-
 /**
  * free a stack
  * @param stack the stack to free
@@ -249,8 +284,10 @@ int stack_add_count(sstack_t * stk, unsigned int count)
     assert(NULL != stk);
 #endif
 
-    for (i = 0; i < count; i++)
-        stack_push(stk, NULL);
+    for (i = 0; i < count; i++) {
+        if (!stack_push(stk, NULL))
+            return 0;
+    }
 
     return 1;
 }
@@ -271,7 +308,9 @@ int stack_remove_count(sstack_t * stk, unsigned int count)
 
     for (i = 0; i < count && stk->count; i++) {
         tmp = stack_pop(stk);
-        stk->data_free(tmp);
+
+        if (NULL != stk->data_free)
+            stk->data_free(tmp);
     }
 
     return 1;
@@ -25,18 +25,20 @@
 #ifndef UTIL_STACK_H
 #define UTIL_STACK_H
 
+/* nodes come out of a slab (see slab.h) rather than malloc */
+
 typedef struct _stacknode_t {
     void *data;
     struct _stacknode_t *next;
-    struct _stacknode_t *prev;
 } stacknode_t;
 
 typedef struct _sstack_t {
     unsigned int count;
 
+    /* the top of the stack */
     stacknode_t *node;
-    stacknode_t *first;
 
+    /* without a data_alloc, entries are stored as they are given */
     void *(*data_alloc) (void *);
     void (*data_free) (void *);
 } sstack_t;
@@ -45,10 +47,14 @@ typedef struct _sstack_t {
 sstack_t *stack_new(void);
 /* initialize an allocated stack */
 void stack_init(sstack_t *);
-/* push something onto the stack */
-void stack_push(sstack_t *, void *);
+/* push something onto the stack, 0 if its data couldn't be allocated */
+int stack_push(sstack_t *, void *);
 /* pop something off of the stack */
 void *stack_pop(sstack_t *);
+/* push several things, the last one ends up on top, returns how many */
+unsigned int stack_push_batch(sstack_t *, void **, unsigned int);
+/* pop up to a number of things, returns how many */
+unsigned int stack_pop_batch(sstack_t *, void **, unsigned int);
 /* look at the top of the stack */
 void *stack_peek(sstack_t *);
 /* destroy a stack */
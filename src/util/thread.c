@@ -28,34 +28,109 @@
 #include <pthread.h>
 #include <assert.h>
 #include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
 
 #include "thread.h"
-#include "stack.h"
+#include "queue.h"
+#include "deque.h"
 #include "util.h"
 
-/*
- * typedef struct _tpool_t {
- *     pthread_t *pool;
- *     unsigned int cnt;
- *     void (*handler)(void *);
- *     sstack_t work;
- * } tpool_t;
- */
+#define TPOOL_LOAD(p)       __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define TPOOL_ADD(p, v)     __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define TPOOL_SUB(p, v)     __atomic_sub_fetch((p), (v), __ATOMIC_SEQ_CST)
+
+/* a clock for sizing decisions, in ms */
+unsigned long long _tpool_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return (unsigned long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
 
 /* allocate */
-tpool_t *tpool_create(unsigned int cnt, tfunc controller, tfunc handler)
+tpool_t *tpool_create(unsigned int min, unsigned int max, unsigned int mode,
+                      tfunc handler)
 {
     tpool_t *tp = calloc(1, sizeof *tp);
 
     /* set it up */
-    if (tp)
-        tpool_init(tp, cnt, controller, handler);
+    if (tp && !tpool_init(tp, min, max, mode, handler)) {
+        free(tp);
+        tp = NULL;
+    }
 
     return tp;
 }
 
+/* stop and join every live worker, then tear everything down */
+void _tpool_free(tpool_t * tp)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&tp->mutex);
+    tp->stop = 1;
+    pthread_cond_broadcast(&tp->cond);
+    pthread_mutex_unlock(&tp->mutex);
+
+    /* workers that retired themselves were detached */
+    for (i = 0; i < tp->slots; i++)
+        if (tp->pool[i].live)
+            pthread_join(tp->pool[i].th, NULL);
+
+    for (i = 0; i < tp->slots; i++) {
+        pthread_mutex_destroy(&tp->pool[i].inbox_mt);
+        queue_destroy(&tp->pool[i].inbox);
+        deque_destroy(&tp->pool[i].dq);
+    }
+
+    for (i = 0; i < TPOOL_PRIO_CNT; i++)
+        queue_destroy(&tp->work[i]);
+
+    pthread_cond_destroy(&tp->cond);
+    pthread_mutex_destroy(&tp->mutex);
+
+    free(tp->pool);
+    tp->pool = NULL;
+    tp->cnt = 0;
+    tp->slots = 0;
+    tp->pending = 0;
+    tp->handler = NULL;
+}
+
+/* start a worker in a free slot, called with the mutex held or
+ * before anyone else can see the pool */
+int _tpool_spawn(tpool_t * tp)
+{
+    unsigned int i;
+
+    for (i = 0; i < tp->slots && tp->pool[i].live; i++) ;
+
+    if (i == tp->slots)
+        return 0;
+
+    tp->pool[i].job = 0;
+    tp->pool[i].busy = 0;
+
+    if (pthread_create(&tp->pool[i].th, NULL, tp->handler,
+                       (void *)(intptr_t) i)) {
+        /* trouble... */
+        ERRF(__FILE__, __LINE__, "error creating thread %u in pool.\n", i);
+        return 0;
+    }
+
+    tp->pool[i].live = 1;
+    ++tp->cnt;
+
+    return 1;
+}
+
 /* create */
-int tpool_init(tpool_t * tp, unsigned int cnt, tfunc controller, tfunc handler)
+int tpool_init(tpool_t * tp, unsigned int min, unsigned int max,
+               unsigned int mode, tfunc handler)
 {
     int i;
 
@@ -64,87 +139,421 @@ int tpool_init(tpool_t * tp, unsigned int cnt, tfunc controller, tfunc handler)
     assert(NULL != handler);
 #endif
 
-    tp->cnt = cnt;
-    tp->pool = calloc(tp->cnt, sizeof *(tp->pool));
+    memset(tp, 0, sizeof *tp);
+
+    if (!min)
+        min = 1;
+
+    /* stealing works over a fixed set of deques */
+    if (max < min || TPOOL_STEAL == mode)
+        max = min;
+
+    tp->min = min;
+    tp->slots = max;
+    tp->mode = mode;
     tp->handler = handler;
-    tp->controller = controller;
-    tp->jobcount = 0;
+    tp->order = TPOOL_FIFO;
 
-    /* set up mutex */
+    /* set up mutex and the idle wait, before anyone can use them */
     pthread_mutex_init(&tp->mutex, NULL);
+    pthread_cond_init(&tp->cond, NULL);
+
+    if (NULL == (tp->pool = calloc(tp->slots, sizeof *(tp->pool)))) {
+        ERRF(__FILE__, __LINE__, "allocating thread pool!\n");
+        tp->slots = 0;
+        _tpool_free(tp);
+        return 0;
+    }
 
-    /* get work queue ready */
-    stack_init(&tp->work);
-
-    /* set up the control thread */
-    pthread_create(&tp->boss.th, NULL, tp->controller, NULL);
-    tp->boss.id = 0;
-    tp->boss.job = 0;
-    tp->boss.busy = 0;
-    pthread_mutex_init(&tp->boss.mt, NULL);
-    pthread_mutex_lock(&tp->boss.mt);
-    pthread_detach(tp->boss.th);
-
-    for (i = 0; i < (signed)tp->cnt; ++i) {
-        if (pthread_create(&tp->pool[i].th, NULL, tp->handler, (void *)i)) {
-            /* trouble... */
-            ERRF(__FILE__, __LINE__, "error creating thread %d in pool.\n", i);
+    /* get work queues ready. jobs are stored as given, so once the
+     * rings have grown to fit a burst queueing never touches the heap. */
+    for (i = 0; i < TPOOL_PRIO_CNT; i++) {
+        if (!queue_init(&tp->work[i], 0)) {
+            _tpool_free(tp);
             return 0;
         }
+    }
 
-        /* automatic cleanup */
+    for (i = 0; i < (signed)tp->slots; ++i) {
         tp->pool[i].id = i;
-        tp->pool[i].job = 0;
-        tp->pool[i].busy = 0;
-        pthread_mutex_init(&tp->pool[i].mt, NULL);
-        pthread_mutex_lock(&tp->pool[i].mt);
-        pthread_detach(tp->pool[i].th);
+        pthread_mutex_init(&tp->pool[i].inbox_mt, NULL);
+
+        if (!queue_init(&tp->pool[i].inbox, 0)
+            || !deque_init(&tp->pool[i].dq, 0)) {
+            _tpool_free(tp);
+            return 0;
+        }
+    }
+
+    pthread_mutex_lock(&tp->mutex);
+
+    for (i = 0; i < (signed)tp->min; ++i) {
+        if (!_tpool_spawn(tp)) {
+            pthread_mutex_unlock(&tp->mutex);
+            _tpool_free(tp);
+            return 0;
+        }
     }
 
+    tp->taken = _tpool_now();
+    pthread_mutex_unlock(&tp->mutex);
+
     return 1;
 }
 
 /* destroy */
 void tpool_destroy(tpool_t * tp)
 {
-    tp->cnt = 0;
-    tp->handler = NULL;
-    pthread_mutex_destroy(&tp->mutex);
-    stack_destroy(&tp->work);
-    memset(tp->pool, '\0', tp->cnt * sizeof(pthread_t));
-    free(tp->pool);
+    _tpool_free(tp);
+}
+
+/* fifo or lifo within a class */
+void tpool_set_order(tpool_t * tp, unsigned int order)
+{
+    pthread_mutex_lock(&tp->mutex);
+    tp->order = order;
+    pthread_mutex_unlock(&tp->mutex);
+}
+
+/* take the next job, called with the mutex held */
+void *_tpool_take(tpool_t * tp)
+{
+    unsigned int i;
+
+    for (i = 0; i < TPOOL_PRIO_CNT; i++) {
+        if (!tp->work[i].count)
+            continue;
+
+        --tp->pending;
+        tp->taken = _tpool_now();
+
+        return (TPOOL_LIFO == tp->order) ?
+            queue_pop_tail(&tp->work[i]) : queue_pop(&tp->work[i]);
+    }
+
+    return NULL;
+}
+
+/* TPOOL_STEAL: wake a worker if any are asleep. pairs with the
+ * sleepers/pending check in _tpool_wait_steal. */
+void _tpool_wake(tpool_t * tp)
+{
+    if (TPOOL_LOAD(&tp->sleepers)) {
+        pthread_mutex_lock(&tp->mutex);
+        pthread_cond_signal(&tp->cond);
+        pthread_mutex_unlock(&tp->mutex);
+    }
+}
+
+/* TPOOL_STEAL: hand a job to a worker's inbox */
+int _tpool_give(tpool_t * tp, void *job, int worker)
+{
+    struct _worker_t *w;
+    int ret;
+
+    if (worker < 0 || worker >= (signed)tp->slots)
+        worker = TPOOL_ADD(&tp->next, 1) % tp->slots;
+
+    w = &tp->pool[worker];
+
+    pthread_mutex_lock(&w->inbox_mt);
+    ret = queue_push(&w->inbox, job);
+    pthread_mutex_unlock(&w->inbox_mt);
+
+    if (ret) {
+        /* only count it once it can be found */
+        TPOOL_ADD(&tp->pending, 1);
+        _tpool_wake(tp);
+    }
+
+    return ret;
+}
+
+/* TPOOL_SHARED: add a worker if everyone is stuck, called with the
+ * mutex held */
+void _tpool_grow(tpool_t * tp)
+{
+    unsigned long long now;
+
+    if (tp->idle || tp->cnt >= tp->slots || tp->stop)
+        return;
+
+    now = _tpool_now();
+
+    if (now - tp->taken < TPOOL_STALL_MS || now - tp->grown < TPOOL_STALL_MS)
+        return;
+
+    if (_tpool_spawn(tp))
+        tp->grown = now;
 }
 
 /* add a job */
 int tpool_add_work(tpool_t * tp, void *job)
 {
+    return tpool_add_work_to(tp, job, TPOOL_PRIO_NORMAL, -1);
+}
+
+/* add a job in a priority class */
+int tpool_add_work_prio(tpool_t * tp, void *job, unsigned int prio)
+{
+    return tpool_add_work_to(tp, job, prio, -1);
+}
+
+/* add a job for a particular worker. the worker is only a hint, used
+ * when stealing, so the job lands where its data is likely cached. */
+int tpool_add_work_to(tpool_t * tp, void *job, unsigned int prio, int worker)
+{
+    int ret;
+
+    /* NULL is what a worker gets when it's time to stop */
+    if (NULL == job)
+        return 0;
+
+    if (TPOOL_STEAL == tp->mode)
+        return _tpool_give(tp, job, worker);
+
+    if (prio >= TPOOL_PRIO_CNT)
+        prio = TPOOL_PRIO_LOW;
+
     pthread_mutex_lock(&tp->mutex);
-    stack_push(&tp->work, job);
-    tp->jobcount++;
+
+    if ((ret = queue_push(&tp->work[prio], job))) {
+        ++tp->pending;
+        pthread_cond_signal(&tp->cond);
+        _tpool_grow(tp);
+    }
+
     pthread_mutex_unlock(&tp->mutex);
 
-    pthread_mutex_unlock(&tp->boss.mt);
+    return ret;
+}
 
-    return 1;
+/* add several jobs, taking the lock once */
+int tpool_add_work_batch(tpool_t * tp, void **jobs, unsigned int cnt)
+{
+    unsigned int i;
+
+    for (i = 0; i < cnt; i++)
+        if (NULL == jobs[i])
+            return 0;
+
+    if (TPOOL_STEAL == tp->mode) {
+        for (i = 0; i < cnt; i++)
+            if (!_tpool_give(tp, jobs[i], -1))
+                return 0;
+
+        return 1;
+    }
+
+    pthread_mutex_lock(&tp->mutex);
+
+    for (i = 0; i < cnt; i++) {
+        if (!queue_push(&tp->work[TPOOL_PRIO_NORMAL], jobs[i]))
+            break;
+
+        ++tp->pending;
+    }
+
+    if (1 == i)
+        pthread_cond_signal(&tp->cond);
+    else if (i)
+        pthread_cond_broadcast(&tp->cond);
+
+    if (i)
+        _tpool_grow(tp);
+
+    pthread_mutex_unlock(&tp->mutex);
+
+    return (i == cnt);
 }
 
-void *tpool_get_work(tpool_t * tp)
+/* TPOOL_STEAL: take from our own deque, refilling it from the inbox */
+void *_tpool_take_local(tpool_t * tp, struct _worker_t *w)
 {
-    void *job = NULL;
+    void *job;
+
+    if (NULL != (job = deque_take(&w->dq)))
+        return job;
+
+    /* the deque only ever holds one inbox's worth, pushed so the job
+     * that should run first ends up at the bottom */
+    pthread_mutex_lock(&w->inbox_mt);
+
+    while (w->inbox.count) {
+        job = (TPOOL_LIFO == tp->order) ?
+            queue_pop(&w->inbox) : queue_pop_tail(&w->inbox);
+
+        if (!deque_push(&w->dq, job)) {
+            /* no room, put it back and run with what we have */
+            if (TPOOL_LIFO == tp->order)
+                queue_push_head(&w->inbox, job);
+            else
+                queue_push(&w->inbox, job);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&w->inbox_mt);
+
+    return deque_take(&w->dq);
+}
+
+/* TPOOL_STEAL: look for work on everyone else */
+void *_tpool_steal(tpool_t * tp, unsigned int id)
+{
+    struct _worker_t *v;
+    unsigned int i;
+    void *job;
+
+    for (i = 1; i < tp->slots; i++) {
+        v = &tp->pool[(id + i) % tp->slots];
+
+        if (NULL != (job = deque_steal(&v->dq)))
+            return job;
+
+        /* its owner may be stuck on something slow */
+        pthread_mutex_lock(&v->inbox_mt);
+        job = queue_pop(&v->inbox);
+        pthread_mutex_unlock(&v->inbox_mt);
+
+        if (NULL != job)
+            return job;
+    }
+
+    return NULL;
+}
+
+/* TPOOL_STEAL: find work, sleeping when there is none anywhere */
+void *_tpool_wait_steal(tpool_t * tp, unsigned int id)
+{
+    struct _worker_t *w = &tp->pool[id];
+    void *job;
+    int stop;
+
+    for (;;) {
+        if (NULL != (job = _tpool_take_local(tp, w))
+            || NULL != (job = _tpool_steal(tp, id)))
+            break;
 
-    if (tp->jobcount) {
-        /* we have work... */
         pthread_mutex_lock(&tp->mutex);
-        tp->jobcount--;
-        job = stack_pop(&tp->work);
+        TPOOL_ADD(&tp->sleepers, 1);
+
+        while (!TPOOL_LOAD(&tp->pending) && !tp->stop)
+            pthread_cond_wait(&tp->cond, &tp->mutex);
+
+        TPOOL_SUB(&tp->sleepers, 1);
+        stop = tp->stop;
         pthread_mutex_unlock(&tp->mutex);
+
+        if (stop)
+            return NULL;
+    }
+
+    TPOOL_SUB(&tp->pending, 1);
+
+    return job;
+}
+
+/* get a job if there is one */
+void *tpool_get_work(tpool_t * tp, unsigned int id)
+{
+    void *job;
+
+    if (TPOOL_STEAL == tp->mode) {
+        if (NULL == (job = _tpool_take_local(tp, &tp->pool[id])))
+            job = _tpool_steal(tp, id);
+
+        if (NULL != job)
+            TPOOL_SUB(&tp->pending, 1);
+
+        return job;
+    }
+
+    pthread_mutex_lock(&tp->mutex);
+    job = _tpool_take(tp);
+    pthread_mutex_unlock(&tp->mutex);
+
+    return job;
+}
+
+/* block until there is a job. a worker above the minimum that stays
+ * idle too long retires, and gets NULL like at shutdown. */
+void *tpool_wait_work(tpool_t * tp, unsigned int id)
+{
+    struct timespec ts;
+    void *job = NULL;
+    int ret = 0;
+
+    if (TPOOL_STEAL == tp->mode)
+        return _tpool_wait_steal(tp, id);
+
+    pthread_mutex_lock(&tp->mutex);
+    ++tp->idle;
+
+    while (!tp->pending && !tp->stop) {
+        if (tp->cnt <= tp->min) {
+            ret = pthread_cond_wait(&tp->cond, &tp->mutex);
+            continue;
+        }
+
+        if (ETIMEDOUT == ret) {
+            /* nothing to do for a while, and more of us than needed */
+            --tp->idle;
+            --tp->cnt;
+            tp->pool[id].live = 0;
+            pthread_detach(pthread_self());
+            pthread_mutex_unlock(&tp->mutex);
+            return NULL;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += TPOOL_IDLE_MS / 1000;
+        ts.tv_nsec += (TPOOL_IDLE_MS % 1000) * 1000000;
+
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+
+        ret = pthread_cond_timedwait(&tp->cond, &tp->mutex, &ts);
     }
 
+    --tp->idle;
+
+    if (!tp->stop)
+        job = _tpool_take(tp);
+
+    pthread_mutex_unlock(&tp->mutex);
+
     return job;
 }
 
 /* check pending */
 int tpool_pending_jobs(tpool_t * tp)
 {
-    return tp->jobcount;
+    int cnt;
+
+    pthread_mutex_lock(&tp->mutex);
+    cnt = TPOOL_LOAD(&tp->pending);
+    pthread_mutex_unlock(&tp->mutex);
+
+    return cnt;
+}
+
+/* how many jobs are waiting on one worker */
+unsigned int tpool_worker_depth(tpool_t * tp, unsigned int id)
+{
+    struct _worker_t *w;
+    unsigned int cnt;
+
+    if (TPOOL_STEAL != tp->mode || id >= tp->slots)
+        return 0;
+
+    w = &tp->pool[id];
+
+    pthread_mutex_lock(&w->inbox_mt);
+    cnt = w->inbox.count;
+    pthread_mutex_unlock(&w->inbox_mt);
+
+    return cnt + deque_size(&w->dq);
 }
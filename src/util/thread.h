@@ -28,44 +28,101 @@
 #include <pthread.h>
 
 #include "vector.h"
-#include "stack.h"
+#include "queue.h"
+#include "deque.h"
 
 typedef void *(*tfunc) (void *);
 
+/* priority classes, a worker always takes from the highest one that
+ * has work. within a class jobs run oldest first, unless the pool is
+ * set to TPOOL_LIFO.
+ */
+#define TPOOL_PRIO_HIGH    0
+#define TPOOL_PRIO_NORMAL  1
+#define TPOOL_PRIO_LOW     2
+#define TPOOL_PRIO_CNT     3
+
+#define TPOOL_FIFO  0
+#define TPOOL_LIFO  1
+
+/* one set of queues for everybody, or one per worker with stealing.
+ * in TPOOL_STEAL jobs go to the worker asked for (or round robin) and
+ * priority classes are not kept apart.
+ */
+#define TPOOL_SHARED  0
+#define TPOOL_STEAL   1
+
+/* TPOOL_SHARED grows between its min and max worker counts. a worker
+ * is added when work is waiting, nobody is idle, and nobody has taken
+ * a job for TPOOL_STALL_MS (they are all blocked); one that sits idle
+ * for TPOOL_IDLE_MS above the minimum goes away.
+ */
+#define TPOOL_STALL_MS     5
+#define TPOOL_IDLE_MS  10000
+
 struct _worker_t {
     int id, busy;
     pthread_t th;
-    pthread_mutex_t mt;
     int job;
+    int live;
+
+    /* TPOOL_STEAL: jobs handed to us, and the deque we work from */
+    pthread_mutex_t inbox_mt;
+    queue_t inbox;
+    deque_t dq;
 };
 
 typedef struct _tpool_t {
-    struct _worker_t boss;
     struct _worker_t *pool;
     unsigned int cnt;
-    unsigned int jobcount;
+    unsigned int min;
+    unsigned int slots;
+    unsigned int mode;
 
-    /* controller function */
-    tfunc controller;
-    /* handler function */
+    /* handler function, run by every worker */
     tfunc handler;
 
-    /* stack and mutex shield */
+    /* queues, mutex shield, and where idle workers wait */
     pthread_mutex_t mutex;
-    sstack_t work;
+    pthread_cond_t cond;
+    queue_t work[TPOOL_PRIO_CNT];
+    unsigned int pending;
+    unsigned int order;
+    int stop;
+
+    /* TPOOL_SHARED sizing: idle workers, last take and last growth */
+    unsigned int idle;
+    unsigned long long taken;
+    unsigned long long grown;
+
+    /* TPOOL_STEAL: workers asleep, and where round robin is up to */
+    unsigned int sleepers;
+    unsigned int next;
 } tpool_t;
 
-/* allocate */
-tpool_t *tpool_create(unsigned int, tfunc, tfunc);
-/* create */
-int tpool_init(tpool_t *, unsigned int, tfunc, tfunc);
-/* destroy */
+/* allocate: min and max workers, mode, handler */
+tpool_t *tpool_create(unsigned int, unsigned int, unsigned int, tfunc);
+/* create: min and max workers, mode, handler */
+int tpool_init(tpool_t *, unsigned int, unsigned int, unsigned int, tfunc);
+/* destroy, waiting for the workers to finish */
 void tpool_destroy(tpool_t *);
-/* add a job */
+/* fifo or lifo within a class */
+void tpool_set_order(tpool_t *, unsigned int);
+/* add a job, which can't be NULL */
 int tpool_add_work(tpool_t *, void *);
-/* get a job */
-void *tpool_get_work(tpool_t *);
+/* add a job in a priority class */
+int tpool_add_work_prio(tpool_t *, void *, unsigned int);
+/* add a job for a worker, -1 for anyone */
+int tpool_add_work_to(tpool_t *, void *, unsigned int, int);
+/* add several jobs */
+int tpool_add_work_batch(tpool_t *, void **, unsigned int);
+/* get a job if there is one */
+void *tpool_get_work(tpool_t *, unsigned int);
+/* wait for a job as a given worker, NULL once the pool is stopping */
+void *tpool_wait_work(tpool_t *, unsigned int);
 /* check pending */
 int tpool_pending_jobs(tpool_t *);
+/* how many jobs are waiting on one worker */
+unsigned int tpool_worker_depth(tpool_t *, unsigned int);
 
 #endif
@@ -0,0 +1,624 @@
+/* uring.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "util.h"
+#include "uring.h"
+
+#ifdef HAVE_URING
+
+#include <sys/syscall.h>
+
+/* everything the server asks of the kernel */
+static const unsigned char uring_ops[] = {
+    IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_OPENAT,
+    IORING_OP_READ, IORING_OP_CLOSE, IORING_OP_SHUTDOWN, IORING_OP_TIMEOUT,
+    IORING_OP_FILES_UPDATE
+};
+
+/**
+ * can this kernel do all of uring_ops?
+ */
+int _uring_probe(uring_t * ur)
+{
+    struct io_uring_probe *pr;
+    unsigned int i, n = 256;
+    int ok = 1;
+
+    pr = calloc(1, sizeof *pr + n * sizeof pr->ops[0]);
+
+    if (NULL == pr)
+        return 0;
+
+    if (syscall(__NR_io_uring_register, ur->fd, IORING_REGISTER_PROBE,
+                pr, n) < 0) {
+        free(pr);
+        return 0;
+    }
+
+    for (i = 0; i < sizeof uring_ops; i++) {
+        if (uring_ops[i] > pr->last_op
+            || !(pr->ops[uring_ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+            DEBUGF(__FILE__, __LINE__, "io_uring lacks op %u\n",
+                   uring_ops[i]);
+            ok = 0;
+        }
+    }
+
+    free(pr);
+
+    return ok;
+}
+
+/**
+ * set up a ring
+ * @param ur the ring
+ * @param entries submission queue size
+ * @param files how many fixed file slots to register
+ */
+int uring_init(uring_t * ur, unsigned int entries, unsigned int files)
+{
+    struct io_uring_params p;
+    struct io_uring_rsrc_register rr;
+    char *sq, *cq;
+
+#ifdef DEBUG
+    assert(NULL != ur);
+#endif
+
+    memset(ur, 0, sizeof *ur);
+    ur->fd = -1;
+
+    /* a roomy completion queue, multishot accepts can burst */
+    memset(&p, 0, sizeof p);
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 4;
+
+    if ((ur->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0) {
+        DEBUGF(__FILE__, __LINE__, "io_uring_setup: %s\n", strerror(errno));
+        ur->fd = -1;
+        return 0;
+    }
+
+    ur->sq_maplen = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ur->cq_maplen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ur->cq_maplen > ur->sq_maplen)
+            ur->sq_maplen = ur->cq_maplen;
+        ur->cq_maplen = 0;
+    }
+
+    ur->sq_map = mmap(NULL, ur->sq_maplen, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+
+    if (MAP_FAILED == ur->sq_map) {
+        ur->sq_map = NULL;
+        uring_destroy(ur);
+        return 0;
+    }
+
+    if (ur->cq_maplen) {
+        ur->cq_map = mmap(NULL, ur->cq_maplen, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ur->fd,
+                          IORING_OFF_CQ_RING);
+
+        if (MAP_FAILED == ur->cq_map) {
+            ur->cq_map = NULL;
+            uring_destroy(ur);
+            return 0;
+        }
+    }
+
+    ur->sqe_maplen = p.sq_entries * sizeof(struct io_uring_sqe);
+    ur->sqes = mmap(NULL, ur->sqe_maplen, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+
+    if (MAP_FAILED == ur->sqes) {
+        ur->sqes = NULL;
+        uring_destroy(ur);
+        return 0;
+    }
+
+    sq = (char *)ur->sq_map;
+    cq = (char *)((ur->cq_map) ? ur->cq_map : ur->sq_map);
+
+    ur->sq_head = (unsigned int *)(sq + p.sq_off.head);
+    ur->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    ur->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    ur->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    ur->sq_entries = p.sq_entries;
+
+    ur->cq_head = (unsigned int *)(cq + p.cq_off.head);
+    ur->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    ur->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    ur->cqes = cq + p.cq_off.cqes;
+
+    if (!_uring_probe(ur)) {
+        DEBUGF(__FILE__, __LINE__, "io_uring is missing ops we need\n");
+        uring_destroy(ur);
+        return 0;
+    }
+
+    /* empty slots, for files opened straight into the ring */
+    if (files) {
+        memset(&rr, 0, sizeof rr);
+        rr.nr = files;
+        rr.flags = IORING_RSRC_REGISTER_SPARSE;
+
+        if (syscall(__NR_io_uring_register, ur->fd, IORING_REGISTER_FILES2,
+                    &rr, sizeof rr) < 0) {
+            DEBUGF(__FILE__, __LINE__, "registering files: %s\n",
+                   strerror(errno));
+            uring_destroy(ur);
+            return 0;
+        }
+
+        ur->files = files;
+    }
+
+    /* until the kernel tells us otherwise */
+    ur->multishot = 1;
+
+    return 1;
+}
+
+/**
+ * tear a ring down
+ * @param ur the ring
+ */
+void uring_destroy(uring_t * ur)
+{
+    if (NULL == ur)
+        return;
+
+    if (NULL != ur->sqes)
+        munmap(ur->sqes, ur->sqe_maplen);
+    if (NULL != ur->cq_map)
+        munmap(ur->cq_map, ur->cq_maplen);
+    if (NULL != ur->sq_map)
+        munmap(ur->sq_map, ur->sq_maplen);
+    if (-1 != ur->fd)
+        close(ur->fd);
+
+    memset(ur, 0, sizeof *ur);
+    ur->fd = -1;
+}
+
+/**
+ * room left in the submission queue
+ */
+unsigned int _uring_room(uring_t * ur)
+{
+    unsigned int head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+
+    return ur->sq_entries - (*ur->sq_tail - head);
+}
+
+/**
+ * make sure the next n sqes go out together, so a linked chain isn't
+ * cut in half by a full queue
+ * @param ur the ring
+ * @param n how many we're about to queue
+ */
+int uring_reserve(uring_t * ur, unsigned int n)
+{
+    if (_uring_room(ur) < n && !uring_enter(ur, 0))
+        return 0;
+
+    return (_uring_room(ur) >= n);
+}
+
+/**
+ * submit everything queued
+ * @param ur the ring
+ * @param wait completions to wait for, 0 to just submit
+ */
+int uring_enter(uring_t * ur, unsigned int wait)
+{
+    int ret;
+
+    if (!ur->sq_pending && !wait)
+        return 1;
+
+    ret = syscall(__NR_io_uring_enter, ur->fd, ur->sq_pending, wait,
+                  (wait) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+    if (ret < 0) {
+        switch (errno) {
+        case EINTR:
+        case EAGAIN:
+        case EBUSY:
+            /* completions need reaping before it'll take more */
+            return 1;
+
+        default:
+            ERRF(__FILE__, __LINE__, "io_uring_enter: %s!\n",
+                 strerror(errno));
+            return 0;
+        }
+    }
+
+    ur->sq_pending -= ret;
+
+    return 1;
+}
+
+/**
+ * hand every waiting completion to a callback
+ * @param ur the ring
+ * @param func called with arg, the sqe's data, the result and flags
+ * @param arg handed to func
+ */
+unsigned int uring_reap(uring_t * ur,
+                        void (*func) (void *, unsigned long long, int,
+                                      unsigned int), void *arg)
+{
+    struct io_uring_cqe *cqe;
+    unsigned int head, tail, cnt = 0;
+
+    head = *ur->cq_head;
+    tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        cqe = &((struct io_uring_cqe *)ur->cqes)[head & *ur->cq_mask];
+
+        func(arg, cqe->user_data, cqe->res,
+             (cqe->flags & IORING_CQE_F_MORE) ? URING_CQE_MORE : 0);
+
+        ++head;
+        ++cnt;
+
+        /* the callback may have queued and flushed more work */
+        if (head == tail)
+            tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    __atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+
+    return cnt;
+}
+
+/**
+ * grab the next free sqe, flushing the queue if it's full
+ */
+struct io_uring_sqe *_uring_sqe(uring_t * ur, unsigned int flags,
+                                unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int tail;
+
+    if (!_uring_room(ur) && (!uring_enter(ur, 0) || !_uring_room(ur))) {
+        ERRF(__FILE__, __LINE__, "io_uring submission queue stuck!\n");
+        return NULL;
+    }
+
+    tail = *ur->sq_tail;
+    sqe = &((struct io_uring_sqe *)ur->sqes)[tail & *ur->sq_mask];
+    memset(sqe, 0, sizeof *sqe);
+
+    sqe->user_data = data;
+    if (flags & URING_LINK)
+        sqe->flags |= IOSQE_IO_LINK;
+    if (flags & URING_HARDLINK)
+        sqe->flags |= IOSQE_IO_HARDLINK;
+
+    ur->sq_array[tail & *ur->sq_mask] = tail & *ur->sq_mask;
+    __atomic_store_n(ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++ur->sq_pending;
+
+    return sqe;
+}
+
+int uring_prep_accept(uring_t * ur, int fd, unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (NULL == (sqe = _uring_sqe(ur, 0, data)))
+        return 0;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    if (ur->multishot)
+        sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+
+    return 1;
+}
+
+int uring_prep_recv(uring_t * ur, int fd, void *buf, size_t len,
+                    unsigned int flags, unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (NULL == (sqe = _uring_sqe(ur, flags, data)))
+        return 0;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+
+    return 1;
+}
+
+int uring_prep_send(uring_t * ur, int fd, const void *buf, size_t len,
+                    unsigned int flags, unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (NULL == (sqe = _uring_sqe(ur, flags, data)))
+        return 0;
+
+    /* all of it or an error, and no SIGPIPE when they hang up */
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    if (flags & URING_MORE)
+        sqe->msg_flags |= MSG_MORE;
+
+    return 1;
+}
+
+int uring_prep_open_direct(uring_t * ur, const char *path,
+                           unsigned int slot, unsigned int flags,
+                           unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (NULL == (sqe = _uring_sqe(ur, flags, data)))
+        return 0;
+
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (unsigned long)path;
+    sqe->open_flags = O_RDONLY;
+    sqe->file_index = slot + 1;
+
+    return 1;
+}
+
+int uring_prep_file_direct(uring_t * ur, const int *fd, unsigned int slot,
+                           unsigned int flags, unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (NULL == (sqe = _uring_sqe(ur, flags, data)))
+        return 0;
+
+    /* fd is read when it runs, which may be after we return */
+    sqe->opcode = IORING_OP_FILES_UPDATE;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long)fd;
+    sqe->len = 1;
+    sqe->off = slot;
+
+    return 1;
+}
+
+int uring_prep_read_direct(uring_t * ur, unsigned int slot, void *buf,
+                           size_t len, unsigned long long off,
+                           unsigned int flags, unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (NULL == (sqe = _uring_sqe(ur, flags, data)))
+        return 0;
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot;
+    sqe->flags |= IOSQE_FIXED_FILE;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->off = off;
+
+    return 1;
+}
+
+int uring_prep_read(uring_t * ur, int fd, void *buf, size_t len,
+                    unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (NULL == (sqe = _uring_sqe(ur, 0, data)))
+        return 0;
+
+    /* from wherever the file is, pipes and sockets have no offset */
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->off = -1;
+
+    return 1;
+}
+
+int uring_prep_close_direct(uring_t * ur, unsigned int slot,
+                            unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (NULL == (sqe = _uring_sqe(ur, 0, data)))
+        return 0;
+
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = slot + 1;
+
+    return 1;
+}
+
+int uring_prep_shutdown(uring_t * ur, int fd, unsigned int flags,
+                        unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (NULL == (sqe = _uring_sqe(ur, flags, data)))
+        return 0;
+
+    sqe->opcode = IORING_OP_SHUTDOWN;
+    sqe->fd = fd;
+    sqe->len = SHUT_WR;
+
+    return 1;
+}
+
+int uring_prep_close(uring_t * ur, int fd, unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+
+    if (NULL == (sqe = _uring_sqe(ur, 0, data)))
+        return 0;
+
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+
+    return 1;
+}
+
+int uring_prep_timeout(uring_t * ur, unsigned int ms, unsigned long long data)
+{
+    struct io_uring_sqe *sqe;
+
+    /* only one in flight at a time, the kernel copies it on submit */
+    if (!uring_enter(ur, 0) || NULL == (sqe = _uring_sqe(ur, 0, data)))
+        return 0;
+
+    ur->ts[0] = ms / 1000;
+    ur->ts[1] = (ms % 1000) * 1000000LL;
+
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long)ur->ts;
+    sqe->len = 1;
+
+    return 1;
+}
+
+#else                           /* no io_uring here */
+
+int uring_init(uring_t * ur, unsigned int entries, unsigned int files)
+{
+    memset(ur, 0, sizeof *ur);
+    ur->fd = -1;
+
+    return 0;
+}
+
+void uring_destroy(uring_t * ur)
+{
+}
+
+int uring_reserve(uring_t * ur, unsigned int n)
+{
+    return 0;
+}
+
+int uring_enter(uring_t * ur, unsigned int wait)
+{
+    return 0;
+}
+
+unsigned int uring_reap(uring_t * ur,
+                        void (*func) (void *, unsigned long long, int,
+                                      unsigned int), void *arg)
+{
+    return 0;
+}
+
+int uring_prep_accept(uring_t * ur, int fd, unsigned long long data)
+{
+    return 0;
+}
+
+int uring_prep_recv(uring_t * ur, int fd, void *buf, size_t len,
+                    unsigned int flags, unsigned long long data)
+{
+    return 0;
+}
+
+int uring_prep_send(uring_t * ur, int fd, const void *buf, size_t len,
+                    unsigned int flags, unsigned long long data)
+{
+    return 0;
+}
+
+int uring_prep_open_direct(uring_t * ur, const char *path,
+                           unsigned int slot, unsigned int flags,
+                           unsigned long long data)
+{
+    return 0;
+}
+
+int uring_prep_file_direct(uring_t * ur, const int *fd, unsigned int slot,
+                           unsigned int flags, unsigned long long data)
+{
+    return 0;
+}
+
+int uring_prep_read_direct(uring_t * ur, unsigned int slot, void *buf,
+                           size_t len, unsigned long long off,
+                           unsigned int flags, unsigned long long data)
+{
+    return 0;
+}
+
+int uring_prep_read(uring_t * ur, int fd, void *buf, size_t len,
+                    unsigned long long data)
+{
+    return 0;
+}
+
+int uring_prep_close_direct(uring_t * ur, unsigned int slot,
+                            unsigned long long data)
+{
+    return 0;
+}
+
+int uring_prep_shutdown(uring_t * ur, int fd, unsigned int flags,
+                        unsigned long long data)
+{
+    return 0;
+}
+
+int uring_prep_close(uring_t * ur, int fd, unsigned long long data)
+{
+    return 0;
+}
+
+int uring_prep_timeout(uring_t * ur, unsigned int ms, unsigned long long data)
+{
+    return 0;
+}
+
+#endif
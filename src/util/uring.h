@@ -0,0 +1,118 @@
+/* uring.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef UTIL_URING_H
+#define UTIL_URING_H
+
+#include <stddef.h>
+
+/* a small io_uring wrapper, straight on the syscalls. everything here
+ * is safe to call on systems without io_uring: uring_init just fails,
+ * and the caller keeps using whatever it used before.
+ */
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_ACCEPT_MULTISHOT
+#define HAVE_URING 1
+#endif
+#endif
+#endif
+
+/* sqe flags for the uring_prep_ functions */
+#define URING_LINK       1    /* the next sqe waits for this one */
+#define URING_MORE       2    /* sends: more data follows, like TCP_CORK */
+#define URING_HARDLINK   4    /* like URING_LINK, even if this one fails */
+
+/* cqe flags handed to the reap callback */
+#define URING_CQE_MORE   1    /* a multishot op keeps going */
+
+typedef struct _uring_t {
+    int fd;
+
+    /* the submission queue */
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int sq_entries;
+    unsigned int sq_pending;
+    void *sqes;
+
+    /* the completion queue */
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    void *cqes;
+
+    /* our mappings */
+    void *sq_map;
+    size_t sq_maplen;
+    void *cq_map;
+    size_t cq_maplen;
+    size_t sqe_maplen;
+
+    /* fixed file slots registered, for the _direct ops */
+    unsigned int files;
+    /* the kernel takes multishot accepts */
+    int multishot;
+
+    /* a timespec for uring_prep_timeout, read as it's submitted */
+    long long ts[2];
+} uring_t;
+
+/* set up a ring, with file slots, if the kernel has everything we use */
+int uring_init(uring_t *, unsigned int, unsigned int);
+/* tear a ring down */
+void uring_destroy(uring_t *);
+/* make sure the next n sqes go out in one submission */
+int uring_reserve(uring_t *, unsigned int);
+/* submit what's queued, and wait for at least n completions */
+int uring_enter(uring_t *, unsigned int);
+/* hand each completion to the callback, returns how many */
+unsigned int uring_reap(uring_t *,
+                        void (*)(void *, unsigned long long, int,
+                                 unsigned int), void *);
+
+/* queue up operations, all return 0 if the ring is stuck */
+int uring_prep_accept(uring_t *, int, unsigned long long);
+int uring_prep_recv(uring_t *, int, void *, size_t, unsigned int,
+                    unsigned long long);
+int uring_prep_send(uring_t *, int, const void *, size_t, unsigned int,
+                    unsigned long long);
+int uring_prep_open_direct(uring_t *, const char *, unsigned int,
+                           unsigned int, unsigned long long);
+int uring_prep_file_direct(uring_t *, const int *, unsigned int,
+                           unsigned int, unsigned long long);
+int uring_prep_read_direct(uring_t *, unsigned int, void *, size_t,
+                           unsigned long long, unsigned int,
+                           unsigned long long);
+int uring_prep_read(uring_t *, int, void *, size_t, unsigned long long);
+int uring_prep_close_direct(uring_t *, unsigned int, unsigned long long);
+int uring_prep_shutdown(uring_t *, int, unsigned int, unsigned long long);
+int uring_prep_close(uring_t *, int, unsigned long long);
+int uring_prep_timeout(uring_t *, unsigned int, unsigned long long);
+
+#endif
@@ -0,0 +1,213 @@
+/* wheel.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "util.h"
+#include "wheel.h"
+
+/**
+ * set up a wheel
+ * @param w the wheel
+ * @param tick how long a tick is, in ms
+ * @param now the time now, in ms
+ * @param expire called for every timer that runs out
+ */
+int wheel_init(wheel_t * w, unsigned int tick, unsigned long long now,
+               void (*expire) (wtimer_t *))
+{
+    unsigned int i, j;
+
+#ifdef DEBUG
+    assert(NULL != w);
+    assert(NULL != expire);
+#endif
+
+    if (!tick)
+        return 0;
+
+    memset(w, 0, sizeof *w);
+    w->tick = tick;
+    w->now = now / tick;
+    w->expire = expire;
+
+    for (i = 0; i < WHEEL_LEVELS; i++) {
+        for (j = 0; j < WHEEL_SLOTS; j++) {
+            w->slots[i][j].next = &w->slots[i][j];
+            w->slots[i][j].prev = &w->slots[i][j];
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * put a timer in the slot for its expiry: the nearest level whose
+ * range covers how far off it is
+ */
+void _wheel_place(wheel_t * w, wtimer_t * t)
+{
+    unsigned long long delta;
+    unsigned int level = 0;
+    wtimer_t *head;
+
+    if (t->expires <= w->now)
+        t->expires = w->now + 1;
+
+    delta = t->expires - w->now;
+
+    while (level < WHEEL_LEVELS - 1
+           && delta >= (1ULL << (WHEEL_BITS * (level + 1))))
+        ++level;
+
+    /* past the end of the last level, park it as far out as we go */
+    if (delta >= (1ULL << (WHEEL_BITS * WHEEL_LEVELS)))
+        t->expires = w->now + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+    head = &w->slots[level][(t->expires >> (WHEEL_BITS * level))
+                            & (WHEEL_SLOTS - 1)];
+
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+/**
+ * set a timer
+ * @param w the wheel
+ * @param t the timer
+ * @param when when it should fire, in ms
+ */
+void wheel_add(wheel_t * w, wtimer_t * t, unsigned long long when)
+{
+#ifdef DEBUG
+    assert(NULL != w);
+    assert(NULL != t);
+#endif
+
+    wheel_del(w, t);
+
+    /* round up, never fire early */
+    t->expires = (when + w->tick - 1) / w->tick;
+    _wheel_place(w, t);
+    ++w->count;
+}
+
+/**
+ * unset a timer
+ * @param w the wheel
+ * @param t the timer
+ */
+void wheel_del(wheel_t * w, wtimer_t * t)
+{
+    if (!wheel_pending(t))
+        return;
+
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+    --w->count;
+}
+
+/**
+ * is this timer set?
+ * @param t the timer
+ */
+int wheel_pending(wtimer_t * t)
+{
+    return (NULL != t->next);
+}
+
+/**
+ * take every timer out of a slot, and put each back where it now belongs
+ */
+void _wheel_cascade(wheel_t * w, wtimer_t * head)
+{
+    wtimer_t *t, *next;
+
+    t = head->next;
+    head->next = head->prev = head;
+
+    for (; t != head; t = next) {
+        next = t->next;
+        _wheel_place(w, t);
+    }
+}
+
+/**
+ * move the wheel up to now, firing what's due along the way
+ * @param w the wheel
+ * @param now the time now, in ms
+ */
+unsigned int wheel_advance(wheel_t * w, unsigned long long now)
+{
+    unsigned long long target = now / w->tick;
+    unsigned int level, idx, fired = 0;
+    wtimer_t due, *t;
+
+#ifdef DEBUG
+    assert(NULL != w);
+#endif
+
+    while (w->now < target) {
+        ++w->now;
+
+        /* crossing into a new turn of a level pulls down the next one */
+        for (level = 1; level < WHEEL_LEVELS; level++) {
+            if (w->now & ((1ULL << (WHEEL_BITS * level)) - 1))
+                break;
+
+            idx = (w->now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+            _wheel_cascade(w, &w->slots[level][idx]);
+        }
+
+        /* take the slot's list first, the callback may set timers */
+        idx = w->now & (WHEEL_SLOTS - 1);
+        if (w->slots[0][idx].next == &w->slots[0][idx])
+            continue;
+
+        due.next = w->slots[0][idx].next;
+        due.prev = w->slots[0][idx].prev;
+        due.next->prev = &due;
+        due.prev->next = &due;
+        w->slots[0][idx].next = w->slots[0][idx].prev = &w->slots[0][idx];
+
+        while (due.next != &due) {
+            t = due.next;
+            due.next = t->next;
+            t->next->prev = &due;
+            t->next = t->prev = NULL;
+            --w->count;
+            ++fired;
+
+            w->expire(t);
+        }
+    }
+
+    return fired;
+}
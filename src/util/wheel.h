@@ -0,0 +1,75 @@
+/* wheel.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef UTIL_WHEEL_H
+#define UTIL_WHEEL_H
+
+/* a hierarchical timing wheel. adding, removing and expiring a timer
+ * are all O(1), however many there are; the price is that timers only
+ * fire on tick boundaries. timers are embedded in whatever they time,
+ * and a wheel belongs to one thread.
+ */
+
+#define WHEEL_BITS    6
+#define WHEEL_SLOTS   (1 << WHEEL_BITS)
+#define WHEEL_LEVELS  4
+
+typedef struct _wtimer_t {
+    struct _wtimer_t *next;
+    struct _wtimer_t *prev;
+
+    /* in ticks */
+    unsigned long long expires;
+
+    /* for the expiry callback */
+    void *data;
+} wtimer_t;
+
+typedef struct _wheel_t {
+    /* the tick we're on, and how long one is in ms */
+    unsigned long long now;
+    unsigned int tick;
+
+    /* timers in the wheel */
+    unsigned int count;
+
+    /* list heads for each slot of each level */
+    wtimer_t slots[WHEEL_LEVELS][WHEEL_SLOTS];
+
+    void (*expire) (wtimer_t *);
+} wheel_t;
+
+/* set up a wheel with a tick length, the time now and an expiry callback */
+int wheel_init(wheel_t *, unsigned int, unsigned long long,
+               void (*)(wtimer_t *));
+/* set a timer for a time in ms, moving it if it was already set */
+void wheel_add(wheel_t *, wtimer_t *, unsigned long long);
+/* unset a timer, fine to call on one that isn't set */
+void wheel_del(wheel_t *, wtimer_t *);
+/* is this timer set? */
+int wheel_pending(wtimer_t *);
+/* move time forward, firing whatever expired, returns how many */
+unsigned int wheel_advance(wheel_t *, unsigned long long);
+
+#endif
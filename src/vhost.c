@@ -0,0 +1,331 @@
+/* vhost.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include <util/util.h>
+#include <util/hash.h>
+
+#include <srv/resp.h>
+#include <srv/proxy.h>
+#include <srv/fcgi.h>
+#include <srv/vhost.h>
+
+/**
+ * sites are kept by pointer, the tables don't own them
+ */
+void *_srv_vhost_ptr(const void *v)
+{
+    return (void *)v;
+}
+
+void _srv_vhost_nofree(void *v)
+{
+}
+
+/**
+ * a name as we look it up: lowercase, without a trailing dot. 0 if
+ * it's empty or too long
+ */
+int _srv_vhost_norm(char *out, const char *name)
+{
+    size_t n;
+
+    for (n = 0; '\0' != name[n]; n++) {
+        if (n + 1 >= SRV_VHOST_NAME_MAX)
+            return 0;
+
+        out[n] = tolower((unsigned char)name[n]);
+    }
+
+    while (n && '.' == out[n - 1])
+        --n;
+
+    out[n] = '\0';
+
+    return (0 != n);
+}
+
+/**
+ * is a module on a site's list? every module is if it has no list
+ */
+int _srv_vhost_has_mod(const vector_t * list, const char *name)
+{
+    unsigned int i;
+
+    if (NULL == list || !list->count)
+        return 1;
+
+    for (i = 0; i < list->count; i++) {
+        if (!strcmp(*(char **)vector_get_at((vector_t *) list, i), name))
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * add hidden paths to a site's routes
+ */
+void _srv_vhost_hide(vhost_t * vh, vector_t * hide)
+{
+    struct _srvhndlr_conf_t *hnd;
+    unsigned int i;
+
+    for (i = 0; i < hide->count; i++) {
+        hnd = (struct _srvhndlr_conf_t *)vector_get_at(hide, i);
+        srv_router_add(&vh->routes, hnd->type, hnd->data, ROUTE_DENY,
+                       SRV_PRIO_NORMAL, NULL);
+        DEBUGF(__FILE__, __LINE__, "%s: hid %s!\n", vh->name, hnd->data);
+    }
+}
+
+/**
+ * is a proxy, or a FastCGI pool, for a site that goes by these names?
+ * every one without a vhost of its own is
+ */
+int _srv_vhost_has_proxy(const vector_t * names, const char *fallback,
+                         const char *vhost)
+{
+    unsigned int i;
+
+    if (NULL == vhost)
+        return 1;
+
+    if (NULL == names)
+        return (NULL != fallback && !strcasecmp(fallback, vhost));
+
+    for (i = 0; i < names->count; i++) {
+        if (!strcasecmp(*(char **)vector_get_at((vector_t *) names, i),
+                        vhost))
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * build a site's routes: everyone's hidden paths, its own, the paths of
+ * each module it may use, the prefixes of the proxies for it, and the
+ * paths of its FastCGI pools
+ */
+void _srv_vhost_routes(vhost_t * vh, conf_t * conf, vector_t * hide,
+                       const vector_t * allowed, const vector_t * names,
+                       struct _modfunc *mods, proxy_t * proxies,
+                       fcgi_t * fcgis)
+{
+    struct _srvhndlr_conf_t *hnd;
+    unsigned int i, j;
+
+    srv_router_init(&vh->routes);
+    _srv_vhost_hide(vh, &conf->hide);
+
+    if (NULL != hide)
+        _srv_vhost_hide(vh, hide);
+
+    for (i = 0; i < conf->mod_cnt; i++) {
+        if (NULL == mods[i].func
+            || !_srv_vhost_has_mod(allowed, conf->mods[i].name))
+            continue;
+
+        for (j = 0; j < conf->mods[i].hnd.count; j++) {
+            /* file, dir and ext handlers all go in the table */
+            hnd = (struct _srvhndlr_conf_t *)
+                vector_get_at(&conf->mods[i].hnd, j);
+            DEBUGF(__FILE__, __LINE__,
+                   "%s: request path %s to be handled with %s...\n",
+                   vh->name, hnd->data, conf->mods[i].func);
+            srv_router_add(&vh->routes, hnd->type, hnd->data,
+                           ROUTE_MODULE, conf->mods[i].prio, &mods[i]);
+        }
+
+        if (SRV_PRIO_NORMAL != conf->mods[i].prio)
+            vh->prio_routes = 1;
+    }
+
+    for (i = 0; i < conf->proxy_cnt; i++) {
+        if (!_srv_vhost_has_proxy(names, conf->hostname,
+                                  conf->proxies[i].vhost))
+            continue;
+
+        /* a hidden path stays hidden, even from a proxy */
+        DEBUGF(__FILE__, __LINE__, "%s: proxying %s\n", vh->name,
+               conf->proxies[i].prefix);
+        srv_router_add(&vh->routes, SRV_HANDLER_DIR, conf->proxies[i].prefix,
+                       ROUTE_PROXY, SRV_PRIO_NORMAL, &proxies[i]);
+    }
+
+    for (i = 0; i < conf->fcgi_cnt; i++) {
+        if (!_srv_vhost_has_proxy(names, conf->hostname,
+                                  conf->fcgis[i].vhost))
+            continue;
+
+        for (j = 0; j < conf->fcgis[i].hnd.count; j++) {
+            hnd = (struct _srvhndlr_conf_t *)
+                vector_get_at(&conf->fcgis[i].hnd, j);
+            DEBUGF(__FILE__, __LINE__, "%s: %s goes to fastcgi\n", vh->name,
+                   hnd->data);
+            srv_router_add(&vh->routes, hnd->type, hnd->data, ROUTE_FCGI,
+                           SRV_PRIO_NORMAL, &fcgis[i]);
+        }
+    }
+
+    srv_router_compile(&vh->routes);
+}
+
+/**
+ * point a name at a site, exact or wildcard
+ */
+int _srv_vhost_name(vhosts_t * vhs, vhost_t * vh, const char *name)
+{
+    char key[SRV_VHOST_NAME_MAX];
+    hash_t *ht = &vhs->exact;
+
+    if ('*' == name[0]) {
+        /* "*.example.com" is kept as "example.com" */
+        if ('.' != name[1]) {
+            ERRF(__FILE__, __LINE__,
+                 "vhost name %s: a wildcard must be \"*.name\"!\n", name);
+            return 0;
+        }
+
+        name += 2;
+        ht = &vhs->wild;
+    }
+
+    if (!_srv_vhost_norm(key, name)) {
+        ERRF(__FILE__, __LINE__, "bad vhost name %s!\n", name);
+        return 0;
+    }
+
+    if (NULL != hash_get(ht, key)) {
+        ERRF(__FILE__, __LINE__, "vhost name %s%s is taken!\n",
+             (ht == &vhs->wild) ? "*." : "", key);
+        return 0;
+    }
+
+    return hash_insert(ht, key, vh);
+}
+
+/**
+ * build every site
+ * @param vhs where they go
+ * @param conf the config, with the default site and the vhost blocks
+ * @param mods the modules, as loaded, in config order
+ * @param proxies the proxies, set up, in config order
+ * @param fcgis the FastCGI pools, set up, in config order
+ * @param pack what the default site serves, NULL for its docroot
+ */
+int srv_vhosts_init(vhosts_t * vhs, conf_t * conf, struct _modfunc *mods,
+                    proxy_t * proxies, fcgi_t * fcgis, const pack_t * pack)
+{
+    struct _srvvhost_conf_t *vc;
+    vhost_t *vh;
+    unsigned int i, j;
+
+#ifdef DEBUG
+    assert(NULL != vhs);
+    assert(NULL != conf);
+#endif
+
+    vhs->count = conf->vhost_cnt + 1;
+
+    if (NULL == (vhs->sites = calloc(vhs->count, sizeof *vhs->sites))) {
+        ERRF(__FILE__, __LINE__, "allocating memory for vhosts!\n");
+        return 0;
+    }
+
+    hash_init_string(&vhs->exact, conf->vhost_cnt * 2);
+    hash_set_valcpy(&vhs->exact, _srv_vhost_ptr);
+    hash_set_free_val(&vhs->exact, _srv_vhost_nofree);
+
+    hash_init_string(&vhs->wild, conf->vhost_cnt * 2);
+    hash_set_valcpy(&vhs->wild, _srv_vhost_ptr);
+    hash_set_free_val(&vhs->wild, _srv_vhost_nofree);
+
+    /* the default site, as it always was */
+    vh = &vhs->sites[0];
+    vh->name = (NULL != conf->hostname) ? conf->hostname : "default";
+    vh->pack = pack;
+    vh->warm = 1;
+    srv_path_root(&vh->root, conf->docroot, conf->index, conf->path_cache);
+    _srv_vhost_routes(vh, conf, NULL, NULL, NULL, mods, proxies, fcgis);
+
+    for (i = 0; i < conf->vhost_cnt; i++) {
+        vc = &conf->vhosts[i];
+        vh = &vhs->sites[i + 1];
+
+        vh->name = *(char **)vector_get_at(&vc->names, 0);
+        srv_path_root(&vh->root, vc->docroot, vc->index, vc->path_cache);
+        _srv_vhost_routes(vh, conf, &vc->hide, &vc->mods, &vc->names, mods,
+                          proxies, fcgis);
+
+        for (j = 0; j < vc->names.count; j++) {
+            if (!_srv_vhost_name(vhs, vh,
+                                 *(char **)vector_get_at(&vc->names, j)))
+                return 0;
+        }
+
+        DEBUGF(__FILE__, __LINE__, "vhost %s at %s\n", vh->name,
+               vc->docroot);
+    }
+
+    return 1;
+}
+
+/**
+ * find the site for a request, by the Host it asked for. an exact name
+ * wins, then the wildcard for each suffix, longest first, so
+ * a.b.example.com tries *.b.example.com before *.example.com.
+ * @param vhs the sites
+ * @param host what the request asked for, without its port
+ */
+vhost_t *srv_vhost_find(vhosts_t * vhs, const char *host)
+{
+    char key[SRV_VHOST_NAME_MAX];
+    vhost_t *vh;
+    char *c;
+
+#ifdef DEBUG
+    assert(NULL != vhs);
+#endif
+
+    if (1 == vhs->count || NULL == host || !_srv_vhost_norm(key, host))
+        return &vhs->sites[0];
+
+    if (NULL != (vh = hash_get(&vhs->exact, key)))
+        return vh;
+
+    for (c = strchr(key, '.'); NULL != c; c = strchr(c + 1, '.')) {
+        if (NULL != (vh = hash_get(&vhs->wild, c + 1)))
+            return vh;
+    }
+
+    return &vhs->sites[0];
+}
@@ -0,0 +1,86 @@
+/* vhost.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef SRV_VHOST_H
+#define SRV_VHOST_H
+
+#include <util/hash.h>
+
+#include <srv/conf.h>
+#include <srv/route.h>
+#include <srv/path.h>
+#include <srv/pack.h>
+
+/* name-based virtual hosts. each site has its own docroot, index and
+ * routes, and its own share of each thread's path cache. the Host a
+ * request asks for is looked up once, right after it's parsed: its
+ * exact name first, then "*." names from the most specific down.
+ * anything else gets the default site, the one set up outside any
+ * vhost block.
+ */
+
+/* the longest Host we'll look for */
+#define SRV_VHOST_NAME_MAX  256
+
+struct _modfunc;
+struct _proxy_t;
+struct _fcgi_t;
+
+typedef struct _vhost_t {
+    /* what it goes by in the log, its first name */
+    const char *name;
+
+    /* its docroot, index and cache share, and what's hidden or handled
+     * by a module under it */
+    path_root_t root;
+    router_t routes;
+    /* whether any of its routes puts a request in another class */
+    unsigned int prio_routes;
+
+    /* served instead of the docroot, and whether its busiest paths go
+     * in the warm manifest. the default site only */
+    const pack_t *pack;
+    unsigned int warm;
+} vhost_t;
+
+typedef struct _vhosts_t {
+    /* the default site first, then one for each vhost block */
+    vhost_t *sites;
+    unsigned int count;
+
+    /* names to sites: exact ones, and what follows the "*." of the
+     * wildcard ones */
+    hash_t exact;
+    hash_t wild;
+} vhosts_t;
+
+/* build every site from the config, with the modules that loaded, the
+ * proxies and FastCGI pools set up from it, and the pack the default
+ * site serves, if any */
+int srv_vhosts_init(vhosts_t *, conf_t *, struct _modfunc *,
+                    struct _proxy_t *, struct _fcgi_t *, const pack_t *);
+/* the site for a Host, the default one if nothing else matches */
+vhost_t *srv_vhost_find(vhosts_t *, const char *);
+
+#endif
@@ -0,0 +1,503 @@
+/* warm.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <util/util.h>
+#include <util/hash.h>
+#include <util/buf.h>
+#include <util/thread.h>
+
+#include <srv/path.h>
+#include <srv/warm.h>
+
+/* a slot in the table of what's been served. whoever holds busy owns
+ * the rest of it; anyone who finds it held just doesn't count.
+ */
+struct _warm_ent {
+    unsigned long long key;
+    unsigned int hits;
+    char busy;
+    char path[SRV_WARM_KEY];
+};
+
+static struct _warm_ent warm_tab[SRV_WARM_SLOTS];
+static int warm_tracking;
+
+/* each thread only counts one in SRV_WARM_SAMPLE of what it serves */
+static pthread_once_t warm_once = PTHREAD_ONCE_INIT;
+static pthread_key_t warm_key;
+
+/* while warming up: what's left to do and where it's going, and the
+ * pool doing it */
+static tpool_t warm_tp;
+static pthread_mutex_t warm_mt = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t warm_done = PTHREAD_COND_INITIALIZER;
+static unsigned int warm_left;
+static unsigned int warm_found;
+static unsigned long long warm_bytes;
+
+static const path_root_t *warm_root;
+static router_t *warm_routes;
+static const pack_t *warm_pack;
+
+void _srv_warm_init(void)
+{
+    pthread_key_create(&warm_key, free);
+}
+
+/**
+ * start counting what gets served
+ */
+void srv_warm_track(void)
+{
+    warm_tracking = 1;
+}
+
+/**
+ * is this one of the requests this thread counts?
+ */
+int _srv_warm_sample(void)
+{
+    unsigned int *tick;
+
+    pthread_once(&warm_once, _srv_warm_init);
+
+    if (NULL == (tick = pthread_getspecific(warm_key))) {
+        if (NULL == (tick = calloc(1, sizeof *tick)))
+            return 0;
+
+        if (pthread_setspecific(warm_key, tick)) {
+            free(tick);
+            return 0;
+        }
+    }
+
+    return !(++*tick % SRV_WARM_SAMPLE);
+}
+
+/**
+ * note a clean request path that was served. a path that keeps coming
+ * up holds its slot, anything else that lands there wears it down
+ * until it can take over.
+ * @param path the path, from the docroot down
+ * @param len how long it is
+ */
+void srv_warm_hit(const char *path, size_t len)
+{
+    struct _warm_ent *e;
+    unsigned long long key;
+
+#ifdef DEBUG
+    assert(NULL != path);
+#endif
+
+    if (!warm_tracking || len >= SRV_WARM_KEY || !_srv_warm_sample())
+        return;
+
+    /* never zero, so an empty slot matches nothing */
+    key = hash_bytes(path, len) | 1;
+    e = &warm_tab[key & (SRV_WARM_SLOTS - 1)];
+
+    if (__atomic_test_and_set(&e->busy, __ATOMIC_ACQUIRE))
+        return;
+
+    if (key == e->key) {
+        ++e->hits;
+    } else if (!e->hits) {
+        e->key = key;
+        e->hits = 1;
+        memcpy(e->path, path, len);
+        e->path[len] = '\0';
+    } else {
+        --e->hits;
+    }
+
+    __atomic_clear(&e->busy, __ATOMIC_RELEASE);
+}
+
+int _srv_warm_cmp(const void *a, const void *b)
+{
+    const struct _warm_ent *x = a, *y = b;
+
+    return (x->hits < y->hits) - (x->hits > y->hits);
+}
+
+/* what was busy when we last looked, on its way to the manifest */
+struct _warm_save {
+    char file[SRV_PATH_MAX];
+    unsigned int cnt;
+    struct _warm_ent top[SRV_WARM_SLOTS];
+};
+
+/* set while a manifest is being written */
+static unsigned int warm_saving;
+
+/**
+ * write the busiest paths out, one a line, busiest first. anything that
+ * wouldn't survive the trip back through a request is escaped.
+ */
+int _srv_warm_write(struct _warm_save *ws)
+{
+    unsigned int i;
+    unsigned char *c;
+    char tmp[SRV_PATH_MAX + 4];
+    FILE *fp;
+
+    qsort(ws->top, ws->cnt, sizeof *ws->top, _srv_warm_cmp);
+
+    snprintf(tmp, sizeof tmp, "%s.tmp", ws->file);
+
+    if (NULL == (fp = fopen(tmp, "w"))) {
+        ERRF(__FILE__, __LINE__, "opening %s: %s!\n", tmp, strerror(errno));
+        return 0;
+    }
+
+    fprintf(fp, "# busiest paths served, busiest first\n");
+
+    for (i = 0; i < ws->cnt && i < SRV_WARM_TOP; i++) {
+        for (c = (unsigned char *)ws->top[i].path; *c; c++) {
+            if ('%' == *c || *c <= ' ' || *c >= 0x7f)
+                fprintf(fp, "%%%02X", *c);
+            else
+                fputc(*c, fp);
+        }
+
+        fputc('\n', fp);
+    }
+
+    if (fclose(fp) || rename(tmp, ws->file)) {
+        ERRF(__FILE__, __LINE__, "writing %s: %s!\n", ws->file,
+             strerror(errno));
+        unlink(tmp);
+        return 0;
+    }
+
+    return 1;
+}
+
+void *_srv_warm_writer(void *arg)
+{
+    struct _warm_save *ws = (struct _warm_save *)arg;
+
+    _srv_warm_write(ws);
+    free(ws);
+    __atomic_store_n(&warm_saving, 0, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+/**
+ * take what's busy, and have it written out on a thread of its own, so
+ * a slow disk never holds up whoever calls this. every count is halved
+ * on the way, so what's there follows recent traffic. if the last one
+ * is still being written, this one is skipped.
+ * @param file the manifest, replaced whole
+ */
+int srv_warm_save(const char *file)
+{
+    struct _warm_save *ws;
+    struct _warm_ent *e;
+    pthread_t th;
+    unsigned int i;
+
+#ifdef DEBUG
+    assert(NULL != file);
+#endif
+
+    if (__atomic_exchange_n(&warm_saving, 1, __ATOMIC_ACQUIRE))
+        return 1;
+
+    if (NULL == (ws = malloc(sizeof *ws))) {
+        ERRF(__FILE__, __LINE__, "allocating the warm manifest!\n");
+        __atomic_store_n(&warm_saving, 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    snprintf(ws->file, sizeof ws->file, "%s", file);
+    ws->cnt = 0;
+
+    for (i = 0; i < SRV_WARM_SLOTS; i++) {
+        e = &warm_tab[i];
+
+        while (__atomic_test_and_set(&e->busy, __ATOMIC_ACQUIRE)) ;
+
+        if (e->hits)
+            memcpy(&ws->top[ws->cnt++], e, sizeof *e);
+
+        e->hits /= 2;
+        __atomic_clear(&e->busy, __ATOMIC_RELEASE);
+    }
+
+    if (pthread_create(&th, NULL, _srv_warm_writer, ws)) {
+        ERRF(__FILE__, __LINE__, "starting the warm manifest writer!\n");
+        free(ws);
+        __atomic_store_n(&warm_saving, 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    pthread_detach(th);
+
+    return 1;
+}
+
+/**
+ * add the paths in a manifest to a list
+ * @param list a vector of char *
+ * @param file the manifest
+ */
+int srv_warm_load(vector_t * list, const char *file)
+{
+    char line[SRV_WARM_KEY * 3 + 2];
+    char *path;
+    size_t len;
+    FILE *fp;
+
+#ifdef DEBUG
+    assert(NULL != list);
+    assert(NULL != file);
+#endif
+
+    if (NULL == (fp = fopen(file, "r")))
+        return 0;
+
+    while (fgets(line, sizeof line, fp)) {
+        len = strcspn(line, "\r\n");
+        line[len] = '\0';
+
+        if ('/' != *line)
+            continue;
+
+        if (NULL != (path = strdup(line)))
+            vector_push(list, &path);
+    }
+
+    fclose(fp);
+
+    return 1;
+}
+
+/**
+ * read a file, or as much of it as we're allowed, so it's in memory
+ * when someone asks for it
+ */
+void _srv_warm_file(const char *file, off_t size)
+{
+    unsigned long long want, had;
+    off_t pos = 0;
+    ssize_t got;
+    buf_t *buf;
+    int fd;
+
+    want = (size < SRV_WARM_FILE_MAX) ? (unsigned long long)size
+        : SRV_WARM_FILE_MAX;
+    had = __atomic_fetch_add(&warm_bytes, want, __ATOMIC_RELAXED);
+
+    if (!want || had >= SRV_WARM_BYTES)
+        return;
+
+    if (-1 == (fd = open(file, O_RDONLY)))
+        return;
+
+    if (NULL == (buf = buf_get(BUF_MAX_SIZE))) {
+        close(fd);
+        return;
+    }
+
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(fd, 0, want, POSIX_FADV_WILLNEED);
+#endif
+
+    while ((unsigned long long)pos < want
+           && 0 < (got = pread(fd, buf->data, buf->size, pos)))
+        pos += got;
+
+    buf_put(buf);
+    close(fd);
+}
+
+/**
+ * fault a body of the pack into our mapping
+ */
+void _srv_warm_packed(const struct _pack_var *v)
+{
+    volatile const char *p;
+    unsigned long long want, had, i;
+
+    want = (v->len < SRV_WARM_FILE_MAX) ? v->len : SRV_WARM_FILE_MAX;
+    had = __atomic_fetch_add(&warm_bytes, want, __ATOMIC_RELAXED);
+
+    if (!want || had >= SRV_WARM_BYTES)
+        return;
+
+    p = warm_pack->map + v->body;
+    madvise((void *)(warm_pack->map + v->body), want, MADV_WILLNEED);
+
+    for (i = 0; i < want; i += PACK_ALIGN)
+        (void)p[i];
+}
+
+/**
+ * get whatever a request path would be answered with into memory: what
+ * it is, and what's in it. 1 if there was something there.
+ */
+int _srv_warm_path(const char *target)
+{
+    const pack_ent_t *pe;
+    const route_t *rt;
+    unsigned int i;
+    path_t path;
+    time_t now;
+
+    time(&now);
+
+    if (!srv_path_lookup(&path, warm_root, target, now))
+        return 0;
+
+    /* hidden, or a module's. either way not ours to read */
+    rt = srv_router_lookup(warm_routes, path.full + path.rel);
+
+    if (NULL != rt && ROUTE_NONE != rt->type)
+        return 0;
+
+    if (NULL != warm_pack) {
+        pe = srv_pack_find(warm_pack, path.full + path.rel,
+                           path.len - path.rel);
+
+        if (NULL == pe)
+            return 0;
+
+        for (i = 0; i < PACK_VAR_CNT; i++)
+            if (pe->var[i].headlen)
+                _srv_warm_packed(&pe->var[i]);
+
+        return 1;
+    }
+
+    srv_path_stat(&path, warm_root, now);
+
+    if (path.err)
+        return 0;
+
+    if (!S_ISDIR(path.st.st_mode))
+        _srv_warm_file(path.full, path.st.st_size);
+    else if (path.has_index)
+        _srv_warm_file(path.index, path.ind.st_size);
+
+    return 1;
+}
+
+/**
+ * a warming thread: take paths until there are none
+ */
+void *_srv_warm_worker(void *arg)
+{
+    unsigned int id = (intptr_t) arg;
+    const char *target;
+    int found;
+
+    while (NULL != (target = tpool_wait_work(&warm_tp, id))) {
+        found = _srv_warm_path(target);
+
+        pthread_mutex_lock(&warm_mt);
+        warm_found += found;
+
+        if (!--warm_left)
+            pthread_cond_signal(&warm_done);
+
+        pthread_mutex_unlock(&warm_mt);
+    }
+
+    return NULL;
+}
+
+/**
+ * warm a list of paths on a few threads, and don't come back until
+ * they're done
+ * @param list a vector of char *, request paths
+ * @param threads how many to warm at once
+ * @param root the docroot and its index
+ * @param routes hidden paths and modules, which are left alone
+ * @param pack the pack we're serving, if there is one
+ */
+unsigned int srv_warm_run(vector_t * list, unsigned int threads,
+                          const path_root_t * root, router_t * routes,
+                          const pack_t * pack)
+{
+    unsigned int i, queued = 0;
+
+#ifdef DEBUG
+    assert(NULL != list);
+    assert(NULL != root);
+    assert(NULL != routes);
+#endif
+
+    if (!list->count)
+        return 0;
+
+    warm_root = root;
+    warm_routes = routes;
+    warm_pack = pack;
+    warm_found = 0;
+    warm_bytes = 0;
+
+    if (!tpool_init(&warm_tp, threads, threads, TPOOL_SHARED,
+                    _srv_warm_worker)) {
+        ERRF(__FILE__, __LINE__, "starting the warm up threads!\n");
+        return 0;
+    }
+
+    pthread_mutex_lock(&warm_mt);
+    warm_left = list->count;
+    pthread_mutex_unlock(&warm_mt);
+
+    for (i = 0; i < list->count; i++)
+        queued += tpool_add_work(&warm_tp,
+                                 *(char **)vector_get_at(list, i));
+
+    pthread_mutex_lock(&warm_mt);
+    warm_left -= list->count - queued;
+
+    while (warm_left)
+        pthread_cond_wait(&warm_done, &warm_mt);
+
+    pthread_mutex_unlock(&warm_mt);
+
+    tpool_destroy(&warm_tp);
+
+    return warm_found;
+}
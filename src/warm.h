@@ -0,0 +1,64 @@
+/* warm.h
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#ifndef SRV_WARM_H
+#define SRV_WARM_H
+
+#include <stddef.h>
+
+#include <util/vector.h>
+
+#include <srv/route.h>
+#include <srv/path.h>
+#include <srv/pack.h>
+
+/* what gets served is sampled into a shared table, a slot per path,
+ * and the busiest are written to a manifest every so often so the
+ * next start can warm up on them
+ */
+#define SRV_WARM_SLOTS     1024
+#define SRV_WARM_KEY        128
+#define SRV_WARM_SAMPLE      16
+#define SRV_WARM_TOP        256
+#define SRV_WARM_SAVE_MS  60000
+
+/* the most we'll read of one file while warming up, and of them all */
+#define SRV_WARM_FILE_MAX  (4 * 1024 * 1024)
+#define SRV_WARM_BYTES     (256ULL * 1024 * 1024)
+
+/* start counting what gets served */
+void srv_warm_track(void);
+/* note a clean request path that was served */
+void srv_warm_hit(const char *, size_t);
+/* age the counts, and have the busiest paths written out, off the
+ * calling thread */
+int srv_warm_save(const char *);
+/* add the paths in a manifest to a vector of char * */
+int srv_warm_load(vector_t *, const char *);
+/* warm a list of paths on a few threads, and wait for it. returns how
+ * many were there to be warmed */
+unsigned int srv_warm_run(vector_t *, unsigned int, const path_root_t *,
+                          router_t *, const pack_t *);
+
+#endif
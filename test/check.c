@@ -0,0 +1,2077 @@
+/* check.c
+ * Copyright (c) 2011
+ * Jeff Nettleton
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <util/util.h>
+#include <util/hash.h>
+#include <util/chash.h>
+#include <util/wheel.h>
+#include <util/deque.h>
+#include <util/buf.h>
+#include <srv/path.h>
+#include <srv/pack.h>
+#include <srv/conf.h>
+#include <srv/route.h>
+#include <srv/mem.h>
+#include <srv/vhost.h>
+#include <srv/proxy.h>
+#include <srv/fcgi.h>
+#include <srv/cache.h>
+#include <srv/warm.h>
+
+#include "check.h"
+
+#define CHECK_HASH_KEYS    4096
+#define CHECK_CHASH_KEYS   20000
+#define CHECK_CHASH_WRITERS 2
+#define CHECK_CHASH_READERS 4
+#define CHECK_DEQUE_ITEMS  100000
+#define CHECK_DEQUE_THIEVES 3
+#define CHECK_PROXY_BODY   40000
+#define CHECK_CACHE_BODY   8000
+#define CHECK_FCGI_BIG     300000
+
+#define CHECK(c) _check((c), #c, __FILE__, __LINE__)
+
+static unsigned int failed;
+
+/* connections the stand-in upstream has taken */
+static unsigned int upstream_accepts;
+
+/* and the stand-in FastCGI responder, and whether its slow requests
+ * may finish */
+static unsigned int fcgi_accepts;
+static unsigned int fcgi_release;
+
+/**
+ * note a failed check, keep going so we see all of them
+ */
+int _check(int ok, const char *what, const char *file, int line)
+{
+    if (!ok) {
+        ERRF(file, line, "check failed: %s\n", what);
+        ++failed;
+    }
+
+    return ok;
+}
+
+/**
+ * canonicalize a target under /srv, and see that it came out as want,
+ * or was turned away if want is NULL
+ */
+void _check_canon(const char *target, const char *want)
+{
+    path_t p;
+    int ok;
+
+    ok = srv_path_canon(&p, "/srv/", target);
+
+    if (NULL == want) {
+        if (!CHECK(!ok))
+            ERRF(__FILE__, __LINE__, "  %s gave %s\n", target, p.full);
+        return;
+    }
+
+    if (!CHECK(ok && !strcmp(p.full, want) && p.len == strlen(want)
+               && 4 == p.rel))
+        ERRF(__FILE__, __LINE__, "  %s gave %s, not %s\n", target,
+             ok ? p.full : "nothing", want);
+}
+
+void srv_check_canon(void)
+{
+    char big[SRV_PATH_MAX + 16];
+
+    _check_canon("/", "/srv/");
+    _check_canon("/a/b.html", "/srv/a/b.html");
+    _check_canon("/a/", "/srv/a/");
+
+    /* dot segments never climb out of the docroot */
+    _check_canon("/a/../b", "/srv/b");
+    _check_canon("/a/./b", "/srv/a/b");
+    _check_canon("/..", "/srv/");
+    _check_canon("/../../etc/passwd", "/srv/etc/passwd");
+    _check_canon("/a/b/../../../c", "/srv/c");
+    _check_canon("/a/..b/c", "/srv/a/..b/c");
+    _check_canon("/a/.../c", "/srv/a/.../c");
+
+    /* empty segments go */
+    _check_canon("//a///b", "/srv/a/b");
+    _check_canon("/a//", "/srv/a/");
+
+    /* escapes are decoded before dot segments are looked at */
+    _check_canon("/%2e%2e/x", "/srv/x");
+    _check_canon("/a/%2E/b", "/srv/a/b");
+    _check_canon("/a/.%2e/b", "/srv/b");
+    _check_canon("/%61%20b", "/srv/a b");
+
+    /* escaped NULs and slashes, and bad escapes, are turned away */
+    _check_canon("/a%00b", NULL);
+    _check_canon("/a%2fb", NULL);
+    _check_canon("/a%2F..%2Fb", NULL);
+    _check_canon("/%zz", NULL);
+    _check_canon("/%2", NULL);
+    _check_canon("/%", NULL);
+    _check_canon("a/b", NULL);
+    _check_canon("", NULL);
+
+    memset(big, 'a', sizeof big - 1);
+    big[0] = '/';
+    big[sizeof big - 1] = '\0';
+    _check_canon(big, NULL);
+}
+
+/**
+ * see that a path routes where it should, to nothing if type is
+ * ROUTE_NONE
+ */
+int _check_route(router_t * rt, const char *path, unsigned int type,
+                 const void *data)
+{
+    const route_t *r = srv_router_lookup(rt, path);
+    int ok;
+
+    if (ROUTE_NONE == type)
+        ok = (NULL == r);
+    else
+        ok = (NULL != r && type == r->type && data == r->data);
+
+    if (!ok)
+        ERRF(__FILE__, __LINE__, "  %s routed to %u (%p)\n", path,
+             (NULL == r) ? ROUTE_NONE : r->type,
+             (NULL == r) ? NULL : r->data);
+
+    return ok;
+}
+
+/**
+ * everything _check_route looks up, compiled or not
+ */
+void _check_routes(router_t * rt, int *mods)
+{
+    char path[32];
+    unsigned int i;
+
+    /* by segment, not by string */
+    CHECK(_check_route(rt, "/app", ROUTE_MODULE, &mods[0]));
+    CHECK(_check_route(rt, "/app/", ROUTE_MODULE, &mods[0]));
+    CHECK(_check_route(rt, "/app/x/y", ROUTE_MODULE, &mods[0]));
+    CHECK(_check_route(rt, "//app//x", ROUTE_MODULE, &mods[0]));
+    CHECK(_check_route(rt, "/apple", ROUTE_NONE, NULL));
+    CHECK(_check_route(rt, "/ap", ROUTE_NONE, NULL));
+
+    /* an exact match, then the longest prefix, then the extension */
+    CHECK(_check_route(rt, "/app/exact", ROUTE_MODULE, &mods[1]));
+    CHECK(_check_route(rt, "/app/exact/more", ROUTE_MODULE, &mods[0]));
+    CHECK(_check_route(rt, "/app/deep/x", ROUTE_MODULE, &mods[2]));
+    CHECK(_check_route(rt, "/x.php", ROUTE_MODULE, &mods[3]));
+    CHECK(_check_route(rt, "/a/b/x.php", ROUTE_MODULE, &mods[3]));
+    CHECK(_check_route(rt, "/app/x.php", ROUTE_MODULE, &mods[0]));
+    CHECK(_check_route(rt, "/x.php/y", ROUTE_NONE, NULL));
+    CHECK(_check_route(rt, "/x.", ROUTE_NONE, NULL));
+    CHECK(_check_route(rt, "/x.phps", ROUTE_NONE, NULL));
+
+    /* deny rules beat everything, wherever they are */
+    CHECK(_check_route(rt, "/private", ROUTE_DENY, NULL));
+    CHECK(_check_route(rt, "/private/x.php", ROUTE_DENY, NULL));
+    CHECK(_check_route(rt, "/private/mod/x", ROUTE_DENY, NULL));
+    CHECK(_check_route(rt, "/private/mod", ROUTE_DENY, NULL));
+    CHECK(_check_route(rt, "/hidden/a", ROUTE_DENY, NULL));
+    CHECK(_check_route(rt, "/secret.txt", ROUTE_DENY, NULL));
+    CHECK(_check_route(rt, "/secret.txt/x", ROUTE_NONE, NULL));
+    CHECK(_check_route(rt, "/a/x.inc", ROUTE_DENY, NULL));
+    CHECK(_check_route(rt, "/app/x.inc", ROUTE_DENY, NULL));
+    CHECK(_check_route(rt, "/app/exact.inc", ROUTE_DENY, NULL));
+    CHECK(_check_route(rt, "/f.bak", ROUTE_DENY, NULL));
+    CHECK(_check_route(rt, "/app/f.bak", ROUTE_DENY, NULL));
+
+    /* every one of the siblings, and the gaps between them */
+    for (i = 0; i < 64; i++) {
+        snprintf(path, sizeof path, "/d%02u/x", i * 2);
+        CHECK(_check_route(rt, path, ROUTE_MODULE, &mods[4 + i]));
+        snprintf(path, sizeof path, "/d%02u/x", i * 2 + 1);
+        CHECK(_check_route(rt, path, ROUTE_NONE, NULL));
+    }
+}
+
+void srv_check_route(void)
+{
+    router_t rt;
+    int mods[4 + 64];
+    char path[32];
+    const route_t *r;
+    unsigned int i;
+
+    srv_router_init(&rt);
+
+    srv_router_add(&rt, SRV_HANDLER_DIR, "/app", ROUTE_MODULE,
+                   SRV_PRIO_LOW, &mods[0]);
+    srv_router_add(&rt, SRV_HANDLER_FILE, "/app/exact", ROUTE_MODULE,
+                   SRV_PRIO_HIGH, &mods[1]);
+    srv_router_add(&rt, SRV_HANDLER_DIR, "/app/deep/", ROUTE_MODULE,
+                   SRV_PRIO_NORMAL, &mods[2]);
+    srv_router_add(&rt, SRV_HANDLER_EXT, ".php", ROUTE_MODULE,
+                   SRV_PRIO_NORMAL, &mods[3]);
+
+    /* denies, some added before the handlers they hide and some
+     * after */
+    srv_router_add(&rt, SRV_HANDLER_DIR, "/private", ROUTE_DENY,
+                   SRV_PRIO_NORMAL, NULL);
+    srv_router_add(&rt, SRV_HANDLER_DIR, "/private/mod", ROUTE_MODULE,
+                   SRV_PRIO_NORMAL, &mods[0]);
+    srv_router_add(&rt, SRV_HANDLER_DIR, "/hidden", ROUTE_MODULE,
+                   SRV_PRIO_NORMAL, &mods[0]);
+    srv_router_add(&rt, SRV_HANDLER_DIR, "/hidden", ROUTE_DENY,
+                   SRV_PRIO_NORMAL, NULL);
+    srv_router_add(&rt, SRV_HANDLER_DIR, "/hidden", ROUTE_MODULE,
+                   SRV_PRIO_NORMAL, &mods[0]);
+    srv_router_add(&rt, SRV_HANDLER_FILE, "/secret.txt", ROUTE_DENY,
+                   SRV_PRIO_NORMAL, NULL);
+    srv_router_add(&rt, SRV_HANDLER_EXT, "inc", ROUTE_DENY,
+                   SRV_PRIO_NORMAL, NULL);
+    srv_router_add(&rt, SRV_HANDLER_EXT, "inc", ROUTE_MODULE,
+                   SRV_PRIO_NORMAL, &mods[3]);
+    srv_router_add(&rt, SRV_HANDLER_EXT, "bak", ROUTE_MODULE,
+                   SRV_PRIO_NORMAL, &mods[3]);
+    srv_router_add(&rt, SRV_HANDLER_EXT, ".bak", ROUTE_DENY,
+                   SRV_PRIO_NORMAL, NULL);
+
+    /* enough siblings, added out of order, that the search has work
+     * to do once they're sorted */
+    for (i = 64; i-- > 0;) {
+        snprintf(path, sizeof path, "/d%02u", i * 2);
+        srv_router_add(&rt, SRV_HANDLER_DIR, path, ROUTE_MODULE,
+                       SRV_PRIO_NORMAL, &mods[4 + i]);
+    }
+
+    /* scanned before it's compiled, searched after, with the same
+     * answers */
+    _check_routes(&rt, mods);
+    srv_router_compile(&rt);
+    CHECK(rt.compiled);
+    _check_routes(&rt, mods);
+
+    for (i = 1; i < rt.root.kid_cnt; i++)
+        CHECK(strcmp(rt.root.kids[i - 1]->seg, rt.root.kids[i]->seg) < 0);
+
+    /* and the class goes with the route */
+    r = srv_router_lookup(&rt, "/app/exact");
+    CHECK(NULL != r && SRV_PRIO_HIGH == r->prio);
+    r = srv_router_lookup(&rt, "/app/y");
+    CHECK(NULL != r && SRV_PRIO_LOW == r->prio);
+
+    srv_router_destroy(&rt);
+}
+
+/**
+ * delete every odd key as we pass it
+ */
+int _check_hash_odd(const void *key, void *arg)
+{
+    hash_t *ht = (hash_t *)arg;
+
+    if (atoi((const char *)key) & 1)
+        hash_delete(ht, key);
+
+    return 1;
+}
+
+/**
+ * count what's left, and that none of it is odd
+ */
+int _check_hash_count(const void *key, void *arg)
+{
+    unsigned int *n = (unsigned int *)arg;
+
+    CHECK(!(atoi((const char *)key) & 1));
+    ++*n;
+
+    return 1;
+}
+
+void srv_check_hash(void)
+{
+    hash_t *ht;
+    char key[16];
+    const char *val;
+    unsigned int i, n, ok;
+
+    ht = hash_new_string(HASH_MIN_SLOTS);
+
+    for (i = 0; i < CHECK_HASH_KEYS; i++) {
+        snprintf(key, sizeof key, "%u", i);
+        CHECK(hash_insert(ht, key, key));
+    }
+
+    CHECK(CHECK_HASH_KEYS == ht->count);
+
+    /* deletes from the middle of probe runs shift the run back, the
+     * rest must all still be found */
+    for (i = 0; i < CHECK_HASH_KEYS; i += 3) {
+        snprintf(key, sizeof key, "%u", i);
+        CHECK(hash_delete(ht, key));
+    }
+
+    for (i = 0, ok = 1; i < CHECK_HASH_KEYS; i++) {
+        snprintf(key, sizeof key, "%u", i);
+        val = (const char *)hash_get(ht, key);
+
+        if (i % 3)
+            ok &= (NULL != val && !strcmp(val, key));
+        else
+            ok &= (NULL == val);
+    }
+
+    CHECK(ok);
+
+    /* a shift during foreach mustn't skip the key that moved into the
+     * slot just visited */
+    hash_foreach(ht, _check_hash_odd, ht);
+
+    n = 0;
+    hash_foreach(ht, _check_hash_count, &n);
+    CHECK(n == ht->count);
+
+    for (i = 0, ok = 0; i < CHECK_HASH_KEYS; i++)
+        ok += (i % 3 && !(i & 1));
+
+    CHECK(n == ok);
+
+    hash_clear(ht);
+    CHECK(0 == ht->count);
+
+    for (i = 0, ok = 1; i < ht->slots; i++)
+        ok &= !ht->data[i].dist;
+
+    CHECK(ok);
+
+    hash_free(ht);
+}
+
+static chash_t ch;
+static int chash_done;
+static unsigned int chash_bad;
+
+/**
+ * a value is the key's number after a v, or a w once it's been
+ * replaced. anything else was freed under us.
+ */
+int _check_chash_val(const char *key, const char *val)
+{
+    return (('v' == val[0] || 'w' == val[0])
+            && !strcmp(key + 1, val + 1));
+}
+
+int _check_chash_each(const void *key, void *val, void *arg)
+{
+    if (!_check_chash_val((const char *)key, (const char *)val))
+        __sync_fetch_and_add(&chash_bad, 1);
+
+    ++*(unsigned int *)arg;
+
+    return 1;
+}
+
+/**
+ * look keys up, and now and then walk the lot, while the writers go
+ */
+void *_check_chash_reader(void *arg)
+{
+    unsigned int i, n, seed = (unsigned int)(size_t)arg;
+    const char *val;
+    char key[16];
+
+    for (i = 0; !__atomic_load_n(&chash_done, __ATOMIC_ACQUIRE); i++) {
+        chash_enter(&ch);
+
+        if (!(i % 4096)) {
+            n = 0;
+            chash_foreach(&ch, _check_chash_each, &n);
+        } else {
+            snprintf(key, sizeof key, "k%u", rand_r(&seed)
+                     % (CHECK_CHASH_KEYS * CHECK_CHASH_WRITERS));
+
+            if (NULL != (val = chash_get(&ch, key))
+                && !_check_chash_val(key, val))
+                __sync_fetch_and_add(&chash_bad, 1);
+        }
+
+        chash_leave(&ch);
+    }
+
+    return NULL;
+}
+
+/**
+ * each writer has its own keys: it adds them all, replaces every other
+ * one, and deletes every third
+ */
+void *_check_chash_writer(void *arg)
+{
+    unsigned int i, base = (unsigned int)(size_t)arg * CHECK_CHASH_KEYS;
+    char key[16], val[16];
+
+    for (i = base; i < base + CHECK_CHASH_KEYS; i++) {
+        snprintf(key, sizeof key, "k%u", i);
+        snprintf(val, sizeof val, "v%u", i);
+
+        if (!chash_insert(&ch, key, val))
+            __sync_fetch_and_add(&chash_bad, 1);
+
+        if (i % 2) {
+            val[0] = 'w';
+            chash_insert(&ch, key, val);
+        }
+
+        if (i >= base + 2 && !((i - base - 2) % 3)) {
+            snprintf(key, sizeof key, "k%u", i - 2);
+            chash_delete(&ch, key);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * whether a writer deleted key i
+ */
+int _check_chash_gone(unsigned int i)
+{
+    i %= CHECK_CHASH_KEYS;
+
+    return (!(i % 3) && i < CHECK_CHASH_KEYS - 2);
+}
+
+void srv_check_chash(void)
+{
+    pthread_t readers[CHECK_CHASH_READERS], writers[CHECK_CHASH_WRITERS];
+    unsigned int i, ok, grew, keys;
+    const char *val;
+    char key[16];
+
+    /* small, so every shard grows many times over while being read */
+    CHECK(chash_init_string(&ch, 4, 16));
+    chash_done = 0;
+    chash_bad = 0;
+
+    for (i = 0; i < CHECK_CHASH_READERS; i++)
+        pthread_create(&readers[i], NULL, _check_chash_reader,
+                       (void *)(size_t)(i + 1));
+
+    for (i = 0; i < CHECK_CHASH_WRITERS; i++)
+        pthread_create(&writers[i], NULL, _check_chash_writer,
+                       (void *)(size_t)i);
+
+    for (i = 0; i < CHECK_CHASH_WRITERS; i++)
+        pthread_join(writers[i], NULL);
+
+    __atomic_store_n(&chash_done, 1, __ATOMIC_RELEASE);
+
+    for (i = 0; i < CHECK_CHASH_READERS; i++)
+        pthread_join(readers[i], NULL);
+
+    if (!CHECK(0 == chash_bad))
+        ERRF(__FILE__, __LINE__, "  %u bad values\n", chash_bad);
+
+    /* every key that wasn't deleted is there, with its last value */
+    keys = CHECK_CHASH_KEYS * CHECK_CHASH_WRITERS;
+    chash_enter(&ch);
+
+    for (i = 0, ok = 1; i < keys; i++) {
+        snprintf(key, sizeof key, "k%u", i);
+        val = chash_get(&ch, key);
+
+        if (_check_chash_gone(i))
+            ok &= (NULL == val);
+        else
+            ok &= (NULL != val && (i % 2 ? 'w' : 'v') == val[0]
+                   && _check_chash_val(key, val));
+    }
+
+    chash_leave(&ch);
+    CHECK(ok);
+
+    for (i = 0, ok = 0; i < keys; i++)
+        ok += !_check_chash_gone(i);
+
+    CHECK(chash_count(&ch) == ok);
+
+    /* and the shards grew, all the way: nothing is left mid-copy
+     * that a write wouldn't finish */
+    for (i = 0, grew = 1; i < ch.shard_cnt; i++)
+        grew &= (ch.shards[i].tbl->slots > 16 / ch.shard_cnt);
+
+    CHECK(grew);
+
+    /* with nobody reading, whatever was retired goes */
+    for (i = 0; i < CHASH_GC_BATCH * 2; i++) {
+        snprintf(key, sizeof key, "x%u", i);
+        chash_insert(&ch, key, key);
+        chash_delete(&ch, key);
+    }
+
+    CHECK(ch.retired_cnt < CHASH_GC_BATCH);
+
+    chash_destroy(&ch);
+}
+
+static unsigned long long wheel_fired[3];
+static unsigned long long wheel_at;
+
+void _check_wheel_expire(wtimer_t * t)
+{
+    wheel_fired[(size_t)t->data] = wheel_at;
+}
+
+void srv_check_wheel(void)
+{
+    wheel_t w;
+    wtimer_t t[3];
+    unsigned long long when[3];
+    unsigned int i;
+
+    memset(t, 0, sizeof t);
+    memset(wheel_fired, 0, sizeof wheel_fired);
+    wheel_init(&w, 1, 0, _check_wheel_expire);
+
+    /* one on each of the first three levels, the last two only fire
+     * once they have cascaded down */
+    when[0] = 10;
+    when[1] = WHEEL_SLOTS * 3 + 7;
+    when[2] = WHEEL_SLOTS * WHEEL_SLOTS * 2 + WHEEL_SLOTS + 5;
+
+    for (i = 0; i < 3; i++) {
+        t[i].data = (void *)(size_t)i;
+        wheel_add(&w, &t[i], when[i]);
+    }
+
+    CHECK(3 == w.count);
+
+    for (wheel_at = 1; wheel_at <= when[2] + 1; wheel_at++)
+        wheel_advance(&w, wheel_at);
+
+    for (i = 0; i < 3; i++) {
+        if (!CHECK(wheel_fired[i] == when[i]))
+            ERRF(__FILE__, __LINE__, "  timer %u for %llu fired at %llu\n",
+                 i, when[i], wheel_fired[i]);
+    }
+
+    CHECK(0 == w.count);
+
+    /* a timer taken off mid-cascade never fires */
+    wheel_add(&w, &t[0], wheel_at + WHEEL_SLOTS * 2);
+    wheel_fired[0] = 0;
+    wheel_advance(&w, wheel_at + WHEEL_SLOTS);
+    CHECK(wheel_pending(&t[0]));
+    wheel_del(&w, &t[0]);
+    wheel_advance(&w, wheel_at + WHEEL_SLOTS * 4);
+    CHECK(!wheel_fired[0] && !wheel_pending(&t[0]) && 0 == w.count);
+}
+
+static deque_t dq;
+static volatile int deque_done;
+static unsigned char deque_seen[CHECK_DEQUE_ITEMS + 1];
+
+void *_check_deque_thief(void *arg)
+{
+    unsigned long n = 0;
+    void *v;
+
+    while (!deque_done || deque_size(&dq) > 0) {
+        if (NULL != (v = deque_steal(&dq))) {
+            __sync_fetch_and_add(&deque_seen[(size_t)v], 1);
+            ++n;
+        }
+    }
+
+    return (void *)n;
+}
+
+void srv_check_deque(void)
+{
+    pthread_t thief[CHECK_DEQUE_THIEVES];
+    size_t i;
+    void *v;
+    int ok;
+
+    /* the owner takes newest first, thieves oldest first */
+    deque_init(&dq, 0);
+
+    for (i = 1; i <= 3; i++)
+        deque_push(&dq, (void *)i);
+
+    CHECK((void *)1 == deque_steal(&dq));
+    CHECK((void *)3 == deque_take(&dq));
+    CHECK((void *)2 == deque_take(&dq));
+    CHECK(NULL == deque_take(&dq));
+    CHECK(NULL == deque_steal(&dq));
+
+    deque_destroy(&dq);
+
+    /* the owner pushing, growing the ring and taking while thieves
+     * steal: everything comes out exactly once */
+    deque_init(&dq, 0);
+    deque_done = 0;
+    memset(deque_seen, 0, sizeof deque_seen);
+
+    for (i = 0; i < CHECK_DEQUE_THIEVES; i++)
+        pthread_create(&thief[i], NULL, _check_deque_thief, NULL);
+
+    for (i = 1; i <= CHECK_DEQUE_ITEMS; i++) {
+        deque_push(&dq, (void *)i);
+
+        if (!(i % 3) && NULL != (v = deque_take(&dq)))
+            __sync_fetch_and_add(&deque_seen[(size_t)v], 1);
+    }
+
+    while (NULL != (v = deque_take(&dq)))
+        __sync_fetch_and_add(&deque_seen[(size_t)v], 1);
+
+    deque_done = 1;
+
+    for (i = 0; i < CHECK_DEQUE_THIEVES; i++)
+        pthread_join(thief[i], NULL);
+
+    for (i = 1, ok = 1; i <= CHECK_DEQUE_ITEMS; i++)
+        ok &= (1 == deque_seen[i]);
+
+    CHECK(ok);
+    deque_destroy(&dq);
+}
+
+/**
+ * write a file under dir, making its directory if need be
+ */
+int _check_put(const char *dir, const char *name, const char *body)
+{
+    char path[SRV_PATH_MAX * 2];
+    FILE *f;
+
+    snprintf(path, sizeof path, "%s/%s", dir, name);
+
+    if (NULL == (f = fopen(path, "w")))
+        return 0;
+
+    fputs(body, f);
+    fclose(f);
+
+    return 1;
+}
+
+/**
+ * the body a pack has for a path, if it has it
+ */
+int _check_pack_has(const pack_t * pk, const char *path, const char *body)
+{
+    const pack_ent_t *e;
+
+    if (NULL == (e = srv_pack_find(pk, path, strlen(path))))
+        return 0;
+
+    return (e->var[PACK_VAR_PLAIN].len == strlen(body)
+            && !memcmp(pk->map + e->var[PACK_VAR_PLAIN].body, body,
+                       strlen(body)));
+}
+
+void srv_check_pack(const char *srvpack)
+{
+    char dir[] = "/tmp/srvcheck.XXXXXX";
+    char root[256], file[SRV_PATH_MAX], cmd[SRV_PATH_MAX];
+    pack_t pk;
+
+    if (!CHECK(NULL != mkdtemp(dir)))
+        return;
+
+    snprintf(root, sizeof root, "%s/root", dir);
+    snprintf(file, sizeof file, "%s/a", root);
+    CHECK(!mkdir(root, 0755) && !mkdir(file, 0755));
+
+    snprintf(file, sizeof file, "port = \"8080\"\ndocroot = \"%s\"\n"
+             "index = \"/index.html\"\nmax_conn = \"16\"\n", root);
+    CHECK(_check_put(dir, "srv.conf", file));
+    CHECK(_check_put(root, "index.html", "<p>hello</p>\n"));
+    CHECK(_check_put(root, "a/b.txt", "b\n"));
+    CHECK(_check_put(root, "a/c.css", "p { }\n"));
+
+    snprintf(cmd, sizeof cmd, "%s %s/srv.conf %s/pack > /dev/null",
+             srvpack, dir, dir);
+
+    if (CHECK(!system(cmd))) {
+        snprintf(file, sizeof file, "%s/pack", dir);
+
+        if (CHECK(srv_pack_open(&pk, file))) {
+            CHECK(3 <= pk.hdr->count);
+            CHECK(_check_pack_has(&pk, "/index.html", "<p>hello</p>\n"));
+            CHECK(_check_pack_has(&pk, "/a/b.txt", "b\n"));
+            CHECK(_check_pack_has(&pk, "/a/c.css", "p { }\n"));
+            CHECK(NULL == srv_pack_find(&pk, "/a/d.txt", 7));
+            CHECK(NULL == srv_pack_find(&pk, "/a/b.tx", 7));
+            srv_pack_close(&pk);
+        }
+    }
+
+    snprintf(cmd, sizeof cmd, "rm -rf %s", dir);
+    system(cmd);
+}
+
+/* two docroots, only the first of them watched */
+static path_root_t check_watched, check_unwatched;
+
+/**
+ * is the file x under a root there, as of now?
+ */
+int _check_path_there(const path_root_t * root, time_t now)
+{
+    path_t p;
+
+    if (!srv_path_lookup(&p, root, "/x", now))
+        return -1;
+
+    srv_path_stat(&p, root, now);
+
+    return !p.err;
+}
+
+/**
+ * on a thread of its own, so its cache has room for the roots
+ */
+void *_check_path(void *arg)
+{
+    time_t now = time(NULL);
+
+    CHECK(0 == _check_path_there(&check_watched, now));
+    CHECK(0 == _check_path_there(&check_unwatched, now));
+
+    CHECK(_check_put(check_watched.dir, "x", "x\n"));
+    CHECK(_check_put(check_unwatched.dir, "x", "x\n"));
+
+    /* past the short ttl the unwatched root looks again, but the
+     * watched one believes its miss until it's told otherwise */
+    CHECK(0 == _check_path_there(&check_watched, now + 10));
+    CHECK(1 == _check_path_there(&check_unwatched, now + 10));
+
+    srv_path_poll();
+    CHECK(1 == _check_path_there(&check_watched, now + 11));
+
+    return NULL;
+}
+
+void srv_check_path(void)
+{
+    char dir[] = "/tmp/srvcheck.XXXXXX";
+    char a[256], b[256], cmd[SRV_PATH_MAX];
+    pthread_t th;
+
+    if (!CHECK(NULL != mkdtemp(dir)))
+        return;
+
+    snprintf(a, sizeof a, "%s/a", dir);
+    snprintf(b, sizeof b, "%s/b", dir);
+    CHECK(!mkdir(a, 0755) && !mkdir(b, 0755));
+
+    srv_path_root(&check_watched, a, "/index.html", 0);
+    srv_path_root(&check_unwatched, b, "/index.html", 0);
+
+    /* watching one root says nothing about another */
+    CHECK(SRV_PATH_NEG_TTL == check_watched.neg_ttl);
+    CHECK(srv_path_watch(&check_watched));
+    CHECK(SRV_PATH_NEG_WATCHED_TTL == check_watched.neg_ttl);
+    CHECK(SRV_PATH_NEG_TTL == check_unwatched.neg_ttl);
+
+    pthread_create(&th, NULL, _check_path, NULL);
+    pthread_join(th, NULL);
+
+    snprintf(cmd, sizeof cmd, "rm -rf %s", dir);
+    system(cmd);
+}
+
+void srv_check_warm(void)
+{
+    char dir[] = "/tmp/srvcheck.XXXXXX";
+    char file[256], cmd[SRV_PATH_MAX];
+    vector_t list;
+    unsigned int i;
+
+    if (!CHECK(NULL != mkdtemp(dir)))
+        return;
+
+    /* the manifest is written off this thread, so wait for it */
+    snprintf(file, sizeof file, "%s/hot", dir);
+    srv_warm_track();
+
+    for (i = 0; i < SRV_WARM_SAMPLE * 4; i++)
+        srv_warm_hit("/busy.html", 10);
+
+    CHECK(srv_warm_save(file));
+
+    for (i = 0; i < 200 && access(file, F_OK); i++)
+        usleep(10000);
+
+    if (CHECK(vector_init(&list, 0, sizeof(char *)))) {
+        CHECK(srv_warm_load(&list, file) && 1 == list.count
+              && !strcmp(*(char **)vector_get_at(&list, 0), "/busy.html"));
+
+        for (i = 0; i < list.count; i++)
+            free(*(char **)vector_get_at(&list, i));
+
+        vector_destroy(&list);
+    }
+
+    snprintf(cmd, sizeof cmd, "rm -rf %s", dir);
+    system(cmd);
+}
+
+/**
+ * write what the governor reads: what's in use, and how long of the
+ * last ten seconds was spent stalled, in hundredths of a percent
+ */
+int _check_mem_set(const char *dir, unsigned long long used,
+                   unsigned int stall)
+{
+    char file[256];
+    FILE *f;
+
+    snprintf(file, sizeof file, "%s/memory.current", dir);
+
+    if (NULL == (f = fopen(file, "w")))
+        return 0;
+
+    fprintf(f, "%llu\n", used);
+    fclose(f);
+
+    snprintf(file, sizeof file, "%s/memory.pressure", dir);
+
+    if (NULL == (f = fopen(file, "w")))
+        return 0;
+
+    fprintf(f, "some avg10=%u.%02u avg60=0.00 avg300=0.00 total=0\n"
+            "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n",
+            stall / 100, stall % 100);
+    fclose(f);
+
+    return 1;
+}
+
+void srv_check_mem(void)
+{
+    char dir[] = "/tmp/srvcheck.XXXXXX";
+    char cur[256], max[256], psi[256], cmd[256];
+    unsigned long long limit = 1ULL << 30, used;
+    const mem_t *m = srv_mem_state();
+    size_t budget, want;
+    FILE *f;
+
+    if (!CHECK(NULL != mkdtemp(dir)))
+        return;
+
+    snprintf(cur, sizeof cur, "%s/memory.current", dir);
+    snprintf(max, sizeof max, "%s/memory.max", dir);
+    snprintf(psi, sizeof psi, "%s/memory.pressure", dir);
+
+    if (NULL != (f = fopen(max, "w"))) {
+        fprintf(f, "%llu\n", limit);
+        fclose(f);
+    }
+
+    /* with nothing pooled, what's free is all the budget goes by */
+    buf_pool_limit(0);
+
+    CHECK(_check_mem_set(dir, 100 << 20, 0));
+    srv_mem_init(0, 0);
+    CHECK(srv_mem_files(cur, max, psi));
+
+    /* plenty free, the pools get all they'd ever keep */
+    budget = srv_mem_poll();
+    CHECK(budget == m->ceiling && 0 < budget);
+    CHECK(m->limit == limit && m->used == 100 << 20 && 0 == m->stall);
+
+    /* stalled, or close to the limit: half goes each time */
+    CHECK(_check_mem_set(dir, 100 << 20, SRV_MEM_STALL + 200));
+    CHECK(srv_mem_poll() == budget / 2);
+    CHECK(SRV_MEM_STALL + 200 == m->stall);
+
+    CHECK(_check_mem_set(dir, limit - limit / 20, 0));
+    CHECK(srv_mem_poll() == budget / 4);
+
+    /* easing off, it comes back a step at a time, never past the
+     * ceiling */
+    CHECK(_check_mem_set(dir, 100 << 20, 0));
+    want = budget / 4 + SRV_MEM_GROW;
+    CHECK(srv_mem_poll() == ((want < m->ceiling) ? want : m->ceiling));
+
+    while (want < m->ceiling) {
+        want += SRV_MEM_GROW;
+        CHECK(srv_mem_poll() == ((want < m->ceiling) ? want : m->ceiling));
+    }
+
+    CHECK(srv_mem_poll() == m->ceiling);
+
+    /* not tight, but with little free the pools get only their share */
+    used = limit - m->ceiling * 3;
+    CHECK(_check_mem_set(dir, used, 0));
+    budget = srv_mem_poll();
+    CHECK(budget == (limit - used + m->held) / SRV_MEM_SHARE);
+    CHECK(budget < m->ceiling && budget > m->ceiling / 2);
+
+    /* a limit of our own wins over the cgroup's */
+    limit = 256 << 20;
+    used = limit - m->ceiling * 3;
+    srv_mem_init(limit, 0);
+    CHECK(srv_mem_files(cur, max, psi));
+    CHECK(_check_mem_set(dir, used, 0));
+    budget = srv_mem_poll();
+    CHECK(m->limit == limit);
+    CHECK(budget == (limit - used + m->held) / SRV_MEM_SHARE);
+    CHECK(budget < m->ceiling && budget > m->ceiling / 2);
+
+    srv_mem_files(NULL, NULL, NULL);
+    buf_pool_limit(buf_pool_max());
+
+    snprintf(cmd, sizeof cmd, "rm -rf %s", dir);
+    system(cmd);
+}
+
+/**
+ * which docroot a Host is served from
+ */
+int _check_vhost(vhosts_t * vhs, const char *host, const char *want)
+{
+    const vhost_t *vh = srv_vhost_find(vhs, host);
+
+    if (!CHECK(!strcmp(vh->root.dir, want)))
+        ERRF(__FILE__, __LINE__, "  %s went to %s, not %s\n",
+             (NULL != host) ? host : "(none)", vh->root.dir, want);
+
+    return 1;
+}
+
+void srv_check_vhost(void)
+{
+    char file[] = "/tmp/srvcheck.XXXXXX";
+    char file2[] = "/tmp/srvcheck.XXXXXX";
+    vhosts_t vhs;
+    conf_t conf;
+    pid_t pid;
+    FILE *f;
+    int fd, st;
+
+    if (!CHECK(-1 != (fd = mkstemp(file))))
+        return;
+
+    f = fdopen(fd, "w");
+    fputs("port = \"8080\"\ndocroot = \"/d\"\nindex = \"/index.html\"\n"
+          "max_conn = \"16\"\n"
+          "vhost {\n    name = \"a.example.com\"\n"
+          "    name = \"*.a.example.com\"\n    docroot = \"/a\"\n}\n"
+          "vhost {\n    name = \"*.example.com\"\n    docroot = \"/b\"\n"
+          "    path_cache = \"1000\"\n}\n", f);
+    fclose(f);
+
+    CHECK(srv_conf_parse(&conf, file));
+    unlink(file);
+
+    if (!CHECK(2 == conf.vhost_cnt && srv_vhosts_init(&vhs, &conf, NULL,
+                                                      NULL, NULL, NULL)))
+        return;
+
+    /* exact names, case and a trailing dot aside */
+    _check_vhost(&vhs, "a.example.com", "/a");
+    _check_vhost(&vhs, "A.Example.COM.", "/a");
+
+    /* the most specific wildcard wins, and never matches the bare name */
+    _check_vhost(&vhs, "x.a.example.com", "/a");
+    _check_vhost(&vhs, "y.x.a.example.com", "/a");
+    _check_vhost(&vhs, "b.example.com", "/b");
+    _check_vhost(&vhs, "example.com", "/d");
+
+    /* everything else is the default site */
+    _check_vhost(&vhs, "example.org", "/d");
+    _check_vhost(&vhs, "", "/d");
+    _check_vhost(&vhs, NULL, "/d");
+
+    /* each has its own share of the path cache */
+    CHECK(1024 == vhs.sites[2].root.slots);
+    CHECK(vhs.sites[1].root.off + vhs.sites[1].root.slots
+          == vhs.sites[2].root.off);
+
+    /* and only the default site is warmed up */
+    CHECK(vhs.sites[0].warm && !vhs.sites[1].warm && !vhs.sites[2].warm);
+
+    /* so warm in a vhost block is refused outright */
+    if (!CHECK(-1 != (fd = mkstemp(file2))))
+        return;
+
+    f = fdopen(fd, "w");
+    fputs("port = \"8080\"\ndocroot = \"/d\"\n"
+          "vhost {\n    name = \"a.example.com\"\n"
+          "    warm = \"/index.html\"\n}\n", f);
+    fclose(f);
+
+    if (0 == (pid = fork())) {
+        fclose(stderr);
+        srv_conf_parse(&conf, file2);
+        _exit(0);
+    }
+
+    CHECK(pid == waitpid(pid, &st, 0) && WIFEXITED(st)
+          && WEXITSTATUS(st));
+    unlink(file2);
+}
+
+/**
+ * a socket listening on loopback, on whatever port is free
+ */
+int _check_listen(unsigned short *port)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof addr;
+    int fd;
+
+    if (-1 == (fd = socket(AF_INET, SOCK_STREAM, 0)))
+        return -1;
+
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof addr)
+        || listen(fd, 16)
+        || getsockname(fd, (struct sockaddr *)&addr, &len)) {
+        close(fd);
+        return -1;
+    }
+
+    *port = ntohs(addr.sin_port);
+
+    return fd;
+}
+
+/**
+ * the stand-in upstream, one connection: /len answers with a length,
+ * /chunk chunked, and anything else echoes the body back. it keeps
+ * answering until it's hung up on, or until the request after a /once,
+ * which it hangs up on without an answer.
+ */
+void *_check_upstream_conn(void *arg)
+{
+    static const char chunked[] = "HTTP/1.1 200 OK\r\n"
+        "Transfer-Encoding: chunked\r\nConnection: keep-alive\r\n\r\n"
+        "3\r\nabc\r\n2;ext=1\r\nde\r\n0\r\nX-Trailer: 1\r\n\r\n";
+    char *buf, *end, *cl, head[128];
+    size_t len = 0, need;
+    ssize_t got;
+    int fd = (intptr_t) arg, once = 0;
+
+    buf = malloc(CHECK_PROXY_BODY * 2);
+
+    for (;;) {
+        buf[len] = '\0';
+
+        if (NULL == (end = strstr(buf, "\r\n\r\n"))) {
+            if ((got = recv(fd, buf + len, CHECK_PROXY_BODY * 2 - 1 - len,
+                            0)) <= 0)
+                break;
+
+            len += got;
+            continue;
+        }
+
+        end += 4;
+        cl = strstr(buf, "Content-Length: ");
+        need = (end - buf) + ((NULL != cl && cl < end) ? atoi(cl + 16) : 0);
+
+        while (len < need) {
+            if ((got = recv(fd, buf + len, need - len, 0)) <= 0)
+                goto out;
+
+            len += got;
+        }
+
+        if (once)
+            break;
+
+        if (!strncmp(buf, "GET /chunk ", 11)) {
+            send(fd, chunked, sizeof chunked - 1, MSG_NOSIGNAL);
+        } else if (!strncmp(buf, "GET /aged ", 10)) {
+            snprintf(head, sizeof head, "HTTP/1.1 200 OK\r\nAge: 30\r\n"
+                     "Cache-Control: max-age=60\r\nContent-Length: 5"
+                     "\r\n\r\nhello");
+            send(fd, head, strlen(head), MSG_NOSIGNAL);
+        } else if (!strncmp(buf, "GET /len ", 9)
+                   || !strncmp(buf, "HEAD /len ", 10)
+                   || (once = !strncmp(buf, "GET /once ", 10))) {
+            snprintf(head, sizeof head, "HTTP/1.1 200 OK\r\n"
+                     "Content-Length: 5\r\nKeep-Alive: timeout=5\r\n\r\n%s",
+                     ('G' == buf[0]) ? "hello" : "");
+            send(fd, head, strlen(head), MSG_NOSIGNAL);
+        } else {
+            snprintf(head, sizeof head, "HTTP/1.1 200 OK\r\n"
+                     "Content-Length: %d\r\n\r\n", (int)(need - (end - buf)));
+            send(fd, head, strlen(head), MSG_NOSIGNAL);
+            send(fd, end, need - (end - buf), MSG_NOSIGNAL);
+        }
+
+        memmove(buf, buf + need, len - need);
+        len -= need;
+    }
+
+  out:
+    free(buf);
+    close(fd);
+
+    return NULL;
+}
+
+void *_check_upstream(void *arg)
+{
+    pthread_t th;
+    int lfd = (intptr_t) arg, fd;
+
+    while (-1 != (fd = accept(lfd, NULL, NULL))) {
+        __atomic_add_fetch(&upstream_accepts, 1, __ATOMIC_RELAXED);
+
+        if (!pthread_create(&th, NULL, _check_upstream_conn,
+                            (void *)(intptr_t) fd))
+            pthread_detach(th);
+    }
+
+    return NULL;
+}
+
+/**
+ * put a request through a proxy, or a FastCGI pool for a site, as a
+ * client on a real socket would, and read back everything the client
+ * got
+ * @param rest more of the body, sent after the request
+ */
+int _check_served(proxy_t * px, fcgi_t * fc, vhost_t * site,
+                  const char *req, const char *rest, size_t restlen,
+                  char *out, size_t outlen)
+{
+    struct sockaddr_in addr;
+    socklen_t alen = sizeof addr;
+    unsigned short port;
+    size_t len = 0;
+    ssize_t got;
+    conn_t clnt;
+    int lfd, cfd, ok;
+
+    memset(&clnt, 0, sizeof clnt);
+
+    if (-1 == (lfd = _check_listen(&port)))
+        return 0;
+
+    cfd = socket(AF_INET, SOCK_STREAM, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(cfd, (struct sockaddr *)&addr, sizeof addr)
+        || -1 == (clnt.sock = accept(lfd, (struct sockaddr *)&clnt.addr,
+                                     &alen))) {
+        close(lfd);
+        close(cfd);
+        return 0;
+    }
+
+    close(lfd);
+    fcntl(clnt.sock, F_SETFL, O_NONBLOCK);
+
+    /* the request as it was read, some of the body in with it */
+    clnt.req.buf = buf_get(SRV_REQ_MAX_LEN);
+    clnt.req.buf->len = strlen(req);
+    memcpy(clnt.req.buf->data, req, clnt.req.buf->len + 1);
+    clnt.req.meth = (!strncmp(req, "HEAD", 4)) ? HTTP_MTHD_HEAD
+        : (!strncmp(req, "POST", 4)) ? HTTP_MTHD_POST : HTTP_MTHD_GET;
+    clnt.req.path = strndup(strchr(req, ' ') + 1,
+                            strcspn(strchr(req, ' ') + 1, " ?"));
+    clnt.site = site;
+
+    if (restlen)
+        send(cfd, rest, restlen, 0);
+
+    ok = (NULL != px) ? srv_proxy_serve(px, &clnt, NULL)
+        : srv_fcgi_serve(fc, &clnt, NULL);
+
+    shutdown(clnt.sock, SHUT_WR);
+
+    while (len + 1 < outlen
+           && (got = recv(cfd, out + len, outlen - 1 - len, 0)) > 0)
+        len += got;
+
+    out[len] = '\0';
+
+    buf_put(clnt.req.buf);
+    free(clnt.req.path);
+    close(clnt.sock);
+    close(cfd);
+
+    return ok;
+}
+
+int _check_proxied(proxy_t * px, const char *req, const char *rest,
+                   size_t restlen, char *out, size_t outlen)
+{
+    return _check_served(px, NULL, NULL, req, rest, restlen, out, outlen);
+}
+
+void srv_check_proxy(void)
+{
+    struct _srvproxy_conf_t pc;
+    unsigned short live, dead;
+    char dir[] = "/tmp/srvcheck.XXXXXX";
+    char up[2][32], *s, *body, *out, *req;
+    cache_ent_t ent;
+    cache_t c;
+    vhost_t site;
+    resp_t r;
+    req_t rq;
+    pthread_t th;
+    proxy_t px;
+    int lfd, fd, i;
+
+    /* nothing listens on dead, once we've found it free */
+    if (!CHECK(-1 != (fd = _check_listen(&dead))))
+        return;
+
+    close(fd);
+
+    if (!CHECK(-1 != (lfd = _check_listen(&live))))
+        return;
+
+    pthread_create(&th, NULL, _check_upstream, (void *)(intptr_t) lfd);
+    pthread_detach(th);
+
+    memset(&pc, 0, sizeof pc);
+    pc.prefix = "/";
+    pc.timeout = 2000;
+    vector_init(&pc.upstreams, 0, sizeof(char *));
+
+    snprintf(up[0], sizeof up[0], "127.0.0.1:%u", dead);
+    snprintf(up[1], sizeof up[1], "127.0.0.1:%u", live);
+    s = up[0];
+    vector_push(&pc.upstreams, &s);
+    s = up[1];
+    vector_push(&pc.upstreams, &s);
+
+    /* what the client hears when it goes wrong */
+    if (!CHECK(srv_resp_errors_init(NULL) && srv_proxy_init(&px, &pc)))
+        return;
+
+    out = malloc(CHECK_PROXY_BODY * 2);
+    body = malloc(CHECK_PROXY_BODY);
+    req = malloc(SRV_REQ_MAX_LEN);
+
+    /* the first pick won't take a connection, so it's passed over */
+    CHECK(_check_proxied(&px, "GET /len HTTP/1.1\r\nHost: x\r\n\r\n", NULL,
+                         0, out, CHECK_PROXY_BODY * 2));
+    CHECK(!strncmp(out, "HTTP/1.1 200 OK\r\n", 17));
+    CHECK(NULL != strstr(out, "\r\nConnection: close\r\n\r\nhello"));
+    CHECK(NULL == strstr(out, "Keep-Alive"));
+    CHECK(px.ups[0].down && !px.ups[1].down);
+
+    /* the same upstream connection, over and over */
+    CHECK(_check_proxied(&px, "GET /len HTTP/1.1\r\nHost: x\r\n\r\n", NULL,
+                         0, out, CHECK_PROXY_BODY * 2));
+    CHECK(NULL != strstr(out, "hello"));
+    CHECK(_check_proxied(&px, "HEAD /len HTTP/1.1\r\nHost: x\r\n\r\n", NULL,
+                         0, out, CHECK_PROXY_BODY * 2));
+    CHECK(NULL == strstr(out, "hello"));
+
+    /* chunked goes through as it is, to the end of its trailer */
+    CHECK(_check_proxied(&px, "GET /chunk HTTP/1.1\r\nHost: x\r\n\r\n",
+                         NULL, 0, out, CHECK_PROXY_BODY * 2));
+    s = strstr(out, "\r\n\r\n");
+    CHECK(NULL != s && !strcmp(s + 4, "3\r\nabc\r\n2;ext=1\r\nde\r\n0\r\n"
+                               "X-Trailer: 1\r\n\r\n"));
+
+    /* a body, some with the request and the rest streamed after */
+    for (i = 0; i < CHECK_PROXY_BODY; i++)
+        body[i] = 'a' + i % 26;
+
+    snprintf(req, SRV_REQ_MAX_LEN, "POST /echo HTTP/1.1\r\nHost: x\r\n"
+             "Content-Length: %d\r\nExpect: 100-continue\r\n\r\n%.100s",
+             CHECK_PROXY_BODY, body);
+    CHECK(_check_proxied(&px, req, body + 100, CHECK_PROXY_BODY - 100, out,
+                         CHECK_PROXY_BODY * 2));
+    CHECK(!strncmp(out, "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK", 40));
+    s = strstr(out + 25, "\r\n\r\n");
+    CHECK(NULL != s && strlen(s + 4) == CHECK_PROXY_BODY
+          && !memcmp(s + 4, body, CHECK_PROXY_BODY));
+
+    CHECK(1 == __atomic_load_n(&upstream_accepts, __ATOMIC_RELAXED));
+    CHECK(5 == px.ups[1].served && 1 == px.ups[1].idle_cnt);
+
+    /* a body has to have a length */
+    CHECK(!_check_proxied(&px, "POST /echo HTTP/1.1\r\nHost: x\r\n"
+                          "Transfer-Encoding: chunked\r\n\r\n", NULL, 0,
+                          out, CHECK_PROXY_BODY * 2));
+    CHECK(!strncmp(out, "HTTP/1.1 411 ", 13));
+
+    /* two lengths have to agree, and only one is passed on */
+    CHECK(!_check_proxied(&px, "POST /echo HTTP/1.1\r\nHost: x\r\n"
+                          "Content-Length: 5\r\nContent-Length: 6\r\n\r\n"
+                          "hello!", NULL, 0, out, CHECK_PROXY_BODY * 2));
+    CHECK(!strncmp(out, "HTTP/1.1 400 ", 13));
+    CHECK(_check_proxied(&px, "POST /echo HTTP/1.1\r\nHost: x\r\n"
+                         "Content-Length: 5\r\nContent-Length: 5\r\n\r\n"
+                         "hello", NULL, 0, out, CHECK_PROXY_BODY * 2));
+    s = strstr(out, "\r\n\r\n");
+    CHECK(NULL != s && !strcmp(s + 4, "hello"));
+
+    /* a kept connection that goes away under a POST isn't tried again,
+     * since the upstream may have acted on it */
+    CHECK(_check_proxied(&px, "GET /once HTTP/1.1\r\nHost: x\r\n\r\n",
+                         NULL, 0, out, CHECK_PROXY_BODY * 2));
+    CHECK(!_check_proxied(&px, "POST /echo HTTP/1.1\r\nHost: x\r\n"
+                          "Content-Length: 5\r\n\r\nhello", NULL, 0,
+                          out, CHECK_PROXY_BODY * 2));
+    CHECK(!strncmp(out, "HTTP/1.1 502 ", 13));
+    CHECK(1 == __atomic_load_n(&upstream_accepts, __ATOMIC_RELAXED));
+
+    /* but a GET is, on a new one: one for the /once, and one more */
+    px.ups[1].down = 0;
+    CHECK(_check_proxied(&px, "GET /once HTTP/1.1\r\nHost: x\r\n\r\n",
+                         NULL, 0, out, CHECK_PROXY_BODY * 2));
+    CHECK(_check_proxied(&px, "GET /len HTTP/1.1\r\nHost: x\r\n\r\n",
+                         NULL, 0, out, CHECK_PROXY_BODY * 2));
+    CHECK(NULL != strstr(out, "hello"));
+    CHECK(3 == __atomic_load_n(&upstream_accepts, __ATOMIC_RELAXED));
+
+    /* what's kept was as old as the upstream said when it came in, and
+     * a hit says how old it is now */
+    if (CHECK(NULL != mkdtemp(dir) && srv_cache_init(&c, dir, 64 * 1024,
+                                                      16 * 1024))) {
+        memset(&site, 0, sizeof site);
+        site.name = "x";
+        px.store = &c;
+
+        CHECK(_check_served(&px, NULL, &site, "GET /aged HTTP/1.1\r\n"
+                            "Host: x\r\n\r\n", NULL, 0, out,
+                            CHECK_PROXY_BODY * 2));
+        CHECK(NULL != strstr(out, "\r\nAge: 30\r\n"));
+
+        if (CHECK(srv_cache_get(&c, "x /aged", &ent, req, SRV_PATH_MAX))) {
+            CHECK(ent.stored <= time(NULL) - 30
+                  && ent.stored >= time(NULL) - 31);
+            memset(&rq, 0, sizeof rq);
+            memset(&r, 0, sizeof r);
+            CHECK(srv_resp_cached(&r, &c, "x /aged", &rq, "now")
+                  && NULL != strstr(r.header, "\r\nAge: 3"));
+            CHECK(0 < r.fd && (ssize_t)r.len == pread(r.fd, out, r.len,
+                                                      r.off));
+            out[r.len] = '\0';
+            CHECK(NULL == strstr(out, "Age:")
+                  && NULL != strstr(out, "\r\n\r\nhello"));
+            srv_resp_release(&r);
+        }
+
+        px.store = NULL;
+        snprintf(req, SRV_REQ_MAX_LEN, "rm -rf %s", dir);
+        system(req);
+    }
+
+    /* and with nowhere to go, the client hears why */
+    px.ups[1].down = 1;
+    CHECK(!_check_proxied(&px, "GET /len HTTP/1.1\r\nHost: x\r\n\r\n", NULL,
+                          0, out, CHECK_PROXY_BODY * 2));
+    CHECK(!strncmp(out, "HTTP/1.1 502 ", 13));
+
+    free(out);
+    free(body);
+    free(req);
+}
+
+/**
+ * run every check, 1 if they all passed
+ */
+/**
+ * when a response is good until, by its header
+ */
+time_t _check_expiry(const char *head, time_t now, unsigned int ttl)
+{
+    return srv_cache_expiry(head, strstr(head, "\r\n\r\n") + 2, now, ttl);
+}
+
+/**
+ * what a request lets the cache do
+ */
+unsigned int _check_request(const char *head)
+{
+    return srv_cache_request(head, strstr(head, "\r\n\r\n") + 2);
+}
+
+/**
+ * is the response kept for a key the one we put there?
+ */
+int _check_cached(cache_t * c, const char *key, const char *want)
+{
+    cache_ent_t ent;
+    char path[SRV_PATH_MAX], got[64];
+    int fd, ok;
+
+    if (!srv_cache_get(c, key, &ent, path, sizeof path))
+        return 0;
+
+    if (-1 == (fd = open(path, O_RDONLY)))
+        return 0;
+
+    ok = (ent.headlen + ent.len == strlen(want)
+          && (ssize_t)strlen(want) == pread(fd, got, strlen(want), ent.off)
+          && !memcmp(got, want, strlen(want)));
+    close(fd);
+
+    return ok;
+}
+
+/**
+ * a record from the stand-in responder
+ */
+void _check_fcgi_put(int fd, unsigned int type, unsigned int id,
+                     const char *data, size_t len)
+{
+    unsigned char h[8] = { 1, type, id >> 8, id & 0xff, len >> 8, len & 0xff };
+
+    send(fd, h, sizeof h, MSG_NOSIGNAL);
+
+    if (len)
+        send(fd, data, len, MSG_NOSIGNAL);
+}
+
+void _check_fcgi_end(int fd, unsigned int id, unsigned int proto)
+{
+    char body[8] = { 0, 0, 0, 0, proto };
+
+    _check_fcgi_put(fd, 3, id, body, sizeof body);
+}
+
+/**
+ * a param the stand-in was sent, "-" if it wasn't
+ */
+char *_check_fcgi_param(const unsigned char *p, size_t len, const char *name,
+                        char *val, size_t size)
+{
+    size_t i = 0, n, v;
+
+    while (i < len) {
+        if (0x80 & (n = p[i++])) {
+            n = ((n & 0x7f) << 24) | (p[i] << 16) | (p[i + 1] << 8) | p[i + 2];
+            i += 3;
+        }
+
+        if (0x80 & (v = p[i++])) {
+            v = ((v & 0x7f) << 24) | (p[i] << 16) | (p[i + 1] << 8) | p[i + 2];
+            i += 3;
+        }
+
+        if (n == strlen(name) && !memcmp(p + i, name, n)) {
+            snprintf(val, size, "%.*s", (int)v, p + i + n);
+            return val;
+        }
+
+        i += n + v;
+    }
+
+    snprintf(val, size, "-");
+
+    return val;
+}
+
+struct _check_fcgi_req {
+    unsigned char params[4096];
+    size_t plen;
+    /* how much body, and whether it was what was sent */
+    size_t in;
+    unsigned int bad;
+};
+
+/**
+ * answer a request whose body is all in: what it was told, back in its
+ * body, its header split across records. some paths do something else.
+ * @param pair a request waiting for another to be answered with
+ * @return 0 to hang up after
+ */
+int _check_fcgi_answer(int fd, struct _check_fcgi_req *reqs, unsigned int id,
+                       unsigned int *pair)
+{
+    static const char *names[] = { "SCRIPT_FILENAME", "SCRIPT_NAME",
+        "PATH_INFO", "QUERY_STRING", "REQUEST_METHOD", "CONTENT_LENGTH",
+        "HTTP_X_A", "HTTP_PROXY", "APP"
+    };
+    struct _check_fcgi_req *r = &reqs[id];
+    char uri[256], val[256], out[2048], q[2][64];
+    unsigned int i, ids[2];
+    size_t len;
+
+    _check_fcgi_param(r->params, r->plen, "REQUEST_URI", uri, sizeof uri);
+
+    if (!strcmp(uri, "/app/busy")) {
+        _check_fcgi_end(fd, id, 2);
+        return 1;
+    }
+
+    if (!strncmp(uri, "/app/pair", 9)) {
+        if (!*pair) {
+            *pair = id;
+            return 1;
+        }
+
+        /* the last first, a piece of each at a time */
+        ids[0] = id;
+        ids[1] = *pair;
+        *pair = 0;
+
+        for (i = 0; i < 2; i++) {
+            _check_fcgi_param(reqs[ids[i]].params, reqs[ids[i]].plen,
+                              "QUERY_STRING", q[i], sizeof q[i]);
+            _check_fcgi_put(fd, 6, ids[i], "Content-Type: text/plain\n\npa",
+                            28);
+        }
+
+        for (i = 2; i--;) {
+            len = snprintf(out, sizeof out, "ir %s", q[i]);
+            _check_fcgi_put(fd, 6, ids[i], out, len);
+            _check_fcgi_end(fd, ids[i], 0);
+        }
+
+        return 1;
+    }
+
+    while (!strcmp(uri, "/app/slow")
+           && !__atomic_load_n(&fcgi_release, __ATOMIC_RELAXED))
+        usleep(1000);
+
+    if (!strcmp(uri, "/app/big")) {
+        _check_fcgi_put(fd, 6, id, "Status: 200 OK\r\n\r\n", 18);
+        memset(out, 'x', sizeof out);
+
+        for (len = 0; len < CHECK_FCGI_BIG; len += sizeof out)
+            _check_fcgi_put(fd, 6, id, out, sizeof out);
+
+        _check_fcgi_end(fd, id, 0);
+        return 1;
+    }
+
+    /* how many times it was told the body's length */
+    if (!strcmp(uri, "/app/lens")) {
+        for (i = 0, len = 0; len + 14 <= r->plen; len++)
+            i += !memcmp(r->params + len, "CONTENT_LENGTH", 14);
+
+        len = snprintf(out, sizeof out, "Status: 200 OK\r\n\r\n%u", i);
+        _check_fcgi_put(fd, 6, id, out, len);
+        _check_fcgi_end(fd, id, 0);
+        return 1;
+    }
+
+    /* something for the log, once */
+    if (!strcmp(uri, "/app/x.php/more?q=1"))
+        _check_fcgi_put(fd, 7, id, "a complaint\n", 12);
+
+    len = snprintf(out, sizeof out, "Status: 201 Created\r\nX-In: %lu\r\n\r",
+                   (unsigned long)r->in);
+    _check_fcgi_put(fd, 6, id, out, len);
+
+    len = snprintf(out, sizeof out, "\n");
+
+    for (i = 0; i < sizeof names / sizeof names[0]; i++)
+        len += snprintf(out + len, sizeof out - len, "%s=%s\n", names[i],
+                        _check_fcgi_param(r->params, r->plen, names[i], val,
+                                          sizeof val));
+
+    len += snprintf(out + len, sizeof out - len, "STDIN=%s\n",
+                    (r->bad) ? "bad" : "ok");
+    _check_fcgi_put(fd, 6, id, out, len);
+    _check_fcgi_end(fd, id, 0);
+
+    /* done with this connection, as php-fpm is every so often */
+    return strcmp(uri, "/app/close");
+}
+
+/**
+ * a FastCGI responder that takes more than one request at a time
+ */
+void *_check_fcgi_conn(void *arg)
+{
+    struct _check_fcgi_req *reqs, *r;
+    unsigned char h[8], *data;
+    unsigned int id, pair = 0;
+    size_t len, i;
+    int fd = (intptr_t) arg;
+
+    reqs = calloc(8, sizeof *reqs);
+    data = malloc(65536 + 256);
+
+    while (8 == recv(fd, h, 8, MSG_WAITALL)) {
+        id = (h[2] << 8) | h[3];
+        len = (h[4] << 8) | h[5];
+
+        if (len + h[6] && recv(fd, data, len + h[6], MSG_WAITALL)
+            != (ssize_t) (len + h[6]))
+            break;
+
+        if (!id || id >= 8)
+            continue;
+
+        r = &reqs[id];
+
+        if (1 == h[1]) {
+            memset(r, 0, sizeof *r);
+        } else if (4 == h[1] && r->plen + len <= sizeof r->params) {
+            memcpy(r->params + r->plen, data, len);
+            r->plen += len;
+        } else if (5 == h[1] && len) {
+            for (i = 0; i < len; i++)
+                r->bad |= (data[i] != 'a' + (r->in + i) % 26);
+
+            r->in += len;
+        } else if (5 == h[1] && !_check_fcgi_answer(fd, reqs, id, &pair)) {
+            break;
+        }
+    }
+
+    free(reqs);
+    free(data);
+    close(fd);
+
+    return NULL;
+}
+
+void *_check_fcgi(void *arg)
+{
+    pthread_t th;
+    int lfd = (intptr_t) arg, fd;
+
+    while (-1 != (fd = accept(lfd, NULL, NULL))) {
+        __atomic_add_fetch(&fcgi_accepts, 1, __ATOMIC_RELAXED);
+
+        if (!pthread_create(&th, NULL, _check_fcgi_conn,
+                            (void *)(intptr_t) fd))
+            pthread_detach(th);
+    }
+
+    return NULL;
+}
+
+/* a request put through a pool from a thread of its own */
+struct _check_fcgi_call {
+    fcgi_t *f;
+    vhost_t *site;
+    const char *req;
+    char out[1024];
+    int ok;
+};
+
+void *_check_fcgi_call(void *arg)
+{
+    struct _check_fcgi_call *c = (struct _check_fcgi_call *)arg;
+
+    c->ok = _check_served(NULL, c->f, c->site, c->req, NULL, 0, c->out,
+                          sizeof c->out);
+
+    return NULL;
+}
+
+/**
+ * wait for a pool's requests in flight, or waiting, to get to n
+ */
+int _check_fcgi_busy(fcgi_t * f, unsigned int n, unsigned int waiting)
+{
+    unsigned int i, got;
+
+    for (i = 0; i < 2000; i++) {
+        pthread_mutex_lock(&f->mt);
+        got = (waiting) ? f->waiting : f->backs[1].conns[0].active;
+        pthread_mutex_unlock(&f->mt);
+
+        if (got == n)
+            return 1;
+
+        usleep(1000);
+    }
+
+    return 0;
+}
+
+void srv_check_fcgi(void)
+{
+    struct _srvfcgi_conf_t fc;
+    struct _srvhndlr_conf_t hnd;
+    struct _check_fcgi_call calls[3];
+    unsigned short live, dead;
+    char back[2][32], *s, *body, *out, *req;
+    pthread_t th[3];
+    vhost_t site;
+    fcgi_t f;
+    int lfd, fd, i;
+
+    if (!CHECK(-1 != (fd = _check_listen(&dead))))
+        return;
+
+    close(fd);
+
+    if (!CHECK(-1 != (lfd = _check_listen(&live))))
+        return;
+
+    pthread_create(&th[0], NULL, _check_fcgi, (void *)(intptr_t) lfd);
+    pthread_detach(th[0]);
+
+    memset(&site, 0, sizeof site);
+    site.name = "x";
+    srv_path_root(&site.root, "/srv/www", "/index.html", 0);
+
+    /* one connection, two requests on it at once */
+    memset(&fc, 0, sizeof fc);
+    fc.conns = 1;
+    fc.mux = 2;
+    fc.timeout = 2000;
+    vector_init(&fc.hnd, 0, sizeof hnd);
+    vector_init(&fc.backends, 0, sizeof(char *));
+    vector_init(&fc.params, 0, sizeof(char *));
+
+    hnd.type = SRV_HANDLER_DIR;
+    hnd.data = "/app";
+    vector_push(&fc.hnd, &hnd);
+    snprintf(back[0], sizeof back[0], "127.0.0.1:%u", dead);
+    snprintf(back[1], sizeof back[1], "127.0.0.1:%u", live);
+    s = back[0];
+    vector_push(&fc.backends, &s);
+    s = back[1];
+    vector_push(&fc.backends, &s);
+    s = "APP check";
+    vector_push(&fc.params, &s);
+
+    if (!CHECK(srv_resp_errors_init(NULL) && srv_fcgi_init(&f, &fc)))
+        return;
+
+    out = malloc(CHECK_FCGI_BIG + 4096);
+    body = malloc(CHECK_PROXY_BODY);
+    req = malloc(SRV_REQ_MAX_LEN);
+
+    /* the first won't take a connection, so it's passed over. what the
+     * script hears is what CGI would have it hear */
+    CHECK(_check_served(NULL, &f, &site, "GET /app/x.php/more?q=1 HTTP/1.1"
+                        "\r\nHost: x\r\nX-A: b\r\nProxy: evil\r\n\r\n",
+                        NULL, 0, out, CHECK_FCGI_BIG));
+    CHECK(!strncmp(out, "HTTP/1.1 201 Created\r\n", 22));
+    CHECK(NULL != strstr(out, "\r\nX-In: 0\r\nConnection: close\r\n\r\n"));
+    CHECK(NULL != strstr(out, "\nSCRIPT_FILENAME=/srv/www/app/x.php/more\n"
+                         "SCRIPT_NAME=/app/x.php/more\nPATH_INFO=-\n"
+                         "QUERY_STRING=q=1\nREQUEST_METHOD=GET\n"
+                         "CONTENT_LENGTH=-\nHTTP_X_A=b\nHTTP_PROXY=-\n"
+                         "APP=check\nSTDIN=ok\n"));
+    CHECK(f.backs[0].down && !f.backs[1].down);
+
+    /* or everything to one script, with the path after it */
+    f.script = "/srv/app.py";
+    CHECK(_check_served(NULL, &f, &site, "GET /app/y HTTP/1.1\r\n\r\n",
+                        NULL, 0, out, CHECK_FCGI_BIG));
+    CHECK(NULL != strstr(out, "\nSCRIPT_FILENAME=/srv/app.py\nSCRIPT_NAME=\n"
+                         "PATH_INFO=/app/y\n"));
+    f.script = NULL;
+
+    CHECK(_check_served(NULL, &f, &site, "HEAD /app/x HTTP/1.1\r\n\r\n",
+                        NULL, 0, out, CHECK_FCGI_BIG));
+    CHECK(!strncmp(out, "HTTP/1.1 201 ", 13)
+          && NULL == strstr(out, "SCRIPT"));
+
+    /* a body, some with the request and the rest streamed after */
+    for (i = 0; i < CHECK_PROXY_BODY; i++)
+        body[i] = 'a' + i % 26;
+
+    snprintf(req, SRV_REQ_MAX_LEN, "POST /app/in HTTP/1.1\r\nHost: x\r\n"
+             "Content-Length: %d\r\nExpect: 100-continue\r\n\r\n%.100s",
+             CHECK_PROXY_BODY, body);
+    CHECK(_check_served(NULL, &f, &site, req, body + 100,
+                        CHECK_PROXY_BODY - 100, out, CHECK_FCGI_BIG));
+    CHECK(!strncmp(out, "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 201 ", 38));
+    CHECK(NULL != strstr(out, "X-In: 40000\r\n")
+          && NULL != strstr(out, "\nSTDIN=ok\n"));
+
+    /* two lengths have to agree, and the script is told just one */
+    CHECK(!_check_served(NULL, &f, &site, "POST /app/lens HTTP/1.1\r\n"
+                         "Content-Length: 2\r\nContent-Length: 3\r\n\r\n"
+                         "abc", NULL, 0, out, CHECK_FCGI_BIG));
+    CHECK(!strncmp(out, "HTTP/1.1 400 ", 13));
+    CHECK(_check_served(NULL, &f, &site, "POST /app/lens HTTP/1.1\r\n"
+                        "Content-Length: 2\r\nContent-Length: 2\r\n\r\n"
+                        "ab", NULL, 0, out, CHECK_FCGI_BIG));
+    s = strstr(out, "\r\n\r\n");
+    CHECK(NULL != s && !strcmp(s + 4, "1"));
+
+    /* more than is ever held for a request at once */
+    CHECK(_check_served(NULL, &f, &site, "GET /app/big HTTP/1.1\r\n\r\n",
+                        NULL, 0, out, CHECK_FCGI_BIG + 4096));
+    s = strstr(out, "\r\n\r\n");
+    CHECK(NULL != s && CHECK_FCGI_BIG <= strlen(s + 4));
+
+    /* a backend that won't take it after all */
+    CHECK(!_check_served(NULL, &f, &site, "GET /app/busy HTTP/1.1\r\n\r\n",
+                         NULL, 0, out, CHECK_FCGI_BIG));
+    CHECK(!strncmp(out, "HTTP/1.1 503 ", 13));
+    CHECK(1 == __atomic_load_n(&fcgi_accepts, __ATOMIC_RELAXED));
+
+    /* two at once on the one connection, answered out of order */
+    memset(calls, 0, sizeof calls);
+
+    for (i = 0; i < 2; i++) {
+        calls[i].f = &f;
+        calls[i].site = &site;
+        calls[i].req = (i) ? "GET /app/pair?b HTTP/1.1\r\n\r\n"
+            : "GET /app/pair?a HTTP/1.1\r\n\r\n";
+        pthread_create(&th[i], NULL, _check_fcgi_call, &calls[i]);
+    }
+
+    for (i = 0; i < 2; i++)
+        pthread_join(th[i], NULL);
+
+    s = strstr(calls[0].out, "\r\n\r\n");
+    CHECK(calls[0].ok && NULL != s && !strcmp(s + 4, "pair a"));
+    s = strstr(calls[1].out, "\r\n\r\n");
+    CHECK(calls[1].ok && NULL != s && !strcmp(s + 4, "pair b"));
+    CHECK(1 == __atomic_load_n(&fcgi_accepts, __ATOMIC_RELAXED));
+
+    /* with every slot taken and no room to wait, a 503 right away */
+    f.queue = 0;
+
+    for (i = 0; i < 2; i++) {
+        calls[i].req = "GET /app/slow HTTP/1.1\r\n\r\n";
+        pthread_create(&th[i], NULL, _check_fcgi_call, &calls[i]);
+    }
+
+    CHECK(_check_fcgi_busy(&f, 2, 0));
+    CHECK(!_check_served(NULL, &f, &site, "GET /app/x HTTP/1.1\r\n\r\n",
+                         NULL, 0, out, CHECK_FCGI_BIG));
+    CHECK(!strncmp(out, "HTTP/1.1 503 ", 13) && 1 == f.rejected);
+
+    /* and with room, it waits its turn */
+    f.queue = 1;
+    calls[2].f = &f;
+    calls[2].site = &site;
+    calls[2].req = "GET /app/x HTTP/1.1\r\n\r\n";
+    pthread_create(&th[2], NULL, _check_fcgi_call, &calls[2]);
+    CHECK(_check_fcgi_busy(&f, 1, 1));
+    __atomic_store_n(&fcgi_release, 1, __ATOMIC_RELAXED);
+
+    for (i = 0; i < 3; i++) {
+        pthread_join(th[i], NULL);
+        CHECK(calls[i].ok && !strncmp(calls[i].out, "HTTP/1.1 201 ", 13));
+    }
+
+    /* a kept connection the backend hung up on is opened again */
+    CHECK(_check_served(NULL, &f, &site, "GET /app/close HTTP/1.1\r\n\r\n",
+                        NULL, 0, out, CHECK_FCGI_BIG));
+    CHECK(_check_served(NULL, &f, &site, "GET /app/x HTTP/1.1\r\n\r\n",
+                        NULL, 0, out, CHECK_FCGI_BIG));
+    CHECK(!strncmp(out, "HTTP/1.1 201 ", 13));
+    CHECK(2 == __atomic_load_n(&fcgi_accepts, __ATOMIC_RELAXED));
+
+    /* and with nowhere to go, the client hears why */
+    CHECK(srv_fcgi_init(&f, &fc));
+    f.count = 1;
+    CHECK(!_check_served(NULL, &f, &site, "GET /app/x HTTP/1.1\r\n\r\n",
+                         NULL, 0, out, CHECK_FCGI_BIG));
+    CHECK(!strncmp(out, "HTTP/1.1 502 ", 13));
+
+    free(out);
+    free(body);
+    free(req);
+}
+
+void srv_check_cache(void)
+{
+    char dir[] = "/tmp/srvcheck.XXXXXX";
+    char cmd[SRV_PATH_MAX], key[64], *body;
+    time_t now = time(NULL);
+    cache_t c, again, small;
+    cache_put_t put;
+    cache_ent_t ent;
+    resp_t r;
+    req_t rq;
+    unsigned int i;
+
+    /* how long the upstream says we may keep it */
+    CHECK(now + 50 == _check_expiry("HTTP/1.1 200 OK\r\n"
+                                    "Cache-Control: public, max-age=60\r\n"
+                                    "Age: 10\r\n\r\n", now, 0));
+    CHECK(now + 5 == _check_expiry("HTTP/1.1 200 OK\r\n"
+                                   "Cache-Control: max-age=60, s-maxage=5"
+                                   "\r\n\r\n", now, 0));
+    CHECK(now + 100 == _check_expiry("HTTP/1.1 200 OK\r\n"
+                                     "Date: Thu, 01 Jan 2015 00:00:00 GMT\r\n"
+                                     "Expires: Thu, 01 Jan 2015 00:01:40 GMT"
+                                     "\r\n\r\n", now, 0));
+    CHECK(0 == _check_expiry("HTTP/1.1 200 OK\r\n"
+                             "Cache-Control: private, max-age=60\r\n\r\n",
+                             now, 0));
+    CHECK(0 == _check_expiry("HTTP/1.1 200 OK\r\n"
+                             "Cache-Control: no-store\r\n\r\n", now, 30));
+    CHECK(0 == _check_expiry("HTTP/1.1 200 OK\r\nSet-Cookie: a=b\r\n"
+                             "Cache-Control: max-age=60\r\n\r\n", now, 0));
+    CHECK(0 == _check_expiry("HTTP/1.1 200 OK\r\nExpires: 0\r\n\r\n",
+                             now, 30));
+    CHECK(0 == _check_expiry("HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\n",
+                             now, 0));
+    CHECK(now + 30 == _check_expiry("HTTP/1.1 200 OK\r\n"
+                                    "Content-Length: 1\r\n\r\n", now, 30));
+
+    /* and what the client lets us do */
+    CHECK((SRV_CACHE_STORE | SRV_CACHE_LOOKUP)
+          == _check_request("GET /a HTTP/1.1\r\nHost: x\r\n\r\n"));
+    CHECK(0 == _check_request("GET /a HTTP/1.1\r\n"
+                              "Authorization: Basic eA==\r\n\r\n"));
+    CHECK(SRV_CACHE_STORE == _check_request("GET /a HTTP/1.1\r\n"
+                                            "Cache-Control: no-cache\r\n"
+                                            "\r\n"));
+    CHECK(srv_cache_key_line(key, sizeof key, "site",
+                             "GET /a?b=c HTTP/1.1\r\n")
+          && !strcmp(key, "site /a?b=c"));
+
+    if (!CHECK(NULL != mkdtemp(dir)))
+        return;
+
+    /* four segments of 16k */
+    if (!CHECK(srv_cache_init(&c, dir, 64 * 1024, 16 * 1024)))
+        return;
+
+    CHECK(srv_cache_store(&c, "k1", "H: 1\r\n\r\n", 8, "one", 3, now,
+                          now + 60));
+    CHECK(_check_cached(&c, "k1", "H: 1\r\n\r\none"));
+    CHECK(srv_cache_store(&c, "old", "\r\n", 2, "x", 1, now - 10, now - 1));
+    CHECK(!_check_cached(&c, "old", "\r\nx"));
+
+    /* cut short, or abandoned, and it's never found */
+    if (CHECK(srv_cache_begin(&c, &put, "k2", "\r\n", 2, 5, now, now + 60)))
+        CHECK(!srv_cache_end(&put, srv_cache_write(&put, "abc", 3)));
+
+    if (CHECK(srv_cache_begin(&c, &put, "k3", "\r\n", 2, 3, now, now + 60)))
+        CHECK(!srv_cache_end(&put, 0));
+
+    CHECK(!_check_cached(&c, "k2", "\r\nabc"));
+    CHECK(!_check_cached(&c, "k3", "\r\n"));
+    CHECK(srv_cache_store(&c, "k4", "\r\n", 2, "four", 4, now, now + 60));
+
+    /* started again, it reads back what was finished */
+    if (!CHECK(srv_cache_init(&again, dir, 64 * 1024, 16 * 1024)))
+        return;
+
+    CHECK(_check_cached(&again, "k1", "H: 1\r\n\r\none"));
+    CHECK(_check_cached(&again, "k4", "\r\nfour"));
+    CHECK(!_check_cached(&again, "k2", "\r\nabc"));
+    CHECK(!_check_cached(&again, "old", "\r\nx"));
+
+    /* and once it's full, the oldest segment goes */
+    if (CHECK(NULL != (body = calloc(1, CHECK_CACHE_BODY)))) {
+        for (i = 0; i < 10; i++) {
+            snprintf(key, sizeof key, "big%u", i);
+            CHECK(srv_cache_store(&again, key, "\r\n", 2, body,
+                                  CHECK_CACHE_BODY, now, now + 60));
+        }
+
+        free(body);
+    }
+
+    CHECK(again.count <= again.seg_max);
+    CHECK(!_check_cached(&again, "k1", "H: 1\r\n\r\none"));
+    CHECK(!_check_cached(&again, "big0", "\r\n"));
+    CHECK(srv_cache_begin(&again, &put, "big9", "\r\n", 2, 1, now, now + 60)
+          && srv_cache_end(&put, srv_cache_write(&put, "9", 1)));
+    CHECK(_check_cached(&again, "big9", "\r\n9"));
+
+    /* a hit holds its segment open, so it can go under us, but once
+     * it's gone it's a miss */
+    memset(&rq, 0, sizeof rq);
+    memset(&r, 0, sizeof r);
+    rq.meth = HTTP_MTHD_GET;
+    CHECK(srv_resp_cached(&r, &again, "big9", &rq, "now") && 0 < r.fd);
+
+    if (CHECK(srv_cache_get(&again, "big9", &ent, cmd, sizeof cmd)))
+        unlink(cmd);
+
+    CHECK(1 == pread(r.fd, key, 1, r.off + 2) && '9' == key[0]);
+    srv_resp_release(&r);
+    CHECK(!srv_resp_cached(&r, &again, "big9", &rq, "now") && !r.fd);
+
+    /* the index is kept to what memory it's given, oldest first, but
+     * the segment being written into stays */
+    snprintf(cmd, sizeof cmd, "%s/trim", dir);
+
+    if (CHECK(!mkdir(cmd, 0700)
+              && srv_cache_init(&small, cmd, 64 * 1024, 16 * 1024))) {
+        for (i = 0; i < 600; i++) {
+            snprintf(key, sizeof key, "t%u", i);
+            CHECK(srv_cache_store(&small, key, "\r\n", 2, "x", 1, now,
+                                  now + 60));
+        }
+
+        CHECK(0 == srv_cache_trim(&small, 600 * SRV_CACHE_ENT_COST));
+        CHECK(0 < srv_cache_trim(&small, 300 * SRV_CACHE_ENT_COST));
+        CHECK(chash_count(&small.index) <= 300 && 0 < small.count);
+        CHECK(!_check_cached(&small, "t0", "\r\nx"));
+        CHECK(_check_cached(&small, "t599", "\r\nx"));
+
+        srv_cache_trim(&small, 0);
+        CHECK(1 == small.count && _check_cached(&small, "t599", "\r\nx"));
+    }
+
+    snprintf(cmd, sizeof cmd, "rm -rf %s", dir);
+    system(cmd);
+}
+
+int srv_check(const char *srvpack)
+{
+    failed = 0;
+
+    srv_check_route();
+    srv_check_canon();
+    srv_check_path();
+    srv_check_hash();
+    srv_check_chash();
+    srv_check_wheel();
+    srv_check_deque();
+    srv_check_pack(srvpack);
+    srv_check_warm();
+    srv_check_mem();
+    srv_check_vhost();
+    srv_check_proxy();
+    srv_check_fcgi();
+    srv_check_cache();
+
+    printf("%s: %u failed\n", failed ? "FAIL" : "ok", failed);
+
+    return !failed;
+}
@@ -31,6 +31,8 @@
 #include <util/sock.h>
 #include <util/util.h>
 
+#include "check.h"
+
 #define SRV_TEST_LEVEL 8
 #define SRV_TEST_ITERS 1024
 
@@ -81,8 +83,14 @@ int main(int argc, char *argv[])
     char *host;
     unsigned int port, i;
 
+    if (2 == argc && !strcmp(argv[1], "check")) {
+        /* no server needed, just the unit checks */
+        return (srv_check("../srvpack")) ? 0 : 1;
+    }
+
     if (argc != 3) {
         ERRF(__FILE__, __LINE__, "./srvtest hostname port\n");
+        ERRF(__FILE__, __LINE__, "./srvtest check\n");
         return 1;
     }
 